@@ -16,6 +16,20 @@ MANDIR ?= /share/man
 
 MHVTL_HOME_PATH ?= /opt/mhvtl
 MHVTL_CONFIG_PATH ?= /etc/mhvtl
+# Compile out MHVTL_DBG() messages above a level (0 - 3), e.g.
+# 'make MHVTL_DBG_MAX=0'. Empty keeps every level, chosen at run time with
+# 'verbose'. Each subsystem can also be set on its own:
+#   IO   - mhvtl_io.c, vtlcart*.c (block I/O path)
+#   SSC  - vtltape, ssc.c and the tape personality modules
+#   SMC  - vtllibrary, smc.c and the library personality modules
+#   CORE - everything else
+# Run 'make clean' after changing these.
+MHVTL_DBG_MAX ?=
+MHVTL_DBG_MAX_IO ?= $(MHVTL_DBG_MAX)
+MHVTL_DBG_MAX_SSC ?= $(MHVTL_DBG_MAX)
+MHVTL_DBG_MAX_SMC ?= $(MHVTL_DBG_MAX)
+MHVTL_DBG_MAX_CORE ?= $(MHVTL_DBG_MAX)
+
 SYSTEMD_GENERATOR_DIR ?= /lib/systemd/system-generators
 SYSTEMD_SERVICE_DIR ?= /lib/systemd/system
 
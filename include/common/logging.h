@@ -22,13 +22,28 @@ extern char	   mhvtl_driver_name[];
 extern uint8_t debug;
 extern uint8_t verbose;
 
-#define MHVTL_DBG_NO_FUNC(lvl, format, arg...)            \
-	do {                                                  \
-		if (debug)                                        \
-			printf("%s: " format "\n",                    \
-				   mhvtl_driver_name, ##arg);             \
-		else if ((verbose) >= (lvl))                      \
-			syslog(LOG_DAEMON | LOG_INFO, format, ##arg); \
+/*
+ * MHVTL_DBG() messages above MHVTL_DBG_MAX are compiled out, arguments and
+ * all. The Makefile sets it per subsystem from MHVTL_DBG_MAX* in config.mk;
+ * left undefined every level is kept and selected at run time by 'verbose'.
+ */
+#ifndef MHVTL_DBG_MAX
+#define MHVTL_DBG_MAX 9
+#endif
+
+/* True if a level 'lvl' message would be logged - to guard extra work */
+#define MHVTL_DBG_ON(lvl) \
+	((lvl) <= MHVTL_DBG_MAX && __builtin_expect(debug || (verbose) >= (lvl), 0))
+
+#define MHVTL_DBG_NO_FUNC(lvl, format, arg...)                \
+	do {                                                      \
+		if (MHVTL_DBG_ON(lvl)) {                              \
+			if (debug)                                        \
+				printf("%s: " format "\n",                    \
+					   mhvtl_driver_name, ##arg);             \
+			else                                              \
+				syslog(LOG_DAEMON | LOG_INFO, format, ##arg); \
+		}                                                     \
 	} while (0)
 
 #define MHVTL_ERR(format, arg...)                                         \
@@ -55,27 +70,27 @@ extern uint8_t verbose;
 		}                                                 \
 	} while (0)
 
-#define MHVTL_DBG(lvl, format, arg...)                     \
-	do {                                                   \
-		if (debug)                                         \
-			printf("%s: %s(): " format "\n",               \
-				   mhvtl_driver_name, __func__, ##arg);    \
-		else if ((verbose) >= (lvl))                       \
-			syslog(LOG_DAEMON | LOG_INFO, "%s(): " format, \
-				   __func__, ##arg);                       \
+#define MHVTL_DBG(lvl, format, arg...)                         \
+	do {                                                       \
+		if (MHVTL_DBG_ON(lvl)) {                               \
+			if (debug)                                         \
+				printf("%s: %s(): " format "\n",               \
+					   mhvtl_driver_name, __func__, ##arg);    \
+			else                                               \
+				syslog(LOG_DAEMON | LOG_INFO, "%s(): " format, \
+					   __func__, ##arg);                       \
+		}                                                      \
 	} while (0)
 
 #define MHVTL_DBG_PRT_CDB(lvl, cmd)      \
 	do {                                 \
-		if (debug) {                     \
-			mhvtl_prt_cdb((lvl), (cmd)); \
-		} else if ((verbose) >= (lvl)) { \
+		if (MHVTL_DBG_ON(lvl))           \
 			mhvtl_prt_cdb((lvl), (cmd)); \
-		}                                \
 	} while (0)
 
 #else
 
+#define MHVTL_DBG_ON(lvl) 0
 #define MHVTL_DBG(lvl, s...)
 #define MHVTL_DBG_NO_FUNC(lvl, s...)
 #define MHVTL_DBG_PRT_CDB(lvl, cmd)
@@ -0,0 +1,58 @@
+/*
+ * Cartridge catalog - where each PCL lives and a summary of its MAM, in
+ * one file shared by every library ($MHVTL_HOME_PATH/catalog)
+ *
+ * Copyright (C) 2005 - 2025 Mark Harvey markh794 at gmail dot com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef _MHVTL_CATALOG_H_
+#define _MHVTL_CATALOG_H_
+
+#include <stdint.h>
+
+#define CATALOG_FILE	"catalog"
+#define CATALOG_MAGIC	0x6d687663 /* "mhvc" */
+#define CATALOG_VERSION 1
+
+#define CATALOG_HOME_SZ 384
+
+/*
+ * One fixed size record per PCL, updated in place.
+ * The first record of the file is a header: 'pcl' empty, 'library' holding
+ * CATALOG_MAGIC and 'filemarks' CATALOG_VERSION. A record with an empty
+ * 'pcl' after that is free.
+ */
+struct catalog_entry {
+	char	 pcl[24];
+	uint32_t library;
+	uint8_t	 medium_type; /* MEDIA_TYPE_DATA, _CLEAN, _WORM, _NULL */
+	uint8_t	 media_type;  /* LTO1, LTO2, AIT etc (Media_Type_list) */
+	uint8_t	 partitions;
+	uint8_t	 write_protect;
+	char	 density[8];
+	uint32_t filemarks;
+	uint32_t load_count;
+	uint64_t capacity; /* Bytes */
+	uint64_t used;
+	uint64_t last_written; /* Seconds since the epoch, 0 = never */
+	uint64_t updated;
+	char	 home[CATALOG_HOME_SZ]; /* Home directory of the library */
+	char	 pad[512 - CATALOG_HOME_SZ - 80];
+};
+
+int catalog_lookup(const char *pcl, struct catalog_entry *e);
+int catalog_update(const struct catalog_entry *e);
+int catalog_remove(const char *pcl);
+int catalog_walk(int (*fn)(const struct catalog_entry *e, void *arg), void *arg);
+struct MAM;
+void catalog_fill(struct catalog_entry *e, const char *pcl, long library,
+				  const char *home, struct MAM *mamp, uint64_t filemarks, uint64_t used);
+void catalog_note(const char *pcl, long library, int written);
+const char *catalog_path(void);
+
+#endif /* _MHVTL_CATALOG_H_ */
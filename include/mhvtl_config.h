@@ -0,0 +1,66 @@
+/*
+ * device.conf, parsed once - the libraries, drives and media home
+ * directories it defines
+ *
+ * Copyright (C) 2005 - 2025 Mark Harvey markh794 at gmail dot com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef _MHVTL_CONFIG_H_
+#define _MHVTL_CONFIG_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+#include "vtllib.h"
+
+/* Parsed copy shared by every process, rebuilt when device.conf changes */
+#define CONFIG_CACHE		 "/dev/shm/mhvtl_config"
+#define CONFIG_CACHE_MAGIC	 0x6d687666 /* "mhvf" */
+#define CONFIG_CACHE_VERSION 2
+
+enum conf_device_type {
+	CONF_LIBRARY = 1,
+	CONF_DRIVE,
+};
+
+struct conf_device {
+	long	id;
+	int		type; /* CONF_LIBRARY or CONF_DRIVE */
+	int		channel;
+	int		target;
+	int		lun;
+	long	library_id; /* Drive: library it is in, 0 if standalone */
+	int		slot;		/* Drive: slot in that library */
+	int		line;		/* Line number of its first line */
+	off_t	offset;		/* The device's lines in device.conf */
+	off_t	end;
+	char	home[HOME_DIR_PATH_SZ + 1]; /* Library: 'Home directory', if set */
+	int		on_demand;	/* Library: 'Provision: on-demand' - media created on first load */
+	long	capacity;	/* Library: 'Capacity' of media so created, MB - 0 for native */
+};
+
+struct mhvtl_config {
+	char				device_conf[CONF_FILE_SZ];
+	dev_t				dev; /* device.conf this was parsed from */
+	ino_t				ino;
+	off_t				size;
+	struct timespec		mtime;
+	int					count;
+	struct conf_device *device;
+};
+
+const struct mhvtl_config *config_load(void);
+const struct conf_device  *config_find(long id, int type);
+off_t					   config_stanza(FILE *conf, const struct conf_device *d);
+void					   config_home(const struct conf_device *d, char *buf, size_t len);
+
+#define for_each_conf_device(cfg, d) \
+	for ((d) = (cfg)->device; (d) < (cfg)->device + (cfg)->count; (d)++)
+
+#endif /* _MHVTL_CONFIG_H_ */
@@ -0,0 +1,107 @@
+/*
+ * Per-LU command statistics - always on, exported read-only through
+ * shared memory (/dev/shm/mhvtl_stats.<id>)
+ *
+ * Copyright (C) 2005 - 2025 Mark Harvey markh794 at gmail dot com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef _MHVTL_STATS_H_
+#define _MHVTL_STATS_H_
+
+#include <stdint.h>
+
+#define STATS_SHM_NAME "/mhvtl_stats.%ld"
+#define STATS_MAGIC	   0x6d687673 /* "mhvs" */
+#define STATS_VERSION  2
+
+/*
+ * Latency histograms have log2 buckets of microseconds.
+ * Bucket 0 is < 1us, bucket n is [2^(n-1), 2^n) us and the last
+ * bucket everything from 2^(STATS_HIST_BUCKETS - 2) us (~16s) up.
+ */
+#define STATS_HIST_BUCKETS 26
+
+enum stats_phase {
+	STATS_KERNEL_WAIT, /* ioctl() fetching the next command */
+	STATS_XFER,		   /* Data to/from the kernel */
+	STATS_COMPRESS,	   /* (De)compression */
+	STATS_STORAGE,	   /* Reading/writing the media files */
+	STATS_FSYNC,	   /* Flushing the media files */
+	STATS_PHASES,
+};
+
+enum stats_lu_type {
+	STATS_LU_TAPE,
+	STATS_LU_LIBRARY,
+};
+
+struct stats_hist {
+	uint64_t count;
+	uint64_t sum_us;
+	uint64_t max_us;
+	uint64_t bucket[STATS_HIST_BUCKETS];
+};
+
+/* Media barcode - 'seq' is odd while it is being changed */
+struct stats_pcl {
+	uint32_t seq;
+	char	 pcl[20];
+};
+
+struct stats_op {
+	uint64_t		  errors; /* Completed with CHECK CONDITION */
+	struct stats_hist latency;
+};
+
+/*
+ * There is a single writer - the daemon's main loop. Each counter is
+ * updated with a relaxed atomic store, so readers never see a torn value
+ * and take no locks. A snapshot can be inconsistent between counters.
+ */
+struct mhvtl_stats {
+	uint32_t		  magic;
+	uint32_t		  version;
+	uint32_t		  lu_type;
+	uint32_t		  pid;
+	int64_t			  lu_id;
+	uint64_t		  start_time; /* time(NULL) the daemon started */
+	uint64_t		  bytes_in;	  /* From the initiator */
+	uint64_t		  bytes_out;  /* To the initiator */
+	uint32_t		  state;	  /* enum MHVTL_STATE */
+	uint32_t		  pad;
+	uint64_t		  tapealert;
+
+	/* Tape only - media loaded, and bytes since the daemon started */
+	struct stats_pcl media;
+	uint64_t		 read_i;	/* Sent to the initiator */
+	uint64_t		 read_m;	/* Read from media (compressed) */
+	uint64_t		 written_i; /* Received from the initiator */
+	uint64_t		 written_m; /* Written to media (compressed) */
+
+	struct stats_hist phase[STATS_PHASES];
+	struct stats_op	  op[256];
+};
+
+int		 stats_init(long id, int lu_type);
+void	 stats_exit(void);
+uint64_t stats_clock(void);
+void	 stats_phase(int phase, uint64_t start);
+void	 stats_cmd(uint8_t opcode, uint64_t start, uint8_t sam_stat);
+void	 stats_bytes(uint64_t in, uint64_t out);
+void	 stats_state(int state);
+void	 stats_tapealert(uint64_t flags);
+void	 stats_media(const char *pcl);
+void	 stats_media_bytes(uint64_t read_i, uint64_t read_m, uint64_t written_i, uint64_t written_m);
+
+const struct mhvtl_stats *stats_open(long id);
+void					  stats_close(const struct mhvtl_stats *s);
+int						  stats_read_media(const struct mhvtl_stats *s, char *pcl, int len);
+const char				 *stats_phase_name(int phase);
+const char				 *stats_opcode_name(uint8_t opcode);
+
+#endif /* _MHVTL_STATS_H_ */
@@ -0,0 +1,88 @@
+/*
+ * Per-LU binary trace ring - always on, exported read-only through
+ * shared memory (/dev/shm/mhvtl_trace.<id>)
+ *
+ * Copyright (C) 2005 - 2025 Mark Harvey markh794 at gmail dot com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef _MHVTL_TRACE_H_
+#define _MHVTL_TRACE_H_
+
+#include <stdint.h>
+
+#define TRACE_SHM_NAME	"/mhvtl_trace.%ld"
+#define TRACE_DUMP_NAME MHVTL_HOME_PATH "/mhvtl_trace.%ld.dump"
+#define TRACE_MAGIC		0x6d687674 /* "mhvt" */
+#define TRACE_VERSION	1
+#define TRACE_RECORDS	16384 /* Power of 2 */
+
+enum trace_event {
+	TRACE_NONE,
+	TRACE_CMD_START, /* opcode, serial */
+	TRACE_CMD_END,	 /* arg: sam_stat, size: bytes returned, extra: latency us */
+	TRACE_SENSE,	 /* extra: key << 16 | asc << 8 | ascq */
+	TRACE_READ_REQ,	 /* arg: partition, block, size: requested, extra: sili | lbp << 1 */
+	TRACE_READ_HDR,	 /* arg: partition, block, offset, size: block size, extra: type */
+	TRACE_READ_DATA, /* arg: partition, block, offset, size: bytes read from media */
+	TRACE_WRITE_BLK, /* arg: partition, block, offset, size: block size, extra: media size */
+	TRACE_FILEMARK,	 /* arg: partition, block, size: count */
+	TRACE_EVENTS,
+};
+
+/* 64 bytes, one cache line */
+struct trace_rec {
+	uint64_t seq; /* Record number + 1, 0 while being written */
+	uint64_t ts;  /* CLOCK_MONOTONIC ns */
+	uint64_t serial;
+	uint64_t block;
+	uint64_t offset;
+	uint32_t size;
+	uint32_t extra;
+	uint16_t event;
+	uint8_t	 opcode;
+	uint8_t	 arg;
+	uint8_t	 pad[12];
+};
+
+/*
+ * The daemon is the only writer. Each record's 'seq' is cleared before and
+ * stored (release) after the record is filled in, so a reader keeps a copy
+ * only if 'seq' is non-zero and unchanged across the copy.
+ *
+ * A flight recorder dump is this same layout written to a file.
+ */
+struct mhvtl_trace {
+	uint32_t		 magic;
+	uint32_t		 version;
+	uint32_t		 pid;
+	uint32_t		 records;
+	int64_t			 lu_id;
+	uint64_t		 mono_base; /* CLOCK_MONOTONIC ns ... */
+	uint64_t		 wall_base; /* ... and CLOCK_REALTIME ns at the same instant */
+	uint64_t		 head;		/* Records written */
+	char			 reason[24];	/* Why a dump was taken */
+	struct trace_rec rec[TRACE_RECORDS];
+};
+
+int	 trace_init(long id);
+void trace_exit(void);
+void trace_begin(uint8_t opcode, uint64_t serial);
+void trace_end(uint8_t sam_stat, uint32_t size);
+void trace_event(int event, uint8_t arg, uint64_t block, uint64_t offset,
+				 uint32_t size, uint32_t extra);
+void trace_dump(const char *reason);
+void trace_error(const char *reason);
+void trace_signal(int signo);
+
+const struct mhvtl_trace *trace_open(long id);
+const struct mhvtl_trace *trace_load(const char *file);
+void					  trace_close(const struct mhvtl_trace *t);
+int						  trace_read(const struct mhvtl_trace *t, struct trace_rec *out);
+const char				 *trace_event_name(int event);
+
+#endif /* _MHVTL_TRACE_H_ */
@@ -5,6 +5,7 @@
 
 struct scsi_cmd;
 struct s_info;
+struct smc_priv;
 
 /* Element type codes */
 #define ANY				 0
@@ -47,10 +48,19 @@ uint8_t smc_open_close_import_export_element(struct scsi_cmd *cmd);
 int	 get_cart_type(char *barcode);
 void update_home_dir(long my_id); /* for the 'get_cart_type()' function only */
 
+uint16_t verify_media(const char *barcode); /* INITIALIZE ELEMENT STATUS audit */
+
 int	 slotOccupied(struct s_info *s);
 void setImpExpStatus(struct s_info *s, int flg);
 void setSlotEmpty(struct s_info *s);
-void unload_drive_on_shutdown(struct s_info *src, struct s_info *dest);
+void setSlotFull(struct s_info *s);
+void unload_drive_on_shutdown(struct smc_priv *smc_p, struct s_info *src,
+							  struct s_info *dest);
+void move_cart(struct smc_priv *smc_p, struct s_info *src, struct s_info *dest);
+void smc_elements_changed(struct smc_priv *smc_p);
+void smc_element_changed(struct s_info *s);
+void smc_journal(struct smc_priv *smc_p, char op, uint32_t src, uint32_t dest,
+				 const char *barcode);
 
 void init_slot_info(struct lu_phy_attr *lu);
 void init_stkl20(struct lu_phy_attr *lu);
@@ -145,6 +145,7 @@ struct priv_lu_ssc {
 	uint8_t configCompressionEnabled;
 
 	uint8_t compressionType; /* lzo or zlib compression */
+	uint8_t zero_blocks;	 /* Record all-zero blocks in the index only - 'Zero blocks:' */
 
 	loff_t capacity_unit;
 	loff_t early_warning_sz;
@@ -169,6 +170,12 @@ struct priv_lu_ssc {
 	uint64_t bytesWritten_M;		/* Bytes written to media (compressed) */
 	uint64_t bytesWritten_I;		/* Bytes recevied from initiator */
 
+	/* Scratch space re-used from one READ to the next (mhvtl_io.c) */
+	uint8_t *comp_buf; /* Compressed block as read from media */
+	uint32_t comp_buf_sz;
+	uint8_t *spill_buf; /* Block data beyond what the initiator asked for */
+	uint32_t spill_buf_sz;
+
 	/* Allow to insert delays into op codes */
 	int delay_load;
 	int delay_unload;
@@ -43,6 +43,7 @@ struct q_entry {
 
 int enter(char *, long rcv_id);
 int send_msg(char *cmd, long rcv_id);
+int send_msg_as(char *cmd, long rcv_id, long snd_id);
 int serve(void);
 int init_queue(void);
 
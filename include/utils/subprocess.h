@@ -1,2 +1,45 @@
+#ifndef _SUBPROCESS_H_
+#define _SUBPROCESS_H_
+
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
 
 int run_command(char *command, int timeout);
+
+#define COPROC_PENDING	16	/* Requests in flight at once */
+#define COPROC_LINE_MAX 256
+
+struct coproc_request {
+	uint32_t		id; /* 0 if this entry is free */
+	int				done;
+	int				status;
+	struct timespec deadline;
+};
+
+/*
+ * A long-lived helper process, started by /bin/sh and restarted as needed.
+ * Requests are lines "<id> <request>" on its stdin, answered in any order
+ * by lines "<id> <status> [text]" on its stdout - status 0 for success.
+ * Safe to share between threads: one waiter reads replies for them all.
+ */
+struct coproc {
+	char				 *command;
+	pid_t				  pid;
+	int					  fd;		  /* Unix socket: the helper's stdin and stdout */
+	int					  reading_fd; /* fd a waiter polls unlocked, else -1 */
+	pthread_mutex_t		  lock;
+	pthread_cond_t		  replied;
+	uint32_t			  next_id;
+	size_t				  len;
+	char				  buf[COPROC_LINE_MAX];
+	struct coproc_request req[COPROC_PENDING];
+};
+
+struct coproc *coproc_new(const char *command);
+int			   coproc_send(struct coproc *cp, const char *request, int timeout);
+int			   coproc_wait(struct coproc *cp, int id);
+void		   coproc_free(struct coproc *cp);
+
+#endif /* _SUBPROCESS_H_ */
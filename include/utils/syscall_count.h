@@ -0,0 +1,34 @@
+/*
+ * syscall_count.h -- Count the file I/O system calls of a benchmark
+ *
+ * Copyright (C) 2005 - 2025 Mark Harvey markh794 at gmail dot com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef _SYSCALL_COUNT_H_
+#define _SYSCALL_COUNT_H_
+
+#include <stdint.h>
+
+enum syscall_class {
+	SC_READ,  /* read */
+	SC_WRITE, /* write */
+	SC_PREAD,
+	SC_PWRITE,
+	SC_LSEEK,
+	SC_SYNC,  /* fsync, fdatasync, sync_file_range */
+	SC_URING, /* io_uring_enter */
+	SC_OTHER, /* open, close, fstat, ftruncate, other syscall() */
+	SC_CLASSES,
+};
+
+/* Calls made since start, by anything linked into the program */
+extern uint64_t syscall_count[SC_CLASSES];
+
+const char *syscall_class_name(int sc);
+
+#endif /* _SYSCALL_COUNT_H_ */
@@ -37,8 +37,11 @@ struct MAM;
 #define BLKHDR_FLG_ENCRYPTED	   0x02
 #define BLKHDR_FLG_LZO_COMPRESSED  0x04
 #define BLKHDR_FLG_CRC			   0x08
+#define BLKHDR_FLG_ZERO			   0x10 /* All zero - nothing stored in .data */
 
 #define TAPE_FMT_VERSION 6
+/* Data in segment files (mktape -S) - rejected by builds knowing only 6 */
+#define TAPE_FMT_SEGMENTED 7
 
 #define ENCR_KEY_MAX_LEN 32
 struct encryption {
@@ -190,6 +193,29 @@ https://github.com/iustin/mt-st/blob/fbfd923faad0d6f613415f4de747833fb6b4a465/mt
 
 #define LZO	 1 /* Using lzo compression libraries */
 #define ZLIB 2 /* Using zlib compression libraries */
+#define ZERO_BLK 3 /* All zero block - recorded in the index only */
+
+/* Storage engine used for cartridge I/O */
+#define STORAGE_SYNC	 0 /* Blocking pread/pwrite */
+#define STORAGE_IO_URING 1 /* Asynchronous - falls back to STORAGE_SYNC */
+
+/* Alignment of buffers, offsets and lengths for O_DIRECT access */
+#define DIRECT_IO_ALIGN 4096
+
+/*
+ * Outcome of reading back a whole cartridge - see verify_partition_index()
+ * and dump_tape -S
+ */
+struct scrub_result {
+	uint64_t time; /* When, seconds since the epoch */
+	uint64_t blocks;
+	uint64_t filemarks;
+	uint64_t bytes;			/* Uncompressed */
+	uint32_t crc_errors;	/* Blocks failing CRC check or decompression */
+	uint32_t index_errors;	/* Index, filemark map or data size mismatches */
+	uint32_t bad_partition; /* Location of the first problem */
+	uint32_t bad_block;
+};
 
 /* The remainder of this file defines the interface between the tape drive
    software and the implementation of a tape cartridge as one or more disk
@@ -229,6 +255,18 @@ uint64_t last_block(uint8_t partition_number);
 uint64_t block_from_filemark(uint8_t partition_number, uint32_t filemark);
 uint64_t count_filemarks(int64_t count);
 
+void cart_set_direct_io(int enable);
+int	 cart_set_storage_engine(int engine);
+void cart_set_segment_size(uint32_t segment_mb);
+
+int verify_partition_index(struct scrub_result *r);
+int write_scrub_result(const char *dir, const struct scrub_result *r);
+int read_scrub_result(const char *dir, struct scrub_result *r);
+
+uint64_t total_filemarks(void);
+int		 read_cart_summary(const char *dir, struct MAM *mamp, uint64_t *fm_count, uint64_t *used);
+int		 check_cart_files(const char *dir);
+
 void print_raw_header(void);
 void print_filemark_count(void);
 void print_metadata(void);
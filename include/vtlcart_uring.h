@@ -0,0 +1,32 @@
+/*
+ * io_uring storage engine for vtlcart
+ *
+ * Copyright (C) 2005 - 2025 Mark Harvey markh794 at gmail dot com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef _VTLCART_URING_H_
+#define _VTLCART_URING_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/* Most requests queued before uring_submit_wait() must be called */
+#define URING_BATCH 64
+
+int		uring_init(void);
+void	uring_exit(void);
+int		uring_ready(void);
+int		uring_queued(void);
+int		uring_queue_write(int fd, const void *buf, uint32_t len, uint64_t offset);
+int		uring_queue_fsync(int fd, int drain);
+int		uring_submit_wait(ssize_t *res);
+void	uring_readahead(int fd, uint64_t offset, uint32_t len);
+ssize_t uring_readahead_get(int fd, void *buf, uint32_t len, uint64_t offset);
+void	uring_readahead_drop(void);
+
+#endif /* _VTLCART_URING_H_ */
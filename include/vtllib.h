@@ -29,6 +29,7 @@
 #include <inttypes.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <pthread.h>
 
 #include "vtl_common.h"
 #include "mhvtl_list.h"
@@ -94,6 +95,7 @@ typedef enum {
 	DEVICE_CONF,
 	LIBCONTENTS,
 	LIBCONTENTS_PERSIST,
+	LIBCONTENTS_JOURNAL,
 } conf_file;
 
 /*
@@ -500,6 +502,7 @@ struct scsi_cmd {
 	useconds_t			pollInterval; /* Poor mans Performance counter */
 	struct mhvtl_ds	   *dbuf_p;
 	struct lu_phy_attr *lu;
+	struct smc_picker  *picker; /* Library: picker thread running this MOVE MEDIUM */
 };
 
 #define SCSI_OP(opcode, fn) \
@@ -568,6 +571,7 @@ struct d_info {
 	int				 SCSI_ID;
 	int				 SCSI_LUN;
 	char			 load_status; /* Tape is 'loaded' by drive */
+	char			 pooled;	  /* drv_id is bound from the drive pool as media is loaded */
 	struct s_info	*slot;
 };
 
@@ -579,6 +583,7 @@ struct m_info { /* Media Info */
 	uint8_t			 media_type;
 	uint8_t			 cart_type;
 	uint8_t			 internal_status; /* internal states */
+	uint16_t		 asc_ascq;		  /* Element's ASC/ASCQ while in a drive */
 };
 
 struct s_info { /* Slot Info */
@@ -594,10 +599,39 @@ struct s_info { /* Slot Info */
 	uint8_t element_type;
 	uint8_t media_domain; /* L700 */
 	uint8_t media_type;	  /* L700 */
+	uint8_t busy;		  /* A picker is moving media to or from it */
+
+	struct smc_res_cache *res_cache; /* READ ELEMENT STATUS cache it is in - see smc.c */
+	uint32_t			  res_index; /* and its position there */
 };
 
 #define DEF_SMC_PRIV_STATE_MSG_LENGTH 64
 
+/* READ ELEMENT STATUS descriptors of one element type */
+struct smc_res_cache {
+	struct s_info **slot; /* Elements of this type, in address order */
+	uint32_t		count;
+	uint8_t		   *desc[4];  /* Encoded descriptors, one set per VOLTAG/DVCID */
+	uint64_t	   *stale[4]; /* and a bit per element to re-encode */
+};
+
+struct coproc;
+
+/*
+ * A medium transport element. With more than one, each has a thread of
+ * its own doing the moves queued for it - see vtllibrary.c
+ */
+struct smc_picker {
+	struct list_head queue; /* Moves waiting for this picker */
+	pthread_t		 thread;
+	pthread_cond_t	 wake;
+	uint32_t		 address;  /* Element address */
+	int				 latency;  /* Time taken by each move, ms */
+	long			 reply_id; /* Message id drives answer this picker on */
+	int				 busy;	   /* Moves queued or in progress */
+	int				 stop;
+};
+
 struct smc_priv {
 	uint32_t		 bufsize;
 	struct list_head drive_list;
@@ -611,8 +645,29 @@ struct smc_priv {
 	char			 cap_closed;
 	char			*state_msg;	  /* Custom State message */
 	char			*movecommand; /* 3rd party command to call */
+	struct coproc	*movehelper;  /* or 3rd party process to ask */
+
+	/* Bind a pooled drive to a tape daemon, and release it once empty */
+	int (*bind_drive)(struct smc_priv *smc_p, struct d_info *d);
+	void (*release_drive)(struct smc_priv *smc_p, struct d_info *d);
+
+	/* ASC/ASCQ for a cartridge whose files would not load, 0 if they would */
+	uint16_t (*verify_media)(const char *barcode);
+
+	struct smc_picker *picker;		   /* num_picker of them */
+	int				   picker_threads; /* Pickers move concurrently */
+	int				   moving;		   /* Moves queued or in progress */
+	pthread_mutex_t	   lock;		   /* Held by whoever reads or changes elements */
+	pthread_cond_t	   moved;		   /* An element is free again */
 
 	struct smc_personality_template *pm;
+
+	struct smc_res_cache res[5]; /* Indexed by element type */
+	int					 res_stale; /* Elements added or changed wholesale */
+
+	int		 journal_fd; /* library_contents.<id>.journal, -1 if not journaling */
+	uint64_t journal_seq;
+	int		 journal_count; /* Records since the .persist file was written */
 };
 
 struct density_info {
@@ -632,7 +687,7 @@ struct supported_density_list {
 	int					 rw;
 };
 
-extern uint8_t sense[SENSE_BUF_SIZE];
+extern __thread uint8_t sense[SENSE_BUF_SIZE];
 
 /* Sense Specific Data - SPC4.5.5.2.4
  * For those sense keys where the invalid byte/field is known
@@ -772,6 +827,9 @@ int add_drive_media_list(struct lu_phy_attr *lu, int status, char *s);
 
 void		 find_media_home_directory(char *config_directory, long lib_id);
 unsigned int set_media_params(struct MAM *mamp, char *density);
+int			 barcode_media_rules(const char *pcl, char *density, size_t len);
+int			 init_new_mam(struct MAM *mamp, const char *pcl, int medium_type,
+						  char *density, uint64_t size);
 uint8_t		 media_max_partitions(uint8_t media_type);
 uint64_t	 media_native_capacity(uint8_t media_type);
 uint64_t	 media_mam_capacity(uint8_t media_type);
@@ -795,7 +853,6 @@ extern struct encryption  app_encryption_state; /* Stores the encryption info th
 extern int				  current_state;		/* Last status sent to fifo */
 extern int				  lbp_rscrc_be;			/* Logical Block Protection: RS-CRC big-endian */
 extern int				  OK_to_write;
-extern uint8_t			  sense[SENSE_BUF_SIZE];
 extern uint8_t			  modeBlockDescriptor[8]; /* Used by Mode Sense - if set, return block descriptor */
 extern char				  home_directory[HOME_DIR_PATH_SZ + 1];
 
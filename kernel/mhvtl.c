@@ -185,7 +185,8 @@ static int mhvtl_major = 0;
 
 #define DEF_MAX_MINOR_NO 1024 /* Max number of minor nos. this driver will handle */
 
-#define VTL_CANQUEUE	1 /* needs to be >= 1 */
+#define VTL_CANQUEUE	1  /* needs to be >= 1 */
+#define VTL_SMC_QDEPTH	8  /* Moves a library can have in flight, one per picker */
 #define VTL_MAX_CMD_LEN 16
 
 static struct kmem_cache *dsp;
@@ -196,6 +197,8 @@ static int mhvtl_max_luns = DEF_MAX_LUNS;
 static int mhvtl_num_tgts = DEF_NUM_TGTS; /* targets per host */
 static int mhvtl_opts	  = DEF_OPTS;
 
+static int mhvtl_can_queue = VTL_CANQUEUE; /* Commands in flight, per host */
+
 static int mhvtl_cmnd_count = 0;
 
 static unsigned long long serial_number;
@@ -667,6 +670,17 @@ static inline int scsi_get_tag_type(struct scsi_device *sdev) {
 
 #endif
 
+/*
+ * Tape drives take one command at a time. vtllibrary, with more than one
+ * picker, moves media concurrently - so let it have a MOVE MEDIUM per picker,
+ * as far as the host allows: can_queue=<n> when loading the module
+ */
+static int mhvtl_max_qdepth(struct scsi_device *sdev) {
+	if (sdev->type == TYPE_MEDIUM_CHANGER)
+		return VTL_SMC_QDEPTH;
+	return sdev->host->cmd_per_lun;
+}
+
 /* RedHat 4 appears to define 'scsi_get_tag_type' but doesn't understand
  * change_queue_depth
  * Disabling for kernel 2.6.9 (RedHat AS 4)
@@ -683,8 +697,8 @@ static int mhvtl_change_queue_depth(struct scsi_device *sdev, int qdepth,
 
 	if (qdepth < 1)
 		qdepth = 1;
-	else if (qdepth > sdev->host->cmd_per_lun)
-		qdepth = sdev->host->cmd_per_lun;
+	else if (qdepth > mhvtl_max_qdepth(sdev))
+		qdepth = mhvtl_max_qdepth(sdev);
 
 #if LINUX_VERSION_CODE < KERNEL_VERSION(3, 19, 0)
 	scsi_adjust_queue_depth(sdev, scsi_get_tag_type(sdev), qdepth);
@@ -857,9 +871,9 @@ static int mhvtl_sdev_configure(struct scsi_device *sdp)
 	if (sdp->host->cmd_per_lun)
 #if LINUX_VERSION_CODE < KERNEL_VERSION(3, 19, 0)
 		scsi_adjust_queue_depth(sdp, VTL_TAGGED_QUEUING,
-								sdp->host->cmd_per_lun);
+								mhvtl_max_qdepth(sdp));
 #else
-		scsi_change_queue_depth(sdp, sdp->host->cmd_per_lun);
+		scsi_change_queue_depth(sdp, mhvtl_max_qdepth(sdp));
 #endif
 	return 0;
 }
@@ -1110,6 +1124,7 @@ static int mhvtl_add_device(unsigned int minor, struct mhvtl_ctl *ctl) {
  * Sysfs parameters defined explicitly below.
  */
 module_param_named(opts, mhvtl_opts, int, 0); /* perm=0644 */
+module_param_named(can_queue, mhvtl_can_queue, int, 0);
 
 MODULE_AUTHOR("Eric Youngdale + Douglas Gilbert + Mark Harvey");
 MODULE_DESCRIPTION("SCSI vtl adapter driver");
@@ -1117,6 +1132,7 @@ MODULE_LICENSE("GPL");
 MODULE_VERSION(MHVTL_VERSION);
 
 MODULE_PARM_DESC(opts, "1->noise, 2->medium_error, 4->...");
+MODULE_PARM_DESC(can_queue, "commands in flight per host (def=1)");
 
 static char mhvtl_parm_info[256];
 
@@ -1437,6 +1453,8 @@ static int mhvtl_driver_probe(struct device *dev) {
 	else
 		hpnt->max_id = mhvtl_num_tgts;
 	hpnt->max_lun = mhvtl_max_luns;
+	if (mhvtl_can_queue > 1)
+		hpnt->can_queue = mhvtl_can_queue;
 
 	error = scsi_add_host(hpnt, &mhvtl_hba->dev);
 	if (error) {
@@ -1578,27 +1596,37 @@ give_up:
 }
 
 static int send_mhvtl_header(unsigned int minor, char __user *arg) {
-	struct mhvtl_header		*vheadp;
-	struct mhvtl_queued_cmd *sqcp, *n;
+	struct mhvtl_lu_info	*lu = devp[minor];
+	struct mhvtl_header		 vhead;
+	struct mhvtl_queued_cmd *sqcp;
+	unsigned long			 iflags;
 	int						 ret = 0;
 
-	list_for_each_entry_safe(sqcp, n, &devp[minor]->cmd_list, queued_sibling) {
+	/*
+	 * A library can have more than one command outstanding, and more
+	 * queued while we look - see mhvtl_max_qdepth()
+	 */
+	spin_lock_irqsave(&lu->cmd_list_lock, iflags);
+	list_for_each_entry(sqcp, &lu->cmd_list, queued_sibling) {
 		if (sqcp->state == CMD_STATE_QUEUED) {
-			vheadp = &sqcp->op_header;
-			if (copy_to_user((u8 *)arg, (u8 *)vheadp,
-							 sizeof(struct mhvtl_header))) {
-				ret = -EFAULT;
-				goto give_up;
-			}
 			/* Found an outstanding cmd to send */
+			memcpy(&vhead, &sqcp->op_header, sizeof(vhead));
 			sqcp->state = CMD_STATE_IN_USE;
 			ret			= VTL_QUEUE_CMD;
 			/* Can only send one header at a time */
-			goto give_up;
+			break;
 		}
 	}
+	spin_unlock_irqrestore(&lu->cmd_list_lock, iflags);
 
-give_up:
+	if (ret == VTL_QUEUE_CMD &&
+		copy_to_user((u8 *)arg, (u8 *)&vhead, sizeof(struct mhvtl_header))) {
+		/* Send it next time */
+		sqcp = lookup_sqcp(lu, vhead.serialNo);
+		if (sqcp)
+			sqcp->state = CMD_STATE_QUEUED;
+		ret = -EFAULT;
+	}
 	return ret;
 }
 
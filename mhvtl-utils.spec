@@ -117,6 +117,10 @@ install -d -m 755 %{buildroot}/var/lib/%{name}
 %doc %{_mandir}/man1/update_device.conf.1*
 %doc %{_mandir}/man1/generate_device_conf.1*
 %doc %{_mandir}/man1/generate_library_contents.1*
+%doc %{_mandir}/man1/mhvtl-exporter.1*
+%doc %{_mandir}/man1/mhvtl-trace.1*
+%doc %{_mandir}/man1/mhvtl-catalog.1*
+# Not installed: mhvtl-bench, vtlcart-bench and their man pages
 %doc %{_mandir}/man5/device.conf.5*
 %doc %{_mandir}/man5/mhvtl.conf.5*
 %doc %{_mandir}/man5/library_contents.5*
@@ -131,6 +135,9 @@ install -d -m 755 %{buildroot}/var/lib/%{name}
 %{_bindir}/update_device.conf
 %{_bindir}/generate_device_conf
 %{_bindir}/generate_library_contents
+%{_bindir}/mhvtl-exporter
+%{_bindir}/mhvtl-trace
+%{_bindir}/mhvtl-catalog
 %{_libdir}/libvtlscsi.so
 %{_libdir}/libvtlcart.so
 %{_firmwarepath}/mhvtl/mhvtl_kernel.tgz
@@ -32,6 +32,8 @@
 #include "vtlcart.h"
 #include "vtllib.h"
 #include "logging.h"
+#include "mhvtl_catalog.h"
+#include "mhvtl_config.h"
 
 #if defined _LARGEFILE64_SOURCE
 static void *largefile_support = "large file support";
@@ -82,11 +84,10 @@ int main(int argc, char *argv[]) {
 	struct MAM	  new_mam;
 	char		 *lib	= NULL;
 	int			  libno = 0;
-	int			  indx;
+	struct catalog_entry entry;
+	const struct mhvtl_config *cfg;
+	const struct conf_device  *d;
 	int			  rc;
-	FILE		 *conf;
-	char		 *b; /* Read from file into this buffer */
-	char		 *s; /* Somewhere for sscanf to store results */
 
 	if (get_config(device_conf, DEVICE_CONF, my_id) < 0)
 		exit(1);
@@ -168,21 +169,9 @@ int main(int argc, char *argv[]) {
 		exit(1);
 	}
 
-	conf = fopen(device_conf, "r");
-	if (!conf) {
-		printf("Can not open config file %s : %s", device_conf,
-			   strerror(errno));
-		perror("Can not open config file");
-		exit(1);
-	}
-	s = zalloc(MALLOC_SZ);
-	if (!s) {
-		perror("Could not allocate memory");
-		exit(1);
-	}
-	b = zalloc(MALLOC_SZ);
-	if (!b) {
-		perror("Could not allocate memory");
+	cfg = config_load();
+	if (!cfg) {
+		fprintf(stderr, "Can not read config file %s\n", device_conf);
 		exit(1);
 	}
 
@@ -193,26 +182,26 @@ int main(int argc, char *argv[]) {
 		printf("Looking for PCL: %s in library %d\n", pcl, libno);
 		find_media_home_directory(NULL, libno);
 		rc = load_tape(pcl, &sam_stat);
-	} else { /* Walk thru all defined libraries looking for media */
-		while (readline(b, MALLOC_SZ, conf) != NULL) {
-			if (b[0] == '#') /* Ignore comments */
+	} else if (!catalog_lookup(pcl, &entry)) {
+		/* The catalog knows where it lives */
+		libno = entry.library;
+		snprintf(home_directory, sizeof(home_directory), "%s", entry.home);
+		rc = load_tape(pcl, &sam_stat);
+	}
+	if (rc && !lib) { /* Walk thru all defined libraries looking for media */
+		for_each_conf_device(cfg, d) {
+			if (d->type != CONF_LIBRARY)
 				continue;
-			/* If found a library: Attempt to load media
-			 * Break out of loop if found. Otherwise try next lib.
-			 */
-			if (sscanf(b, "Library: %d CHANNEL:", &indx)) {
-				find_media_home_directory(NULL, indx);
-				rc = load_tape(pcl, &sam_stat);
-				if (!rc)
-					break;
+			/* Attempt to load media. Break out of loop if found. */
+			config_home(d, home_directory, sizeof(home_directory));
+			rc = load_tape(pcl, &sam_stat);
+			if (!rc) {
+				libno = d->id;
+				break;
 			}
 		}
 	}
 
-	fclose(conf);
-	free(s);
-	free(b);
-
 	if (rc) {
 		fprintf(stderr, "PCL %s cannot be dumped, "
 						"load_tape() returned %d\n",
@@ -289,6 +278,7 @@ int main(int argc, char *argv[]) {
 
 	memcpy(&mam, &new_mam, sizeof(mam));
 	rewriteMAM(&sam_stat);
+	catalog_note(pcl, libno, 0);
 	unload_tape(&sam_stat);
 
 	exit(0);
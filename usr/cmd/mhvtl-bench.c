@@ -0,0 +1,1029 @@
+/*
+ * mhvtl-bench - Throughput / latency benchmark for virtual tape drives
+ *
+ * Drives one or more tape drives, through SCSI generic (/dev/sgN) or the st
+ * driver (/dev/nstN), with a configurable block size, fixed/variable block
+ * mode, compression, Logical Block Protection and filemark frequency, and
+ * reports MB/s, IOPS and latency percentiles as JSON.
+ *
+ * Each device is driven from its own thread. The threads start every
+ * workload phase together, so the aggregate figures show what the host
+ * sustains with that many drives busy at once.
+ *
+ * Copyright (C) 2005 - 2025 Mark Harvey markh794 at gmail dot com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/mtio.h>
+#include <scsi/sg.h>
+#include "be_byteshift.h"
+#include "mhvtl_scsi.h"
+#include "ccan/crc32c/crc32c.h"
+
+uint32_t BlockProtectRSCRC(uint8_t *blkbuf, uint32_t blklen, int32_t bigendian);
+uint32_t BlockVerifyRSCRC(const uint8_t *blkbuf, uint32_t blklen, int32_t bigendian);
+
+#define MAX_DEVICES 64
+#define MAX_PHASES	16
+#define MAX_XFER	0xffffff			/* 24 bit READ(6)/WRITE(6) transfer length */
+#define POOL_SZ		(4 * 1024 * 1024) /* Source of per-block write data */
+#define LBP_LEN		4
+#define MIXED_SEG	64 /* Blocks per write / read back round without -m */
+#define ERR_LEN		160
+#define DRIVER_SENSE 0x08 /* sg_io_hdr driver_status: sense buffer valid */
+
+#define TIMEOUT		(60 * 1000)		 /* ms - data transfer, mode select */
+#define TIMEOUT_POS (15 * 60 * 1000) /* ms - rewind, locate, space */
+
+/* dev_xxx() return codes, besides 0 / a byte count */
+#define R_ERR	   -1 /* Failed - reason in the phase result */
+#define R_EOD	   -2 /* Read hit end of data */
+#define R_EOM	   -3 /* Write hit early warning / end of medium */
+#define R_FILEMARK -4 /* Read a filemark */
+
+enum workload {
+	WL_WRITE,
+	WL_READ,
+	WL_MIXED,
+	WL_LOCATE,
+	WL_COUNT,
+};
+
+static const char *workload_name[WL_COUNT] = {
+	[WL_WRITE]	= "write",
+	[WL_READ]	= "read",
+	[WL_MIXED]	= "mixed",
+	[WL_LOCATE] = "locate",
+};
+
+enum op {
+	OP_WRITE,
+	OP_READ,
+	OP_LOCATE,
+	OP_COUNT,
+};
+
+static const char *op_name[OP_COUNT] = {
+	[OP_WRITE]	= "write",
+	[OP_READ]	= "read",
+	[OP_LOCATE] = "locate",
+};
+
+enum pattern {
+	PAT_RANDOM,
+	PAT_TEXT,
+	PAT_ZERO,
+	PAT_COUNT,
+};
+
+static const char *pattern_name[PAT_COUNT] = {
+	[PAT_RANDOM] = "random",
+	[PAT_TEXT]	 = "compressible",
+	[PAT_ZERO]	 = "zero",
+};
+
+/* Indexed by LBP method, as in the Control mode page */
+static const char *lbp_name[] = {"none", "rs-crc", "crc32c"};
+
+struct latency {
+	uint64_t *ns;
+	size_t	  count;
+	size_t	  size;
+};
+
+struct phase_result {
+	uint64_t	   elapsed; /* ns */
+	uint64_t	   bytes;	/* Payload, excluding any LBP CRC */
+	uint64_t	   filemarks;
+	uint64_t	   crc_errors;
+	int			   eom;
+	struct latency lat[OP_COUNT];
+	char		   error[ERR_LEN];
+};
+
+struct device {
+	const char		   *path;
+	int					fd;
+	int					sg; /* SCSI generic, otherwise st */
+	int					id;
+	pthread_t			thread;
+	uint32_t			rand;
+	uint8_t			   *pool;
+	uint8_t			   *wbuf;
+	uint8_t			   *rbuf;
+	uint8_t				sense[32];
+	char			   *error; /* Where fail() writes */
+	char				setup_error[ERR_LEN];
+	struct phase_result result[MAX_PHASES];
+};
+
+static struct {
+	uint32_t	  blk_sz;
+	uint32_t	  xfer_sz; /* blk_sz + LBP CRC */
+	long		  blocks;
+	int			  fixed;
+	int			  compression; /* -1: leave as is */
+	int			  lbp;		   /* -1: leave as is, else LBP method */
+	long		  fm_every;
+	enum pattern  pattern;
+	long		  locates;
+	unsigned int  seed;
+	enum workload phase[MAX_PHASES];
+	int			  phases;
+} cfg = {
+	.blk_sz		 = 256 * 1024,
+	.blocks		 = 4096,
+	.compression = -1,
+	.lbp		 = -1,
+	.locates	 = 1000,
+	.seed		 = 1,
+};
+
+static struct device	 dev[MAX_DEVICES];
+static int				 devices;
+static pthread_barrier_t barrier;
+static char				*progname;
+
+static void usage(void) {
+	fprintf(stderr, "Usage: %s [options] -f device [-f device ...]\n", progname);
+	fprintf(stderr, "  -f device   Tape drive, /dev/sgN (SCSI generic) or /dev/nstN (st)\n");
+	fprintf(stderr, "  -w list     Comma separated workloads, run in order:\n"
+					"              write, read, mixed, locate (default: write,read)\n");
+	fprintf(stderr, "  -b size     Block size in bytes, k or m suffix (default: 256k)\n");
+	fprintf(stderr, "  -n blocks   Blocks per write/read/mixed phase (default: 4096)\n");
+	fprintf(stderr, "  -F          Fixed block mode (default: variable)\n");
+	fprintf(stderr, "  -c on|off   Data compression (default: leave as is)\n");
+	fprintf(stderr, "  -L method   Logical Block Protection: none, rs-crc or crc32c\n"
+					"              (default: leave as is, data sent without CRC)\n");
+	fprintf(stderr, "  -m count    Write a filemark every 'count' blocks\n");
+	fprintf(stderr, "  -D pattern  Data: random, compressible or zero (default: random)\n");
+	fprintf(stderr, "  -p count    Locates in the locate phase (default: 1000)\n");
+	fprintf(stderr, "  -S seed     Seed for write data and locate targets (default: 1)\n");
+	fprintf(stderr, "  -V          Print version and exit\n");
+}
+
+static uint64_t now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* xorshift32 - repeatable for a given -S */
+static uint32_t next_rand(struct device *d) {
+	uint32_t x = d->rand;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	d->rand = x;
+	return x;
+}
+
+static void fail(struct device *d, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+
+static void fail(struct device *d, const char *fmt, ...) {
+	va_list ap;
+
+	va_start(ap, fmt);
+	vsnprintf(d->error, ERR_LEN, fmt, ap);
+	va_end(ap);
+}
+
+static void lat_add(struct latency *l, uint64_t ns) {
+	uint64_t *p;
+
+	if (l->count == l->size) {
+		p = realloc(l->ns, (l->size ? l->size * 2 : 4096) * sizeof(uint64_t));
+		if (!p)
+			return; /* Keep going, just with fewer samples */
+		l->ns	= p;
+		l->size = l->size ? l->size * 2 : 4096;
+	}
+	l->ns[l->count++] = ns;
+}
+
+/*
+ * Issue 'cdb' through SG_IO - works on st device nodes too
+ *
+ * Returns 0 on GOOD status, 1 on CHECK CONDITION (sense in d->sense),
+ * R_ERR on any other failure. '*resid' (if not NULL) gets the residual count.
+ */
+static int sg_cmd(struct device *d, uint8_t *cdb, int cdb_len, int dir,
+				  void *buf, uint32_t len, uint32_t timeout, int *resid) {
+	struct sg_io_hdr io;
+
+	memset(&io, 0, sizeof(io));
+	io.interface_id	   = 'S';
+	io.cmdp			   = cdb;
+	io.cmd_len		   = cdb_len;
+	io.dxfer_direction = len ? dir : SG_DXFER_NONE;
+	io.dxferp		   = buf;
+	io.dxfer_len	   = len;
+	io.sbp			   = d->sense;
+	io.mx_sb_len	   = sizeof(d->sense);
+	io.timeout		   = timeout;
+
+	if (ioctl(d->fd, SG_IO, &io) < 0) {
+		fail(d, "SG_IO, opcode 0x%02x: %s", cdb[0], strerror(errno));
+		return R_ERR;
+	}
+	if (resid)
+		*resid = io.resid;
+	if (io.status == SAM_STAT_CHECK_CONDITION)
+		return 1;
+	if (io.status || io.host_status || (io.driver_status & ~DRIVER_SENSE)) {
+		fail(d, "opcode 0x%02x: status 0x%02x, host 0x%02x, driver 0x%02x",
+			 cdb[0], io.status, io.host_status, io.driver_status);
+		return R_ERR;
+	}
+	return 0;
+}
+
+static int sense_fail(struct device *d, uint8_t opcode) {
+	fail(d, "opcode 0x%02x: [Key/ASC/ASCQ] [%02x %02x %02x]", opcode,
+		 d->sense[2] & 0x0f, d->sense[12], d->sense[13]);
+	return R_ERR;
+}
+
+/* Commands where any CHECK CONDITION is a failure */
+static int sg_simple(struct device *d, uint8_t *cdb, int cdb_len, int dir,
+					 void *buf, uint32_t len, uint32_t timeout) {
+	int rc = sg_cmd(d, cdb, cdb_len, dir, buf, len, timeout, NULL);
+
+	return rc == 1 ? sense_fail(d, cdb[0]) : rc;
+}
+
+/* MODE SELECT(6) of an optional block descriptor and an optional mode page */
+static int mode_select(struct device *d, uint8_t *bd, uint8_t *page, int page_len) {
+	uint8_t cdb[6] = {MODE_SELECT, 0x10, 0, 0, 0, 0}; /* PF */
+	uint8_t buf[64];
+	int		len = 4;
+
+	memset(buf, 0, sizeof(buf));
+	if (bd) {
+		buf[3] = 8;
+		memcpy(&buf[len], bd, 8);
+		len += 8;
+	}
+	if (page) {
+		memcpy(&buf[len], page, page_len);
+		len += page_len;
+	}
+	cdb[4] = len;
+	return sg_simple(d, cdb, 6, SG_DXFER_TO_DEV, buf, len, TIMEOUT);
+}
+
+/* Set the block length in the block descriptor, keeping the density */
+static int sg_set_block_length(struct device *d, uint32_t len) {
+	uint8_t cdb[6] = {MODE_SENSE, 0, MODE_DATA_COMPRESSION, 0, 64, 0};
+	uint8_t buf[64];
+
+	memset(buf, 0, sizeof(buf));
+	if (sg_simple(d, cdb, 6, SG_DXFER_FROM_DEV, buf, sizeof(buf), TIMEOUT))
+		return R_ERR;
+	if (buf[3] < 8) {
+		fail(d, "MODE SENSE returned no block descriptor");
+		return R_ERR;
+	}
+	memset(&buf[5], 0, 3); /* Number of blocks */
+	put_unaligned_be24(len, &buf[9]);
+	return mode_select(d, &buf[4], NULL, 0);
+}
+
+static int sg_set_compression(struct device *d, int on) {
+	uint8_t page[16];
+
+	memset(page, 0, sizeof(page));
+	page[0] = MODE_DATA_COMPRESSION;
+	page[1] = 0x0e;
+	page[2] = on ? 0xc0 : 0x40; /* DCE, DCC */
+	page[3] = 0x80;				/* DDE */
+	put_unaligned_be32(on, &page[4]);
+	put_unaligned_be32(1, &page[8]);
+	return mode_select(d, NULL, page, sizeof(page));
+}
+
+/* Control mode page, Logical Block Protection subpage */
+static int set_lbp(struct device *d, int method) {
+	uint8_t page[32];
+
+	memset(page, 0, sizeof(page));
+	page[0] = MODE_CONTROL;
+	page[1] = 0xf0;
+	put_unaligned_be16(sizeof(page) - 4, &page[2]);
+	page[4] = method;
+	page[5] = method ? LBP_LEN : 0;
+	page[6] = method ? 0xc0 : 0; /* LBP_W, LBP_R */
+	return mode_select(d, NULL, page, sizeof(page));
+}
+
+static int st_op(struct device *d, short op, int count, const char *name) {
+	struct mtop mt = {.mt_op = op, .mt_count = count};
+
+	if (ioctl(d->fd, MTIOCTOP, &mt) < 0) {
+		fail(d, "%s: %s", name, strerror(errno));
+		return R_ERR;
+	}
+	return 0;
+}
+
+/* st: is the drive at end of data? */
+static int st_at_eod(struct device *d) {
+	struct mtget mt;
+
+	return ioctl(d->fd, MTIOCGET, &mt) == 0 && GMT_EOD(mt.mt_gstat);
+}
+
+static int dev_rewind(struct device *d) {
+	uint8_t cdb[6] = {REZERO_UNIT, 0, 0, 0, 0, 0};
+
+	if (!d->sg)
+		return st_op(d, MTREW, 1, "MTREW");
+	return sg_simple(d, cdb, 6, SG_DXFER_NONE, NULL, 0, TIMEOUT_POS);
+}
+
+static int dev_filemark(struct device *d) {
+	uint8_t cdb[6] = {WRITE_FILEMARKS, 0, 0, 0, 1, 0};
+
+	if (!d->sg)
+		return st_op(d, MTWEOF, 1, "MTWEOF");
+	return sg_simple(d, cdb, 6, SG_DXFER_NONE, NULL, 0, TIMEOUT);
+}
+
+static int dev_eod(struct device *d) {
+	uint8_t cdb[6] = {SPACE, 0x03, 0, 0, 0, 0}; /* End of data */
+
+	if (!d->sg)
+		return st_op(d, MTEOM, 1, "MTEOM");
+	return sg_simple(d, cdb, 6, SG_DXFER_NONE, NULL, 0, TIMEOUT_POS);
+}
+
+static int dev_locate(struct device *d, uint32_t blk) {
+	uint8_t cdb[10] = {LOCATE_10, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+
+	if (!d->sg)
+		return st_op(d, MTSEEK, blk, "MTSEEK");
+	put_unaligned_be32(blk, &cdb[3]);
+	return sg_simple(d, cdb, 10, SG_DXFER_NONE, NULL, 0, TIMEOUT_POS);
+}
+
+static int dev_tell(struct device *d, uint32_t *blk) {
+	uint8_t		cdb[10] = {READ_POSITION, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+	uint8_t		buf[20];
+	struct mtpos pos;
+
+	if (!d->sg) {
+		if (ioctl(d->fd, MTIOCPOS, &pos) < 0) {
+			fail(d, "MTIOCPOS: %s", strerror(errno));
+			return R_ERR;
+		}
+		*blk = pos.mt_blkno;
+		return 0;
+	}
+	if (sg_simple(d, cdb, 10, SG_DXFER_FROM_DEV, buf, sizeof(buf), TIMEOUT))
+		return R_ERR;
+	*blk = get_unaligned_be32(&buf[4]);
+	return 0;
+}
+
+static int dev_write(struct device *d, uint8_t *buf, uint32_t len) {
+	uint8_t cdb[6] = {WRITE_6, 0, 0, 0, 0, 0};
+	ssize_t n;
+
+	if (!d->sg) {
+		n = write(d->fd, buf, len);
+		if (n == len)
+			return 0;
+		if (n >= 0 || errno == ENOSPC)
+			return R_EOM;
+		fail(d, "write: %s", strerror(errno));
+		return R_ERR;
+	}
+
+	cdb[1] = cfg.fixed ? 1 : 0;
+	put_unaligned_be24(cfg.fixed ? 1 : len, &cdb[2]);
+	switch (sg_cmd(d, cdb, 6, SG_DXFER_TO_DEV, buf, len, TIMEOUT, NULL)) {
+	case 0:
+		return 0;
+	case 1:
+		if ((d->sense[2] & SD_EOM) || (d->sense[2] & 0x0f) == VOLUME_OVERFLOW)
+			return R_EOM;
+		return sense_fail(d, cdb[0]);
+	}
+	return R_ERR;
+}
+
+/* Returns bytes read (including any LBP CRC) or R_FILEMARK / R_EOD / R_ERR */
+static int dev_read(struct device *d, uint8_t *buf, uint32_t len) {
+	uint8_t cdb[6] = {READ_6, 0, 0, 0, 0, 0};
+	int32_t info;
+	ssize_t n;
+	int		resid = 0;
+
+	if (!d->sg) {
+		n = read(d->fd, buf, len);
+		if (n > 0)
+			return n;
+		if (st_at_eod(d))
+			return R_EOD;
+		if (n == 0)
+			return R_FILEMARK;
+		fail(d, "read: %s", strerror(errno));
+		return R_ERR;
+	}
+
+	cdb[1] = cfg.fixed ? 1 : SILI;
+	put_unaligned_be24(cfg.fixed ? 1 : len, &cdb[2]);
+	switch (sg_cmd(d, cdb, 6, SG_DXFER_FROM_DEV, buf, len, TIMEOUT, &resid)) {
+	case 0:
+		return len - resid;
+	case 1:
+		if (d->sense[2] & SD_FILEMARK)
+			return R_FILEMARK;
+		if ((d->sense[2] & 0x0f) == BLANK_CHECK)
+			return R_EOD;
+		if (d->sense[2] & SD_ILI) {
+			info = get_unaligned_be32(&d->sense[3]);
+			if (info > 0)
+				return len - info;
+			fail(d, "Block larger than %u bytes", len);
+			return R_ERR;
+		}
+		return sense_fail(d, cdb[0]);
+	}
+	return R_ERR;
+}
+
+/* Fill the write buffer for block 'blk', returns the transfer length */
+static uint32_t fill_block(struct device *d, uint64_t blk) {
+	uint32_t crc;
+
+	memcpy(d->wbuf, d->pool + (blk * 4099 % POOL_SZ), cfg.blk_sz);
+	if (cfg.pattern != PAT_ZERO && cfg.blk_sz >= sizeof(blk))
+		memcpy(d->wbuf, &blk, sizeof(blk));
+
+	switch (cfg.lbp) {
+	case 1:
+		return BlockProtectRSCRC(d->wbuf, cfg.blk_sz, 1);
+	case 2:
+		crc = crc32c(0, d->wbuf, cfg.blk_sz);
+		memcpy(&d->wbuf[cfg.blk_sz], &crc, LBP_LEN);
+		return cfg.blk_sz + LBP_LEN;
+	}
+	return cfg.blk_sz;
+}
+
+/* Check the LBP CRC of a block just read, returns its payload size */
+static uint32_t check_block(struct device *d, struct phase_result *r, uint32_t n) {
+	uint32_t crc;
+
+	if (cfg.lbp <= 0)
+		return n;
+	if (n <= LBP_LEN) {
+		r->crc_errors++;
+		return 0;
+	}
+	if (cfg.lbp == 1) {
+		if (!BlockVerifyRSCRC(d->rbuf, n, 1))
+			r->crc_errors++;
+	} else {
+		crc = crc32c(0, d->rbuf, n - LBP_LEN);
+		if (memcmp(&crc, &d->rbuf[n - LBP_LEN], LBP_LEN))
+			r->crc_errors++;
+	}
+	return n - LBP_LEN;
+}
+
+/* Write 'count' blocks numbered from 'blk', with a filemark every -m blocks */
+static int write_blocks(struct device *d, struct phase_result *r,
+						uint64_t blk, long count) {
+	uint64_t start;
+	uint32_t len;
+	int		 rc;
+
+	for (; count > 0; count--, blk++) {
+		len	  = fill_block(d, blk);
+		start = now();
+		rc	  = dev_write(d, d->wbuf, len);
+		lat_add(&r->lat[OP_WRITE], now() - start);
+		if (rc == R_EOM) {
+			r->eom = 1;
+			return R_EOM;
+		}
+		if (rc)
+			return rc;
+		r->bytes += cfg.blk_sz;
+
+		if (cfg.fm_every && (blk + 1) % cfg.fm_every == 0) {
+			if (dev_filemark(d))
+				return R_ERR;
+			r->filemarks++;
+		}
+	}
+	return 0;
+}
+
+/* Read 'count' data blocks, skipping filemarks. Returns blocks read */
+static long read_blocks(struct device *d, struct phase_result *r, long count) {
+	uint64_t start;
+	long	 got = 0;
+	int		 rc;
+
+	while (got < count) {
+		start = now();
+		rc	  = dev_read(d, d->rbuf, cfg.xfer_sz);
+		if (rc == R_FILEMARK) {
+			r->filemarks++;
+			continue;
+		}
+		if (rc == R_EOD)
+			break;
+		if (rc < 0)
+			return R_ERR;
+		lat_add(&r->lat[OP_READ], now() - start);
+		r->bytes += check_block(d, r, rc);
+		got++;
+	}
+	return got;
+}
+
+static int timed_locate(struct device *d, struct phase_result *r, uint32_t blk) {
+	uint64_t start = now();
+	int		 rc	   = dev_locate(d, blk);
+
+	lat_add(&r->lat[OP_LOCATE], now() - start);
+	return rc;
+}
+
+/* Sequential write from BOT, terminated by a filemark */
+static int phase_write(struct device *d, struct phase_result *r) {
+	int rc;
+
+	if (dev_rewind(d))
+		return R_ERR;
+	rc = write_blocks(d, r, 0, cfg.blocks);
+	if (rc == R_ERR)
+		return rc;
+	if (cfg.fm_every && !r->eom && cfg.blocks % cfg.fm_every == 0)
+		return 0; /* Last block already followed by a filemark */
+	if (dev_filemark(d))
+		return R_ERR;
+	r->filemarks++;
+	return 0;
+}
+
+/* Sequential read from BOT up to -n data blocks or end of data */
+static int phase_read(struct device *d, struct phase_result *r) {
+	long got;
+
+	if (dev_rewind(d))
+		return R_ERR;
+	got = read_blocks(d, r, cfg.blocks);
+	if (got < 0)
+		return R_ERR;
+	if (!got) {
+		fail(d, "No data on tape - run the write workload first");
+		return R_ERR;
+	}
+	return 0;
+}
+
+/*
+ * Write a segment (-m blocks, or MIXED_SEG), locate back, read it, locate
+ * to the end and carry on - a backup application verifying as it goes.
+ */
+static int phase_mixed(struct device *d, struct phase_result *r) {
+	uint32_t start, end;
+	uint64_t blk;
+	long	 seg = cfg.fm_every ? cfg.fm_every : MIXED_SEG;
+	long	 n;
+	int		 rc;
+
+	if (dev_rewind(d))
+		return R_ERR;
+	for (blk = 0; blk < (uint64_t)cfg.blocks; blk += n) {
+		n = cfg.blocks - blk < seg ? cfg.blocks - blk : seg;
+		if (dev_tell(d, &start))
+			return R_ERR;
+		rc = write_blocks(d, r, blk, n);
+		if (rc == R_EOM)
+			return 0;
+		if (rc || dev_tell(d, &end) || timed_locate(d, r, start))
+			return R_ERR;
+		if (read_blocks(d, r, n) != n) {
+			if (!d->error[0])
+				fail(d, "Short read back of blocks written at %u", start);
+			return R_ERR;
+		}
+		if (timed_locate(d, r, end))
+			return R_ERR;
+	}
+	return 0;
+}
+
+/* Random locates across the written part of the tape, each reading one block */
+static int phase_locate(struct device *d, struct phase_result *r) {
+	uint32_t last;
+	long	 i;
+
+	if (dev_eod(d) || dev_tell(d, &last))
+		return R_ERR;
+	if (!last) {
+		fail(d, "No data on tape - run the write workload first");
+		return R_ERR;
+	}
+	for (i = 0; i < cfg.locates; i++) {
+		if (timed_locate(d, r, next_rand(d) % last))
+			return R_ERR;
+		if (read_blocks(d, r, 1) < 0)
+			return R_ERR;
+	}
+	return 0;
+}
+
+static int (*phase_fn[WL_COUNT])(struct device *, struct phase_result *) = {
+	[WL_WRITE]	= phase_write,
+	[WL_READ]	= phase_read,
+	[WL_MIXED]	= phase_mixed,
+	[WL_LOCATE] = phase_locate,
+};
+
+static void *run(void *arg) {
+	struct device		*d = arg;
+	struct phase_result *r;
+	uint64_t			 start;
+	int					 i;
+
+	for (i = 0; i < cfg.phases; i++) {
+		r		 = &d->result[i];
+		d->error = r->error;
+		pthread_barrier_wait(&barrier);
+		if (d->setup_error[0])
+			continue;
+		start = now();
+		phase_fn[cfg.phase[i]](d, r);
+		r->elapsed = now() - start;
+	}
+	return NULL;
+}
+
+static int setup(struct device *d) {
+	int v, i;
+
+	d->error = d->setup_error;
+	d->fd	 = open(d->path, O_RDWR);
+	if (d->fd < 0) {
+		fail(d, "Unable to open: %s", strerror(errno));
+		return R_ERR;
+	}
+	d->sg	= ioctl(d->fd, SG_GET_VERSION_NUM, &v) == 0;
+	d->rand = cfg.seed + d->id * 7919;
+	if (!d->rand)
+		d->rand = 1;
+
+	d->pool = malloc(POOL_SZ + cfg.blk_sz);
+	d->wbuf = malloc(cfg.xfer_sz);
+	d->rbuf = malloc(cfg.xfer_sz);
+	if (!d->pool || !d->wbuf || !d->rbuf) {
+		fail(d, "Out of memory");
+		return R_ERR;
+	}
+	for (i = 0; i < POOL_SZ + (int)cfg.blk_sz; i++) {
+		switch (cfg.pattern) {
+		case PAT_RANDOM:
+			d->pool[i] = next_rand(d);
+			break;
+		case PAT_TEXT: /* Roughly 2:1 - runs of a few random letters */
+			d->pool[i] = (i & 3) ? d->pool[i - 1] : 'a' + next_rand(d) % 26;
+			break;
+		default:
+			d->pool[i] = 0;
+		}
+	}
+
+	if (d->sg) {
+		if (sg_set_block_length(d, cfg.fixed ? cfg.xfer_sz : 0))
+			return R_ERR;
+		if (cfg.compression >= 0 && sg_set_compression(d, cfg.compression))
+			return R_ERR;
+	} else {
+		if (st_op(d, MTSETBLK, cfg.fixed ? cfg.xfer_sz : 0, "MTSETBLK"))
+			return R_ERR;
+		if (cfg.compression >= 0 &&
+			st_op(d, MTCOMPRESSION, cfg.compression, "MTCOMPRESSION"))
+			return R_ERR;
+	}
+	if (cfg.lbp >= 0 && set_lbp(d, cfg.lbp))
+		return R_ERR;
+	return 0;
+}
+
+static void json_str(const char *s) {
+	putchar('"');
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			printf("\\%c", *s);
+		else if ((unsigned char)*s < 0x20)
+			printf("\\u%04x", *s);
+		else
+			putchar(*s);
+	}
+	putchar('"');
+}
+
+static int cmp_u64(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* Nearest rank percentile, 'per_mille' of 1000 */
+static double pct_us(struct latency *l, unsigned int per_mille) {
+	size_t rank = (l->count * per_mille + 999) / 1000;
+
+	return l->ns[rank ? rank - 1 : 0] / 1000.0;
+}
+
+static void print_latency(struct latency *lat) {
+	struct latency *l;
+	uint64_t		sum;
+	const char	   *sep = "";
+	size_t			i;
+	int				op;
+
+	printf("\"latency_us\": {");
+	for (op = 0; op < OP_COUNT; op++) {
+		l = &lat[op];
+		if (!l->count)
+			continue;
+		qsort(l->ns, l->count, sizeof(uint64_t), cmp_u64);
+		for (sum = 0, i = 0; i < l->count; i++)
+			sum += l->ns[i];
+		printf("%s\"%s\": {\"ops\": %zu, \"min\": %.1f, \"mean\": %.1f, "
+			   "\"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f, \"p99.9\": %.1f, "
+			   "\"max\": %.1f}",
+			   sep, op_name[op], l->count, l->ns[0] / 1000.0,
+			   (double)sum / l->count / 1000.0, pct_us(l, 500), pct_us(l, 900),
+			   pct_us(l, 990), pct_us(l, 999), l->ns[l->count - 1] / 1000.0);
+		sep = ", ";
+	}
+	printf("}");
+}
+
+static uint64_t ops(struct phase_result *r) {
+	return r->lat[OP_WRITE].count + r->lat[OP_READ].count + r->lat[OP_LOCATE].count;
+}
+
+static double rate(uint64_t n, uint64_t ns) {
+	return ns ? n * 1e9 / ns : 0.0;
+}
+
+/* Returns non-zero if any device failed */
+static int report(void) {
+	struct phase_result *r;
+	uint64_t			 bytes, nops, elapsed;
+	int					 i, j, ok, failed = 0;
+
+	printf("{\n  \"version\": \"%s\",\n", MHVTL_VERSION);
+	printf("  \"config\": {\"block_size\": %u, \"blocks\": %ld, \"mode\": \"%s\", "
+		   "\"compression\": \"%s\", \"lbp\": \"%s\", \"filemark_every\": %ld, "
+		   "\"pattern\": \"%s\", \"locates\": %ld, \"seed\": %u, \"workloads\": [",
+		   cfg.blk_sz, cfg.blocks, cfg.fixed ? "fixed" : "variable",
+		   cfg.compression < 0 ? "unchanged" : cfg.compression ? "on" : "off",
+		   cfg.lbp < 0 ? "unchanged" : lbp_name[cfg.lbp], cfg.fm_every,
+		   pattern_name[cfg.pattern], cfg.locates, cfg.seed);
+	for (j = 0; j < cfg.phases; j++)
+		printf("%s\"%s\"", j ? ", " : "", workload_name[cfg.phase[j]]);
+	printf("]},\n  \"devices\": [\n");
+
+	for (i = 0; i < devices; i++) {
+		printf("    {\"device\": ");
+		json_str(dev[i].path);
+		printf(", \"interface\": \"%s\"", dev[i].sg ? "sg" : "st");
+		if (dev[i].setup_error[0]) {
+			printf(", \"error\": ");
+			json_str(dev[i].setup_error);
+			failed = 1;
+		}
+		printf(", \"phases\": [");
+		for (j = 0; !dev[i].setup_error[0] && j < cfg.phases; j++) {
+			r = &dev[i].result[j];
+			printf("%s\n      {\"workload\": \"%s\", \"seconds\": %.3f, "
+				   "\"bytes\": %" PRIu64 ", \"mb_per_s\": %.2f, \"iops\": %.1f, "
+				   "\"filemarks\": %" PRIu64 ", \"crc_errors\": %" PRIu64
+				   ", \"end_of_medium\": %s, ",
+				   j ? "," : "", workload_name[cfg.phase[j]], r->elapsed / 1e9,
+				   r->bytes, rate(r->bytes, r->elapsed) / 1e6,
+				   rate(ops(r), r->elapsed), r->filemarks, r->crc_errors,
+				   r->eom ? "true" : "false");
+			if (r->error[0]) {
+				printf("\"error\": ");
+				json_str(r->error);
+				printf(", ");
+				failed = 1;
+			}
+			if (r->crc_errors)
+				failed = 1;
+			print_latency(r->lat);
+			printf("}");
+		}
+		printf("]}%s\n", i < devices - 1 ? "," : "");
+	}
+
+	/* Phases start together, so the slowest drive sets the elapsed time */
+	printf("  ],\n  \"aggregate\": [");
+	for (j = 0; j < cfg.phases; j++) {
+		bytes = nops = elapsed = 0;
+		for (ok = 0, i = 0; i < devices; i++) {
+			r = &dev[i].result[j];
+			if (dev[i].setup_error[0] || r->error[0])
+				continue;
+			ok++;
+			bytes += r->bytes;
+			nops += ops(r);
+			if (r->elapsed > elapsed)
+				elapsed = r->elapsed;
+		}
+		printf("%s\n    {\"workload\": \"%s\", \"drives\": %d, \"seconds\": %.3f, "
+			   "\"bytes\": %" PRIu64 ", \"mb_per_s\": %.2f, \"iops\": %.1f}",
+			   j ? "," : "", workload_name[cfg.phase[j]], ok, elapsed / 1e9,
+			   bytes, rate(bytes, elapsed) / 1e6, rate(nops, elapsed));
+	}
+	printf("\n  ]\n}\n");
+
+	return failed;
+}
+
+/* Lookup 's' in 'names', returns its index or -1 */
+static int lookup(const char *s, const char **names, int count) {
+	int i;
+
+	for (i = 0; i < count; i++)
+		if (names[i] && !strcmp(s, names[i]))
+			return i;
+	return -1;
+}
+
+static int parse_workloads(char *list) {
+	char *tok, *save;
+	int	  w;
+
+	cfg.phases = 0;
+	for (tok = strtok_r(list, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+		w = lookup(tok, workload_name, WL_COUNT);
+		if (w < 0 || cfg.phases == MAX_PHASES) {
+			fprintf(stderr, "%s: %s workload '%s'\n", progname,
+					w < 0 ? "Unknown" : "Too many, at", tok);
+			return -1;
+		}
+		cfg.phase[cfg.phases++] = w;
+	}
+	return cfg.phases ? 0 : -1;
+}
+
+static long parse_size(const char *s) {
+	char *end;
+	long  v = strtol(s, &end, 0);
+
+	switch (*end) {
+	case 'k':
+	case 'K':
+		v *= 1024;
+		end++;
+		break;
+	case 'm':
+	case 'M':
+		v *= 1024 * 1024;
+		end++;
+		break;
+	}
+	return *end ? -1 : v;
+}
+
+int main(int argc, char *argv[]) {
+	char def_workloads[] = "write,read";
+	long blk_sz;
+	int	 opt, i;
+
+	progname = argv[0];
+
+	while ((opt = getopt(argc, argv, "f:w:b:n:Fc:L:m:D:p:S:Vh")) != -1) {
+		switch (opt) {
+		case 'f':
+			if (devices == MAX_DEVICES) {
+				fprintf(stderr, "%s: At most %d devices\n", progname, MAX_DEVICES);
+				exit(1);
+			}
+			dev[devices].path = optarg;
+			dev[devices].id	  = devices;
+			devices++;
+			break;
+		case 'w':
+			if (parse_workloads(optarg)) {
+				usage();
+				exit(1);
+			}
+			break;
+		case 'b':
+			blk_sz = parse_size(optarg);
+			if (blk_sz <= 0 || blk_sz > MAX_XFER - LBP_LEN) {
+				fprintf(stderr, "%s: Invalid block size '%s'\n", progname, optarg);
+				exit(1);
+			}
+			cfg.blk_sz = blk_sz;
+			break;
+		case 'n':
+			cfg.blocks = atol(optarg);
+			break;
+		case 'F':
+			cfg.fixed = 1;
+			break;
+		case 'c':
+			cfg.compression = !strcmp(optarg, "on") ? 1 : !strcmp(optarg, "off") ? 0 : -2;
+			if (cfg.compression == -2) {
+				usage();
+				exit(1);
+			}
+			break;
+		case 'L':
+			cfg.lbp = lookup(optarg, lbp_name, 3);
+			if (cfg.lbp < 0) {
+				usage();
+				exit(1);
+			}
+			break;
+		case 'm':
+			cfg.fm_every = atol(optarg);
+			break;
+		case 'D':
+			cfg.pattern = lookup(optarg, pattern_name, PAT_COUNT);
+			if ((int)cfg.pattern < 0) {
+				usage();
+				exit(1);
+			}
+			break;
+		case 'p':
+			cfg.locates = atol(optarg);
+			break;
+		case 'S':
+			cfg.seed = strtoul(optarg, NULL, 0);
+			break;
+		case 'V':
+			printf("%s: version %s\n", progname, MHVTL_VERSION);
+			exit(0);
+		default:
+			usage();
+			exit(opt == 'h' ? 0 : 1);
+		}
+	}
+
+	if (!devices || optind < argc || cfg.blocks <= 0 || cfg.fm_every < 0 ||
+		cfg.locates < 0) {
+		usage();
+		exit(1);
+	}
+	if (!cfg.phases)
+		parse_workloads(def_workloads);
+	cfg.xfer_sz = cfg.blk_sz + (cfg.lbp > 0 ? LBP_LEN : 0);
+
+	for (i = 0; i < devices; i++)
+		setup(&dev[i]);
+
+	pthread_barrier_init(&barrier, NULL, devices);
+	for (i = 0; i < devices; i++) {
+		if (pthread_create(&dev[i].thread, NULL, run, &dev[i])) {
+			fprintf(stderr, "%s: Unable to create thread\n", progname);
+			exit(1);
+		}
+	}
+	for (i = 0; i < devices; i++)
+		pthread_join(dev[i].thread, NULL);
+	pthread_barrier_destroy(&barrier);
+
+	return report();
+}
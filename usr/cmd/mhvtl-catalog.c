@@ -0,0 +1,281 @@
+/*
+ * mhvtl-catalog -- List, query and rebuild the cartridge catalog
+ *
+ * Copyright (C) 2005 - 2025 Mark Harvey markh794 at gmail dot com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "vtl_common.h"
+#include "vtllib.h"
+#include "vtlcart.h"
+#include "logging.h"
+#include "mhvtl_catalog.h"
+#include "mhvtl_config.h"
+
+char mhvtl_driver_name[] = "mhvtl-catalog";
+
+static char *progname;
+
+static void usage(void) {
+	printf("Usage: %s [-l lib] [-m PCL] [-d PCL] [-r] [-D] [-V]\n", progname);
+	printf("  List the cartridges of every library from %s\n", catalog_path());
+	printf("      -l lib  -- only list library 'lib'\n");
+	printf("      -m PCL  -- describe one cartridge\n");
+	printf("      -d PCL  -- remove a cartridge from the catalog\n");
+	printf("      -r      -- rebuild the catalog from the library home directories\n");
+	printf("      -D      -- debug\n");
+	printf("      -V      -- print Version and exit\n");
+}
+
+static const char *medium_type_str(uint8_t type) {
+	switch (type) {
+	case MEDIA_TYPE_DATA:
+		return "Data";
+	case MEDIA_TYPE_WORM:
+		return "WORM";
+	case MEDIA_TYPE_NULL:
+		return "NULL";
+	case MEDIA_TYPE_CLEAN:
+		return "Clean";
+	}
+	return "?";
+}
+
+static char *time_str(uint64_t t, char *buf, size_t len) {
+	time_t	  tt = t;
+	struct tm tm;
+
+	if (!t || !localtime_r(&tt, &tm))
+		snprintf(buf, len, "-");
+	else
+		strftime(buf, len, "%Y-%m-%d %H:%M", &tm);
+	return buf;
+}
+
+static void density_str(const struct catalog_entry *e, char *buf) {
+	memcpy(buf, e->density, sizeof(e->density));
+	buf[sizeof(e->density)] = '\0';
+}
+
+static int print_entry(const struct catalog_entry *e, void *arg) {
+	long *libno = arg;
+	char  when[32], density[sizeof(e->density) + 1];
+
+	if (*libno && e->library != *libno)
+		return 0;
+
+	density_str(e, density);
+	printf("%-16s %4u  %-5s %-8s %10" PRIu64 " %10" PRIu64 " %4u %9u %6u  %-16s%s\n",
+		   e->pcl, e->library, medium_type_str(e->medium_type), density,
+		   e->used >> 20, e->capacity >> 20, e->partitions, e->filemarks,
+		   e->load_count, time_str(e->last_written, when, sizeof(when)),
+		   e->write_protect ? "  WP" : "");
+	return 0;
+}
+
+static void describe(const struct catalog_entry *e) {
+	char when[32], density[sizeof(e->density) + 1];
+
+	density_str(e, density);
+	printf("PCL             : %s\n", e->pcl);
+	printf("Library         : %u\n", e->library);
+	printf("Location        : %s/%s\n", e->home, e->pcl);
+	printf("Media type      : %s\n", medium_type_str(e->medium_type));
+	printf("Density         : %s\n", density);
+	printf("Capacity        : %" PRIu64 " MB\n", e->capacity >> 20);
+	printf("Used            : %" PRIu64 " MB\n", e->used >> 20);
+	printf("Partitions      : %u\n", e->partitions);
+	printf("Filemarks       : %u\n", e->filemarks);
+	printf("Load count      : %u\n", e->load_count);
+	printf("Write protected : %s\n", e->write_protect ? "Yes" : "No");
+	printf("Last written    : %s\n", time_str(e->last_written, when, sizeof(when)));
+	printf("Updated         : %s\n", time_str(e->updated, when, sizeof(when)));
+}
+
+/* Entries as they were before a rebuild, to keep their last written time */
+struct old_entries {
+	struct catalog_entry *e;
+	int					  count;
+	int					  alloc;
+};
+
+static int save_entry(const struct catalog_entry *e, void *arg) {
+	struct old_entries	 *old = arg;
+	struct catalog_entry *n;
+
+	if (old->count == old->alloc) {
+		n = realloc(old->e, (old->alloc + 256) * sizeof(*n));
+		if (!n)
+			return 1;
+		old->e = n;
+		old->alloc += 256;
+	}
+	old->e[old->count++] = *e;
+	return 0;
+}
+
+/* Newest index file - it is only written when data or filemarks are */
+static uint64_t indx_mtime(const char *dir, int partitions) {
+	char		path[HOME_DIR_PATH_SZ + 64];
+	struct stat st;
+	uint64_t	t = 0;
+
+	for (int j = 0; j < partitions && j < MAX_PARTITIONS; j++) {
+		snprintf(path, sizeof(path), "%s/indx.%d", dir, j);
+		if (!stat(path, &st) && (uint64_t)st.st_mtime > t)
+			t = st.st_mtime;
+	}
+	return t;
+}
+
+static int rebuild_library(const struct conf_device *lib, struct old_entries *old) {
+	char				 dir[HOME_DIR_PATH_SZ + MAX_BARCODE_LEN + 2];
+	char				 home[HOME_DIR_PATH_SZ + 1];
+	struct catalog_entry e;
+	struct dirent		*d;
+	struct MAM			 m;
+	uint64_t			 filemarks, used;
+	DIR					*dp;
+	int					 i, count = 0;
+
+	config_home(lib, home, sizeof(home));
+
+	dp = opendir(home);
+	if (!dp) {
+		fprintf(stderr, "Library %ld: cannot open %s: %s\n", lib->id, home,
+				strerror(errno));
+		return 0;
+	}
+	while ((d = readdir(dp)) != NULL) {
+		if (d->d_name[0] == '.' || strlen(d->d_name) > MAX_BARCODE_LEN)
+			continue;
+		snprintf(dir, sizeof(dir), "%s/%s", home, d->d_name);
+		if (read_cart_summary(dir, &m, &filemarks, &used))
+			continue;
+		/* Libraries sharing a home directory: first one listed wins */
+		if (!catalog_lookup(d->d_name, &e))
+			continue;
+
+		catalog_fill(&e, d->d_name, lib->id, home, &m, filemarks, used);
+		for (i = 0; i < old->count; i++)
+			if (!strcmp(old->e[i].pcl, e.pcl))
+				break;
+		if (i < old->count)
+			e.last_written = old->e[i].last_written;
+		else if (used)
+			e.last_written = indx_mtime(dir, m.num_partitions);
+		if (!catalog_update(&e))
+			count++;
+	}
+	closedir(dp);
+	printf("Library %ld: %d cartridges in %s\n", lib->id, count, home);
+	return count;
+}
+
+static int rebuild(void) {
+	const struct mhvtl_config *cfg;
+	const struct conf_device  *lib;
+	struct old_entries		   old	 = {NULL, 0, 0};
+	int						   count = 0;
+
+	cfg = config_load();
+	if (!cfg)
+		return 1;
+
+	catalog_walk(save_entry, &old);
+	if (unlink(catalog_path()) && errno != ENOENT) {
+		fprintf(stderr, "Cannot remove %s: %s\n", catalog_path(),
+				strerror(errno));
+		exit(1);
+	}
+
+	for_each_conf_device(cfg, lib)
+		if (lib->type == CONF_LIBRARY)
+			count += rebuild_library(lib, &old);
+	free(old.e);
+	printf("%d cartridges in %s\n", count, catalog_path());
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	struct catalog_entry e;
+	char				*pcl	= NULL;
+	char				*remove = NULL;
+	long				 libno	= 0;
+	int					 opt;
+
+	progname = argv[0];
+
+	while ((opt = getopt(argc, argv, "d:l:m:rDVh")) != -1) {
+		switch (opt) {
+		case 'd':
+			remove = optarg;
+			break;
+		case 'l':
+			libno = strtol(optarg, NULL, 10);
+			break;
+		case 'm':
+			pcl = optarg;
+			break;
+		case 'r':
+			return rebuild();
+		case 'D':
+			debug++;
+			break;
+		case 'V':
+			printf("%s: version %s\n", progname, MHVTL_VERSION);
+			exit(0);
+		case 'h':
+			usage();
+			exit(0);
+		default:
+			usage();
+			exit(1);
+		}
+	}
+
+	if (remove) {
+		if (catalog_remove(remove)) {
+			fprintf(stderr, "%s not in %s\n", remove, catalog_path());
+			exit(1);
+		}
+		return 0;
+	}
+
+	if (pcl) {
+		if (catalog_lookup(pcl, &e)) {
+			fprintf(stderr, "%s not in %s\n", pcl, catalog_path());
+			exit(1);
+		}
+		describe(&e);
+		return 0;
+	}
+
+	printf("%-16s %4s  %-5s %-8s %10s %10s %4s %9s %6s  %s\n",
+		   "PCL", "Lib", "Type", "Density", "Used MB", "Size MB",
+		   "Part", "Filemarks", "Loads", "Last written");
+	if (catalog_walk(print_entry, &libno) < 0) {
+		fprintf(stderr, "No catalog at %s - run '%s -r' to build it\n",
+				catalog_path(), progname);
+		exit(1);
+	}
+	return 0;
+}
@@ -0,0 +1,515 @@
+/*
+ * mhvtl-exporter - Serve the statistics of all running vtltape/vtllibrary
+ *		    daemons in OpenMetrics (Prometheus) text format
+ *
+ * Copyright (C) 2005 - 2025 Mark Harvey markh794 at gmail dot com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * The daemons publish their counters read-only in /dev/shm/mhvtl_stats.<id>
+ * (see mhvtl_stats.h). Each scrape maps every segment found, renders the
+ * metrics and unmaps them again - nothing is kept between requests.
+ */
+
+#define _FILE_OFFSET_BITS 64
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <getopt.h>
+#include <dirent.h>
+#include <inttypes.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "vtllib.h"
+#include "mhvtl_scsi.h"
+#include "mhvtl_stats.h"
+
+char mhvtl_driver_name[] = "mhvtl-exporter";
+
+#define DEFAULT_PORT 9661
+#define MAX_DEVICES	 1024
+
+static char *progname;
+
+static const char *state_name[] = {
+	[MHVTL_STATE_INIT]					= "init",
+	[MHVTL_STATE_IDLE]					= "idle",
+	[MHVTL_STATE_UNLOADED]				= "unloaded",
+	[MHVTL_STATE_LOADING]				= "loading",
+	[MHVTL_STATE_LOADING_CLEAN]			= "loading_clean",
+	[MHVTL_STATE_LOADING_WORM]			= "loading_worm",
+	[MHVTL_STATE_LOADED]				= "loaded",
+	[MHVTL_STATE_LOADED_IDLE]			= "loaded_idle",
+	[MHVTL_STATE_LOAD_FAILED]			= "load_failed",
+	[MHVTL_STATE_REWIND]				= "rewind",
+	[MHVTL_STATE_POSITIONING]			= "positioning",
+	[MHVTL_STATE_LOCATE]				= "locate",
+	[MHVTL_STATE_READING]				= "reading",
+	[MHVTL_STATE_WRITING]				= "writing",
+	[MHVTL_STATE_UNLOADING]				= "unloading",
+	[MHVTL_STATE_ERASE]					= "erase",
+	[MHVTL_STATE_VERIFY]				= "verify",
+	[MHVTL_STATE_MOVING_DRIVE_2_SLOT]	= "moving_drive_to_slot",
+	[MHVTL_STATE_MOVING_SLOT_2_DRIVE]	= "moving_slot_to_drive",
+	[MHVTL_STATE_MOVING_DRIVE_2_MAP]	= "moving_drive_to_map",
+	[MHVTL_STATE_MOVING_MAP_2_DRIVE]	= "moving_map_to_drive",
+	[MHVTL_STATE_MOVING_SLOT_2_MAP]		= "moving_slot_to_map",
+	[MHVTL_STATE_MOVING_MAP_2_SLOT]		= "moving_map_to_slot",
+	[MHVTL_STATE_MOVING_DRIVE_2_DRIVE]	= "moving_drive_to_drive",
+	[MHVTL_STATE_MOVING_SLOT_2_SLOT]	= "moving_slot_to_slot",
+	[MHVTL_STATE_OPENING_MAP]			= "opening_map",
+	[MHVTL_STATE_CLOSING_MAP]			= "closing_map",
+	[MHVTL_STATE_INVENTORY]				= "inventory",
+	[MHVTL_STATE_INITIALISE_ELEMENTS]	= "initialise_elements",
+	[MHVTL_STATE_ONLINE]				= "online",
+	[MHVTL_STATE_OFFLINE]				= "offline",
+	[MHVTL_STATE_UNKNOWN]				= "unknown",
+};
+
+#define STATE_COUNT (int)(sizeof(state_name) / sizeof(state_name[0]))
+
+struct device {
+	long					  id;
+	const struct mhvtl_stats *st;
+};
+
+static void usage(void) {
+	fprintf(stderr, "Usage: %s [-p port] [-b address] [-u socket]\n", progname);
+	fprintf(stderr, "  -p port     TCP port to listen on (default %d)\n",
+			DEFAULT_PORT);
+	fprintf(stderr, "  -b address  IPv4 address to bind to (default 127.0.0.1)\n");
+	fprintf(stderr, "  -u socket   Listen on a Unix domain socket instead\n");
+	fprintf(stderr, "  -V          Print version and exit\n");
+	fprintf(stderr, "Metrics are served as HTTP GET /metrics\n");
+}
+
+static int cmp_device(const void *a, const void *b) {
+	const struct device *da = a;
+	const struct device *db = b;
+
+	return (da->id > db->id) - (da->id < db->id);
+}
+
+/*
+ * Map the statistics of every running daemon, sorted by device id.
+ * Segments left behind by a daemon which did not exit cleanly are skipped.
+ */
+static int open_devices(struct device *dev, int max) {
+	struct dirent *d;
+	DIR			  *dir;
+	char		  *end;
+	int			   n = 0;
+
+	dir = opendir("/dev/shm");
+	if (!dir)
+		return 0;
+
+	while ((d = readdir(dir)) && n < max) {
+		const struct mhvtl_stats *st;
+		long					  id;
+
+		if (strncmp(d->d_name, "mhvtl_stats.", 12))
+			continue;
+		id = strtol(d->d_name + 12, &end, 10);
+		if (*end || end == d->d_name + 12)
+			continue;
+
+		st = stats_open(id);
+		if (!st)
+			continue;
+		if (kill(st->pid, 0) && errno == ESRCH) {
+			stats_close(st);
+			continue;
+		}
+		dev[n].id = id;
+		dev[n].st = st;
+		n++;
+	}
+	closedir(dir);
+
+	qsort(dev, n, sizeof(struct device), cmp_device);
+	return n;
+}
+
+static void print_hist(FILE *f, const char *name, const char *labels,
+					   const struct stats_hist *h) {
+	uint64_t cum = 0;
+	int		 b;
+
+	for (b = 0; b < STATS_HIST_BUCKETS - 1; b++) {
+		cum += h->bucket[b];
+		fprintf(f, "%s_bucket{%s,le=\"%g\"} %" PRIu64 "\n",
+				name, labels, (double)(1ull << b) / 1e6, cum);
+	}
+	cum += h->bucket[b];
+	fprintf(f, "%s_bucket{%s,le=\"+Inf\"} %" PRIu64 "\n", name, labels, cum);
+	fprintf(f, "%s_count{%s} %" PRIu64 "\n", name, labels, cum);
+	fprintf(f, "%s_sum{%s} %.6f\n", name, labels, (double)h->sum_us / 1e6);
+}
+
+static void hist_merge(struct stats_hist *to, const struct stats_hist *from) {
+	int b;
+
+	to->count += from->count;
+	to->sum_us += from->sum_us;
+	if (from->max_us > to->max_us)
+		to->max_us = from->max_us;
+	for (b = 0; b < STATS_HIST_BUCKETS; b++)
+		to->bucket[b] += from->bucket[b];
+}
+
+static int is_tape(struct device *d) {
+	return d->st->lu_type == STATS_LU_TAPE;
+}
+
+static void render(FILE *f, struct device *dev, int n) {
+	struct stats_hist moves;
+	char			  labels[128];
+	char			  pcl[24];
+	int				  i, j;
+
+	fprintf(f, "# TYPE mhvtl_device info\n"
+			   "# HELP mhvtl_device Running vtltape/vtllibrary daemons\n");
+	for (i = 0; i < n; i++)
+		fprintf(f, "mhvtl_device_info{device=\"%ld\",type=\"%s\"} 1\n",
+				dev[i].id, is_tape(&dev[i]) ? "tape" : "library");
+
+	fprintf(f, "# TYPE mhvtl_start_time_seconds gauge\n"
+			   "# UNIT mhvtl_start_time_seconds seconds\n");
+	for (i = 0; i < n; i++)
+		fprintf(f, "mhvtl_start_time_seconds{device=\"%ld\"} %" PRIu64 "\n",
+				dev[i].id, dev[i].st->start_time);
+
+	fprintf(f, "# TYPE mhvtl_state stateset\n"
+			   "# HELP mhvtl_state Current device state\n");
+	for (i = 0; i < n; i++) {
+		uint32_t state = dev[i].st->state;
+
+		for (j = 0; j < STATE_COUNT; j++)
+			fprintf(f, "mhvtl_state{device=\"%ld\",mhvtl_state=\"%s\"} %d\n",
+					dev[i].id, state_name[j], state == (uint32_t)j);
+	}
+
+	fprintf(f, "# TYPE mhvtl_media info\n"
+			   "# HELP mhvtl_media Barcode of the media loaded in a drive\n");
+	for (i = 0; i < n; i++) {
+		if (!is_tape(&dev[i]))
+			continue;
+		if (stats_read_media(dev[i].st, pcl, sizeof(pcl)) == 0 && pcl[0])
+			fprintf(f, "mhvtl_media_info{device=\"%ld\",pcl=\"%s\"} 1\n",
+					dev[i].id, pcl);
+	}
+
+	fprintf(f, "# TYPE mhvtl_initiator_bytes counter\n"
+			   "# UNIT mhvtl_initiator_bytes bytes\n"
+			   "# HELP mhvtl_initiator_bytes Data transferred with the initiator\n");
+	for (i = 0; i < n; i++) {
+		fprintf(f, "mhvtl_initiator_bytes_total{device=\"%ld\",direction=\"in\"} %" PRIu64 "\n",
+				dev[i].id, dev[i].st->bytes_in);
+		fprintf(f, "mhvtl_initiator_bytes_total{device=\"%ld\",direction=\"out\"} %" PRIu64 "\n",
+				dev[i].id, dev[i].st->bytes_out);
+	}
+
+	fprintf(f, "# TYPE mhvtl_drive_bytes counter\n"
+			   "# UNIT mhvtl_drive_bytes bytes\n"
+			   "# HELP mhvtl_drive_bytes Tape data before (initiator) and after (media) compression\n");
+	for (i = 0; i < n; i++) {
+		const struct mhvtl_stats *st = dev[i].st;
+
+		if (!is_tape(&dev[i]))
+			continue;
+		fprintf(f, "mhvtl_drive_bytes_total{device=\"%ld\",op=\"read\",side=\"initiator\"} %" PRIu64 "\n"
+				   "mhvtl_drive_bytes_total{device=\"%ld\",op=\"read\",side=\"media\"} %" PRIu64 "\n"
+				   "mhvtl_drive_bytes_total{device=\"%ld\",op=\"write\",side=\"initiator\"} %" PRIu64 "\n"
+				   "mhvtl_drive_bytes_total{device=\"%ld\",op=\"write\",side=\"media\"} %" PRIu64 "\n",
+				dev[i].id, st->read_i, dev[i].id, st->read_m,
+				dev[i].id, st->written_i, dev[i].id, st->written_m);
+	}
+
+	fprintf(f, "# TYPE mhvtl_drive_compression_ratio gauge\n"
+			   "# HELP mhvtl_drive_compression_ratio Initiator bytes per media byte\n");
+	for (i = 0; i < n; i++) {
+		const struct mhvtl_stats *st = dev[i].st;
+
+		if (!is_tape(&dev[i]))
+			continue;
+		if (st->read_m)
+			fprintf(f, "mhvtl_drive_compression_ratio{device=\"%ld\",op=\"read\"} %.3f\n",
+					dev[i].id, (double)st->read_i / st->read_m);
+		if (st->written_m)
+			fprintf(f, "mhvtl_drive_compression_ratio{device=\"%ld\",op=\"write\"} %.3f\n",
+					dev[i].id, (double)st->written_i / st->written_m);
+	}
+
+	fprintf(f, "# TYPE mhvtl_tapealert gauge\n"
+			   "# HELP mhvtl_tapealert TapeAlert flags currently set\n");
+	for (i = 0; i < n; i++) {
+		uint64_t flags = dev[i].st->tapealert;
+
+		for (j = 0; j < 64; j++)
+			if (flags & (1ull << j))
+				fprintf(f, "mhvtl_tapealert{device=\"%ld\",flag=\"%d\"} 1\n",
+						dev[i].id, j + 1);
+	}
+
+	fprintf(f, "# TYPE mhvtl_command_latency_seconds histogram\n"
+			   "# UNIT mhvtl_command_latency_seconds seconds\n"
+			   "# HELP mhvtl_command_latency_seconds SCSI command service time\n");
+	for (i = 0; i < n; i++)
+		for (j = 0; j < 256; j++) {
+			if (!dev[i].st->op[j].latency.count)
+				continue;
+			snprintf(labels, sizeof(labels),
+					 "device=\"%ld\",opcode=\"0x%02x\",command=\"%s\"",
+					 dev[i].id, j, stats_opcode_name(j));
+			print_hist(f, "mhvtl_command_latency_seconds", labels,
+					   &dev[i].st->op[j].latency);
+		}
+
+	fprintf(f, "# TYPE mhvtl_command_errors counter\n"
+			   "# HELP mhvtl_command_errors Commands completed with CHECK CONDITION\n");
+	for (i = 0; i < n; i++)
+		for (j = 0; j < 256; j++) {
+			if (!dev[i].st->op[j].latency.count)
+				continue;
+			fprintf(f, "mhvtl_command_errors_total{device=\"%ld\",opcode=\"0x%02x\",command=\"%s\"} %" PRIu64 "\n",
+					dev[i].id, j, stats_opcode_name(j), dev[i].st->op[j].errors);
+		}
+
+	fprintf(f, "# TYPE mhvtl_phase_latency_seconds histogram\n"
+			   "# UNIT mhvtl_phase_latency_seconds seconds\n"
+			   "# HELP mhvtl_phase_latency_seconds Time spent in each phase of command processing\n");
+	for (i = 0; i < n; i++)
+		for (j = 0; j < STATS_PHASES; j++) {
+			if (!dev[i].st->phase[j].count)
+				continue;
+			snprintf(labels, sizeof(labels), "device=\"%ld\",phase=\"%s\"",
+					 dev[i].id, stats_phase_name(j));
+			print_hist(f, "mhvtl_phase_latency_seconds", labels,
+					   &dev[i].st->phase[j]);
+		}
+
+	/* MOVE MEDIUM and EXCHANGE MEDIUM both move cartridges */
+	fprintf(f, "# TYPE mhvtl_library_moves counter\n"
+			   "# HELP mhvtl_library_moves Media movement commands\n");
+	for (i = 0; i < n; i++) {
+		const struct mhvtl_stats *st = dev[i].st;
+
+		if (is_tape(&dev[i]))
+			continue;
+		fprintf(f, "mhvtl_library_moves_total{device=\"%ld\"} %" PRIu64 "\n",
+				dev[i].id, st->op[MOVE_MEDIUM].latency.count +
+							   st->op[EXCHANGE_MEDIUM].latency.count);
+	}
+
+	fprintf(f, "# TYPE mhvtl_library_move_latency_seconds histogram\n"
+			   "# UNIT mhvtl_library_move_latency_seconds seconds\n");
+	for (i = 0; i < n; i++) {
+		const struct mhvtl_stats *st = dev[i].st;
+
+		if (is_tape(&dev[i]))
+			continue;
+		memset(&moves, 0, sizeof(moves));
+		hist_merge(&moves, &st->op[MOVE_MEDIUM].latency);
+		hist_merge(&moves, &st->op[EXCHANGE_MEDIUM].latency);
+		snprintf(labels, sizeof(labels), "device=\"%ld\"", dev[i].id);
+		print_hist(f, "mhvtl_library_move_latency_seconds", labels, &moves);
+	}
+
+	fprintf(f, "# EOF\n");
+}
+
+static void send_all(int fd, const char *buf, size_t len) {
+	ssize_t ret;
+
+	while (len) {
+		ret = write(fd, buf, len);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return;
+		buf += ret;
+		len -= ret;
+	}
+}
+
+static void reply(int fd, const char *status, const char *type,
+				  const char *body, size_t len) {
+	char hdr[256];
+	int	 n;
+
+	n = snprintf(hdr, sizeof(hdr),
+				 "HTTP/1.0 %s\r\n"
+				 "Content-Type: %s\r\n"
+				 "Content-Length: %zu\r\n"
+				 "Connection: close\r\n\r\n",
+				 status, type, len);
+	send_all(fd, hdr, n);
+	send_all(fd, body, len);
+}
+
+static void serve(int fd) {
+	struct device dev[MAX_DEVICES];
+	char		  req[1024];
+	char		 *body;
+	size_t		  len = 0;
+	ssize_t		  ret;
+	FILE		 *f;
+	int			  n, i;
+
+	/* Only the request line matters - headers are ignored */
+	ret = read(fd, req, sizeof(req) - 1);
+	if (ret <= 0)
+		return;
+	req[ret] = '\0';
+
+	if (strncmp(req, "GET ", 4)) {
+		reply(fd, "405 Method Not Allowed", "text/plain", "", 0);
+		return;
+	}
+	if (strncmp(req + 4, "/metrics ", 9) && strncmp(req + 4, "/metrics?", 9) &&
+		strncmp(req + 4, "/ ", 2)) {
+		reply(fd, "404 Not Found", "text/plain", "Try /metrics\n", 13);
+		return;
+	}
+
+	f = open_memstream(&body, &len);
+	if (!f) {
+		reply(fd, "500 Internal Server Error", "text/plain", "", 0);
+		return;
+	}
+	n = open_devices(dev, MAX_DEVICES);
+	render(f, dev, n);
+	for (i = 0; i < n; i++)
+		stats_close(dev[i].st);
+	fclose(f);
+
+	reply(fd, "200 OK",
+		  "application/openmetrics-text; version=1.0.0; charset=utf-8",
+		  body, len);
+	free(body);
+}
+
+static int listen_tcp(const char *addr, int port) {
+	struct sockaddr_in sin;
+	int				   fd, on = 1;
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_port   = htons(port);
+	if (inet_pton(AF_INET, addr, &sin.sin_addr) != 1) {
+		fprintf(stderr, "Invalid address: %s\n", addr);
+		return -1;
+	}
+
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) {
+		perror("socket");
+		return -1;
+	}
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	if (bind(fd, (struct sockaddr *)&sin, sizeof(sin)) || listen(fd, 16)) {
+		fprintf(stderr, "Unable to listen on %s:%d: %s\n", addr, port,
+				strerror(errno));
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static int listen_unix(const char *path) {
+	struct sockaddr_un sun;
+	int				   fd;
+
+	if (strlen(path) >= sizeof(sun.sun_path)) {
+		fprintf(stderr, "Socket path too long: %s\n", path);
+		return -1;
+	}
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	strcpy(sun.sun_path, path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		perror("socket");
+		return -1;
+	}
+	unlink(path);
+	if (bind(fd, (struct sockaddr *)&sun, sizeof(sun)) || listen(fd, 16)) {
+		fprintf(stderr, "Unable to listen on %s: %s\n", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+int main(int argc, char *argv[]) {
+	struct timeval tv	= {.tv_sec = 5};
+	char		  *addr = "127.0.0.1";
+	char		  *path = NULL;
+	int			   port = DEFAULT_PORT;
+	int			   opt, fd, cfd;
+
+	progname = argv[0];
+
+	while ((opt = getopt(argc, argv, "p:b:u:Vh")) != -1) {
+		switch (opt) {
+		case 'p':
+			port = atoi(optarg);
+			if (port <= 0 || port > 65535) {
+				fprintf(stderr, "Invalid port: %s\n", optarg);
+				exit(1);
+			}
+			break;
+		case 'b':
+			addr = optarg;
+			break;
+		case 'u':
+			path = optarg;
+			break;
+		case 'V':
+			printf("%s: version %s\n", progname, MHVTL_VERSION);
+			exit(0);
+		default:
+			usage();
+			exit(opt == 'h' ? 0 : 1);
+		}
+	}
+
+	fd = path ? listen_unix(path) : listen_tcp(addr, port);
+	if (fd < 0)
+		exit(1);
+
+	signal(SIGPIPE, SIG_IGN);
+
+	for (;;) {
+		cfd = accept(fd, NULL, NULL);
+		if (cfd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			perror("accept");
+			exit(1);
+		}
+		/* Scrapes are served one at a time; don't let a stalled client block others */
+		setsockopt(cfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+		setsockopt(cfd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+		serve(cfd);
+		close(cfd);
+	}
+}
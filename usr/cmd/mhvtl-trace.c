@@ -0,0 +1,178 @@
+/*
+ * mhvtl-trace - Decode the binary trace ring of a vtltape/vtllibrary daemon,
+ *		 or a flight recorder dump of it
+ *
+ * Copyright (C) 2005 - 2025 Mark Harvey markh794 at gmail dot com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#define _FILE_OFFSET_BITS 64
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <time.h>
+#include "vtllib.h"
+#include "vtlcart.h"
+#include "mhvtl_stats.h"
+#include "mhvtl_trace.h"
+
+char mhvtl_driver_name[] = "mhvtl-trace";
+
+static char *progname;
+
+static void usage(void) {
+	fprintf(stderr, "Usage: %s [-n count] <DeviceNo>\n", progname);
+	fprintf(stderr, "       %s [-n count] -f dump-file\n", progname);
+	fprintf(stderr, "  -n count  Only show the last 'count' records\n");
+	fprintf(stderr, "  -f file   Decode a flight recorder dump"
+					" (/var/tmp/mhvtl_trace.<id>.dump)\n");
+	fprintf(stderr, "  -V        Print version and exit\n");
+}
+
+static const char *block_type(uint32_t type) {
+	switch (type) {
+	case B_DATA:
+		return "DATA";
+	case B_FILEMARK:
+		return "FILEMARK";
+	case B_EOD:
+		return "EOD";
+	case B_NOOP:
+		return "NOOP";
+	}
+	return "unknown";
+}
+
+static void print_rec(const struct mhvtl_trace *t, const struct trace_rec *r,
+					  uint64_t prev) {
+	uint64_t  wall = t->wall_base + (r->ts - t->mono_base);
+	time_t	  secs = wall / 1000000000;
+	struct tm tm;
+	char	  when[32];
+
+	localtime_r(&secs, &tm);
+	strftime(when, sizeof(when), "%H:%M:%S", &tm);
+
+	printf("%s.%06u %+9.1fus sn %-8" PRIu64 " %-24s %-12s ",
+		   when, (unsigned)(wall % 1000000000 / 1000),
+		   prev ? (double)(r->ts - prev) / 1000 : 0.0, r->serial,
+		   r->serial ? stats_opcode_name(r->opcode) : "-",
+		   trace_event_name(r->event));
+
+	switch (r->event) {
+	case TRACE_CMD_START:
+		printf("opcode 0x%02x", r->opcode);
+		break;
+	case TRACE_CMD_END:
+		printf("status 0x%02x, %u bytes, %u us", r->arg, r->size, r->extra);
+		break;
+	case TRACE_SENSE:
+		printf("[Key/ASC/ASCQ] [%02x %02x %02x]", r->extra >> 16,
+			   (r->extra >> 8) & 0xff, r->extra & 0xff);
+		break;
+	case TRACE_READ_REQ:
+		printf("partition/block %u/%" PRIu64 ", %u bytes, SILI: %u, LBP method: %u",
+			   r->arg, r->block, r->size, r->extra & 1, r->extra >> 1);
+		break;
+	case TRACE_READ_HDR:
+		printf("partition/block %u/%" PRIu64 " at offset %" PRIu64 ", type: %s, size: %u",
+			   r->arg, r->block, r->offset, block_type(r->extra), r->size);
+		break;
+	case TRACE_READ_DATA:
+		printf("partition/block %u/%" PRIu64 " at offset %" PRIu64 ", %u bytes from media",
+			   r->arg, r->block, r->offset, r->size);
+		break;
+	case TRACE_WRITE_BLK:
+		printf("partition/block %u/%" PRIu64 " at offset %" PRIu64 ", size: %u, on media: %u",
+			   r->arg, r->block, r->offset, r->size, r->extra);
+		break;
+	case TRACE_FILEMARK:
+		printf("partition/block %u/%" PRIu64 ", count: %u",
+			   r->arg, r->block, r->size);
+		break;
+	}
+	printf("\n");
+}
+
+int main(int argc, char *argv[]) {
+	const struct mhvtl_trace *t;
+	struct trace_rec		 *rec;
+	char					  dump[64];
+	char					 *file	= NULL;
+	long					  count = 0;
+	long					  id;
+	int						  opt, n, i;
+
+	progname = argv[0];
+
+	while ((opt = getopt(argc, argv, "n:f:Vh")) != -1) {
+		switch (opt) {
+		case 'n':
+			count = atol(optarg);
+			break;
+		case 'f':
+			file = optarg;
+			break;
+		case 'V':
+			printf("%s: version %s\n", progname, MHVTL_VERSION);
+			exit(0);
+		default:
+			usage();
+			exit(opt == 'h' ? 0 : 1);
+		}
+	}
+
+	if (file) {
+		t = trace_load(file);
+	} else {
+		if (optind >= argc) {
+			usage();
+			exit(1);
+		}
+		id = strtol(argv[optind], NULL, 10);
+		t  = trace_open(id);
+		if (!t) {
+			/* Daemon gone - fall back to its last dump */
+			snprintf(dump, sizeof(dump), TRACE_DUMP_NAME, id);
+			file = dump;
+			t	 = trace_load(file);
+		}
+	}
+	if (!t) {
+		fprintf(stderr, "No trace %s%s: %s\n", file ? "in " : "for device ",
+				file ? file : argv[optind], strerror(errno));
+		exit(1);
+	}
+
+	rec = malloc(sizeof(struct trace_rec) * TRACE_RECORDS);
+	if (!rec) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+	n = trace_read(t, rec);
+
+	printf("Device: %ld, pid: %u, %" PRIu64 " records written, %d held%s%s\n",
+		   (long)t->lu_id, t->pid, t->head, n,
+		   file ? ", dump reason: " : "", file ? t->reason : "");
+
+	for (i = (count && count < n) ? n - count : 0; i < n; i++)
+		print_rec(t, &rec[i], i ? rec[i - 1].ts : 0);
+
+	free(rec);
+	trace_close(t);
+	return 0;
+}
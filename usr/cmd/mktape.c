@@ -9,9 +9,11 @@
 #include <string.h>
 #include <time.h>
 #include <inttypes.h>
+#include <errno.h>
 #include "be_byteshift.h"
 #include "vtlcart.h"
 #include "vtllib.h"
+#include "mhvtl_catalog.h"
 
 #if defined _LARGEFILE64_SOURCE
 static void *largefile_support = "large file support";
@@ -19,6 +21,8 @@ static void *largefile_support = "large file support";
 static void *largefile_support = "No largefile support";
 #endif
 
+#define MAX_SEGMENT_MB (1024 * 1024) /* -S: 1 TiB segments at most */
+
 /* The following variables are needed for the MHVTL_DBG() macro to work. */
 
 char mhvtl_driver_name[] = "mktape";
@@ -34,6 +38,8 @@ static void usage(char *progname) {
 		   MHVTL_CONFIG_PATH);
 	printf("      -H home-dir   -- override default home dir [ %s ]\n",
 		   MHVTL_HOME_PATH);
+	printf("      -S seg-size   -- split the data into segment files of seg-size Megabytes (1 - %d)\n",
+		   MAX_SEGMENT_MB);
 	printf("And REQUIRED-PARAMS are:\n");
 	printf("      -l lib      -- set Library number\n");
 	printf("      -m PCL      -- set Physical Cartrige Label (barcode)\n");
@@ -53,14 +59,6 @@ static void usage(char *progname) {
 	printf("\n");
 }
 
-int gettime() {
-	const char *source_date_epoch = getenv("SOURCE_DATE_EPOCH");
-	time_t		t;
-	if (source_date_epoch == NULL || (t = (time_t)strtoll(source_date_epoch, NULL, 10)) <= 0)
-		t = time(NULL);
-	return t;
-}
-
 int main(int argc, char *argv[]) {
 	unsigned char sam_stat;
 	char		 *progname		= argv[0];
@@ -75,9 +73,9 @@ int main(int argc, char *argv[]) {
 	int			  res;
 	char		 *param_config_dir = NULL;
 	char		 *param_home_dir   = NULL;
-	char		  ver[64];
-	int			  major, minor;
-	int			  ret;
+	int			  medium_type;
+	unsigned long segment_mb;
+	char		 *end;
 
 	if (argc < 2) {
 		fprintf(stderr, "error: not enough arguments\n");
@@ -85,7 +83,7 @@ int main(int argc, char *argv[]) {
 		exit(1);
 	}
 
-	while ((opt = getopt(argc, argv, "d:l:m:s:t:VvD::hC:H:")) != -1) {
+	while ((opt = getopt(argc, argv, "d:l:m:s:S:t:VvD::hC:H:")) != -1) {
 		switch (opt) {
 		case 'h':
 			usage(progname);
@@ -102,6 +100,18 @@ int main(int argc, char *argv[]) {
 		case 's':
 			mediaCapacity = strdup(optarg);
 			break;
+		case 'S':
+			errno	   = 0;
+			segment_mb = strtoul(optarg, &end, 0);
+			if (errno || end == optarg || *end || optarg[0] == '-' ||
+				segment_mb < 1 || segment_mb > MAX_SEGMENT_MB) {
+				fprintf(stderr, "error: segment size must be 1 - %d Megabytes\n",
+						MAX_SEGMENT_MB);
+				usage(progname);
+				exit(1);
+			}
+			cart_set_segment_size(segment_mb);
+			break;
 		case 't':
 			mediaType = strdup(optarg);
 			break;
@@ -168,12 +178,6 @@ int main(int argc, char *argv[]) {
 		exit(1);
 	}
 
-	ret = sscanf(MHVTL_VERSION, "%d.%d", &major, &minor);
-	sprintf(ver, "vtl-%d.%d      ", major, minor);
-	if (ret != 2) {
-		printf("Warning: Attempting to retrieve version string from %s failed\n", MHVTL_VERSION);
-	}
-
 	if (param_home_dir)
 		strncpy(home_directory, param_home_dir, HOME_DIR_PATH_SZ);
 	else
@@ -185,55 +189,39 @@ int main(int argc, char *argv[]) {
 		exit(1);
 	}
 
-	/* Initialize the contents of the MAM to be used for the new PCL. */
-	init_mam(&mam);
-
-	mam.tape_fmt_version = TAPE_FMT_VERSION;
-	mam.mam_fmt_version	 = MAM_VERSION;
+	if (!strncmp("clean", mediaType, 5))
+		medium_type = MEDIA_TYPE_CLEAN; /* Cleaning cart */
+	else if (!strncmp("NULL", mediaType, 4))
+		medium_type = MEDIA_TYPE_NULL; /* save metadata only */
+	else if (!strncmp("WORM", mediaType, 4))
+		medium_type = MEDIA_TYPE_WORM; /* WORM cart */
+	else
+		medium_type = MEDIA_TYPE_DATA; /* Normal data cart */
 
-	/* A size of zero leaves the capacity to set_media_params(), which fills in
-	 * whatever the media type natively holds.
-	 */
-	put_unaligned_be64(size * 1048576, &mam.max_capacity);
-	put_unaligned_be64(size * 1048576, &mam.remaining_capacity);
-
-	memcpy(&mam.MediumManufacturer, "linuxVTL", 8);
-	memcpy(&mam.ApplicationVendor, &ver, 8);
-	sprintf((char *)mam.ApplicationVersion, "%d", TAPE_FMT_VERSION);
-
-	if (!strncmp("clean", mediaType, 5)) {
-		mam.MediumType			  = MEDIA_TYPE_CLEAN; /* Cleaning cart */
-		mam.MediumTypeInformation = 20;				  /* Max cleaning loads */
-	} else if (!strncmp("NULL", mediaType, 4)) {
-		mam.MediumType = MEDIA_TYPE_NULL; /* save metadata only */
-	} else if (!strncmp("WORM", mediaType, 4)) {
-		mam.MediumType = MEDIA_TYPE_WORM; /* WORM cart */
-	} else {
-		mam.MediumType = MEDIA_TYPE_DATA; /* Normal data cart */
-	}
-	/* Without a recognised density there is no media type, and so no capacity
+	/* Initialize the contents of the MAM to be used for the new PCL.
+	 * Without a recognised density there is no media type, and so no capacity
 	 * to give the cartridge - refuse rather than write out unusable media.
 	 */
-	if (set_media_params(&mam, density)) {
+	if (init_new_mam(&mam, pcl, medium_type, density, size)) {
 		fprintf(stderr, "error: '%s' is not a density this build knows\n",
 				density);
 		exit(1);
 	}
 
-	/* Space left in the cartridge memory, being what the attributes stored in
-	 * it do not already take up.
-	 */
-	mam_space_remaining(&mam);
-
-	sprintf((char *)mam.MediumSerialNumber, "%s_%d", pcl, (int)gettime());
-	sprintf((char *)mam.MediumManufactureDate, "%d", (int)gettime());
-	sprintf((char *)mam.Barcode, "%-31s", pcl);
-
 	/* Create the PCL using the initialized MAM. */
 
 	if (verbose)
 		printf("Creating tape data ...\n");
 	res = create_tape(pcl, &sam_stat);
+	if (!res) {
+		struct catalog_entry e;
+
+		catalog_fill(&e, pcl, libno,
+					 strlen(home_directory) ? home_directory : MHVTL_HOME_PATH,
+					 &mam, 0, 0);
+		e.partitions = 1; /* Until it is formatted */
+		catalog_update(&e);
+	}
 
 	exit(res);
 }
@@ -28,6 +28,12 @@
 #include <fcntl.h>
 #include <string.h>
 #include <inttypes.h>
+#include <stdarg.h>
+#include <time.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 #include <zlib.h>
 #include "minilzo.h"
 #include "be_byteshift.h"
@@ -36,12 +42,16 @@
 #include "vtl_common.h"
 #include "vtllib.h"
 #include "vtlcart.h"
+#include "mhvtl_catalog.h"
+#include "mhvtl_config.h"
 #include "q.h"
 #include "ssc.h"
 
 #define MEDIA_WRITABLE 0
 #define MEDIA_READONLY 1
 
+#define MAX_BULK_PCL 1024 /* -m given for bulk export */
+
 char	   mhvtl_driver_name[] = "tape_util";
 static int dump_tape		   = 0; /* dual personality - dump_tape & preload_tape */
 
@@ -389,13 +399,22 @@ static void usage(char *errmsg) {
 	if (dump_tape == 1) {
 		printf("  -D               Dump data\n");
 		printf("  -l lib_no        Look in specified library\n");
-		printf("  -m pcl           Look for specified PCL\n");
+		printf("  -m pcl           Look for specified PCL (repeat for -E, -S)\n");
+		printf("  -E <dir>         Export each tape file to <dir>/PCL/NNNNN\n");
+		printf("                   (all PCLs in library -l if no -m)\n");
+		printf("  -S               Scrub: read back and verify every block and the\n");
+		printf("                   index (all PCLs in library -l if no -m)\n");
+		printf("  -r <MB/s>        Scrub rate limit per cartridge\n");
+		printf("  -j <jobs>        Cartridges exported or scrubbed in parallel\n");
 	} else if (dump_tape == 2) {
 		printf("  -l lib_no        Look in specified library\n");
 		printf("  -m pcl           Look for specified PCL\n");
 		printf("  -b <block size>  tape block size\n");
 		printf("  -c <compression> Compression type (NONE|LZO|ZLIB)\n");
 		printf("  -F <inputfile>   Filename to read data from\n");
+		printf("  -I <dir>         Import each file, directory or .tar in <dir>\n");
+		printf("                   to the PCL of that name\n");
+		printf("  -j <jobs>        Cartridges imported in parallel\n");
 	} else {
 		printf("\n\nNot sure of my personality (dump_tape or preload_tape)\n");
 	}
@@ -431,20 +450,916 @@ static void dump_tape_metadata(int dump_data, uint8_t *sam_stat) {
 	print_raw_header();
 }
 
+/*
+ * Bulk import / export
+ *
+ * Each cartridge is handled by a child process of its own - the cartridge
+ * code keeps the loaded tape in globals - with up to 'jobs' running at
+ * once. Within a cartridge a second thread moves data between the files
+ * and a small ring of buffers, so file I/O overlaps with compression and
+ * cartridge I/O on the main thread.
+ */
+
+#define BULK_RING 8 /* Buffers between the file side and the cartridge side */
+#define TAR_BLOCK 512
+
+enum chunk_type {
+	CHUNK_DATA,
+	CHUNK_FILEMARK,
+	CHUNK_END,
+};
+
+struct bulk_chunk {
+	uint8_t		   *data;
+	uint32_t		size; /* Allocated */
+	uint32_t		len;
+	int				partition;
+	enum chunk_type type;
+};
+
+struct bulk_ring {
+	pthread_mutex_t	  lock;
+	pthread_cond_t	  cond;
+	struct bulk_chunk chunk[BULK_RING];
+	unsigned int	  head; /* Next to fill */
+	unsigned int	  tail; /* Next to drain */
+	int				  abort;
+};
+
+enum bulk_source {
+	SRC_FILE, /* PCL     - one tape file */
+	SRC_DIR,  /* PCL/    - a tape file per regular file, in name order */
+	SRC_TAR,  /* PCL.tar - a tape file per regular member, in archive order */
+};
+
+enum bulk_op {
+	BULK_IMPORT,
+	BULK_EXPORT,
+	BULK_SCRUB,
+};
+
+struct bulk_job {
+	char			 pcl[MAX_BARCODE_LEN + 1];
+	char			 path[1024]; /* Import source or export destination */
+	enum bulk_op	 op;
+	enum bulk_source source;
+	uint32_t		 block_size;
+	uint32_t		 rate; /* Scrub MB/s, 0 = unlimited */
+	struct bulk_ring ring;
+};
+
+/* Sent up a pipe from each child to the parent */
+struct bulk_result {
+	int		 rc;
+	uint64_t bytes;
+	uint64_t files;
+	uint64_t ns;
+	char	 error[200];
+};
+
+static struct bulk_result result;
+
+static void bulk_error(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+static void bulk_error(const char *fmt, ...) {
+	va_list ap;
+
+	if (result.rc) /* Keep the first */
+		return;
+	result.rc = 1;
+	va_start(ap, fmt);
+	vsnprintf(result.error, sizeof(result.error), fmt, ap);
+	va_end(ap);
+}
+
+static uint64_t now_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static ssize_t full_read(int fd, void *buf, size_t len) {
+	size_t	done = 0;
+	ssize_t n;
+
+	while (done < len) {
+		n = read(fd, (uint8_t *)buf + done, len - done);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			return -1;
+		if (n == 0)
+			break;
+		done += n;
+	}
+	return done;
+}
+
+static int full_write(int fd, const void *buf, size_t len) {
+	ssize_t n;
+
+	while (len) {
+		n = write(fd, buf, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			return -1;
+		buf = (const uint8_t *)buf + n;
+		len -= n;
+	}
+	return 0;
+}
+
+static void ring_init(struct bulk_ring *r) {
+	memset(r, 0, sizeof(*r));
+	pthread_mutex_init(&r->lock, NULL);
+	pthread_cond_init(&r->cond, NULL);
+}
+
+static void ring_free(struct bulk_ring *r) {
+	int i;
+
+	for (i = 0; i < BULK_RING; i++)
+		free(r->chunk[i].data);
+	pthread_mutex_destroy(&r->lock);
+	pthread_cond_destroy(&r->cond);
+}
+
+static void ring_abort(struct bulk_ring *r) {
+	pthread_mutex_lock(&r->lock);
+	r->abort = 1;
+	pthread_cond_broadcast(&r->cond);
+	pthread_mutex_unlock(&r->lock);
+}
+
+/* Producer: wait for a free chunk of at least 'size' bytes. NULL if aborted */
+static struct bulk_chunk *ring_fill_slot(struct bulk_ring *r, uint32_t size) {
+	struct bulk_chunk *c;
+	uint8_t			  *p;
+
+	pthread_mutex_lock(&r->lock);
+	while (r->head - r->tail == BULK_RING && !r->abort)
+		pthread_cond_wait(&r->cond, &r->lock);
+	pthread_mutex_unlock(&r->lock);
+	if (r->abort)
+		return NULL;
+
+	c = &r->chunk[r->head % BULK_RING];
+	if (c->size < size) {
+		p = realloc(c->data, size);
+		if (!p) {
+			bulk_error("Unable to allocate %u bytes", size);
+			ring_abort(r);
+			return NULL;
+		}
+		c->data = p;
+		c->size = size;
+	}
+	c->len		 = 0;
+	c->partition = 0;
+	c->type		 = CHUNK_DATA;
+	return c;
+}
+
+static void ring_filled(struct bulk_ring *r) {
+	pthread_mutex_lock(&r->lock);
+	r->head++;
+	pthread_cond_broadcast(&r->cond);
+	pthread_mutex_unlock(&r->lock);
+}
+
+/* Queue a chunk carrying no data */
+static int ring_mark(struct bulk_ring *r, enum chunk_type type, int partition) {
+	struct bulk_chunk *c = ring_fill_slot(r, 0);
+
+	if (!c)
+		return -1;
+	c->type		 = type;
+	c->partition = partition;
+	ring_filled(r);
+	return 0;
+}
+
+/* Consumer: wait for the next chunk. NULL if aborted */
+static struct bulk_chunk *ring_drain_slot(struct bulk_ring *r) {
+	pthread_mutex_lock(&r->lock);
+	while (r->head == r->tail && !r->abort)
+		pthread_cond_wait(&r->cond, &r->lock);
+	pthread_mutex_unlock(&r->lock);
+	if (r->abort)
+		return NULL;
+	return &r->chunk[r->tail % BULK_RING];
+}
+
+static void ring_drained(struct bulk_ring *r) {
+	pthread_mutex_lock(&r->lock);
+	r->tail++;
+	pthread_cond_broadcast(&r->cond);
+	pthread_mutex_unlock(&r->lock);
+}
+
+/* Queue 'len' bytes of 'fd' as blocks, 'len' < 0 for up to end of file */
+static int import_stream(struct bulk_job *job, int fd, int64_t len, const char *name) {
+	struct bulk_chunk *c;
+	uint32_t		   want;
+	ssize_t			   n;
+
+	while (len) {
+		want = (len > 0 && len < job->block_size) ? len : job->block_size;
+		c	 = ring_fill_slot(&job->ring, want);
+		if (!c)
+			return -1;
+		n = full_read(fd, c->data, want);
+		if (n < 0) {
+			bulk_error("%s: %s", name, strerror(errno));
+			return -1;
+		}
+		if (n == 0)
+			break;
+		if (len > 0 && (uint32_t)n < want) {
+			bulk_error("%s: truncated", name);
+			return -1;
+		}
+		c->len = n;
+		ring_filled(&job->ring);
+		if (len > 0)
+			len -= n;
+		else if ((uint32_t)n < want)
+			break;
+	}
+	return 0;
+}
+
+static int import_file(struct bulk_job *job, const char *path) {
+	int fd, rc;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		bulk_error("%s: %s", path, strerror(errno));
+		return -1;
+	}
+	rc = import_stream(job, fd, -1, path);
+	close(fd);
+	if (rc)
+		return rc;
+	return ring_mark(&job->ring, CHUNK_FILEMARK, 0);
+}
+
+static int regular_file(const struct dirent *d) {
+	return d->d_type == DT_REG || d->d_type == DT_UNKNOWN;
+}
+
+static int import_dir(struct bulk_job *job) {
+	struct dirent **names;
+	struct stat		st;
+	char			path[2048];
+	int				n, i, rc = 0;
+
+	n = scandir(job->path, &names, regular_file, alphasort);
+	if (n < 0) {
+		bulk_error("%s: %s", job->path, strerror(errno));
+		return -1;
+	}
+	for (i = 0; i < n; i++) {
+		snprintf(path, sizeof(path), "%s/%s", job->path, names[i]->d_name);
+		if (!rc && !stat(path, &st) && S_ISREG(st.st_mode))
+			rc = import_file(job, path);
+		free(names[i]);
+	}
+	free(names);
+	return rc;
+}
+
+/* Size field of a tar header - octal, or base-256 for large members */
+static int64_t tar_size(const uint8_t *hdr) {
+	int64_t size = 0;
+	int		i;
+
+	if (hdr[124] & 0x80) {
+		for (i = 125; i < 136; i++)
+			size = (size << 8) | hdr[i];
+		return size;
+	}
+	for (i = 124; i < 136 && hdr[i] >= '0' && hdr[i] <= '7'; i++)
+		size = (size << 3) | (hdr[i] - '0');
+	return size;
+}
+
+static int import_tar(struct bulk_job *job) {
+	static const uint8_t zero[TAR_BLOCK];
+	uint8_t				 hdr[TAR_BLOCK];
+	uint8_t				 skip[TAR_BLOCK];
+	int64_t				 size, pad;
+	ssize_t				 n;
+	int					 fd, rc = 0;
+
+	fd = open(job->path, O_RDONLY);
+	if (fd < 0) {
+		bulk_error("%s: %s", job->path, strerror(errno));
+		return -1;
+	}
+	for (;;) {
+		n = full_read(fd, hdr, TAR_BLOCK);
+		if (n == 0 || (n == TAR_BLOCK && !memcmp(hdr, zero, TAR_BLOCK)))
+			break; /* End of archive */
+		if (n != TAR_BLOCK) {
+			bulk_error("%s: truncated tar header", job->path);
+			rc = -1;
+			break;
+		}
+		size = tar_size(hdr);
+		pad	 = (TAR_BLOCK - size % TAR_BLOCK) % TAR_BLOCK;
+
+		if (hdr[156] == '0' || hdr[156] == '\0' || hdr[156] == '7') {
+			/* Regular file */
+			rc = import_stream(job, fd, size, job->path);
+			if (!rc)
+				rc = ring_mark(&job->ring, CHUNK_FILEMARK, 0);
+		} else {
+			/* Directory, link, long name... - nothing for the tape */
+			pad += size;
+		}
+		while (!rc && pad > 0) {
+			n = full_read(fd, skip, pad < TAR_BLOCK ? pad : TAR_BLOCK);
+			if (n <= 0) {
+				bulk_error("%s: truncated tar member", job->path);
+				rc = -1;
+			}
+			pad -= n;
+		}
+		if (rc)
+			break;
+	}
+	close(fd);
+	return rc;
+}
+
+static void *import_reader(void *arg) {
+	struct bulk_job *job = arg;
+	int				 rc;
+
+	switch (job->source) {
+	case SRC_DIR:
+		rc = import_dir(job);
+		break;
+	case SRC_TAR:
+		rc = import_tar(job);
+		break;
+	default:
+		rc = import_file(job, job->path);
+		break;
+	}
+	if (rc || ring_mark(&job->ring, CHUNK_END, 0))
+		ring_abort(&job->ring);
+	return NULL;
+}
+
+/* Write what import_reader() queues to the loaded cartridge */
+static void import_cartridge(struct bulk_job *job, char *compression, uint8_t *sam_stat) {
+	struct bulk_chunk *c;
+	struct scsi_cmd	   cmd;
+	struct mhvtl_ds	   ds;
+	pthread_t		   reader;
+	int				   done = 0;
+
+	memset(&cmd, 0, sizeof(cmd));
+	memset(&ds, 0, sizeof(ds));
+	cmd.lu		 = &lunit;
+	cmd.dbuf_p	 = &ds;
+	ds.sense_buf = sense;
+
+	init_default_ssc(&lunit);
+	set_compression(lunit.lu_private, compression);
+	lu_ssc.max_capacity = get_unaligned_be64(&mam.max_capacity);
+
+	if (pthread_create(&reader, NULL, import_reader, job)) {
+		bulk_error("Unable to create reader thread");
+		return;
+	}
+	while (!done) {
+		c = ring_drain_slot(&job->ring);
+		if (!c)
+			break;
+		switch (c->type) {
+		case CHUNK_DATA:
+			ds.data = c->data;
+			ds.sz	= c->len;
+			if (writeBlock(&cmd, c->len) < (int)c->len) {
+				if (sense[2] == (VOLUME_OVERFLOW | SD_EOM) && sense[13] == E_EOM)
+					bulk_error("No space left on media after %" PRIu64 " bytes",
+							   result.bytes);
+				else
+					bulk_error("Write failed, sense [%02x %02x %02x]",
+							   sense[2], sense[12], sense[13]);
+				ring_abort(&job->ring);
+				done = 1;
+				break;
+			}
+			result.bytes += c->len;
+			break;
+		case CHUNK_FILEMARK:
+			if (write_filemarks(1, sam_stat)) {
+				bulk_error("Unable to write filemark");
+				ring_abort(&job->ring);
+				done = 1;
+				break;
+			}
+			result.files++;
+			break;
+		case CHUNK_END:
+			done = 1;
+			break;
+		}
+		ring_drained(&job->ring);
+	}
+	pthread_join(reader, NULL);
+}
+
+/* Tape file 'n' of 'partition' in the export directory */
+static int export_open(struct bulk_job *job, int partition, int n) {
+	char path[2048];
+	int	 fd;
+
+	if (partition)
+		snprintf(path, sizeof(path), "%s/p%d.%05d", job->path, partition, n);
+	else
+		snprintf(path, sizeof(path), "%s/%05d", job->path, n);
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		bulk_error("%s: %s", path, strerror(errno));
+	return fd;
+}
+
+/* Write what export_cartridge() queues to one file per tape file */
+static void *export_writer(void *arg) {
+	struct bulk_job	  *job = arg;
+	struct bulk_chunk *c;
+	int				   fd = -1, n = 0, partition = 0;
+
+	while ((c = ring_drain_slot(&job->ring))) {
+		if (c->type == CHUNK_END)
+			break;
+		if (c->partition != partition) {
+			if (fd >= 0) {
+				close(fd);
+				result.files++;
+			}
+			fd		  = -1;
+			n		  = 0;
+			partition = c->partition;
+		}
+		if (fd < 0) {
+			fd = export_open(job, partition, n);
+			if (fd < 0)
+				goto abort;
+		}
+		if (c->type == CHUNK_DATA) {
+			if (full_write(fd, c->data, c->len)) {
+				bulk_error("%s/%05d: %s", job->path, n, strerror(errno));
+				goto abort;
+			}
+			result.bytes += c->len;
+		} else {
+			close(fd);
+			fd = -1;
+			n++;
+			result.files++;
+		}
+		ring_drained(&job->ring);
+	}
+	if (fd >= 0) { /* Data after the last filemark */
+		close(fd);
+		result.files++;
+	}
+	return NULL;
+
+abort:
+	if (fd >= 0)
+		close(fd);
+	ring_abort(&job->ring);
+	return NULL;
+}
+
+/* Queue every block and filemark of the loaded cartridge for export_writer() */
+static void export_cartridge(struct bulk_job *job, uint8_t *sam_stat) {
+	struct bulk_chunk *c;
+	pthread_t		   writer;
+	uint32_t		   blk_number, blk_size;
+	int				   k, n;
+
+	init_default_ssc(&lunit);
+	if (mkdir(job->path, 0755) && errno != EEXIST) {
+		bulk_error("%s: %s", job->path, strerror(errno));
+		return;
+	}
+	if (pthread_create(&writer, NULL, export_writer, job)) {
+		bulk_error("Unable to create writer thread");
+		return;
+	}
+	for (k = 0; k < mam.num_partitions; k++) {
+		change_partition(k);
+		while (c_pos->blk_type != B_EOD) {
+			if (c_pos->blk_type == B_FILEMARK) {
+				if (ring_mark(&job->ring, CHUNK_FILEMARK, k))
+					goto out;
+				position_blocks_forw(1, sam_stat);
+				continue;
+			}
+			blk_number = c_pos->blk_number;
+			blk_size   = c_pos->blk_size;
+			c		   = ring_fill_slot(&job->ring, blk_size);
+			if (!c)
+				goto out;
+			n = readBlock(c->data, blk_size, 1, 0, sam_stat);
+			if (n < 0 || (uint32_t)n != blk_size) {
+				bulk_error("Read failed at block %u, sense [%02x %02x %02x]",
+						   blk_number, sense[2], sense[12], sense[13]);
+				ring_abort(&job->ring);
+				goto out;
+			}
+			c->len		 = n;
+			c->partition = k;
+			ring_filled(&job->ring);
+		}
+	}
+	if (ring_mark(&job->ring, CHUNK_END, 0))
+		ring_abort(&job->ring);
+out:
+	pthread_join(writer, NULL);
+}
+
+/* Sleep as needed to hold 'bytes' since 'start' to 'rate' MB/s */
+static void throttle(uint32_t rate, uint64_t bytes, uint64_t start) {
+	struct timespec ts;
+	uint64_t		due, now;
+
+	if (!rate)
+		return;
+	due = start + bytes * 1000 / rate;
+	now = now_ns();
+	if (due <= now)
+		return;
+	ts.tv_sec  = (due - now) / 1000000000;
+	ts.tv_nsec = (due - now) % 1000000000;
+	nanosleep(&ts, NULL);
+}
+
+/*
+ * Read back every block of the loaded cartridge, checking the CRC recorded
+ * when it was written, and check the index of each partition. The outcome
+ * is kept with the cartridge for vtltape to raise TapeAlert on load.
+ */
+static void scrub_cartridge(struct bulk_job *job, uint8_t *sam_stat) {
+	struct scrub_result sr;
+	uint8_t			   *buf	   = NULL;
+	uint32_t			buf_sz = 0;
+	uint32_t			blk_number, blk_size, eod;
+	uint64_t			start = now_ns();
+	uint8_t			   *p;
+	int					k, n;
+
+	init_default_ssc(&lunit);
+	memset(&sr, 0, sizeof(sr));
+
+	for (k = 0; k < mam.num_partitions; k++) {
+		change_partition(k);
+		verify_partition_index(&sr);
+		eod = last_block(k);
+		/* Count blocks here - a damaged index may not be trusted to */
+		for (blk_number = 0; blk_number < eod; blk_number++) {
+			if (c_pos->blk_number != blk_number)
+				position_to_block(blk_number, sam_stat);
+			blk_size = c_pos->blk_size;
+			if (c_pos->blk_type == B_FILEMARK) {
+				sr.filemarks++;
+				position_to_block(blk_number + 1, sam_stat);
+				continue;
+			}
+			if (blk_size > buf_sz) {
+				p = realloc(buf, blk_size);
+				if (!p) {
+					bulk_error("Unable to allocate %u bytes", blk_size);
+					goto out;
+				}
+				buf	   = p;
+				buf_sz = blk_size;
+			}
+			n = blk_size ? readBlock(buf, blk_size, 1, 0, sam_stat) : -1;
+			if (n < 0 || (uint32_t)n != blk_size) {
+				printf("%s: partition %d block %u unreadable, sense [%02x %02x %02x]\n",
+					   job->pcl, k, blk_number, sense[2], sense[12], sense[13]);
+				if (!sr.crc_errors && !sr.index_errors) {
+					sr.bad_partition = k;
+					sr.bad_block	 = blk_number;
+				}
+				sr.crc_errors++;
+				continue;
+			}
+			sr.blocks++;
+			sr.bytes += blk_size;
+			result.bytes = sr.bytes;
+			throttle(job->rate, sr.bytes, start);
+		}
+	}
+
+	sr.time		 = time(NULL);
+	result.files = sr.filemarks;
+	if (write_scrub_result(NULL, &sr))
+		bulk_error("Unable to record the scrub result");
+	else if (sr.crc_errors || sr.index_errors)
+		bulk_error("DAMAGED: %u CRC errors, %u index errors, first at partition %u block %u",
+				   sr.crc_errors, sr.index_errors, sr.bad_partition, sr.bad_block);
+out:
+	free(buf);
+}
+
+/*
+ * Load 'pcl' from library '*libno', or find it: first in the catalog, then by
+ * trying each library in device.conf. '*libno' is set to where it was found.
+ *
+ * Returns 0 on success
+ */
+static int open_pcl(char *pcl, int *libno, char *device_conf, uint8_t *sam_stat) {
+	const struct mhvtl_config *cfg;
+	const struct conf_device  *d;
+	struct catalog_entry	   e;
+	int						   rc = ENOENT;
+
+	if (*libno) {
+		find_media_home_directory(NULL, *libno);
+		return load_tape(pcl, sam_stat);
+	}
+
+	if (!catalog_lookup(pcl, &e)) {
+		snprintf(home_directory, sizeof(home_directory), "%s", e.home);
+		if (!load_tape(pcl, sam_stat)) {
+			*libno = e.library;
+			return 0;
+		}
+	}
+
+	cfg = config_load();
+	if (!cfg) {
+		fprintf(stderr, "Cannot read config file %s\n", device_conf);
+		exit(1);
+	}
+	/* Walk thru all defined libraries looking for media */
+	for_each_conf_device(cfg, d) {
+		if (d->type != CONF_LIBRARY)
+			continue;
+		config_home(d, home_directory, sizeof(home_directory));
+		rc = load_tape(pcl, sam_stat);
+		if (!rc) {
+			*libno = d->id;
+			break;
+		}
+	}
+	return rc;
+}
+
+static void bulk_child(struct bulk_job *job, int libno, char *device_conf,
+					   char *compression) {
+	uint8_t	 sam_stat;
+	uint64_t start = now_ns();
+	int		 rc;
+
+	init_lu_ssc(&lu_ssc);
+	init_lunit(&lunit, &lu_ssc);
+	ring_init(&job->ring);
+
+	if (lzo_init() != LZO_E_OK) {
+		bulk_error("lzo_init() failed");
+		return;
+	}
+
+	rc = open_pcl(job->pcl, &libno, device_conf, &sam_stat);
+	if (rc) {
+		bulk_error("Cannot be opened, load_tape() returned %d", rc);
+		return;
+	}
+	switch (job->op) {
+	case BULK_IMPORT:
+		import_cartridge(job, compression, &sam_stat);
+		catalog_note(job->pcl, libno, 1);
+		break;
+	case BULK_EXPORT:
+		export_cartridge(job, &sam_stat);
+		break;
+	case BULK_SCRUB:
+		scrub_cartridge(job, &sam_stat);
+		break;
+	}
+	unload_tape(&sam_stat);
+	ring_free(&job->ring);
+	result.ns = now_ns() - start;
+}
+
+static double mb_per_s(uint64_t bytes, uint64_t ns) {
+	return ns ? (double)bytes * 1000 / ns : 0.0;
+}
+
+/*
+ * Run 'job[0..count)' with up to 'jobs' child processes at a time,
+ * printing a line per cartridge as it completes and a total
+ *
+ * Returns the number of cartridges that failed
+ */
+static int bulk_run(struct bulk_job *job, int count, int jobs, int libno,
+					char *device_conf, char *compression) {
+	struct bulk_result r;
+	pid_t			  *pid;
+	int				  *pipe_fd;
+	uint64_t		   start = now_ns(), bytes = 0, files = 0;
+	int				   next = 0, running = 0, failed = 0;
+	int				   fd[2], status, i;
+	pid_t			   p;
+
+	pid		= calloc(count, sizeof(pid_t));
+	pipe_fd = calloc(count, sizeof(int));
+	if (!pid || !pipe_fd) {
+		perror("Could not allocate memory");
+		exit(1);
+	}
+
+	while (next < count || running) {
+		while (running < jobs && next < count) {
+			if (pipe(fd)) {
+				perror("pipe");
+				exit(1);
+			}
+			fflush(stdout);
+			p = fork();
+			if (p < 0) {
+				perror("fork");
+				exit(1);
+			}
+			if (p == 0) {
+				close(fd[0]);
+				bulk_child(&job[next], libno, device_conf, compression);
+				if (write(fd[1], &result, sizeof(result)) != sizeof(result))
+					_exit(2);
+				_exit(result.rc);
+			}
+			close(fd[1]);
+			pid[next]	  = p;
+			pipe_fd[next] = fd[0];
+			next++;
+			running++;
+		}
+
+		p = wait(&status);
+		if (p < 0)
+			break;
+		for (i = 0; i < next && pid[i] != p; i++)
+			;
+		if (i == next)
+			continue;
+		running--;
+
+		memset(&r, 0, sizeof(r));
+		if (read(pipe_fd[i], &r, sizeof(r)) != sizeof(r)) {
+			r.rc = 1;
+			snprintf(r.error, sizeof(r.error), "Exited abnormally (status 0x%x)", status);
+		}
+		close(pipe_fd[i]);
+
+		printf("%-8s %6" PRIu64 " files %14" PRIu64 " bytes %8.1fs %8.1f MB/s%s%s\n",
+			   job[i].pcl, r.files, r.bytes, r.ns / 1e9, mb_per_s(r.bytes, r.ns),
+			   r.rc ? "  FAILED: " : "", r.rc ? r.error : "");
+		files += r.files;
+		bytes += r.bytes;
+		if (r.rc)
+			failed++;
+	}
+
+	printf("Total: %d cartridges (%d failed), %" PRIu64 " files, %" PRIu64
+		   " bytes in %.1fs, %.1f MB/s\n",
+		   count, failed, files, bytes, (now_ns() - start) / 1e9,
+		   mb_per_s(bytes, now_ns() - start));
+	free(pid);
+	free(pipe_fd);
+	return failed;
+}
+
+/* One job per file, directory or .tar in 'source' */
+static int import_jobs(char *source, uint32_t block_size, struct bulk_job **jobs) {
+	struct dirent  **names;
+	struct bulk_job *job;
+	struct stat		 st;
+	char			 path[1024];
+	size_t			 len;
+	int				 n, i, count = 0;
+
+	n = scandir(source, &names, NULL, alphasort);
+	if (n < 0) {
+		fprintf(stderr, "%s: %s\n", source, strerror(errno));
+		exit(1);
+	}
+	*jobs = calloc(n ? n : 1, sizeof(struct bulk_job));
+	if (!*jobs) {
+		perror("Could not allocate memory");
+		exit(1);
+	}
+	for (i = 0; i < n; i++) {
+		snprintf(path, sizeof(path), "%s/%s", source, names[i]->d_name);
+		if (names[i]->d_name[0] == '.' || stat(path, &st) ||
+			!(S_ISREG(st.st_mode) || S_ISDIR(st.st_mode)))
+			goto next;
+
+		job = &(*jobs)[count];
+		snprintf(job->path, sizeof(job->path), "%s", path);
+		snprintf(job->pcl, sizeof(job->pcl), "%.*s", MAX_BARCODE_LEN, names[i]->d_name);
+		job->op			= BULK_IMPORT;
+		job->block_size = block_size;
+		job->source		= S_ISDIR(st.st_mode) ? SRC_DIR : SRC_FILE;
+		len				= strlen(names[i]->d_name);
+		if (job->source == SRC_FILE && len > 4 &&
+			!strcmp(names[i]->d_name + len - 4, ".tar")) {
+			job->source = SRC_TAR;
+			if (len - 4 < sizeof(job->pcl))
+				job->pcl[len - 4] = '\0';
+		}
+		count++;
+next:
+		free(names[i]);
+	}
+	free(names);
+	return count;
+}
+
+/*
+ * One job per 'pcl', or per cartridge in library 'libno' if none given.
+ * 'dest' is the export directory, NULL to scrub at 'rate' MB/s.
+ */
+static int export_jobs(char *dest, uint32_t rate, char **pcl, int pcls, int libno,
+					   struct bulk_job **jobs) {
+	struct dirent **names = NULL;
+	struct stat		st;
+	char			path[2048];
+	int				n = pcls, i, count = 0;
+
+	if (dest && mkdir(dest, 0755) && errno != EEXIST) {
+		fprintf(stderr, "%s: %s\n", dest, strerror(errno));
+		exit(1);
+	}
+	if (!pcls) {
+		if (!libno)
+			usage("Need a PCL (-m) or library (-l)");
+		find_media_home_directory(NULL, libno);
+		n = scandir(home_directory, &names, NULL, alphasort);
+		if (n < 0) {
+			fprintf(stderr, "%s: %s\n", home_directory, strerror(errno));
+			exit(1);
+		}
+	}
+	*jobs = calloc(n ? n : 1, sizeof(struct bulk_job));
+	if (!*jobs) {
+		perror("Could not allocate memory");
+		exit(1);
+	}
+	for (i = 0; i < n; i++) {
+		if (names) {
+			/* A cartridge is a directory holding a 'mam' file */
+			snprintf(path, sizeof(path), "%s/%s/mam", home_directory, names[i]->d_name);
+			if (names[i]->d_name[0] == '.' || stat(path, &st)) {
+				free(names[i]);
+				continue;
+			}
+		}
+		snprintf((*jobs)[count].pcl, sizeof((*jobs)[count].pcl), "%.*s", MAX_BARCODE_LEN,
+				 names ? names[i]->d_name : pcl[i]);
+		if (dest)
+			snprintf((*jobs)[count].path, sizeof((*jobs)[count].path), "%s/%s",
+					 dest, (*jobs)[count].pcl);
+		(*jobs)[count].op	= dest ? BULK_EXPORT : BULK_SCRUB;
+		(*jobs)[count].rate = rate;
+		count++;
+		if (names)
+			free(names[i]);
+	}
+	free(names);
+	return count;
+}
+
 int main(int argc, char *argv[]) {
-	char	device_conf[CONF_FILE_SZ];
-	uint8_t sam_stat;
-	char   *pcl = NULL;
-	int		rc;
-	int		libno = 0;
-	int		indx;
-	int		block_size	= 0;
-	int		dump_data	= FALSE;
-	char   *source_file = NULL;
-	char   *compression = NULL;
-	FILE   *conf;
-	char   *b; /* Read from file into this buffer */
-	char   *s; /* Somewhere for sscanf to store results */
+	char			 device_conf[CONF_FILE_SZ];
+	uint8_t			 sam_stat;
+	char			*pcl = NULL;
+	char			*pcl_list[MAX_BULK_PCL];
+	int				 pcls = 0;
+	int				 rc;
+	int				 libno		 = 0;
+	int				 block_size	 = 0;
+	int				 dump_data	 = FALSE;
+	int				 jobs		 = 0;
+	int				 scrub		 = FALSE;
+	int				 rate		 = 0;
+	char			*source_file = NULL;
+	char			*compression = NULL;
+	char			*bulk_dir	 = NULL;
+	struct bulk_job *job;
+	int				 count;
 
 	if (get_config(device_conf, DEVICE_CONF, my_id) < 0)
 		exit(1);
@@ -472,20 +1387,42 @@ int main(int argc, char *argv[]) {
 				verbose = 9; /* If debug, make verbose... */
 				break;
 			case 'm':
-				if (argc > 1)
-					pcl = argv[2];
-				else
+				if (argc > 2) {
+					if (pcls == MAX_BULK_PCL)
+						usage("Too many PCLs");
+					pcl_list[pcls++] = argv[2];
+					if (!pcl)
+						pcl = argv[2];
+				} else
 					usage("More args needed for -m");
 				break;
 			case 'l':
-				if (argc > 1)
-					libno = atoi(argv[1]);
+				if (argc > 2)
+					libno = atoi(argv[2]);
 				else
 					usage("More args needed for -l");
 				break;
+			case 'j':
+				if (argc > 2)
+					jobs = atoi(argv[2]);
+				else
+					usage("More args needed for -j");
+				break;
 			case 'D':
 				dump_data = TRUE;
 				break;
+			case 'S': /* Scrub */
+				if (dump_tape == 1)
+					scrub = TRUE;
+				else
+					usage("-S is not a supported option");
+				break;
+			case 'r': /* Scrub rate */
+				if (argc > 2)
+					rate = atoi(argv[2]);
+				else
+					usage("More args needed for -r");
+				break;
 			case 'v':
 				verbose++;
 				break;
@@ -522,6 +1459,28 @@ int main(int argc, char *argv[]) {
 					usage("-F is not a supported option");
 				}
 				break;
+			case 'I': /* Directory to bulk import from */
+				if (dump_tape == 2) {
+					if (argc > 2) {
+						bulk_dir = argv[2];
+					} else {
+						usage("-I requires additional directory");
+					}
+				} else {
+					usage("-I is not a supported option");
+				}
+				break;
+			case 'E': /* Directory to bulk export to */
+				if (dump_tape == 1) {
+					if (argc > 2) {
+						bulk_dir = argv[2];
+					} else {
+						usage("-E requires additional directory");
+					}
+				} else {
+					usage("-E is not a supported option");
+				}
+				break;
 			default:
 				usage("Unknown option");
 				break;
@@ -531,16 +1490,24 @@ int main(int argc, char *argv[]) {
 		argc--;
 	}
 
-	if (pcl == NULL)
+	if (pcl == NULL && bulk_dir == NULL && !scrub)
 		usage("No PCL number supplied");
+	if (scrub && bulk_dir)
+		usage("-S and -E are mutually exclusive");
 	if (dump_tape == 2) {
-		if (source_file == NULL)
+		if (source_file == NULL && bulk_dir == NULL)
 			usage("Need to specify the filename to read data from");
+		if (source_file && bulk_dir)
+			usage("-F and -I are mutually exclusive");
 		if (compression == NULL)
 			usage("Need to specify the compression type NONE|LZO|ZLIB");
-		if (block_size == 0)
+		if (block_size <= 0)
 			usage("Need to specify a block size");
 	}
+	if (jobs <= 0)
+		jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	if (jobs <= 0)
+		jobs = 1;
 
 #ifdef __x86_64__
 	if (verbose) {
@@ -552,52 +1519,27 @@ int main(int argc, char *argv[]) {
 	}
 #endif
 
-	init_lu_ssc(&lu_ssc);
-	init_lunit(&lunit, &lu_ssc);
-
-	conf = fopen(device_conf, "r");
-	if (!conf) {
-		fprintf(stderr, "Cannot open config file %s: %s\n", device_conf,
-				strerror(errno));
-		exit(1);
-	}
-	s = malloc(MALLOC_SZ);
-	if (!s) {
-		perror("Could not allocate memory");
-		exit(1);
-	}
-	b = malloc(MALLOC_SZ);
-	if (!b) {
-		perror("Could not allocate memory");
-		exit(1);
-	}
-
-	rc = ENOENT;
-
-	if (libno) {
-		printf("Looking for PCL: %s in library %d\n", pcl, libno);
-		find_media_home_directory(NULL, libno);
-		rc = load_tape(pcl, &sam_stat);
-	} else { /* Walk thru all defined libraries looking for media */
-		while (readline(b, MALLOC_SZ, conf) != NULL) {
-			if (b[0] == '#') /* Ignore comments */
-				continue;
-			/* If found a library: Attempt to load media
-			 * Break out of loop if found. Otherwise try next lib.
-			 */
-			if (sscanf(b, "Library: %d CHANNEL:", &indx)) {
-				find_media_home_directory(NULL, indx);
-				rc = load_tape(pcl, &sam_stat);
-				if (!rc)
-					break;
-			}
+	if (bulk_dir || scrub) {
+		if (dump_tape == 2)
+			count = import_jobs(bulk_dir, block_size, &job);
+		else
+			count = export_jobs(bulk_dir, rate, pcl_list, pcls, libno, &job);
+		if (!count) {
+			fprintf(stderr, "Nothing to %s\n",
+					dump_tape == 2 ? "import" : scrub ? "scrub" : "export");
+			exit(1);
 		}
+		rc = bulk_run(job, count, jobs, libno, device_conf, compression);
+		free(job);
+		return rc ? 1 : 0;
 	}
 
-	fclose(conf);
-	free(s);
-	free(b);
+	init_lu_ssc(&lu_ssc);
+	init_lunit(&lunit, &lu_ssc);
 
+	if (libno)
+		printf("Looking for PCL: %s in library %d\n", pcl, libno);
+	rc = open_pcl(pcl, &libno, device_conf, &sam_stat);
 	if (rc) {
 		fprintf(stderr, "PCL %s cannot be opened, "
 						"load_tape() returned %d\n",
@@ -614,6 +1556,7 @@ int main(int argc, char *argv[]) {
 		unload_tape(&sam_stat);
 	} else if (dump_tape == 2) {
 		write_tape(source_file, block_size, compression, &sam_stat);
+		catalog_note(pcl, libno, 1);
 	}
 
 	return 0;
@@ -0,0 +1,473 @@
+/*
+ * vtlcart-bench - Microbenchmarks of the cartridge storage layer
+ *
+ * Runs write_tape_block()/read_tape_block(), filemark writes, positioning,
+ * the writeBlock()/readBlock() compression paths and the LBP CRC kernels
+ * in-process against a scratch cartridge in a temporary directory - the
+ * way preload_tape/dump_tape drive the I/O path - so no kernel module, SCSI
+ * stack or root is needed. Reports the cost of each operation and the
+ * system calls it made.
+ *
+ * Copyright (C) 2005 - 2025 Mark Harvey markh794 at gmail dot com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <time.h>
+#include <zlib.h>
+#include "be_byteshift.h"
+#include "mhvtl_scsi.h"
+#include "mhvtl_list.h"
+#include "vtl_common.h"
+#include "vtllib.h"
+#include "vtlcart.h"
+#include "ssc.h"
+#include "logging.h"
+#include "minilzo.h"
+#include "syscall_count.h"
+#include "ccan/crc32c/crc32c.h"
+
+uint32_t GenerateRSCRC(uint32_t crc, uint32_t cnt, const void *start);
+
+char mhvtl_driver_name[] = "vtlcart-bench";
+
+#define PCL "VCBENCH1"
+
+static char *progname;
+
+static struct {
+	uint32_t blk_sz;
+	long	 blocks;
+	long	 filemarks;
+	long	 positions;
+	int		 engine;
+	int		 direct_io;
+	uint32_t segment_mb;
+	int		 pattern; /* 0: compressible, 1: random, 2: zero */
+	char	*only;
+	int		 keep;
+} cfg = {
+	.blk_sz	   = 64 * 1024,
+	.blocks	   = 4096,
+	.filemarks = 256,
+	.positions = 1000,
+	.engine	   = STORAGE_SYNC,
+};
+
+static const char *pattern_name[] = {"compressible", "random", "zero"};
+
+static uint8_t		   *wbuf;
+static uint8_t		   *rbuf;
+static struct scsi_cmd	cmd;
+static struct mhvtl_ds	ds;
+static uint8_t			sam_stat;
+static int				failed;
+
+/* Hooks the personality module and mhvtl_io.c expect from vtltape */
+uint8_t check_restrictions(struct scsi_cmd *scmd) {
+	*lu_ssc.OK_2_write = 1;
+	return 1;
+}
+
+uint8_t valid_encryption_blk(struct scsi_cmd *scmd) {
+	return TRUE;
+}
+
+void register_ops(struct lu_phy_attr *lu, int op, void *f, void *g, void *h) {
+}
+
+void ssc_personality_module_register(struct ssc_personality_template *pm) {
+	lu_ssc.pm = pm;
+}
+
+int add_drive_media_list(struct lu_phy_attr *lu, int status, char *s) {
+	return 0;
+}
+
+static void usage(void) {
+	fprintf(stderr, "Usage: %s [options]\n", progname);
+	fprintf(stderr, "  -b size      Block size in bytes (default: 65536)\n");
+	fprintf(stderr, "  -n blocks    Blocks per write/read case (default: 4096)\n");
+	fprintf(stderr, "  -m count     Filemarks in the filemark case (default: 256)\n");
+	fprintf(stderr, "  -p count     Operations per positioning case (default: 1000)\n");
+	fprintf(stderr, "  -e engine    Storage engine: sync or io_uring (default: sync)\n");
+	fprintf(stderr, "  -d           Direct I/O (O_DIRECT) for the data file\n");
+	fprintf(stderr, "  -s size_mb   Segmented layout with 'size_mb' MB segments\n");
+	fprintf(stderr, "  -D pattern   Data: compressible, random or zero (default: compressible)\n");
+	fprintf(stderr, "  -o list      Only run cases whose name contains one of the comma\n"
+					"               separated words, e.g. -o read,crc\n");
+	fprintf(stderr, "  -k           Keep the scratch directory\n");
+	fprintf(stderr, "  -V           Print version and exit\n");
+}
+
+static uint64_t now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* xorshift32 - repeatable runs */
+static uint32_t next_rand(void) {
+	static uint32_t x = 2463534242U;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return x;
+}
+
+static int selected(const char *name) {
+	char  list[256];
+	char *tok, *save;
+
+	if (!cfg.only)
+		return 1;
+	snprintf(list, sizeof(list), "%s", cfg.only);
+	for (tok = strtok_r(list, ",", &save); tok; tok = strtok_r(NULL, ",", &save))
+		if (strstr(name, tok))
+			return 1;
+	return 0;
+}
+
+/*
+ * Run 'fn' 'ops' times (it gets the iteration number) after 'prep', and
+ * print the cost per operation. 'bytes' is the payload per operation for
+ * the MB/s column, 0 if not meaningful.
+ *
+ * A 'setup' case lays down the blocks and filemarks later cases work on,
+ * so it runs even when -o leaves it out - it just isn't reported.
+ */
+static void run_case(const char *name, long ops, uint32_t bytes, int setup,
+					 void (*prep)(void), int (*fn)(long)) {
+	uint64_t before[SC_CLASSES];
+	uint64_t start, elapsed, total = 0;
+	char	 mbs[16];
+	long	 i;
+	int		 sc;
+
+	if ((!selected(name) && !setup) || ops <= 0)
+		return;
+	if (prep)
+		prep();
+
+	memcpy(before, syscall_count, sizeof(before));
+	start = now();
+	for (i = 0; i < ops; i++)
+		if (fn(i)) {
+			fprintf(stderr, "%s: failed at operation %ld, sense [%02x %02x %02x]\n",
+					name, i, sense[2], sense[12], sense[13]);
+			failed = 1;
+			break;
+		}
+	elapsed = now() - start;
+	if (i < ops || !selected(name))
+		return;
+
+	for (sc = 0; sc < SC_CLASSES; sc++)
+		total += syscall_count[sc] - before[sc];
+
+	mbs[0] = '\0';
+	if (bytes && elapsed)
+		snprintf(mbs, sizeof(mbs), "%.1f", (double)bytes * ops * 1000 / elapsed);
+	printf("%-24s %8ld %10.0f %9s %8.2f", name, ops, (double)elapsed / ops,
+		   mbs, (double)total / ops);
+	for (sc = 0; sc < SC_CLASSES; sc++)
+		printf(" %7.2f", (double)(syscall_count[sc] - before[sc]) / ops);
+	printf("\n");
+}
+
+/*
+ * Cases
+ */
+
+static void fill_block(long i) {
+	if (cfg.pattern != 2)
+		memcpy(wbuf, &i, sizeof(i));
+}
+
+static void prep_rewind(void) {
+	rewind_tape(&sam_stat);
+}
+
+static int do_write_tape_block(long i) {
+	fill_block(i);
+	return write_tape_block(wbuf, cfg.blk_sz, 0, NULL, 0, FALSE,
+							crc32c(0, wbuf, cfg.blk_sz), &sam_stat);
+}
+
+static int do_filemark(long i) {
+	return write_filemarks(1, &sam_stat);
+}
+
+static int do_read_tape_block(long i) {
+	return read_tape_block(rbuf, cfg.blk_sz, &sam_stat) != cfg.blk_sz;
+}
+
+/* Positioning calls return -1 on failure, 0 or 1 on success */
+static int do_position_to_block(long i) {
+	return position_to_block(next_rand() % cfg.blocks, &sam_stat) < 0;
+}
+
+static int do_blocks_forw(long i) {
+	return position_blocks_forw(1, &sam_stat) < 0;
+}
+
+static int do_blocks_back(long i) {
+	return position_blocks_back(1, &sam_stat) < 0;
+}
+
+static int do_filemarks_forw(long i) {
+	return position_filemarks_forw(1, &sam_stat) < 0;
+}
+
+static int do_eod_rewind(long i) {
+	return ((i & 1) ? rewind_tape(&sam_stat) : position_to_eod(&sam_stat)) < 0;
+}
+
+static void prep_eod(void) {
+	position_to_eod(&sam_stat);
+}
+
+static void prep_blocks_end(void) {
+	position_to_block(cfg.blocks, &sam_stat);
+}
+
+static int do_writeBlock(long i) {
+	fill_block(i);
+	return writeBlock(&cmd, cfg.blk_sz) != (int)cfg.blk_sz;
+}
+
+/* The trailing filemark flushes anything the io_uring engine still holds */
+static int do_writeBlock_fm(long i) {
+	if (do_writeBlock(i))
+		return 1;
+	return (i == cfg.blocks - 1) ? write_filemarks(1, &sam_stat) : 0;
+}
+
+static int do_readBlock(long i) {
+	return readBlock(rbuf, cfg.blk_sz, 1, 0, &sam_stat) != (int)cfg.blk_sz;
+}
+
+/* Keeps the CRC calls from being optimised away */
+static volatile uint32_t crc_sink;
+
+static int do_crc32c(long i) {
+	crc_sink = crc32c(crc_sink, wbuf, cfg.blk_sz);
+	return 0;
+}
+
+static int do_rscrc(long i) {
+	crc_sink = GenerateRSCRC(crc_sink, cfg.blk_sz, wbuf);
+	return 0;
+}
+
+static void compression_cases(int type, const char *suffix) {
+	char name[64];
+
+	lu_ssc.compressionType = type;
+
+	snprintf(name, sizeof(name), "writeBlock/%s", suffix);
+	run_case(name, cfg.blocks, cfg.blk_sz, 0, prep_rewind, do_writeBlock_fm);
+	snprintf(name, sizeof(name), "readBlock/%s", suffix);
+	run_case(name, cfg.blocks, cfg.blk_sz, 0, prep_rewind, do_readBlock);
+}
+
+static void setup(void) {
+	long i;
+
+	memset(&lunit, 0, sizeof(lunit));
+	memset(&lu_ssc, 0, sizeof(lu_ssc));
+	lunit.lu_private = &lu_ssc;
+	lunit.sense_p	 = sense;
+	INIT_LIST_HEAD(&lunit.den_list);
+	INIT_LIST_HEAD(&lunit.mode_pg);
+	INIT_LIST_HEAD(&lunit.log_pg);
+
+	lu_ssc.load_status	   = TAPE_UNLOADED;
+	lu_ssc.capacity_unit   = 1;
+	lu_ssc.c_pos		   = c_pos;
+	lu_ssc.app_encr_info   = &app_encryption_state;
+	lu_ssc.OK_2_write	   = &OK_to_write;
+	lu_ssc.mamp			   = &mam;
+	lu_ssc.compressionType = LZO;
+	INIT_LIST_HEAD(&lu_ssc.supported_media_list);
+
+	init_default_ssc(&lunit);
+
+	init_mam(&mam);
+	mam.tape_fmt_version = TAPE_FMT_VERSION;
+	mam.mam_fmt_version	 = MAM_VERSION;
+	mam.MediumType		 = MEDIA_TYPE_DATA;
+	put_unaligned_be64(1ULL << 40, &mam.max_capacity);
+	put_unaligned_be64(1ULL << 40, &mam.remaining_capacity);
+	sprintf((char *)mam.Barcode, "%-31s", PCL);
+
+	cart_set_direct_io(cfg.direct_io);
+	cart_set_segment_size(cfg.segment_mb);
+	if (cart_set_storage_engine(cfg.engine) != cfg.engine)
+		fprintf(stderr, "io_uring not available - using synchronous I/O\n");
+
+	if (create_tape(PCL, &sam_stat) || load_tape(PCL, &sam_stat)) {
+		fprintf(stderr, "Unable to create a cartridge in %s\n", home_directory);
+		exit(1);
+	}
+	lu_ssc.max_capacity = get_unaligned_be64(&mam.max_capacity);
+
+	wbuf = malloc(cfg.blk_sz);
+	rbuf = malloc(cfg.blk_sz);
+	if (!wbuf || !rbuf) {
+		fprintf(stderr, "Unable to allocate %u byte buffers\n", cfg.blk_sz);
+		exit(1);
+	}
+	for (i = 0; i < (long)cfg.blk_sz; i++) {
+		switch (cfg.pattern) {
+		case 0: /* Runs of a few random letters, roughly 2:1 */
+			wbuf[i] = (i & 3) ? wbuf[i - 1] : 'a' + next_rand() % 26;
+			break;
+		case 1:
+			wbuf[i] = next_rand();
+			break;
+		default:
+			wbuf[i] = 0;
+		}
+	}
+
+	memset(&cmd, 0, sizeof(cmd));
+	memset(&ds, 0, sizeof(ds));
+	cmd.lu		 = &lunit;
+	cmd.dbuf_p	 = &ds;
+	ds.sense_buf = sense;
+	ds.data		 = wbuf;
+	ds.sz		 = cfg.blk_sz;
+}
+
+int main(int argc, char *argv[]) {
+	char dir[] = "/tmp/vtlcart-bench.XXXXXX";
+	char rm[64];
+	int	 opt, i;
+
+	progname = argv[0];
+
+	while ((opt = getopt(argc, argv, "b:n:m:p:e:ds:D:o:kVh")) != -1) {
+		switch (opt) {
+		case 'b':
+			cfg.blk_sz = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			cfg.blocks = atol(optarg);
+			break;
+		case 'm':
+			cfg.filemarks = atol(optarg);
+			break;
+		case 'p':
+			cfg.positions = atol(optarg);
+			break;
+		case 'e':
+			if (!strcasecmp(optarg, "io_uring")) {
+				cfg.engine = STORAGE_IO_URING;
+			} else if (strcasecmp(optarg, "sync")) {
+				usage();
+				exit(1);
+			}
+			break;
+		case 'd':
+			cfg.direct_io = 1;
+			break;
+		case 's':
+			cfg.segment_mb = atoi(optarg);
+			break;
+		case 'D':
+			for (cfg.pattern = 0; cfg.pattern < 3; cfg.pattern++)
+				if (!strcmp(optarg, pattern_name[cfg.pattern]))
+					break;
+			if (cfg.pattern == 3) {
+				usage();
+				exit(1);
+			}
+			break;
+		case 'o':
+			cfg.only = optarg;
+			break;
+		case 'k':
+			cfg.keep = 1;
+			break;
+		case 'V':
+			printf("%s: version %s\n", progname, MHVTL_VERSION);
+			exit(0);
+		default:
+			usage();
+			exit(opt == 'h' ? 0 : 1);
+		}
+	}
+	if (optind < argc || cfg.blk_sz < sizeof(long) || cfg.blocks <= 0) {
+		usage();
+		exit(1);
+	}
+
+	if (!mkdtemp(dir)) {
+		perror("mkdtemp");
+		exit(1);
+	}
+	snprintf(home_directory, HOME_DIR_PATH_SZ, "%s", dir);
+	lzo_init();
+	setup();
+
+	printf("# %s, %u byte blocks, %s data, %s engine%s", dir, cfg.blk_sz,
+		   pattern_name[cfg.pattern],
+		   cfg.engine == STORAGE_IO_URING ? "io_uring" : "sync",
+		   cfg.direct_io ? ", direct I/O" : "");
+	if (cfg.segment_mb)
+		printf(", %u MB segments", cfg.segment_mb);
+	printf("\n# system calls per operation\n");
+	printf("%-24s %8s %10s %9s %8s", "case", "ops", "ns/op", "MB/s", "sys/op");
+	for (i = 0; i < SC_CLASSES; i++)
+		printf(" %7s", syscall_class_name(i));
+	printf("\n");
+
+	/* Raw block format - no compression, CRC computed up front */
+	run_case("write_tape_block", cfg.blocks, cfg.blk_sz, 1, NULL, do_write_tape_block);
+	run_case("write_filemarks", cfg.filemarks, 0, 1, NULL, do_filemark);
+	run_case("read_tape_block", cfg.blocks, cfg.blk_sz, 0, prep_rewind, do_read_tape_block);
+
+	/* Positioning over the blocks and filemarks just written */
+	run_case("position_to_block", cfg.positions, 0, 0, NULL, do_position_to_block);
+	run_case("position_blocks_forw", cfg.blocks, 0, 0, prep_rewind, do_blocks_forw);
+	run_case("position_blocks_back", cfg.blocks, 0, 0, prep_blocks_end, do_blocks_back);
+	run_case("position_filemarks_forw", cfg.filemarks, 0, 0, prep_blocks_end, do_filemarks_forw);
+	run_case("position_to_eod/rewind", cfg.positions, 0, 0, prep_eod, do_eod_rewind);
+
+	/* Compression paths, each overwriting the tape from BOT */
+	compression_cases(0, "none");
+	compression_cases(LZO, "lzo");
+	compression_cases(ZLIB, "zlib");
+
+	/* LBP CRC kernels */
+	run_case("crc32c", cfg.blocks, cfg.blk_sz, 0, NULL, do_crc32c);
+	run_case("rs-crc", cfg.blocks, cfg.blk_sz, 0, NULL, do_rscrc);
+
+	unload_tape(&sam_stat);
+	if (!cfg.keep) {
+		snprintf(rm, sizeof(rm), "rm -rf %s", dir);
+		if (system(rm))
+			fprintf(stderr, "Unable to remove %s\n", dir);
+	}
+	free(wbuf);
+	free(rbuf);
+	return failed;
+}
@@ -41,11 +41,14 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <fcntl.h>
 #include <ctype.h>
 #include <inttypes.h>
+#include <time.h>
 #include "q.h"
 #include "vtllib.h"
+#include "mhvtl_stats.h"
 
 char mhvtl_driver_name[] = "vtlcmd";
 
@@ -65,6 +68,7 @@ static void usage(char *prog) {
 	*/
 	fprintf(stderr, "   TapeAlert #       -> 64bit TapeAlert mask (hex)\n");
 	fprintf(stderr, "   InquiryDataChange -> Set LU state to indicate Inquiry Data Has Changed\n");
+	fprintf(stderr, "   stats             -> Dump command counts and latencies\n");
 	fprintf(stderr, "   exit              -> To shutdown tape/library "
 					"daemon/device\n");
 	fprintf(stderr, "\nTape specific commands:\n");
@@ -87,6 +91,10 @@ static void usage(char *prog) {
 	fprintf(stderr, "   open map     -> Open map to allow media export\n");
 	fprintf(stderr, "   close map    -> Close map to allow media import\n");
 	fprintf(stderr, "   load map ID  -> Load media ID into map\n");
+	fprintf(stderr, "   import map|storage ID.. | -f file\n"
+					"                -> Place media into map or storage slots\n");
+	fprintf(stderr, "   export ID.. | -f file\n"
+					"                -> Remove media from map or storage slots\n");
 }
 
 /* check if media (tape) exists in directory (/opt/mhvtl/..) */
@@ -111,6 +119,72 @@ int check_media(int libno, char *barcode) {
 	return 0;
 }
 
+/* Upper bound (us) of the histogram bucket holding the 'pct' percentile */
+static uint64_t hist_pct(const struct stats_hist *h, uint64_t count, int pct) {
+	uint64_t want = (count * pct + 99) / 100;
+	uint64_t seen = 0;
+	int		 b;
+
+	for (b = 0; b < STATS_HIST_BUCKETS - 1; b++) {
+		seen += h->bucket[b];
+		if (seen >= want)
+			break;
+	}
+
+	return (b == STATS_HIST_BUCKETS - 1) ? h->max_us : (1ull << b);
+}
+
+static void print_hist(const char *name, const struct stats_hist *h, const uint64_t *errors) {
+	uint64_t count = h->count;
+	char	 err[24] = "";
+
+	if (!count)
+		return;
+
+	if (errors)
+		snprintf(err, sizeof(err), "%" PRIu64, *errors);
+	printf("  %-28s %10" PRIu64 " %8s %10" PRIu64 " %10" PRIu64 " %10" PRIu64,
+		   name, count, err, h->sum_us / count,
+		   hist_pct(h, count, 50), hist_pct(h, count, 99));
+	printf(" %10" PRIu64 "\n", h->max_us);
+}
+
+/* Dump the stats block of a running tape/library daemon */
+static int print_stats(long deviceNo) {
+	const struct mhvtl_stats *st;
+	int						  i;
+
+	st = stats_open(deviceNo);
+	if (!st) {
+		fprintf(stderr, "No statistics for device %ld - is it running?\n",
+				deviceNo);
+		return 1;
+	}
+
+	printf("Device: %ld (%s), pid: %u, up %ld seconds\n", (long)st->lu_id,
+		   st->lu_type == STATS_LU_LIBRARY ? "library" : "tape",
+		   st->pid, (long)(time(NULL) - st->start_time));
+	printf("Bytes from initiator: %" PRIu64 ", to initiator: %" PRIu64 "\n\n",
+		   st->bytes_in, st->bytes_out);
+
+	printf("  %-28s %10s %8s %10s %10s %10s %10s\n", "Phase",
+		   "count", "", "avg(us)", "p50(us)", "p99(us)", "max(us)");
+	for (i = 0; i < STATS_PHASES; i++)
+		print_hist(stats_phase_name(i), &st->phase[i], NULL);
+
+	printf("\n  %-28s %10s %8s %10s %10s %10s %10s\n", "Opcode",
+		   "count", "errors", "avg(us)", "p50(us)", "p99(us)", "max(us)");
+	for (i = 0; i < 256; i++) {
+		char name[48];
+
+		snprintf(name, sizeof(name), "0x%02x %s", i, stats_opcode_name(i));
+		print_hist(name, &st->op[i].latency, &st->op[i].errors);
+	}
+
+	stats_close(st);
+	return 0;
+}
+
 /* Display the answer from daemon/service */
 void DisplayResponse(int msqid, char *s) {
 	struct q_entry r_entry;
@@ -256,6 +330,24 @@ void Check_Close(int argc, char **argv) {
 	PrintErrorExit(argv[0], "close map");
 }
 
+/* import map|storage <ID..|-f file> */
+void Check_Import(int argc, char **argv) {
+	if (argc > 4 && (!strcmp(argv[3], "map") || !strcmp(argv[3], "storage"))) {
+		if (strcmp(argv[4], "-f") || argc == 6)
+			return;
+	}
+	PrintErrorExit(argv[0], "import");
+}
+
+/* export <ID..|-f file> */
+void Check_Export(int argc, char **argv) {
+	if (argc > 3) {
+		if (strcmp(argv[3], "-f") || argc == 5)
+			return;
+	}
+	PrintErrorExit(argv[0], "export");
+}
+
 void Check_Params(int argc, char **argv) {
 	if (argc > 1) {
 		if (!isnumeric(argv[1])) {
@@ -287,6 +379,11 @@ void Check_Params(int argc, char **argv) {
 			if (!strncasecmp(argv[2], "InquiryDataChange", 17)) {
 				return;
 			}
+			if (!strcmp(argv[2], "stats")) {
+				if (argc == 3)
+					return;
+				PrintErrorExit(argv[0], "stats");
+			}
 			if (!strncasecmp(argv[2], "TapeAlert", 9)) {
 				Check_TapeAlert(argc, argv);
 				return;
@@ -346,6 +443,14 @@ void Check_Params(int argc, char **argv) {
 				Check_Close(argc, argv);
 				return;
 			}
+			if (!strcmp(argv[2], "import")) {
+				Check_Import(argc, argv);
+				return;
+			}
+			if (!strcmp(argv[2], "export")) {
+				Check_Export(argc, argv);
+				return;
+			}
 			PrintErrorExit(argv[0], "check param");
 		}
 		PrintErrorExit(argv[0], "");
@@ -378,6 +483,62 @@ int OpenExistingQueue(key_t key) {
 	return queue_id;
 }
 
+/*
+ * The barcodes to import or export, from the command line or a file
+ * ('-' for stdin), are written to a file for the library to read rather
+ * than being sent a message each. 'first' is the first barcode argument.
+ *
+ * Returns 0 with the name of that file in 'path'
+ */
+static int write_barcode_list(int argc, char **argv, int first, char *path,
+							  size_t len) {
+	FILE *in, *out;
+	char  b[1024];
+	int	  fd, count;
+
+	snprintf(path, len, "/tmp/vtlcmd.XXXXXX");
+	fd = mkstemp(path);
+	if (fd < 0) {
+		fprintf(stderr, "Can not create %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	fchmod(fd, 0644); /* The library daemon may run as another user */
+	out = fdopen(fd, "w");
+	if (!out) {
+		close(fd);
+		unlink(path);
+		return -1;
+	}
+
+	if (!strcmp(argv[first], "-f")) {
+		if (!strcmp(argv[first + 1], "-"))
+			in = stdin;
+		else
+			in = fopen(argv[first + 1], "r");
+		if (!in) {
+			fprintf(stderr, "Can not open %s: %s\n", argv[first + 1],
+					strerror(errno));
+			fclose(out);
+			unlink(path);
+			return -1;
+		}
+		while ((count = fread(b, 1, sizeof(b), in)) > 0)
+			fwrite(b, 1, count, out);
+		if (in != stdin)
+			fclose(in);
+	} else {
+		for (count = first; count < argc; count++)
+			fprintf(out, "%s\n", argv[count]);
+	}
+
+	if (fclose(out)) {
+		fprintf(stderr, "Can not write %s: %s\n", path, strerror(errno));
+		unlink(path);
+		return -1;
+	}
+	return 0;
+}
+
 /* Send command to queue */
 int SendMsg(long ReceiverQid, long ReceiverMtyp, char *sndbuf) {
 	struct q_entry s_entry;
@@ -402,6 +563,7 @@ int main(int argc, char **argv) {
 	long  deviceNo, indx;
 	int	  count;
 	char  buf[1024];
+	char  list[64] = "";
 	char *p;
 
 	my_id = VTLCMD_Q;
@@ -409,7 +571,8 @@ int main(int argc, char **argv) {
 	if (get_config(device_conf, DEVICE_CONF, my_id) < 0)
 		exit(1);
 
-	if ((argc < 2) || (argc > 6)) {
+	if ((argc < 2) || (argc > 6 && strcmp(argv[2], "import") &&
+								 strcmp(argv[2], "export"))) {
 		usage(argv[0]);
 		exit(1);
 	}
@@ -476,12 +639,33 @@ int main(int argc, char **argv) {
 		exit(1);
 	}
 
+	/* Read straight out of shared memory - nothing to send */
+	if (!strcmp(argv[2], "stats"))
+		exit(print_stats(deviceNo));
+
+	/* Barcodes to import or export are sent as a file listing them */
+	if (!strcmp(argv[2], "import") || !strcmp(argv[2], "export")) {
+		if (device_type != TYPE_LIBRARY) {
+			fprintf(stderr, "Command for tape not allowed\n");
+			exit(1);
+		}
+		if (write_barcode_list(argc, argv, argv[2][0] == 'i' ? 4 : 3,
+							   list, sizeof(list)))
+			exit(1);
+		/* Our pid, for the library to check the list's owner against */
+		if (argv[2][0] == 'i')
+			snprintf(buf, sizeof(buf), "import %s %s %ld", argv[3], list,
+					 (long)getpid());
+		else
+			snprintf(buf, sizeof(buf), "export %s %ld", list, (long)getpid());
+	}
+
 	/* Concat all args into one string.
 	 * Bound each write by remaining buffer space so an oversized argv
 	 * cannot overflow buf[] (the outgoing message queue slot is
 	 * sizeof(buf) bytes).
 	 */
-	{
+	if (!list[0]) {
 		size_t remaining = sizeof(buf);
 		p				 = buf;
 		buf[0]			 = '\0';
@@ -508,6 +692,8 @@ int main(int argc, char **argv) {
 		} else if (!strncmp(buf, "empty map", 9)) {
 		} else if (!strncmp(buf, "list map", 8)) {
 		} else if (!strncmp(buf, "load map", 8)) {
+		} else if (!strncmp(buf, "import ", 7)) {
+		} else if (!strncmp(buf, "export ", 7)) {
 		} else if (!strncmp(buf, "verbose", 7)) {
 		} else if (!strncmp(buf, "debug", 5)) {
 		} else if (!strncmp(buf, "exit", 4)) {
@@ -556,11 +742,15 @@ int main(int argc, char **argv) {
 	ReceiverQid = OpenExistingQueue(QKEY);
 	if (ReceiverQid == -1) {
 		fprintf(stderr, "MessageQueue not available\n");
+		if (list[0])
+			unlink(list);
 		exit(1);
 	}
 
 	if (SendMsg(ReceiverQid, deviceNo, buf) < 0) {
 		fprintf(stderr, "Message Queue Error: send message\n");
+		if (list[0])
+			unlink(list);
 		exit(1);
 	}
 
@@ -577,6 +767,10 @@ int main(int argc, char **argv) {
 			DisplayResponse(ReceiverQid, "Contents: ");
 		if (!strcmp(argv[2], "load") && !strcmp(argv[3], "map"))
 			DisplayResponse(ReceiverQid, "");
+		if (list[0]) {
+			DisplayResponse(ReceiverQid, "");
+			unlink(list);
+		}
 	}
 
 	exit(0);
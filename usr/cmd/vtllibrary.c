@@ -49,6 +49,11 @@
 #include <ctype.h>
 #include <inttypes.h>
 #include <signal.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/file.h>
+#include <pthread.h>
 #include "vtl_common.h"
 #include "mhvtl_scsi.h"
 #include "mhvtl_list.h"
@@ -60,6 +65,11 @@
 #include "mode.h"
 #include "be_byteshift.h"
 #include "mhvtl_log.h"
+#include "mhvtl_stats.h"
+#include "mhvtl_trace.h"
+#include "vtlcart.h"
+#include "mhvtl_config.h"
+#include "subprocess.h"
 
 char mhvtl_driver_name[] = "vtllibrary";
 
@@ -70,12 +80,90 @@ char mhvtl_driver_name[] = "vtllibrary";
 
 #define SMC_BUF_SIZE 1024 * 1024 /* Default size of buffer */
 
-static uint8_t sam_status = 0; /* Non-zero if Sense-data is valid */
-static long	   backoff;		   /* Backoff value for polling char device */
+static long backoff; /* Backoff value for polling char device */
 
-static struct smc_priv smc_slots;
+static struct smc_priv smc_slots = {
+	.lock  = PTHREAD_MUTEX_INITIALIZER,
+	.moved = PTHREAD_COND_INITIALIZER,
+};
+
+/*
+ * Medium transport elements. 'Picker latency:' in device.conf is the time,
+ * in ms, each move takes - 'Picker <n> latency:' for picker n alone. With
+ * more than one picker in library_contents, each has a thread doing its
+ * moves while the main loop takes the next command - see picker_run().
+ * Drives answer a picker thread on a message id of its own.
+ */
+#define PICKER_REPLY_ID(id, n) ((id) | ((long)(n) << 24)) /* n from 1 */
+
+static int	picker_latency;	 /* ms, of pickers not given their own */
+static int *picker_ms;		 /* 'Picker <n> latency:', -1 if not given */
+static int	picker_ms_count;
+
+/* A MOVE MEDIUM waiting for its picker */
+struct smc_move {
+	struct list_head	siblings;
+	struct mhvtl_header hdr;
+	int					cdev;
+	useconds_t			pollInterval;
+};
+
+/*
+ * Background scrub of the cartridges in storage slots, one at a time with
+ * 'dump_tape -S' at the lowest priority, while the library is idle.
+ * 'Scrub interval:' (days between scrubs of a cartridge) in device.conf
+ * turns it on.
+ */
+#define SCRUB_DEFAULT_RATE 50	/* MB/s */
+#define SCRUB_RECHECK	   3600 /* Seconds between looks when none are due */
+
+static int		scrub_days;
+static int		scrub_rate;
+static pid_t	scrub_pid;
+static char		scrub_pcl[MAX_BARCODE_LEN + 1];
+static time_t	scrub_next;
+static uint32_t scrub_cursor; /* Slot of the last cartridge scrubbed */
+
+/*
+ * Drive pool - 'Drive pool:' in device.conf lists tape daemons any number
+ * of libraries share. The drives in library_contents with no drive of their
+ * own in device.conf are then logical drives: loading media into one binds
+ * it to the least loaded daemon of the pool no library holds, released
+ * again once it is unloaded. A daemon is held by a lock on POOL_CLAIM,
+ * which goes with the library should it exit. Its load is the share of
+ * time it has spent running commands, from its statistics segment,
+ * averaged over the last few samples.
+ */
+#define POOL_CLAIM	   "/dev/shm/mhvtl_pool.%ld"
+#define POOL_SAMPLE_MS 1000 /* Between samples of the daemons' load */
+
+struct pool_drive {
+	long					  drv_id;
+	int						  claim;   /* fd locking POOL_CLAIM, -1 if not held */
+	struct d_info			 *bound;   /* Logical drive it is bound to */
+	const struct mhvtl_stats *stats;   /* NULL while the daemon is not running */
+	uint64_t				  busy_us; /* Time in commands at the last sample */
+	uint32_t				  load;	   /* Per mille */
+	int						  tried;
+};
+
+static struct pool_drive *pool;
+static int				  pool_count;
+static uint64_t			  pool_sampled; /* ms */
+
+/*
+ * Library state journal - see journal_start().
+ * Set by __init_slot_info(): whether the .persist file was read, and the
+ * last journal record it includes
+ */
+#define JOURNAL_COMPACT 1024 /* Records before the .persist file is rewritten */
+
+static int		contents_persist;
+static uint64_t persist_seq;
 
 struct s_info *add_new_slot(struct lu_phy_attr *lu);
+static void	   journal_start(struct lu_phy_attr *lu);
+static void	   journal_compact(struct lu_phy_attr *lu);
 
 static void usage(char *progname) {
 	printf("Usage: %s [OPTIONS] -q <Q-number>\n", progname);
@@ -171,7 +259,7 @@ void register_ops(struct lu_phy_attr *lu, int op,
  *	SAM status returned in struct mhvtl_ds.sam_stat
  */
 static void processCommand(int cdev, uint8_t *cdb, struct mhvtl_ds *dbuf_p,
-						   useconds_t pollInterval) {
+						   useconds_t pollInterval, struct smc_picker *pk) {
 	int				 err = 0;
 	struct scsi_cmd	 _cmd;
 	struct scsi_cmd *cmd;
@@ -183,6 +271,7 @@ static void processCommand(int cdev, uint8_t *cdb, struct mhvtl_ds *dbuf_p,
 	cmd->lu			  = &lunit;
 	cmd->pollInterval = pollInterval;
 	cmd->cdev		  = cdev;
+	cmd->picker		  = pk;
 
 	MHVTL_DBG_PRT_CDB(1, cmd);
 
@@ -274,20 +363,68 @@ static struct s_info *locate_empty_map(void) {
 	return NULL;
 }
 
+/*
+ * Index of media_list by barcode - open addressing, kept under half full
+ */
+static struct m_info **media_hash;
+static uint32_t		   media_hash_size;
+static uint32_t		   media_hash_count;
+
+static uint32_t barcode_hash(const char *barcode) {
+	uint32_t h = 2166136261u; /* FNV-1a */
+
+	for (int i = 0; i <= MAX_BARCODE_LEN && barcode[i]; i++)
+		h = (h ^ (uint8_t)barcode[i]) * 16777619u;
+	return h;
+}
+
+static void media_hash_insert(struct m_info *m) {
+	struct m_info **old		 = media_hash;
+	uint32_t		old_size = media_hash_size;
+	uint32_t		i;
+
+	if ((media_hash_count + 1) * 2 > media_hash_size) {
+		media_hash_size = old_size ? old_size * 2 : 1024;
+		media_hash		= calloc(media_hash_size, sizeof(*media_hash));
+		if (!media_hash) {
+			MHVTL_ERR("Could not allocate memory");
+			exit(-ENOMEM);
+		}
+		media_hash_count = 0;
+		for (i = 0; i < old_size; i++)
+			if (old[i])
+				media_hash_insert(old[i]);
+		free(old);
+	}
+
+	i = barcode_hash(m->barcode) & (media_hash_size - 1);
+	while (media_hash[i])
+		i = (i + 1) & (media_hash_size - 1);
+	media_hash[i] = m;
+	media_hash_count++;
+}
+
+static void media_hash_free(void) {
+	free(media_hash);
+	media_hash		 = NULL;
+	media_hash_size	 = 0;
+	media_hash_count = 0;
+}
+
 static struct m_info *lookup_barcode(struct lu_phy_attr *lu, char *barcode) {
-	struct list_head *media_list_head;
-	struct m_info	 *m;
-	int				  match;
+	struct m_info *m;
+	uint32_t	   i;
 
-	media_list_head = &((struct smc_priv *)lu->lu_private)->media_list;
+	if (!media_hash_size)
+		return NULL;
 
-	list_for_each_entry(m, media_list_head, siblings) {
-		match = strncmp(m->barcode, barcode, MAX_BARCODE_LEN + 1);
-		if (!match) {
-			MHVTL_DBG(3, "Match barcodes: %s %s: %d",
-					  barcode, m->barcode, match);
+	i = barcode_hash(barcode) & (media_hash_size - 1);
+	while ((m = media_hash[i]) != NULL) {
+		if (!strncmp(m->barcode, barcode, MAX_BARCODE_LEN + 1)) {
+			MHVTL_DBG(3, "Match barcodes: %s %s", barcode, m->barcode);
 			return m;
 		}
+		i = (i + 1) & (media_hash_size - 1);
 	}
 
 	return NULL;
@@ -328,13 +465,36 @@ static struct m_info *add_barcode(struct lu_phy_attr *lu, char *barcode) {
 		m->internal_status = 0;
 
 	list_add_tail(&m->siblings, media_list_head);
+	media_hash_insert(m);
 	return m;
 }
 
+/* Media 'barcode' placed in MAP slot 'sp' by the operator */
+static void import_to_map(struct s_info *sp, char *barcode) {
+	struct m_info *mp;
+
+	mp = lookup_barcode(&lunit, barcode);
+	if (!mp)
+		mp = add_barcode(&lunit, barcode);
+
+	snprintf((char *)mp->barcode, MAX_BARCODE_LEN + 1, LEFT_JUST_16_STR,
+			 barcode);
+	mp->barcode[MAX_BARCODE_LEN] = '\0';
+
+	/* 1 = data, 2 = Clean */
+	mp->cart_type = get_cart_type(barcode);
+	sp->status	  = STATUS_InEnab | STATUS_ExEnab |
+				 STATUS_Access | STATUS_ImpExp |
+				 STATUS_Full;
+	/* Media placed by operator */
+	setImpExpStatus(sp, OPERATOR);
+	sp->media				   = mp;
+	sp->media->internal_status = 0;
+}
+
 /* Return zero - failed, non-zero - success */
 static int load_map(struct q_msg *msg) {
 	struct s_info *sp = NULL;
-	struct m_info *mp = NULL;
 	char		  *barcode;
 	int			   i;
 	int			   str_len;
@@ -373,23 +533,8 @@ static int load_map(struct q_msg *msg) {
 
 	sp = locate_empty_map();
 	if (sp) {
-		mp = lookup_barcode(&lunit, barcode);
-		if (!mp)
-			mp = add_barcode(&lunit, barcode);
-
-		snprintf((char *)mp->barcode, MAX_BARCODE_LEN + 1, LEFT_JUST_16_STR,
-				 barcode);
-		mp->barcode[MAX_BARCODE_LEN] = '\0';
-
-		/* 1 = data, 2 = Clean */
-		mp->cart_type = get_cart_type(barcode);
-		sp->status	  = STATUS_InEnab | STATUS_ExEnab |
-					 STATUS_Access | STATUS_ImpExp |
-					 STATUS_Full;
-		/* Media placed by operator */
-		setImpExpStatus(sp, OPERATOR);
-		sp->media				   = mp;
-		sp->media->internal_status = 0;
+		import_to_map(sp, barcode);
+		smc_journal(&smc_slots, 'I', 0, sp->slot_location, barcode);
 		send_msg("OK", msg->snd_id);
 		return 1;
 	}
@@ -403,6 +548,7 @@ static void open_map(struct q_msg *msg) {
 	current_state = MHVTL_STATE_OPENING_MAP;
 
 	smc_slots.cap_closed = CAP_OPEN;
+	smc_elements_changed(&smc_slots);
 	send_msg("OK", msg->snd_id);
 }
 
@@ -412,14 +558,14 @@ static void close_map(struct q_msg *msg) {
 	current_state = MHVTL_STATE_CLOSING_MAP;
 
 	smc_slots.cap_closed = CAP_CLOSED;
+	smc_elements_changed(&smc_slots);
 	send_msg("OK", msg->snd_id);
 }
 
 /* add new slot && assignment && initialization memory */
-static void add_storage_slot(struct q_msg *msg) {
+static struct s_info *new_storage_slot(void) {
 	int				 buffer_size;
 	int				 slt_no;
-	char			 message[20];
 	struct s_info	*sp1   = NULL;
 	struct smc_priv *smc_p = lunit.lu_private;
 
@@ -444,9 +590,18 @@ static void add_storage_slot(struct q_msg *msg) {
 	smc_slots.bufsize = buffer_size;
 	MHVTL_DBG(1, "Setting buffer size to %d", buffer_size);
 
-	sprintf(message, "slot=%d", slt_no);
+	return sp1;
+}
+
+static void add_storage_slot(struct q_msg *msg) {
+	char		   message[20];
+	struct s_info *sp;
+
+	sp = new_storage_slot();
+	smc_journal(&smc_slots, 'S', 0, sp->slot_location, NULL);
+
+	sprintf(message, "slot=%d", smc_slots.num_storage);
 	send_msg(message, msg->snd_id);
-	return;
 }
 
 /*
@@ -466,6 +621,8 @@ static int empty_map(struct q_msg *msg) {
 	list_for_each_entry(sp, slot_head, siblings) {
 		if (slotOccupied(sp) && sp->element_type == MAP_ELEMENT) {
 			setSlotEmpty(sp);
+			smc_journal(&smc_slots, 'E', sp->slot_location, 0,
+						sp->media ? sp->media->barcode : NULL);
 			MHVTL_DBG(2, "MAP slot %d emptied",
 					  sp->slot_location -
 						  smc_slots.pm->start_map);
@@ -476,6 +633,295 @@ static int empty_map(struct q_msg *msg) {
 	return 1;
 }
 
+/*
+ * Bulk import and export - 'import map <file>', 'import storage <file>' and
+ * 'export <file>', where <file> lists barcodes separated by white space.
+ * The slots are indexed once, every barcode placed or removed against that
+ * index, and the result written to the .persist file once, with a single
+ * reply for the lot.
+ */
+struct bulk_index {
+	struct s_info **slot; /* Occupied slots by barcode, open addressing */
+	uint32_t		size;
+	struct s_info **empty; /* Empty slots of the type imported to, in order */
+	uint32_t		empty_count;
+	uint32_t		next_empty;
+};
+
+static void bulk_index_insert(struct bulk_index *idx, struct s_info *sp) {
+	uint32_t i = barcode_hash(sp->media->barcode) & (idx->size - 1);
+
+	while (idx->slot[i])
+		i = (i + 1) & (idx->size - 1);
+	idx->slot[i] = sp;
+}
+
+/* 'barcode' as it is held in m_info - padded to MAX_BARCODE_LEN */
+static struct s_info *bulk_index_lookup(struct bulk_index *idx, char *barcode) {
+	struct s_info *sp;
+	uint32_t	   i = barcode_hash(barcode) & (idx->size - 1);
+
+	while ((sp = idx->slot[i]) != NULL) {
+		if (!strncmp(sp->media->barcode, barcode, MAX_BARCODE_LEN + 1))
+			return sp;
+		i = (i + 1) & (idx->size - 1);
+	}
+	return NULL;
+}
+
+/* Index the slots in one pass. Returns 0 on success */
+static int bulk_index_build(struct bulk_index *idx, int empty_type) {
+	struct s_info *sp;
+	uint32_t	   count = 0;
+
+	memset(idx, 0, sizeof(*idx));
+	list_for_each_entry(sp, &smc_slots.slot_list, siblings)
+		count++;
+
+	idx->size = 64;
+	while (idx->size < count * 2)
+		idx->size <<= 1;
+	idx->slot  = calloc(idx->size, sizeof(*idx->slot));
+	idx->empty = calloc(count + 1, sizeof(*idx->empty));
+	if (!idx->slot || !idx->empty) {
+		MHVTL_ERR("Could not allocate memory");
+		free(idx->slot);
+		free(idx->empty);
+		return -1;
+	}
+
+	list_for_each_entry(sp, &smc_slots.slot_list, siblings) {
+		if (slotOccupied(sp) && sp->media)
+			bulk_index_insert(idx, sp);
+		else if (sp->element_type == empty_type && !sp->busy)
+			idx->empty[idx->empty_count++] = sp;
+	}
+	return 0;
+}
+
+static void bulk_index_free(struct bulk_index *idx) {
+	free(idx->slot);
+	free(idx->empty);
+}
+
+#define BULK_LIST_PREFIX "/tmp/vtlcmd." /* As vtlcmd's mkstemp() names them */
+
+/* Owner of vtlcmd process 'pid', waiting on our reply to the request it
+ * named itself in. Returns (uid_t)-1 if there is no such process
+ */
+static uid_t sender_uid(long pid) {
+	struct stat st;
+	char		proc[32];
+
+	if (pid <= 0)
+		return (uid_t)-1;
+	snprintf(proc, sizeof(proc), "/proc/%ld", pid);
+	if (stat(proc, &st) < 0)
+		return (uid_t)-1;
+	return st.st_uid;
+}
+
+/*
+ * Open the barcode list an import or export names. Only a file vtlcmd
+ * wrote, owned by root or by the sender - vtlcmd process 'pid' - is read,
+ * never through a symlink. Returns NULL, having replied, if not
+ */
+static FILE *bulk_open_list(char *path, long pid, struct q_msg *msg) {
+	struct stat st;
+	FILE	   *fp;
+	int			fd;
+
+	if (strncmp(path, BULK_LIST_PREFIX, strlen(BULK_LIST_PREFIX)) ||
+		strchr(path + strlen(BULK_LIST_PREFIX), '/')) {
+		MHVTL_ERR("Barcode list %s not from vtlcmd - refused", path);
+		send_msg("Barcode list refused", msg->snd_id);
+		return NULL;
+	}
+	fd = open(path, O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_CLOEXEC);
+	if (fd < 0) {
+		MHVTL_ERR("Can not open %s: %s", path, strerror(errno));
+		send_msg("Can not open barcode list", msg->snd_id);
+		return NULL;
+	}
+	if (fstat(fd, &st) || !S_ISREG(st.st_mode) ||
+		(st.st_uid != 0 && st.st_uid != sender_uid(pid))) {
+		MHVTL_ERR("Barcode list %s not from vtlcmd - refused", path);
+		close(fd);
+		send_msg("Barcode list refused", msg->snd_id);
+		return NULL;
+	}
+	fp = fdopen(fd, "r");
+	if (!fp) {
+		close(fd);
+		send_msg("Can not open barcode list", msg->snd_id);
+	}
+	return fp;
+}
+
+/* Next barcode in 'fp', skipping '#' comments. Returns 0 at end of file */
+static int bulk_next_barcode(FILE *fp, char *tok, int len) {
+	char fmt[16];
+	int	 c;
+
+	snprintf(fmt, sizeof(fmt), "%%%ds", len - 1);
+	while (fscanf(fp, fmt, tok) == 1) {
+		if (tok[0] != '#')
+			return 1;
+		do
+			c = fgetc(fp);
+		while (c != '\n' && c != EOF);
+	}
+	return 0;
+}
+
+/* Media 'barcode' placed in storage slot 'sp' by the operator */
+static void import_to_storage(struct s_info *sp, char *barcode) {
+	struct m_info *mp;
+
+	mp = lookup_barcode(&lunit, barcode);
+	if (!mp)
+		mp = add_barcode(&lunit, barcode);
+	mp->cart_type		= get_cart_type(barcode);
+	mp->internal_status = 0;
+	sp->media			= mp;
+	sp->last_location	= 0;
+	setSlotFull(sp);
+}
+
+static void bulk_import(struct q_msg *msg) {
+	struct bulk_index idx;
+	struct s_info	 *sp;
+	FILE			 *fp;
+	char			  path[MAXTEXTLEN + 1];
+	char			  tok[64];
+	char			  barcode[MAX_BARCODE_LEN + 1];
+	char			  reply[128];
+	long			  pid = 0;
+	int				  to_map;
+	int				  imported = 0, present = 0, bad = 0, no_room = 0;
+
+	/* '<file> <pid>' from vtlcmd */
+	if (sscanf(msg->text, "import map %1024s %ld", path, &pid) >= 1)
+		to_map = 1;
+	else if (sscanf(msg->text, "import storage %1024s %ld", path, &pid) >= 1)
+		to_map = 0;
+	else {
+		send_msg("import map|storage <file>", msg->snd_id);
+		return;
+	}
+
+	if (to_map && smc_slots.cap_closed) {
+		send_msg("MAP not opened", msg->snd_id);
+		return;
+	}
+
+	fp = bulk_open_list(path, pid, msg);
+	if (!fp)
+		return;
+	if (bulk_index_build(&idx, to_map ? MAP_ELEMENT : STORAGE_ELEMENT)) {
+		fclose(fp);
+		send_msg("Out of memory", msg->snd_id);
+		return;
+	}
+
+	while (bulk_next_barcode(fp, tok, sizeof(tok))) {
+		if (strlen(tok) > MAX_BARCODE_LEN || !isalnum(tok[0])) {
+			MHVTL_DBG(2, "Bad barcode %s", tok);
+			bad++;
+			continue;
+		}
+		snprintf(barcode, sizeof(barcode), LEFT_JUST_16_STR, tok);
+		if (bulk_index_lookup(&idx, barcode)) {
+			present++;
+			continue;
+		}
+		if (idx.next_empty == idx.empty_count) {
+			no_room++;
+			continue;
+		}
+		sp = idx.empty[idx.next_empty++];
+		if (to_map)
+			import_to_map(sp, barcode);
+		else
+			import_to_storage(sp, barcode);
+		bulk_index_insert(&idx, sp);
+		MHVTL_DBG(2, "Imported %s to slot %d", tok, sp->slot_location);
+		imported++;
+	}
+	fclose(fp);
+	bulk_index_free(&idx);
+
+	if (imported && lunit.persist)
+		journal_compact(&lunit);
+
+	snprintf(reply, sizeof(reply),
+			 "Imported %d, %d already in library, %d bad barcode, %d no empty %s slot",
+			 imported, present, bad, no_room, to_map ? "MAP" : "storage");
+	MHVTL_LOG("%s", reply);
+	send_msg(reply, msg->snd_id);
+}
+
+/* Media in a drive, being moved, or in a MAP while it is closed, is left
+ * where it is - as empty_map() would refuse
+ */
+static void bulk_export(struct q_msg *msg) {
+	struct bulk_index idx;
+	struct s_info	 *sp;
+	FILE			 *fp;
+	char			  path[MAXTEXTLEN + 1];
+	char			  tok[64];
+	char			  barcode[MAX_BARCODE_LEN + 1];
+	char			  reply[128];
+	long			  pid	   = 0;
+	int				  exported = 0, absent = 0, in_use = 0, map_closed = 0;
+
+	if (sscanf(msg->text, "export %1024s %ld", path, &pid) < 1) {
+		send_msg("export <file>", msg->snd_id);
+		return;
+	}
+
+	fp = bulk_open_list(path, pid, msg);
+	if (!fp)
+		return;
+	if (bulk_index_build(&idx, 0)) {
+		fclose(fp);
+		send_msg("Out of memory", msg->snd_id);
+		return;
+	}
+
+	while (bulk_next_barcode(fp, tok, sizeof(tok))) {
+		snprintf(barcode, sizeof(barcode), LEFT_JUST_16_STR, tok);
+		sp = strlen(tok) > MAX_BARCODE_LEN ? NULL : bulk_index_lookup(&idx, barcode);
+		if (!sp || !slotOccupied(sp)) {
+			absent++;
+			continue;
+		}
+		if (sp->element_type == DATA_TRANSFER ||
+			sp->element_type == MEDIUM_TRANSPORT || sp->busy) {
+			in_use++;
+			continue;
+		}
+		if (sp->element_type == MAP_ELEMENT && smc_slots.cap_closed) {
+			map_closed++;
+			continue;
+		}
+		setSlotEmpty(sp);
+		MHVTL_DBG(2, "Exported %s from slot %d", tok, sp->slot_location);
+		exported++;
+	}
+	fclose(fp);
+	bulk_index_free(&idx);
+
+	if (exported && lunit.persist)
+		journal_compact(&lunit);
+
+	snprintf(reply, sizeof(reply),
+			 "Exported %d, %d not in library, %d in use, %d in closed MAP",
+			 exported, absent, in_use, map_closed);
+	MHVTL_LOG("%s", reply);
+	send_msg(reply, msg->snd_id);
+}
+
 /* Extract the id of the tape sending notification a tape was ejected
  * Set the 'access' bit in the READ_ELEMENT_STATUS page
  */
@@ -525,6 +971,10 @@ static int processMessageQ(struct q_msg *msg) {
 		list_map(msg);
 	if (!strncmp(msg->text, "load map ", 9))
 		load_map(msg);
+	if (!strncmp(msg->text, "import ", 7))
+		bulk_import(msg);
+	if (!strncmp(msg->text, "export ", 7))
+		bulk_export(msg);
 	if (!strncmp(msg->text, "InquiryDataChange", 17))
 		set_inquiry_data_changed();
 	if (!strncmp(msg->text, "offline", 7)) {
@@ -586,48 +1036,49 @@ struct s_info *add_new_slot(struct lu_phy_attr *lu) {
 	}
 
 	list_add_tail(&new->siblings, slot_list_head);
+	smc_elements_changed(lu->lu_private);
 	return new;
 }
 
-/* Open device config file and update device information
- */
-static void update_drive_details(struct lu_phy_attr *lu) {
-	char			 device_conf[CONF_FILE_SZ];
-	FILE			*conf;
-	char			*b; /* Read from file into this buffer */
-	char			*s; /* Somewhere for sscanf to store results */
+/* Drive details from device.conf, up to offset 'end' (-1: to the end) */
+/* Serial number and inquiry data of drive 'dp' from its device.conf line 'b' */
+static void read_drive_identity(struct d_info *dp, char *b, char *s) {
+	if (sscanf(b, " Unit serial number: %s", s) > 0) {
+		strncpy(dp->inq_product_sno, s, 10);
+		rmnl(dp->inq_product_sno, ' ', 10);
+	}
+	if (sscanf(b, " Product identification: %16c", s) > 0) {
+		/* sscanf does not NULL terminate */
+		/* 25 is len of ' Product identification: ' */
+		s[strlen(b) - 25] = '\0';
+		strncpy(dp->inq_product_id, s, 16);
+		dp->inq_product_id[16] = 0;
+		MHVTL_DBG(3, "id: \'%s\', inq_product_id: \'%s\'",
+				  s, dp->inq_product_id);
+	}
+	if (sscanf(b, " Product revision level: %s", s) > 0) {
+		strncpy(dp->inq_product_rev, s, 4);
+		rmnl(dp->inq_product_rev, ' ', 4);
+	}
+	if (sscanf(b, " Vendor identification: %s", s) > 0) {
+		strncpy(dp->inq_vendor_id, s, 8);
+		rmnl(dp->inq_vendor_id, ' ', 8);
+	}
+}
+
+static void read_drive_details(struct lu_phy_attr *lu, FILE *conf, char *b,
+							   char *s, off_t end) {
 	int				 slot;
 	long			 drv_id, lib_id;
 	struct d_info	*dp;
 	struct s_info	*sp;
 	struct smc_priv *smc_p = lu->lu_private;
 
-	if (get_config(device_conf, DEVICE_CONF, my_id) < 0)
-		exit(1);
-
-	conf = fopen(device_conf, "r");
-	if (!conf) {
-		MHVTL_DBG(1, "Can not open config file %s : %s", device_conf,
-				  strerror(errno));
-		perror("Can not open config file");
-		exit(1);
-	}
-	s = zalloc(MALLOC_SZ);
-	if (!s) {
-		perror("Could not allocate memory");
-		exit(1);
-	}
-	b = zalloc(MALLOC_SZ);
-	if (!b) {
-		perror("Could not allocate memory");
-		exit(1);
-	}
-
 	drv_id = -1;
 	dp	   = NULL;
 
 	/* While read in a line */
-	while (readline(b, MALLOC_SZ, conf) != NULL) {
+	while ((end < 0 || ftello(conf) < end) && readline(b, MALLOC_SZ, conf) != NULL) {
 		if (b[0] == '#') /* Ignore comments */
 			continue;
 		if (sscanf(b, "Drive: %ld", &drv_id) > 0)
@@ -657,38 +1108,286 @@ static void update_drive_details(struct lu_phy_attr *lu) {
 			dp->drv_id = drv_id;
 			continue;
 		}
-		if (dp) {
-			if (sscanf(b, " Unit serial number: %s", s) > 0) {
-				strncpy(dp->inq_product_sno, s, 10);
-				rmnl(dp->inq_product_sno, ' ', 10);
-			}
-			if (sscanf(b, " Product identification: %16c", s) > 0) {
-				/* sscanf does not NULL terminate */
-				/* 25 is len of ' Product identification: ' */
-				s[strlen(b) - 25] = '\0';
-				strncpy(dp->inq_product_id, s, 16);
-				dp->inq_product_id[16] = 0;
-				MHVTL_DBG(3, "id: \'%s\', inq_product_id: \'%s\'",
-						  s, dp->inq_product_id);
-			}
-			if (sscanf(b, " Product revision level: %s", s) > 0) {
-				strncpy(dp->inq_product_rev, s, 4);
-				rmnl(dp->inq_product_rev, ' ', 4);
-			}
-			if (sscanf(b, " Vendor identification: %s", s) > 0) {
-				strncpy(dp->inq_vendor_id, s, 8);
-				rmnl(dp->inq_vendor_id, ' ', 8);
-			}
-		}
+		if (dp)
+			read_drive_identity(dp, b, s);
 		if (strlen(b) == 1) { /* Blank line => Reset device pointer */
 			drv_id = -1;
 			dp	   = NULL;
 		}
 	}
+}
+
+static uint64_t pool_now_ms(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* 'Drive pool: <id> [<id>-<id>] ..' */
+static void pool_parse(char *list) {
+	struct pool_drive *p;
+	char			  *tok, *save;
+	long			   first, last, id;
+	int				   n;
+
+	for (tok = strtok_r(list, " ,\t", &save); tok;
+		 tok = strtok_r(NULL, " ,\t", &save)) {
+		n = sscanf(tok, "%ld-%ld", &first, &last);
+		if (n < 1 || first < 1 || (n == 2 && last < first)) {
+			MHVTL_ERR("Drive pool: '%s' is not a drive id or range", tok);
+			continue;
+		}
+		if (n == 1)
+			last = first;
+		for (id = first; id <= last; id++) {
+			p = realloc(pool, (pool_count + 1) * sizeof(*pool));
+			if (!p) {
+				MHVTL_ERR("Could not allocate memory");
+				return;
+			}
+			pool = p;
+			memset(&pool[pool_count], 0, sizeof(*pool));
+			pool[pool_count].drv_id = id;
+			pool[pool_count].claim	= -1;
+			pool_count++;
+		}
+	}
+}
+
+static uint64_t pool_busy_us(const struct mhvtl_stats *st) {
+	uint64_t us = 0;
+
+	for (int i = 0; i < 256; i++)
+		us += __atomic_load_n(&st->op[i].latency.sum_us, __ATOMIC_RELAXED);
+	return us;
+}
+
+/* How busy each daemon of the pool has been since the last sample */
+static void pool_sample(void) {
+	struct pool_drive *pd;
+	uint64_t		   now = pool_now_ms();
+	uint64_t		   elapsed, busy, util;
+
+	if (pool_sampled && now - pool_sampled < POOL_SAMPLE_MS)
+		return;
+	elapsed		 = pool_sampled ? now - pool_sampled : 0;
+	pool_sampled = now;
+
+	for (pd = pool; pd < pool + pool_count; pd++) {
+		if (pd->stats && kill(pd->stats->pid, 0) && errno == ESRCH) {
+			stats_close(pd->stats);
+			pd->stats = NULL;
+		}
+		if (!pd->stats) {
+			pd->stats = stats_open(pd->drv_id);
+			if (pd->stats)
+				pd->busy_us = pool_busy_us(pd->stats);
+			continue;
+		}
+		busy = pool_busy_us(pd->stats);
+		util = 0;
+		if (elapsed && busy > pd->busy_us) /* us per ms is per mille */
+			util = min((busy - pd->busy_us) / elapsed, (uint64_t)1000);
+		pd->load	= (pd->load * 3 + util) / 4;
+		pd->busy_us = busy;
+	}
+}
+
+/* Lock daemon 'pd' for this library. Returns 0 if it is ours */
+static int pool_claim(struct pool_drive *pd) {
+	char path[64];
+	char pcl[MAX_BARCODE_LEN + 1];
+	int	 fd;
+
+	snprintf(path, sizeof(path), POOL_CLAIM, pd->drv_id);
+	fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		MHVTL_ERR("Can not open %s: %s", path, strerror(errno));
+		return -1;
+	}
+	if (flock(fd, LOCK_EX | LOCK_NB)) {
+		close(fd); /* Another library has it */
+		return -1;
+	}
+	if (stats_read_media(pd->stats, pcl, sizeof(pcl))) {
+		MHVTL_LOG("Pool drive %ld stats unreadable - skipped", pd->drv_id);
+		close(fd);
+		return -1;
+	}
+	/* Loaded by hand, 'vtlcmd <id> load' */
+	if (pcl[0]) {
+		MHVTL_DBG(2, "Pool drive %ld has %s loaded", pd->drv_id, pcl);
+		close(fd);
+		return -1;
+	}
+	pd->claim = fd;
+	return 0;
+}
+
+/* Serial number and inquiry data of pool drive 'dp->drv_id' */
+static void pool_identity(struct d_info *dp) {
+	const struct conf_device *d;
+	char					  device_conf[CONF_FILE_SZ];
+	FILE					 *conf;
+	char					 *b, *s;
+	off_t					  end;
+
+	d = config_find(dp->drv_id, CONF_DRIVE);
+	if (!d || get_config(device_conf, DEVICE_CONF, my_id) < 0)
+		return;
+	conf = fopen(device_conf, "r");
+	if (!conf)
+		return;
+	b = zalloc(MALLOC_SZ);
+	s = zalloc(MALLOC_SZ);
+	if (b && s) {
+		end = config_stanza(conf, d);
+		while (ftello(conf) < end && readline(b, MALLOC_SZ, conf) != NULL)
+			read_drive_identity(dp, b, s);
+	}
+	free(b);
+	free(s);
+	fclose(conf);
+}
+
+/*
+ * Bind logical drive 'dp' to the least loaded daemon of the pool no
+ * library holds. Returns 0 on success
+ */
+static int pool_bind(struct smc_priv *smc_p, struct d_info *dp) {
+	struct pool_drive *pd, *best;
+	char			   msg[32];
+
+	pool_sample();
+	for (pd = pool; pd < pool + pool_count; pd++)
+		pd->tried = 0;
+	for (;;) {
+		best = NULL;
+		for (pd = pool; pd < pool + pool_count; pd++) {
+			if (pd->tried || pd->claim >= 0 || !pd->stats)
+				continue;
+			if (!best || pd->load < best->load)
+				best = pd;
+		}
+		if (!best)
+			return -1;
+		best->tried = 1;
+		if (!pool_claim(best))
+			break;
+	}
+
+	best->bound = dp;
+	dp->drv_id	= best->drv_id;
+	pool_identity(dp);
+	smc_element_changed(dp->slot); /* Serial number reported for the drive */
+
+	/* Media is now looked for in this library's home directory */
+	snprintf(msg, sizeof(msg), "Register %ld", my_id);
+	send_msg(msg, dp->drv_id);
+
+	MHVTL_LOG("Drive %d bound to pool drive %ld, load %u.%u%%",
+			  dp->slot->slot_location - smc_p->pm->start_drive + 1, best->drv_id,
+			  best->load / 10, best->load % 10);
+	return 0;
+}
+
+static void pool_release(struct smc_priv *smc_p, struct d_info *dp) {
+	struct pool_drive *pd;
+
+	for (pd = pool; pd < pool + pool_count; pd++) {
+		if (pd->bound != dp)
+			continue;
+		MHVTL_DBG(1, "Drive %d released pool drive %ld",
+				  dp->slot->slot_location - smc_p->pm->start_drive + 1, pd->drv_id);
+		close(pd->claim);
+		pd->claim = -1;
+		pd->bound = NULL;
+	}
+	dp->drv_id = 0;
+}
+
+/* Drives with no daemon of their own in device.conf are served by the pool */
+static void pool_drives(struct lu_phy_attr *lu) {
+	struct smc_priv *smc_p = lu->lu_private;
+	struct d_info	*dp;
+	int				 n = 0;
+
+	list_for_each_entry(dp, &smc_p->drive_list, siblings) {
+		if (dp->drv_id)
+			continue;
+		dp->pooled = 1;
+		n++;
+	}
+	smc_p->bind_drive	 = pool_bind;
+	smc_p->release_drive = pool_release;
+	pool_sample();
+	MHVTL_LOG("%d drives served by a pool of %d", n, pool_count);
+}
+
+static void pool_free(void) {
+	struct pool_drive *pd;
+
+	for (pd = pool; pd < pool + pool_count; pd++) {
+		if (pd->claim >= 0)
+			close(pd->claim);
+		if (pd->stats)
+			stats_close(pd->stats);
+	}
+	free(pool);
+	pool		 = NULL;
+	pool_count	 = 0;
+	pool_sampled = 0;
+}
+
+/* Open device config file and update device information
+ */
+static void update_drive_details(struct lu_phy_attr *lu) {
+	const struct mhvtl_config *cfg;
+	const struct conf_device  *d;
+	char					   device_conf[CONF_FILE_SZ];
+	FILE					  *conf;
+	char					  *b; /* Read from file into this buffer */
+	char					  *s; /* Somewhere for sscanf to store results */
+
+	if (get_config(device_conf, DEVICE_CONF, my_id) < 0)
+		exit(1);
+
+	conf = fopen(device_conf, "r");
+	if (!conf) {
+		MHVTL_DBG(1, "Can not open config file %s : %s", device_conf,
+				  strerror(errno));
+		perror("Can not open config file");
+		exit(1);
+	}
+	s = zalloc(MALLOC_SZ);
+	if (!s) {
+		perror("Could not allocate memory");
+		exit(1);
+	}
+	b = zalloc(MALLOC_SZ);
+	if (!b) {
+		perror("Could not allocate memory");
+		exit(1);
+	}
+
+	/* Only the lines of drives in this library, if device.conf has been parsed */
+	cfg = config_load();
+	if (cfg) {
+		for_each_conf_device(cfg, d)
+			if (d->type == CONF_DRIVE && d->library_id == my_id)
+				read_drive_details(lu, conf, b, s, config_stanza(conf, d));
+	} else {
+		read_drive_details(lu, conf, b, s, -1);
+	}
+	smc_elements_changed(lu->lu_private); /* Drive serial numbers, inquiry */
 
 	free(b);
 	free(s);
 	fclose(conf);
+
+	if (pool_count)
+		pool_drives(lu);
 }
 
 /*
@@ -880,19 +1579,245 @@ void init_storage_slot(struct lu_phy_attr *lu, int slt, char *barcode) {
 	}
 }
 
-static void __init_slot_info(struct lu_phy_attr *lu, int type) {
-	char		lib_conf[CONF_FILE_SZ];
-	FILE	   *ctrl;
-	char	   *b; /* Read from file into this buffer */
-	char	   *s; /* Somewhere for sscanf to store results */
-	int			slt;
+/*
+ * library_contents is read in one pass into a list of elements per type,
+ * holes in the Drive and Slot numbering filled in, and the elements then
+ * created type by type in address order.
+ *
+ * The lists are also kept in CONTENTS_CACHE, with the identity of the file
+ * they were read from, so that the next start-up with that file unchanged
+ * loads them with a single read.
+ */
+#define CONTENTS_CACHE		   "/dev/shm/mhvtl_contents"
+#define CONTENTS_CACHE_MAGIC   0x6d68766c /* "mhvl" */
+#define CONTENTS_CACHE_VERSION 1
+
+struct contents_entry {
+	uint8_t	 type;
+	uint8_t	 pad[3];
+	uint32_t slot;
+	char	 text[MAX_BARCODE_LEN + 1]; /* Barcode, drive serial number */
+	char	 pad2[7];
+};
+
+struct contents_cache_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t record_size;
+	uint32_t count;
+	uint64_t dev;
+	uint64_t ino;
+	uint64_t size;
+	int64_t	 mtime_sec;
+	int64_t	 mtime_nsec;
+	uint64_t persist_seq;
+	uint32_t persist;
+	uint32_t pad;
+	char	 lib_conf[CONF_FILE_SZ];
+};
+
+struct contents_list {
+	struct contents_entry *e;
+	int					   count;
+	int					   alloc;
+	int					   next; /* Next slot number expected */
+};
+
+static void contents_add(struct contents_list *l, int type, int slt, const char *text) {
+	struct contents_entry *e;
+
+	if (l->count == l->alloc) {
+		e = realloc(l->e, (l->alloc + 1024) * sizeof(*e));
+		if (!e) {
+			MHVTL_ERR("Could not allocate memory");
+			exit(-ENOMEM);
+		}
+		l->e = e;
+		l->alloc += 1024;
+	}
+	e = &l->e[l->count++];
+	memset(e, 0, sizeof(*e));
+	e->type = type;
+	e->slot = slt;
+	/* Only the first 10 characters of a drive serial number are used */
+	if (type != DATA_TRANSFER && strlen(text) > MAX_BARCODE_LEN) {
+		MHVTL_ERR("Barcode \'%s\' exceeds max barcode lenght: %d",
+				  text, MAX_BARCODE_LEN);
+		exit(1);
+	}
+	snprintf(e->text, sizeof(e->text), "%s", text);
+}
+
+/* Drive and Slot numbers missing from the file are created empty */
+static void contents_fill_to(struct contents_list *l, int type, int slt) {
+	if (slt > l->next) {
+		MHVTL_DBG(1, "Config file is missing %s %d - Creating empty records up to %d",
+				  slot_type_str(type), l->next, slt);
+		for (; l->next < slt; l->next++)
+			contents_add(l, type, l->next, "");
+	}
+	l->next = slt + 1;
+}
+
+/* Elements in 'ctrl', in lists indexed by element type */
+static void contents_parse(FILE *ctrl, struct contents_list *list, char *b, char *s) {
+	int slt;
+
+	while (readline(b, MALLOC_SZ, ctrl) != NULL) {
+		if (contents_persist &&
+			sscanf(b, "# Journal sequence: %" SCNu64, &persist_seq) == 1)
+			continue;
+		if (b[0] == '#') /* Ignore comments */
+			continue;
+		s[0] = '\0';
+
+		if (!strncmp(b, "Drive ", 6)) {
+			if (sscanf(b, "Drive %d: %s", &slt, s) >= 1) {
+				contents_fill_to(&list[DATA_TRANSFER], DATA_TRANSFER, slt);
+				contents_add(&list[DATA_TRANSFER], DATA_TRANSFER, slt, s);
+			}
+		} else if (!strncmp(b, "MAP ", 4)) {
+			if (sscanf(b, "MAP %d: %s", &slt, s) >= 1)
+				contents_add(&list[MAP_ELEMENT], MAP_ELEMENT, slt, s);
+		} else if (!strncmp(b, "Picker ", 7)) {
+			if (sscanf(b, "Picker %d: %s", &slt, s) >= 1)
+				contents_add(&list[MEDIUM_TRANSPORT], MEDIUM_TRANSPORT, slt, s);
+		} else if (!strncmp(b, "Slot ", 5)) {
+			if (sscanf(b, "Slot %d: %s", &slt, s) >= 1) {
+				contents_fill_to(&list[STORAGE_ELEMENT], STORAGE_ELEMENT, slt);
+				contents_add(&list[STORAGE_ELEMENT], STORAGE_ELEMENT, slt, s);
+			}
+		}
+	}
+}
+
+static void contents_cache_path(char *buf, size_t len) {
+	snprintf(buf, len, "%s.%ld", CONTENTS_CACHE, my_id);
+}
+
+static void contents_cache_header_init(struct contents_cache_header *h,
+									   const char *lib_conf, const struct stat *st) {
+	memset(h, 0, sizeof(*h));
+	h->magic	   = CONTENTS_CACHE_MAGIC;
+	h->version	   = CONTENTS_CACHE_VERSION;
+	h->record_size = sizeof(struct contents_entry);
+	h->dev		   = st->st_dev;
+	h->ino		   = st->st_ino;
+	h->size		   = st->st_size;
+	h->mtime_sec   = st->st_mtim.tv_sec;
+	h->mtime_nsec  = st->st_mtim.tv_nsec;
+	snprintf(h->lib_conf, sizeof(h->lib_conf), "%s", lib_conf);
+}
+
+/* Returns 0 if the cache holds 'lib_conf' as it is now */
+static int contents_cache_read(const char *lib_conf, const struct stat *st,
+							   struct contents_list *list) {
+	struct contents_cache_header want, *h;
+	struct contents_entry		*e;
+	struct stat					 cst;
+	char						 path[64];
+	char						*buf;
+	uint32_t					 i;
+	int							 fd;
+
+	contents_cache_path(path, sizeof(path));
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	/* Only trust what we, or root, wrote */
+	if (fstat(fd, &cst) || (cst.st_uid != 0 && cst.st_uid != geteuid()) ||
+		cst.st_size < (off_t)sizeof(*h)) {
+		close(fd);
+		return -1;
+	}
+
+	buf = malloc(cst.st_size);
+	if (!buf || read(fd, buf, cst.st_size) != cst.st_size)
+		goto fail;
+
+	h = (struct contents_cache_header *)buf;
+	contents_cache_header_init(&want, lib_conf, st);
+	want.count		 = h->count;
+	want.persist_seq = h->persist_seq;
+	want.persist	 = h->persist;
+	if (memcmp(&want, h, sizeof(want)) ||
+		cst.st_size != (off_t)(sizeof(*h) + h->count * sizeof(*e)))
+		goto fail;
+
+	e = (struct contents_entry *)(buf + sizeof(*h));
+	for (i = 0; i < h->count; i++) {
+		if (!e[i].type || e[i].type > 4)
+			goto fail;
+		e[i].text[MAX_BARCODE_LEN] = '\0';
+		contents_add(&list[e[i].type], e[i].type, e[i].slot, e[i].text);
+	}
+	contents_persist = h->persist;
+	persist_seq		 = h->persist_seq;
+
+	MHVTL_DBG(2, "%u elements of %s from %s", h->count, lib_conf, path);
+	free(buf);
+	close(fd);
+	return 0;
+
+fail:
+	for (i = 1; i < 5; i++)
+		list[i].count = 0;
+	free(buf);
+	close(fd);
+	return -1;
+}
+
+static void contents_cache_write(const char *lib_conf, const struct stat *st,
+								 struct contents_list *list, struct smc_type_slot *arr,
+								 int persist, uint64_t seq) {
+	struct contents_cache_header h;
+	char						 path[64], tmp[80];
+	int							 i, fd, ok;
+
+	contents_cache_path(path, sizeof(path));
+	snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+	/* Never through a file, or symlink, someone else left there */
+	fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0644);
+	if (fd < 0 && errno == EEXIST && !unlink(tmp)) /* An earlier us died */
+		fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		MHVTL_DBG(2, "Can not create %s: %s", tmp, strerror(errno));
+		return;
+	}
+
+	contents_cache_header_init(&h, lib_conf, st);
+	for (i = 1; i < 5; i++)
+		h.count += list[i].count;
+	h.persist_seq = seq;
+	h.persist	  = persist;
+
+	ok = write(fd, &h, sizeof(h)) == sizeof(h);
+	/* In the order the elements are created */
+	for (i = 0; i < 4 && ok; i++) {
+		struct contents_list *l = &list[(int)arr[i].type];
+		ssize_t				  len = l->count * sizeof(*l->e);
+
+		ok = write(fd, l->e, len) == len;
+	}
+	close(fd);
+	if (!ok || rename(tmp, path)) {
+		MHVTL_DBG(2, "Can not write %s: %s", tmp, strerror(errno));
+		unlink(tmp);
+	}
+}
+
+/*
+ * The file to read the library contents from: library_contents.<id>.persist
+ * if PERSIST is set and it is newer than library_contents.<id>
+ */
+static void library_contents_file(struct lu_phy_attr *lu, char *lib_conf) {
 	struct stat configstat;
 	struct stat persiststat;
 	int			filestat;
-	int			start_slot = 1; /* Slot creation needs to start with 1 */
-	int			z;
 
-	filestat = -1; /* Default to .persist file does not exist */
+	filestat		 = -1; /* Default to .persist file does not exist */
+	contents_persist = 0;
+	persist_seq		 = 0;
 
 	/* Lets stat each (potential) file and identify the last one modified */
 	get_config(lib_conf, LIBCONTENTS_PERSIST, my_id);
@@ -924,8 +1849,29 @@ static void __init_slot_info(struct lu_phy_attr *lu, int type) {
 			   library_contents.<id>.persist
 			*/
 			get_config(lib_conf, LIBCONTENTS_PERSIST, my_id);
+			contents_persist = 1;
 		}
 	}
+}
+
+/* Linked list data needs to be built in slot order */
+void init_slot_info(struct lu_phy_attr *lu) {
+	char				 lib_conf[CONF_FILE_SZ];
+	struct contents_list list[5];
+	struct contents_list *l;
+	struct smc_type_slot arr[4];
+	struct stat			 st;
+	FILE				*ctrl;
+	char				*b; /* Read from file into this buffer */
+	char				*s; /* Somewhere for sscanf to store results */
+	int					 i, j;
+
+	memset(list, 0, sizeof(list));
+	for (i = 0; i < 5; i++)
+		list[i].next = 1; /* Slot creation needs to start with 1 */
+
+	sort_library_slot_type(lu, &arr[0]);
+	library_contents_file(lu, lib_conf);
 
 	/* By the time we get here -
 	 * - If PERSIST is enabled
@@ -934,89 +1880,54 @@ static void __init_slot_info(struct lu_phy_attr *lu, int type) {
 	 * - Filename will be latest modify date
 	 */
 	ctrl = fopen(lib_conf, "r");
-	if (!ctrl) {
+	if (!ctrl || fstat(fileno(ctrl), &st)) {
 		MHVTL_ERR("Can not open config file %s : %s", lib_conf,
 				  strerror(errno));
 		exit(1);
 	}
 
-	/* Log which config file is being used to read in data */
-	MHVTL_DBG(2, "Reading %s configuration information from %s",
-			  slot_type_str(type),
-			  lib_conf);
+	if (contents_cache_read(lib_conf, &st, list)) {
+		/* Log which config file is being used to read in data */
+		MHVTL_DBG(2, "Reading configuration information from %s", lib_conf);
 
-	/* Grab a couple of generic MALLOC_SZ buffers.. */
-	s = zalloc(MALLOC_SZ);
-	if (!s) {
-		perror("Could not allocate memory");
-		exit(1);
-	}
-	b = zalloc(MALLOC_SZ);
-	if (!b) {
-		perror("Could not allocate memory");
-		exit(1);
+		/* Grab a couple of generic MALLOC_SZ buffers.. */
+		s = zalloc(MALLOC_SZ);
+		b = zalloc(MALLOC_SZ);
+		if (!s || !b) {
+			perror("Could not allocate memory");
+			exit(1);
+		}
+		contents_parse(ctrl, list, b, s);
+		free(b);
+		free(s);
+		contents_cache_write(lib_conf, &st, list, arr, contents_persist,
+							 persist_seq);
 	}
+	fclose(ctrl);
 
-	rewind(ctrl);
-	while (readline(b, MALLOC_SZ, ctrl) != NULL) {
-		if (b[0] == '#') /* Ignore comments */
-			continue;
-		s[0] = '\0';
-
-		switch (type) {
-		case DATA_TRANSFER:
-			if (sscanf(b, "Drive %d: %s", &slt, s)) {
-				if (slt > start_slot) {
-					/* Config file has holes - fill in empty slots */
-					MHVTL_DBG(1, "Config file is missing Drive %d - Creating empty records up to drive %d", start_slot, slt);
-					for (z = start_slot; z < slt; z++) {
-						init_drive_slot(lu, z, "");
-					}
-				}
-				init_drive_slot(lu, slt, s);
-				start_slot = slt + 1;
-			}
-			break;
-
-		case MAP_ELEMENT:
-			if (sscanf(b, "MAP %d: %s", &slt, s))
-				init_map_slot(lu, slt, s);
-			break;
-
-		case MEDIUM_TRANSPORT:
-			if (sscanf(b, "Picker %d: %s", &slt, s))
-				init_transport_slot(lu, slt, s);
-			break;
-
-		case STORAGE_ELEMENT:
-			if (sscanf(b, "Slot %d: %s", &slt, s)) {
-				if (slt > start_slot) {
-					/* Config file has holes - fill in empty slots */
-					MHVTL_DBG(1, "Config file is missing Slot %d - Creating empty slots up to %d", start_slot, slt);
-					for (z = start_slot; z < slt; z++) {
-						init_storage_slot(lu, z, "");
-					}
-				}
-				init_storage_slot(lu, slt, s);
-				start_slot = slt + 1;
+	for (i = 0; i < 4; i++) {
+		l = &list[(int)arr[i].type];
+		for (j = 0; j < l->count; j++) {
+			switch (arr[i].type) {
+			case DATA_TRANSFER:
+				init_drive_slot(lu, l->e[j].slot, l->e[j].text);
+				break;
+			case MAP_ELEMENT:
+				init_map_slot(lu, l->e[j].slot, l->e[j].text);
+				break;
+			case MEDIUM_TRANSPORT:
+				init_transport_slot(lu, l->e[j].slot, l->e[j].text);
+				break;
+			case STORAGE_ELEMENT:
+				init_storage_slot(lu, l->e[j].slot, l->e[j].text);
+				break;
 			}
-			break;
 		}
 	}
-	fclose(ctrl);
-	free(b);
-	free(s);
-}
-
-/* Linked list data needs to be built in slot order */
-void init_slot_info(struct lu_phy_attr *lu) {
-	int					 i;
-	struct smc_type_slot arr[4];
-
-	sort_library_slot_type(lu, &arr[0]);
+	for (i = 0; i < 5; i++)
+		free(list[i].e);
 
-	for (i = 0; i < 4; i++)
-		__init_slot_info(lu, arr[i].type);
+	journal_start(lu);
 }
 
 /* Return original slot location if empty
@@ -1052,24 +1963,13 @@ static struct s_info *find_empty_storage_slot(struct s_info	   *s,
 	return NULL;
 }
 
-/* Save config on shutdown - Not to be called at other times !! */
-static void save_config(struct lu_phy_attr *lu) {
-	FILE			 *ctrl;
-	char			  lib_conf[CONF_FILE_SZ];
+/* Move media left in drives back to storage, where it came from if possible */
+static void unload_drives(struct lu_phy_attr *lu) {
 	struct smc_priv	 *lu_priv;
 	struct list_head *slot_head;
 	struct list_head *drive_head;
 	struct s_info	 *sp; /* Slot Pointer */
 	struct d_info	 *dp; /* Drive Pointer */
-	int				  last_element_type = 0;
-
-	get_config(lib_conf, LIBCONTENTS_PERSIST, my_id);
-	ctrl = fopen(lib_conf, "w");
-	if (!ctrl) {
-		MHVTL_ERR("Can not open file %s to save state : %s", lib_conf,
-				  strerror(errno));
-		return;
-	}
 
 	lu_priv = lu->lu_private;
 
@@ -1089,7 +1989,7 @@ static void save_config(struct lu_phy_attr *lu) {
 					  sp->slot_location -
 						  lu_priv->pm->start_drive + 1,
 					  sp->last_location);
-			unload_drive_on_shutdown(sp,
+			unload_drive_on_shutdown(lu_priv, sp,
 									 previous_storage_slot(sp, slot_head));
 		}
 	}
@@ -1106,13 +2006,105 @@ static void save_config(struct lu_phy_attr *lu) {
 					  sp->slot_location -
 						  lu_priv->pm->start_drive + 1,
 					  sp->last_location);
-			unload_drive_on_shutdown(sp,
+			unload_drive_on_shutdown(lu_priv, sp,
 									 find_empty_storage_slot(sp, slot_head));
 		}
 	}
+}
+
+static int media_placed(struct m_info **slot, int n, struct m_info *m) {
+	for (int k = 0; k < n; k++)
+		if (slot[k] == m)
+			return 1;
+	return 0;
+}
+
+/*
+ * Media in each storage slot, indexed by slot number - 1, with media in
+ * drives placed where unload_drives() would put it
+ */
+static struct m_info **storage_contents(struct smc_priv *lu_priv) {
+	struct m_info **slot;
+	struct s_info  *sp;
+	struct d_info  *dp;
+	int				n = lu_priv->num_storage;
+	int				k;
+
+	slot = calloc(n ? n : 1, sizeof(*slot));
+	if (!slot) {
+		MHVTL_ERR("Could not allocate memory");
+		return NULL;
+	}
+
+	list_for_each_entry(sp, &lu_priv->slot_list, siblings) {
+		k = sp->slot_location - lu_priv->pm->start_storage;
+		if (sp->element_type == STORAGE_ELEMENT && slotOccupied(sp) &&
+			k >= 0 && k < n)
+			slot[k] = sp->media;
+	}
+
+	/* Previous location - if empty */
+	list_for_each_entry(dp, &lu_priv->drive_list, siblings) {
+		sp = dp->slot;
+		k  = sp->last_location - lu_priv->pm->start_storage;
+		if (slotOccupied(sp) && k >= 0 && k < n && !slot[k])
+			slot[k] = sp->media;
+	}
+
+	/* Otherwise the first empty slot */
+	list_for_each_entry(dp, &lu_priv->drive_list, siblings) {
+		sp = dp->slot;
+		if (!slotOccupied(sp) || media_placed(slot, n, sp->media))
+			continue;
+		for (k = 0; k < n && slot[k]; k++)
+			;
+		if (k < n)
+			slot[k] = sp->media;
+	}
+	return slot;
+}
+
+/*
+ * Write the library contents to library_contents.<id>.persist, recording
+ * the last journal record it includes
+ *
+ * Returns 0 on success
+ */
+static int write_persist(struct lu_phy_attr *lu) {
+	FILE				*ctrl;
+	char				 lib_conf[CONF_FILE_SZ];
+	char				 tmp[CONF_FILE_SZ + 8];
+	char				 text[MAX_BARCODE_LEN + 1];
+	struct smc_priv		*lu_priv;
+	struct m_info	   **storage;
+	struct s_info		*sp; /* Slot Pointer */
+	struct contents_list list[5];
+	struct smc_type_slot arr[4];
+	struct stat			 st;
+	const char			*barcode;
+	int					 last_element_type = 0;
+	int					 slt, i;
+
+	lu_priv = lu->lu_private;
+	storage = storage_contents(lu_priv);
+	if (!storage)
+		return -1;
+	memset(list, 0, sizeof(list));
+
+	get_config(lib_conf, LIBCONTENTS_PERSIST, my_id);
+	snprintf(tmp, sizeof(tmp), "%s.tmp", lib_conf);
+	ctrl = fopen(tmp, "w");
+	if (!ctrl) {
+		MHVTL_ERR("Can not open file %s to save state : %s", tmp,
+				  strerror(errno));
+		free(storage);
+		return -1;
+	}
+
+	fprintf(ctrl, "# Journal sequence: %" PRIu64 "\n", lu_priv->journal_seq);
 
 	/* Walk the list of all slots and write data into .persist file */
-	list_for_each_entry(sp, slot_head, siblings) {
+	list_for_each_entry(sp, &lu_priv->slot_list, siblings) {
 		/* Pretty up conf file -
 		 * Place a blank line between element types
 		 */
@@ -1121,33 +2113,265 @@ static void save_config(struct lu_phy_attr *lu) {
 			fprintf(ctrl, "\n");
 		}
 
+		barcode = slotOccupied(sp) ? sp->media->barcode : "";
 		switch (sp->element_type) {
 		case DATA_TRANSFER:
-			fprintf(ctrl, "Drive %d:\n",
-					sp->slot_location -
-						lu_priv->pm->start_drive + 1);
+			slt		= sp->slot_location - lu_priv->pm->start_drive + 1;
+			barcode = "";
+			fprintf(ctrl, "Drive %d:\n", slt);
 			break;
 		case MEDIUM_TRANSPORT:
-			fprintf(ctrl, "Picker %d: %s\n",
-					sp->slot_location -
-						lu_priv->pm->start_picker + 1,
-					slotOccupied(sp) ? sp->media->barcode : "");
+			slt = sp->slot_location - lu_priv->pm->start_picker + 1;
+			fprintf(ctrl, "Picker %d: %s\n", slt, barcode);
 			break;
 		case MAP_ELEMENT:
-			fprintf(ctrl, "MAP %d: %s\n",
-					sp->slot_location -
-						lu_priv->pm->start_map + 1,
-					slotOccupied(sp) ? sp->media->barcode : "");
+			slt = sp->slot_location - lu_priv->pm->start_map + 1;
+			fprintf(ctrl, "MAP %d: %s\n", slt, barcode);
 			break;
 		case STORAGE_ELEMENT:
-			fprintf(ctrl, "Slot %d: %s\n",
-					sp->slot_location -
-						lu_priv->pm->start_storage + 1,
-					slotOccupied(sp) ? sp->media->barcode : "");
+			slt		= sp->slot_location - lu_priv->pm->start_storage + 1;
+			barcode = (slt >= 1 && slt <= lu_priv->num_storage && storage[slt - 1]) ? storage[slt - 1]->barcode : "";
+			fprintf(ctrl, "Slot %d: %s\n", slt, barcode);
 			break;
+		default:
+			continue;
 		}
+		/* As contents_parse() will read it back */
+		if (sscanf(barcode, "%16s", text) != 1)
+			text[0] = '\0';
+		contents_add(&list[sp->element_type], sp->element_type, slt, text);
+	}
+	free(storage);
+
+	if (fflush(ctrl) || fsync(fileno(ctrl))) {
+		MHVTL_ERR("Can not write %s : %s", tmp, strerror(errno));
+		fclose(ctrl);
+		unlink(tmp);
+		for (i = 0; i < 5; i++)
+			free(list[i].e);
+		return -1;
 	}
 	fclose(ctrl);
+	if (rename(tmp, lib_conf)) {
+		MHVTL_ERR("Can not rename %s to %s : %s", tmp, lib_conf,
+				  strerror(errno));
+		unlink(tmp);
+		for (i = 0; i < 5; i++)
+			free(list[i].e);
+		return -1;
+	}
+
+	/* So the next start-up need not parse it */
+	sort_library_slot_type(lu, &arr[0]);
+	if (!stat(lib_conf, &st))
+		contents_cache_write(lib_conf, &st, list, arr, 1, lu_priv->journal_seq);
+	for (i = 0; i < 5; i++)
+		free(list[i].e);
+	return 0;
+}
+
+/*
+ * Fold the journal into the .persist file: write the current contents,
+ * then empty the journal. Should we stop between the two, the records
+ * already in the .persist file are skipped on replay by their sequence.
+ *
+ * The .persist file has media in drives back in storage, so the new
+ * journal starts with a 'D' record per loaded drive - replayed first, to
+ * put it back in the drive before any later move into its slot.
+ */
+static void journal_compact(struct lu_phy_attr *lu) {
+	struct smc_priv *lu_priv = lu->lu_private;
+	struct d_info	*dp;
+
+	if (write_persist(lu))
+		return;
+	if (lu_priv->journal_fd >= 0 && ftruncate(lu_priv->journal_fd, 0))
+		MHVTL_ERR("Can not truncate library state journal: %s",
+				  strerror(errno));
+	list_for_each_entry(dp, &lu_priv->drive_list, siblings)
+		if (slotOccupied(dp->slot) && dp->slot->media)
+			smc_journal(lu_priv, 'D', dp->slot->last_location,
+						dp->slot->slot_location, dp->slot->media->barcode);
+	lu_priv->journal_count = 0;
+	MHVTL_DBG(2, "Library state written at journal sequence %" PRIu64,
+			  lu_priv->journal_seq);
+}
+
+/* Save config on shutdown - Not to be called at other times !! */
+static void save_config(struct lu_phy_attr *lu) {
+	unload_drives(lu);
+	journal_compact(lu);
+}
+
+/* Slot holding media 'barcode' (without trailing spaces) */
+static struct s_info *locate_barcode(const char *barcode) {
+	struct s_info *sp;
+	char		   bc[MAX_BARCODE_LEN + 1];
+
+	list_for_each_entry(sp, &smc_slots.slot_list, siblings) {
+		if (!slotOccupied(sp) || !sp->media)
+			continue;
+		snprintf(bc, sizeof(bc), "%s", sp->media->barcode);
+		truncate_spaces(bc, sizeof(bc));
+		if (!strcmp(bc, barcode))
+			return sp;
+	}
+	return NULL;
+}
+
+static struct s_info *locate_slot(uint32_t addr) {
+	struct s_info *sp;
+
+	list_for_each_entry(sp, &smc_slots.slot_list, siblings)
+		if (sp->slot_location == addr)
+			return sp;
+	return NULL;
+}
+
+/* Apply one journal record. Returns 0 if it was applied */
+static int journal_apply(char op, uint32_t src, uint32_t dest, char *barcode) {
+	struct s_info *sp, *dp;
+
+	switch (op) {
+	case 'M':
+		/* By barcode: media in drives was put back in storage since */
+		sp = locate_barcode(barcode);
+		dp = locate_slot(dest);
+		if (!sp || !dp || sp == dp || slotOccupied(dp))
+			return -1;
+		move_cart(&smc_slots, sp, dp);
+		return 0;
+	case 'D':
+		/* Loaded in drive 'dest', from 'src', as the journal was emptied */
+		sp = locate_barcode(barcode);
+		dp = locate_slot(dest);
+		if (!sp || !dp || dp->element_type != DATA_TRANSFER ||
+			sp == dp || slotOccupied(dp))
+			return -1;
+		move_cart(&smc_slots, sp, dp);
+		dp->last_location		 = src;
+		dp->media->last_location = src;
+		return 0;
+	case 'I':
+		dp = locate_slot(dest);
+		if (!dp || dp->element_type != MAP_ELEMENT || slotOccupied(dp) ||
+			locate_barcode(barcode))
+			return -1;
+		import_to_map(dp, barcode);
+		return 0;
+	case 'E':
+		sp = locate_slot(src);
+		if (!sp || sp->element_type != MAP_ELEMENT || !slotOccupied(sp))
+			return -1;
+		setSlotEmpty(sp);
+		return 0;
+	case 'S':
+		if (locate_slot(dest))
+			return -1;
+		new_storage_slot();
+		return 0;
+	}
+	return -1;
+}
+
+/* Apply the records of 'journal' after those the .persist file includes */
+static void journal_replay(const char *journal) {
+	FILE	*fp;
+	char	*line = NULL;
+	size_t	 len  = 0;
+	ssize_t	 n;
+	uint64_t seq;
+	uint32_t src, dest;
+	char	 op;
+	char	 barcode[MAX_BARCODE_LEN + 1];
+	int		 applied = 0, skipped = 0;
+
+	fp = fopen(journal, "r");
+	if (!fp)
+		return;
+
+	while ((n = getline(&line, &len, fp)) > 0) {
+		if (line[n - 1] != '\n') /* Torn by a crash: never completed */
+			break;
+		if (sscanf(line, "%" SCNu64 " %c %u %u %16s", &seq, &op, &src,
+				   &dest, barcode) != 5)
+			continue;
+		if (seq <= smc_slots.journal_seq)
+			continue;
+		smc_slots.journal_seq = seq;
+		if (journal_apply(op, src, dest, barcode)) {
+			MHVTL_LOG("%s: record %" PRIu64 " (%c %u %u %s) does not apply - skipped",
+					  journal, seq, op, src, dest, barcode);
+			skipped++;
+		} else {
+			applied++;
+		}
+	}
+	free(line);
+	fclose(fp);
+
+	if (applied || skipped)
+		MHVTL_LOG("Replayed %d changes from %s, %d skipped", applied, journal,
+				  skipped);
+}
+
+/*
+ * With PERSIST set, every change to the library contents is appended to
+ * library_contents.<id>.journal as it is made, so a crash loses nothing,
+ * and folded into the .persist file when the library is idle.
+ *
+ * Called once the contents have been read: replays the journal if the
+ * .persist file was what was read, discards it if library_contents.<id>
+ * was newer, and starts a new one.
+ */
+static void journal_start(struct lu_phy_attr *lu) {
+	char journal[CONF_FILE_SZ];
+
+	if (smc_slots.journal_fd >= 0) {
+		close(smc_slots.journal_fd);
+		smc_slots.journal_fd = -1;
+	}
+	if (!lu->persist)
+		return;
+
+	get_config(journal, LIBCONTENTS_JOURNAL, my_id);
+	smc_slots.journal_seq = persist_seq;
+	if (contents_persist)
+		journal_replay(journal);
+	else if (!access(journal, F_OK))
+		MHVTL_LOG("Library contents read from library_contents.%ld - "
+				  "discarding %s", my_id, journal);
+
+	/* Whatever drives held before has not been loaded since */
+	unload_drives(lu);
+
+	smc_slots.journal_fd = open(journal, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if (smc_slots.journal_fd < 0) {
+		MHVTL_ERR("Can not open %s: %s - library state only saved on shutdown",
+				  journal, strerror(errno));
+		return;
+	}
+	journal_compact(lu);
+}
+
+static void set_picker_latency(int n, int ms) {
+	int *p;
+
+	if (n < 1 || n > 127) {
+		MHVTL_ERR("Picker %d latency: no such picker", n);
+		return;
+	}
+	if (n > picker_ms_count) {
+		p = realloc(picker_ms, n * sizeof(*p));
+		if (!p) {
+			MHVTL_ERR("Could not allocate memory");
+			return;
+		}
+		for (; picker_ms_count < n; picker_ms_count++)
+			p[picker_ms_count] = -1;
+		picker_ms = p;
+	}
+	picker_ms[n - 1] = ms;
 }
 
 static int init_lu(struct lu_phy_attr *lu, unsigned minor, struct mhvtl_ctl *ctl) {
@@ -1162,9 +2386,15 @@ static int init_lu(struct lu_phy_attr *lu, unsigned minor, struct mhvtl_ctl *ctl
 	struct mhvtl_ctl tmpctl;
 	int				 found = 0;
 	int				 linecount;
+	const struct conf_device *library;
+	off_t			 end = -1;
 
 	backoff		= DEFLT_BACKOFF_VALUE;
 	lu->persist = FALSE;
+	scrub_days	= 0;
+	scrub_rate	= SCRUB_DEFAULT_RATE;
+
+	picker_latency = 0;
 
 	if (get_config(device_conf, DEVICE_CONF, my_id) < 0)
 		exit(1);
@@ -1188,7 +2418,7 @@ static int init_lu(struct lu_phy_attr *lu, unsigned minor, struct mhvtl_ctl *ctl
 
 	lu->ptype = TYPE_MEDIUM_CHANGER; /* SSC */
 
-	lu->sense_p = &sense[0]; /* Save pointer to sense buffer */
+	lu->sense_p = &sense[0]; /* Save pointer to sense buffer - the main thread's */
 
 	conf = fopen(device_conf, "r");
 	if (!conf) {
@@ -1213,11 +2443,20 @@ static int init_lu(struct lu_phy_attr *lu, unsigned minor, struct mhvtl_ctl *ctl
 	lu->fifo_flag = 0;
 
 	smc_slots.movecommand	 = NULL;
+	smc_slots.movehelper	 = NULL;
 	smc_slots.commandtimeout = 20;
 
-	/* While read in a line */
+	/* Only our own lines, if device.conf has been parsed */
 	linecount = 0; /* Line count */
-	while (readline(b, MALLOC_SZ, conf) != NULL) {
+	indx	  = 0xff;
+	library	  = config_find(minor, CONF_LIBRARY);
+	if (library) {
+		end		  = config_stanza(conf, library);
+		linecount = library->line - 1;
+	}
+
+	/* While read in a line */
+	while ((end < 0 || ftello(conf) < end) && readline(b, MALLOC_SZ, conf) != NULL) {
 		linecount++;
 		if (b[0] == '#') /* Ignore comments */
 			continue;
@@ -1235,7 +2474,7 @@ static int init_lu(struct lu_phy_attr *lu, unsigned minor, struct mhvtl_ctl *ctl
 		}
 		if (indx == minor) {
 			unsigned int c, d, e, f, g, h, j, k;
-			int			 i;
+			int			 i, n;
 
 			if (sscanf(b, " Unit serial number: %s", s)) {
 				checkstrlen(s, SCSI_SN_LEN, linecount);
@@ -1266,8 +2505,20 @@ static int init_lu(struct lu_phy_attr *lu, unsigned minor, struct mhvtl_ctl *ctl
 			}
 			if (sscanf(b, " movecommand: %s", s))
 				smc_slots.movecommand = strndup(s, MALLOC_SZ);
+			if (sscanf(b, " movehelper: %[^\n]", s) == 1 && !smc_slots.movehelper)
+				smc_slots.movehelper = coproc_new(s);
 			if (sscanf(b, " commandtimeout: %d", &d))
 				smc_slots.commandtimeout = d;
+			if (sscanf(b, " Picker latency: %d", &i) == 1)
+				picker_latency = i;
+			if (sscanf(b, " Picker %d latency: %d", &n, &i) == 2)
+				set_picker_latency(n, i);
+			if (sscanf(b, " Drive pool: %[^\n]", s) == 1)
+				pool_parse(s);
+			if (sscanf(b, " Scrub interval: %d", &i) == 1)
+				scrub_days = i;
+			if (sscanf(b, " Scrub rate: %d", &i) == 1)
+				scrub_rate = i;
 			if (sscanf(b, " Backoff: %d", &i)) {
 				if ((i > 1) && (i < 10000)) {
 					MHVTL_DBG(1, "Backoff value: %d", i);
@@ -1331,15 +2582,127 @@ static int init_lu(struct lu_phy_attr *lu, unsigned minor, struct mhvtl_ctl *ctl
 	lu_vpd[PCODE_OFFSET(0x80)] = alloc_vpd(strlen(lu->lu_serial_no));
 	update_vpd_80(lu, lu->lu_serial_no);
 
-	lu->lu_private		 = &smc_slots;
-	smc_slots.cap_closed = CAP_CLOSED;
+	lu->lu_private			 = &smc_slots;
+	smc_slots.cap_closed	 = CAP_CLOSED;
+	smc_slots.verify_media	 = verify_media;
 	return found;
 }
 
+/* Is the cartridge in 'sp' due a scrub ? */
+static int scrub_due(struct s_info *sp, time_t now) {
+	struct scrub_result r;
+	char				bc[MAX_BARCODE_LEN + 1];
+	char				dir[HOME_DIR_PATH_SZ + MAX_BARCODE_LEN + 2];
+
+	if (sp->element_type != STORAGE_ELEMENT || !slotOccupied(sp))
+		return 0;
+	/* Only Data and WORM carts hold blocks - see get_cart_type() */
+	if (sp->media->cart_type != 1 && sp->media->cart_type != 4)
+		return 0;
+	/* The PCL directory is named without the barcode's padding */
+	snprintf(bc, sizeof(bc), "%s", sp->media->barcode);
+	truncate_spaces(bc, sizeof(bc));
+	snprintf(dir, sizeof(dir), "%s/%s", home_directory, bc);
+	if (read_scrub_result(dir, &r))
+		return !access(dir, F_OK); /* Never scrubbed - or not yet created */
+	return r.time + (uint64_t)scrub_days * 86400 <= (uint64_t)now;
+}
+
+static void scrub_start(struct s_info *sp) {
+	char lib[16], rate[16];
+	int	 fd;
+
+	snprintf(lib, sizeof(lib), "%ld", my_id);
+	snprintf(rate, sizeof(rate), "%d", scrub_rate);
+	snprintf(scrub_pcl, sizeof(scrub_pcl), "%s", sp->media->barcode);
+	truncate_spaces(scrub_pcl, sizeof(scrub_pcl));
+
+	scrub_pid = fork();
+	if (scrub_pid < 0) {
+		MHVTL_ERR("Unable to start scrub of %s: %s", scrub_pcl, strerror(errno));
+		scrub_pid  = 0;
+		scrub_next = time(NULL) + SCRUB_RECHECK;
+		return;
+	}
+	if (scrub_pid == 0) {
+		setpriority(PRIO_PROCESS, 0, 19);
+		fd = open("/dev/null", O_RDWR);
+		if (fd >= 0) {
+			dup2(fd, STDIN_FILENO);
+			dup2(fd, STDOUT_FILENO);
+			dup2(fd, STDERR_FILENO);
+		}
+		execlp("dump_tape", "dump_tape", "-S", "-j", "1", "-l", lib,
+			   "-m", scrub_pcl, "-r", rate, (char *)NULL);
+		_exit(127);
+	}
+	scrub_cursor = sp->slot_location;
+	MHVTL_DBG(1, "Scrubbing %s in slot %d, pid %ld", scrub_pcl,
+			  sp->slot_location, (long)scrub_pid);
+}
+
+/* Start scrubbing the next cartridge due, in slot order from the last one */
+static void scrub_idle(void) {
+	struct list_head *slot_head = &smc_slots.slot_list;
+	struct s_info	 *sp, *first = NULL;
+	time_t			  now		 = time(NULL);
+
+	if (!scrub_days || scrub_pid || now < scrub_next)
+		return;
+
+	list_for_each_entry(sp, slot_head, siblings) {
+		if (!scrub_due(sp, now))
+			continue;
+		if (sp->slot_location > scrub_cursor) {
+			scrub_start(sp);
+			return;
+		}
+		if (!first)
+			first = sp;
+	}
+	if (first)
+		scrub_start(first);
+	else
+		scrub_next = now + SCRUB_RECHECK;
+}
+
+static void scrub_reap(void) {
+	int status;
+
+	if (!scrub_pid || waitpid(scrub_pid, &status, WNOHANG) <= 0)
+		return;
+	scrub_pid = 0;
+	if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+		MHVTL_DBG(1, "Scrub of %s found no problems", scrub_pcl);
+	else if (WIFEXITED(status) && WEXITSTATUS(status) == 1)
+		MHVTL_LOG("Scrub of %s found damage - see %s/%s/scrub",
+				  scrub_pcl, home_directory, scrub_pcl);
+	else {
+		MHVTL_ERR("Scrub of %s failed, status 0x%x", scrub_pcl, status);
+		scrub_next = time(NULL) + SCRUB_RECHECK;
+	}
+}
+
+/* Stop scrubbing - before a cartridge could move to a drive.
+ * Killed outright, the scrub leaves the cartridge untouched.
+ */
+static void scrub_cancel(void) {
+	if (!scrub_pid)
+		return;
+	MHVTL_DBG(1, "Cancelling scrub of %s", scrub_pcl);
+	kill(scrub_pid, SIGKILL);
+	waitpid(scrub_pid, NULL, 0);
+	scrub_pid = 0;
+}
+
 static void process_cmd(int cdev, uint8_t *buf, struct mhvtl_header *mhvtl_cmd,
-						useconds_t pollInterval) {
+						useconds_t pollInterval, struct smc_picker *pk) {
 	struct mhvtl_ds dbuf;
 	uint8_t		   *cdb;
+	uint64_t		start;
+	uint32_t		sz;
+	uint8_t			sam_stat;
+	uint8_t			cmd_sense[SENSE_BUF_SIZE]; /* This command's, whichever thread */
 
 	/* Get the SCSI cdb from vtl driver
 	 * - Returns SCSI command S/No. */
@@ -1352,16 +2715,167 @@ static void process_cmd(int cdev, uint8_t *buf, struct mhvtl_header *mhvtl_cmd,
 	dbuf.sz		   = 0;
 	dbuf.serialNo  = mhvtl_cmd->serialNo;
 	dbuf.data	   = buf;
-	dbuf.sam_stat  = sam_status;
-	dbuf.sense_buf = &sense;
+	dbuf.sam_stat  = SAM_STAT_GOOD;
+	dbuf.sense_buf = &sense; /* This thread's, until completed */
+
+	if (cdb[0] == MOVE_MEDIUM || cdb[0] == EXCHANGE_MEDIUM)
+		scrub_cancel();
+
+	start = stats_clock();
+	trace_begin(cdb[0], dbuf.serialNo);
+	processCommand(cdev, cdb, &dbuf, pollInterval, pk);
+	sam_stat = dbuf.sam_stat;
+	sz		 = dbuf.sz;
 
-	processCommand(cdev, cdb, &dbuf, pollInterval);
+	/* Completed with a copy of its own - REQUEST SENSE, on the main
+	 * thread, sees what a picker's move last reported
+	 */
+	memcpy(cmd_sense, sense, SENSE_BUF_SIZE);
+	dbuf.sense_buf = cmd_sense;
+	if (pk && sam_stat == SAM_STAT_CHECK_CONDITION)
+		memcpy(lunit.sense_p, cmd_sense, SENSE_BUF_SIZE);
 
 	/* Complete SCSI cmd processing */
 	completeSCSICommand(cdev, &dbuf);
+	stats_cmd(cdb[0], start, sam_stat);
+	trace_end(sam_stat, sz);
+}
+
+/*
+ * Picker thread: the moves queued for 'pk', in order. Holds the library
+ * lock but for the time spent waiting on the robot or a drive.
+ */
+static void *picker_run(void *arg) {
+	struct smc_picker *pk = arg;
+	struct smc_move	  *mv;
+	sigset_t		   set;
+
+	/* Signals are for the main loop */
+	sigfillset(&set);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+	pthread_mutex_lock(&smc_slots.lock);
+	while (!pk->stop || !list_empty(&pk->queue)) {
+		if (list_empty(&pk->queue)) {
+			pthread_cond_wait(&pk->wake, &smc_slots.lock);
+			continue;
+		}
+		mv = list_first_entry(&pk->queue, struct smc_move, siblings);
+		list_del(&mv->siblings);
+		process_cmd(mv->cdev, NULL, &mv->hdr, mv->pollInterval, pk);
+		free(mv);
+		pk->busy--;
+		smc_slots.moving--;
+		pthread_cond_broadcast(&smc_slots.moved);
+	}
+	pthread_mutex_unlock(&smc_slots.lock);
+	return NULL;
+}
+
+/*
+ * Queue MOVE MEDIUM for the picker it asks for if that is free, else for
+ * any free picker - behind the one asked for if none are.
+ *
+ * Returns -1 if it could not be queued
+ */
+static int queue_move(int cdev, struct mhvtl_header *mhvtl_cmd,
+					  useconds_t pollInterval) {
+	struct smc_picker *pk = NULL, *want, *p;
+	struct smc_move	  *mv;
+	uint32_t		   addr;
+
+	mv = malloc(sizeof(*mv));
+	if (!mv)
+		return -1;
+	mv->hdr			 = *mhvtl_cmd;
+	mv->cdev		 = cdev;
+	mv->pollInterval = pollInterval;
+
+	addr = get_unaligned_be16(&mhvtl_cmd->cdb[2]);
+	if (addr >= smc_slots.pm->start_picker &&
+		addr < smc_slots.pm->start_picker + smc_slots.num_picker)
+		pk = &smc_slots.picker[addr - smc_slots.pm->start_picker];
+	want = pk;
+	if (!pk || pk->busy) {
+		for (p = smc_slots.picker; p < smc_slots.picker + smc_slots.num_picker; p++)
+			if (!pk || p->busy < pk->busy)
+				pk = p;
+		if (want && pk->busy)
+			pk = want;
+	}
+
+	MHVTL_DBG(2, "MOVE MEDIUM (%ld) for picker %u, %d ahead of it",
+			  (long)mhvtl_cmd->serialNo, pk->address, pk->busy);
+	list_add_tail(&mv->siblings, &pk->queue);
+	pk->busy++;
+	smc_slots.moving++;
+	pthread_cond_signal(&pk->wake);
+	return 0;
+}
+
+/* Wait for the pickers to finish every move queued */
+static void pickers_drain(void) {
+	while (smc_slots.moving)
+		pthread_cond_wait(&smc_slots.moved, &smc_slots.lock);
+}
+
+/* Finish the moves queued, and stop the picker threads */
+static void pickers_stop(void) {
+	int i;
+
+	pthread_mutex_lock(&smc_slots.lock);
+	for (i = 0; i < smc_slots.picker_threads; i++) {
+		smc_slots.picker[i].stop = 1;
+		pthread_cond_signal(&smc_slots.picker[i].wake);
+	}
+	pthread_mutex_unlock(&smc_slots.lock);
 
-	/* dbuf.sam_stat was zeroed in completeSCSICommand */
-	sam_status = dbuf.sam_stat;
+	for (i = 0; i < smc_slots.picker_threads; i++)
+		pthread_join(smc_slots.picker[i].thread, NULL);
+	smc_slots.picker_threads = 0;
+}
+
+/* Set up the pickers - and their threads if there is more than one */
+static void pickers_start(void) {
+	struct smc_picker *pk;
+	int				   n = smc_slots.num_picker;
+	int				   i, rc;
+
+	smc_slots.picker = calloc(n ? n : 1, sizeof(*pk));
+	if (!smc_slots.picker) {
+		MHVTL_ERR("Could not allocate memory");
+		return;
+	}
+	for (i = 0; i < n; i++) {
+		pk = &smc_slots.picker[i];
+		INIT_LIST_HEAD(&pk->queue);
+		pthread_cond_init(&pk->wake, NULL);
+		pk->address	 = smc_slots.pm->start_picker + i;
+		pk->latency	 = picker_latency;
+		pk->reply_id = (n > 1) ? PICKER_REPLY_ID(my_id, i + 1) : my_id;
+		if (i < picker_ms_count && picker_ms[i] >= 0)
+			pk->latency = picker_ms[i];
+		MHVTL_DBG(1, "Picker %d: address %u, latency %d ms",
+				  i + 1, pk->address, pk->latency);
+	}
+	if (n < 2)
+		return;
+
+	for (i = 0; i < n; i++) {
+		rc = pthread_create(&smc_slots.picker[i].thread, NULL, picker_run,
+							&smc_slots.picker[i]);
+		if (rc) {
+			MHVTL_ERR("Can not start picker %d: %s - moving media one at a time",
+					  i + 1, strerror(rc));
+			smc_slots.picker_threads = i;
+			pickers_stop();
+			for (i = 0; i < n; i++)
+				smc_slots.picker[i].reply_id = my_id;
+			return;
+		}
+	}
+	smc_slots.picker_threads = n;
+	MHVTL_LOG("%d pickers moving media concurrently", n);
 }
 
 /*
@@ -1407,8 +2921,18 @@ static void cleanup_lu(struct lu_phy_attr *lu) {
 		list_del(&mp->siblings);
 		free(mp);
 	}
+	media_hash_free();
 	free(lu_priv->state_msg);
 	lu_priv->state_msg = NULL;
+	coproc_free(lu_priv->movehelper);
+	lu_priv->movehelper = NULL;
+	free(lu_priv->picker);
+	lu_priv->picker = NULL;
+	free(picker_ms);
+	picker_ms		= NULL;
+	picker_ms_count = 0;
+	pool_free();
+	smc_elements_changed(lu_priv);
 }
 
 static void customise_ibm_lu(struct lu_phy_attr *lu) {
@@ -1540,12 +3064,14 @@ int main(int argc, char *argv[]) {
 	int		 cdev;
 	int		 ret;
 	long	 pollInterval = 0L;
+	uint64_t poll_start;
 	uint8_t *buf;
 	int		 buffer_size;
 	int		 fifo_retval;
 	int		 opt;
 	int		 foreground	  = 0;
 	int		 time_to_exit = 0;
+	int		 moving		  = 0;
 
 	int last_state = MHVTL_STATE_UNKNOWN;
 
@@ -1621,6 +3147,8 @@ int main(int argc, char *argv[]) {
 	memset(sense, 0, sizeof(sense));
 	reset_device(); /* power-on reset */
 
+	smc_slots.journal_fd = -1;
+
 	if (!init_lu(&lunit, my_id, &ctl)) {
 		fprintf(stderr, "error: Can not find entry for '%ld' in config file\n",
 				my_id);
@@ -1646,12 +3174,15 @@ int main(int argc, char *argv[]) {
 	sigaction(SIGINT, &new_action, &old_action);
 	sigaction(SIGPIPE, &new_action, &old_action);
 	sigaction(SIGTERM, &new_action, &old_action);
-	sigaction(SIGUSR1, &new_action, &old_action);
 	sigaction(SIGUSR2, &new_action, &old_action);
 
 	new_action.sa_handler = rereadconfig;
 	sigaction(SIGHUP, &new_action, &old_action);
 
+	/* SIGUSR1 dumps the trace ring - see mhvtl-trace(1) */
+	new_action.sa_handler = trace_signal;
+	sigaction(SIGUSR1, &new_action, &old_action);
+
 	/* Initialise message queue as necessary */
 	r_qid = init_queue();
 	if (r_qid == -1) {
@@ -1700,8 +3231,10 @@ int main(int argc, char *argv[]) {
 	list_for_each_entry(sp, slot_head, siblings) {
 		if (sp->element_type == DATA_TRANSFER) {
 			dp = sp->drive;
-			MHVTL_DBG(1, "Registering driveId: %ld", dp->drv_id);
-			send_msg("Register", dp->drv_id);
+			if (dp->drv_id) {
+				MHVTL_DBG(1, "Registering driveId: %ld", dp->drv_id);
+				send_msg("Register", dp->drv_id);
+			}
 
 			if (debug) {
 
@@ -1785,18 +3318,28 @@ int main(int argc, char *argv[]) {
 		MHVTL_ERR("Failed to set fifo count()...");
 	}
 
+	stats_init(my_id, STATS_LU_LIBRARY);
+	trace_init(my_id);
+
 	child_cleanup = add_lu(my_id, &ctl);
 	if (!child_cleanup) {
 		fprintf(stderr, "error: Could not create logical unit\n");
 		exit(1);
 	}
 
+	pickers_start();
+
 	for (;;) {
+		stats_state(current_state);
+
 		/* Check for any messages */
 		mlen = msgrcv(r_qid, &r_entry, MAXOBN, my_id, IPC_NOWAIT);
 		if (mlen > 0) {
+			pthread_mutex_lock(&smc_slots.lock);
+			pickers_drain();
 			if (processMessageQ(&r_entry.msg))
 				time_to_exit = 1;
+			pthread_mutex_unlock(&smc_slots.lock);
 		} else if (mlen < 0) {
 			r_qid = init_queue();
 			if (r_qid == -1)
@@ -1804,6 +3347,7 @@ int main(int argc, char *argv[]) {
 						  strerror(errno));
 		}
 
+		poll_start = stats_clock();
 		ret = ioctl(cdev, VTL_POLL_AND_GET_HEADER, &mhvtl_cmd);
 		if (ret < 0) {
 			MHVTL_LOG("ret: %d : %s", ret, strerror(errno));
@@ -1823,6 +3367,7 @@ int main(int argc, char *argv[]) {
 				fflush(NULL); /* So I can pipe debug o/p thru tee */
 			switch (ret) {
 			case VTL_QUEUE_CMD:
+				stats_phase(STATS_KERNEL_WAIT, poll_start);
 				if (smc_slots.bufsize != buffer_size) {
 					buffer_size = smc_slots.bufsize;
 					buf			= realloc(buf, buffer_size);
@@ -1831,14 +3376,30 @@ int main(int argc, char *argv[]) {
 						exit(1);
 					}
 				}
-				process_cmd(cdev, buf, &mhvtl_cmd, pollInterval);
+				pthread_mutex_lock(&smc_slots.lock);
+				if (mhvtl_cmd.cdb[0] != MOVE_MEDIUM ||
+					!smc_slots.picker_threads ||
+					queue_move(cdev, &mhvtl_cmd, pollInterval))
+					process_cmd(cdev, buf, &mhvtl_cmd, pollInterval, NULL);
+				pthread_mutex_unlock(&smc_slots.lock);
 				pollInterval = MIN_SLEEP_TIME;
 				break;
 
 			case VTL_IDLE:
+				pthread_mutex_lock(&smc_slots.lock);
+				if (smc_slots.journal_count >= JOURNAL_COMPACT)
+					journal_compact(&lunit);
+				scrub_reap();
+				if (pollInterval > 0x18000)
+					scrub_idle();
+				if (pool_count)
+					pool_sample();
+				moving = smc_slots.moving;
+				pthread_mutex_unlock(&smc_slots.lock);
 				usleep(pollInterval);
 
-				if (pollInterval < 1000000)
+				/* Keep polling briskly while the pickers are busy */
+				if (pollInterval < 1000000 && !moving)
 					pollInterval += backoff;
 				break;
 
@@ -1848,6 +3409,7 @@ int main(int argc, char *argv[]) {
 				sleep(1);
 				break;
 			}
+			pthread_mutex_lock(&smc_slots.lock);
 			if (current_state != last_state) {
 				status_change(lunit.fifo_fd,
 							  current_state,
@@ -1855,15 +3417,18 @@ int main(int argc, char *argv[]) {
 							  &smc_slots.state_msg);
 				last_state = current_state;
 			}
-			if (pollInterval > 0xf000) /* enough time to ensure no outstanding op in flight */
-				if (time_to_exit)
-					goto exit;
 			if (pollInterval > 0x18000)
 				if (current_state != MHVTL_STATE_OFFLINE)
 					current_state = MHVTL_STATE_IDLE;
+			pthread_mutex_unlock(&smc_slots.lock);
+			if (pollInterval > 0xf000) /* enough time to ensure no outstanding op in flight */
+				if (time_to_exit)
+					goto exit;
 		}
 	}
 exit:
+	pickers_stop();
+	scrub_cancel();
 	ioctl(cdev, VTL_REMOVE_LU, &ctl);
 	if (lunit.persist)
 		save_config(&lunit);
@@ -1871,6 +3436,8 @@ exit:
 	close(cdev);
 	free(buf);
 	dec_fifo_count();
+	stats_exit();
+	trace_exit();
 	if (lunit.fifo_fd) {
 		fclose(lunit.fifo_fd);
 		unlink(lunit.fifoname);
@@ -79,6 +79,10 @@
 #include "spc.h"
 #include "ssc.h"
 #include "mhvtl_log.h"
+#include "mhvtl_stats.h"
+#include "mhvtl_trace.h"
+#include "mhvtl_catalog.h"
+#include "mhvtl_config.h"
 #include "mode.h"
 
 char mhvtl_driver_name[] = "vtltape";
@@ -1164,6 +1168,42 @@ static struct media_details *check_media_can_load(struct list_head *mdl, int mt)
 	return NULL;
 }
 
+/*
+ * Create media 'PCL' on its first load, if the library it is in provisions
+ * media on demand, from the media type and density its barcode implies
+ */
+static void provision_media(char *PCL) {
+	const struct conf_device *lib;
+	struct catalog_entry	  e;
+	char					  path[HOME_DIR_PATH_SZ + MAX_BARCODE_LEN + 2];
+	char					  density[16];
+	uint8_t					  sam_stat;
+	int						  type;
+
+	if (library_id <= 0 || !strlen(home_directory))
+		return;
+	lib = config_find(library_id, CONF_LIBRARY);
+	if (!lib || !lib->on_demand)
+		return;
+	snprintf(path, sizeof(path), "%s/%s", home_directory, PCL);
+	if (!access(path, F_OK))
+		return;
+
+	type = barcode_media_rules(PCL, density, sizeof(density));
+	if (!density[0] || init_new_mam(&mam, PCL, type, density, lib->capacity)) {
+		MHVTL_ERR("Can not create %s: no known density in its barcode", PCL);
+		return;
+	}
+	MHVTL_LOG("Creating %s media %s on first load", density, PCL);
+	if (create_tape(PCL, &sam_stat)) {
+		MHVTL_ERR("Failed to create media %s in %s", PCL, home_directory);
+		return;
+	}
+	catalog_fill(&e, PCL, library_id, home_directory, &mam, 0, 0);
+	e.partitions = 1; /* Until it is formatted */
+	catalog_update(&e);
+}
+
 /*
  * Attempt to load PCL - i.e. Open datafile and read in BOT header & MAM
  *
@@ -1180,6 +1220,7 @@ int loadTape(char *PCL, uint8_t *sam_stat) {
 	int					  overflow;
 	struct media_details *m_detail;
 	struct lu_phy_attr	 *lu;
+	struct scrub_result	  scrub;
 
 	lu_ssc.bytesWritten_I = 0; /* Global - Bytes written this load */
 	lu_ssc.bytesWritten_M = 0; /* Global - Bytes written this load */
@@ -1187,6 +1228,7 @@ int loadTape(char *PCL, uint8_t *sam_stat) {
 	lu_ssc.bytesRead_M	  = 0; /* Global - Bytes read this load */
 	lu					  = lu_ssc.pm->lu;
 
+	provision_media(PCL);
 	rc = load_tape(PCL, sam_stat);
 	if (rc) {
 		MHVTL_ERR("Media load failed.. Unsupported format");
@@ -1289,6 +1331,19 @@ int loadTape(char *PCL, uint8_t *sam_stat) {
 		MHVTL_DBG(1, "Previous unload was not clean");
 	}
 
+	/* Damage found by the last scrub (dump_tape -S) */
+	if (!read_scrub_result(NULL, &scrub)) {
+		if (scrub.crc_errors)
+			fg |= TA_MEDIA;
+		if (scrub.index_errors)
+			fg |= TA_MEDIA_DIR_CORRUPT;
+		if (scrub.crc_errors || scrub.index_errors)
+			MHVTL_LOG("%s: last scrub found %u CRC errors, %u index errors,"
+					  " first at partition %u block %u",
+					  PCL, scrub.crc_errors, scrub.index_errors,
+					  scrub.bad_partition, scrub.bad_block);
+	}
+
 	if (lu_ssc.max_capacity) {
 		lu_ssc.early_warning_position =
 			lu_ssc.max_capacity -
@@ -1460,6 +1515,8 @@ void unloadTape(int update_library, uint8_t *sam_stat) {
 	case TAPE_LOADED:
 		/* Don't update load count on unload -done at load time */
 		updateMAM(sam_stat, 0);
+		if (lu_ssc.barcode)
+			catalog_note(lu_ssc.barcode, library_id, lu_ssc.bytesWritten_I != 0);
 		unload_tape(sam_stat);
 		if (lu_ssc.pm->clear_WORM)
 			lu_ssc.pm->clear_WORM(&lu->mode_pg);
@@ -1592,9 +1649,16 @@ static int processMessageQ(struct q_msg *msg, uint8_t *sam_stat) {
 		return 1;
 
 	if (!strncmp(msg->text, "Register", 8)) {
+		long lib;
+
 		lu_ssc.inLibrary = 1;
 		MHVTL_DBG(1, "Notice from Library controller : %s", msg->text);
-		/*		find_media_home_directory(NULL, library_id); */
+		/* A pool drive, taken by library 'lib' - see 'Drive pool:' */
+		if (sscanf(msg->text, "Register %ld", &lib) == 1 && lib != library_id) {
+			MHVTL_LOG("Drive pool: now in library %ld", lib);
+			library_id = lib;
+			find_media_home_directory(NULL, library_id);
+		}
 	}
 
 	if (!strncmp(msg->text, "verbose", 7)) {
@@ -1913,6 +1977,8 @@ static int init_lu(struct lu_phy_attr *lu, unsigned minor, struct mhvtl_ctl *ctl
 	struct mhvtl_ctl tmpctl;
 	int				 found = 0;
 	int				 linecount;
+	const struct conf_device *drive;
+	off_t			 end = -1;
 
 	if (get_config(device_conf, DEVICE_CONF, my_id) < 0) {
 		exit(1);
@@ -1968,9 +2034,17 @@ static int init_lu(struct lu_phy_attr *lu, unsigned minor, struct mhvtl_ctl *ctl
 		exit(1);
 	}
 
-	/* While read in a line */
+	/* Only our own lines, if device.conf has been parsed */
 	linecount = 0;
-	while (readline(b, MALLOC_SZ, conf) != NULL) {
+	indx	  = 0xff;
+	drive	  = config_find(minor, CONF_DRIVE);
+	if (drive) {
+		end		  = config_stanza(conf, drive);
+		linecount = drive->line - 1;
+	}
+
+	/* While read in a line */
+	while ((end < 0 || ftello(conf) < end) && readline(b, MALLOC_SZ, conf) != NULL) {
 		linecount++;
 		if (b[0] == '#') /* Ignore comments */
 			continue;
@@ -2025,6 +2099,24 @@ static int init_lu(struct lu_phy_attr *lu, unsigned minor, struct mhvtl_ctl *ctl
 					backoff = i;
 				}
 			}
+			if (sscanf(b, " Storage engine: %s", s)) {
+				i = STORAGE_SYNC;
+				if (!strncasecmp(s, "io_uring", 8))
+					i = STORAGE_IO_URING;
+				else if (strncasecmp(s, "sync", 4))
+					MHVTL_LOG("Unknown storage engine '%s' - using sync", s);
+				i = cart_set_storage_engine(i);
+				MHVTL_DBG(1, "Storage engine: %s",
+						  (i == STORAGE_IO_URING) ? "io_uring" : "sync");
+			}
+			if (sscanf(b, " Direct IO: %d", &i)) {
+				MHVTL_DBG(1, "Direct IO: %s", (i) ? "enabled" : "disabled");
+				cart_set_direct_io(i);
+			}
+			if (sscanf(b, " Zero blocks: %d", &i)) {
+				MHVTL_DBG(1, "Zero blocks: %s", (i) ? "index only" : "stored");
+				lu_ssc.zero_blocks = i ? 1 : 0;
+			}
 			if (sscanf(b, " Compression type: %s", s)) {
 				if (!strncasecmp(s, "lzo", 3))
 					lu_ssc.compressionType = LZO;
@@ -2107,6 +2199,9 @@ static void process_cmd(int cdev, uint8_t *buf, struct mhvtl_header *mhvtl_cmd,
 						useconds_t pollInterval) {
 	struct mhvtl_ds dbuf;
 	uint8_t		   *cdb;
+	uint64_t		start;
+	uint32_t		sz;
+	uint8_t			sam_stat;
 
 	/* Get the SCSI cdb from vtl driver
 	 * - Returns SCSI command S/No. */
@@ -2122,15 +2217,29 @@ static void process_cmd(int cdev, uint8_t *buf, struct mhvtl_header *mhvtl_cmd,
 	dbuf.sam_stat  = lu_ssc.sam_status;
 	dbuf.sense_buf = &sense;
 
+	start = stats_clock();
+	trace_begin(cdb[0], dbuf.serialNo);
 	processCommand(cdev, cdb, &dbuf, pollInterval);
+	sam_stat = dbuf.sam_stat;
+	sz		 = dbuf.sz;
 
 	/* Complete SCSI cmd processing */
 	completeSCSICommand(cdev, &dbuf);
+	stats_cmd(cdb[0], start, sam_stat);
+	trace_end(sam_stat, sz);
 
 	/* dbuf.sam_stat was zeroed in completeSCSICommand */
 	lu_ssc.sam_status = dbuf.sam_stat;
 }
 
+/* Drive state as seen by 'vtlcmd stats' and mhvtl-exporter */
+static void update_stats(void) {
+	stats_state(current_state);
+	stats_media(get_tape_load_status() == TAPE_LOADED ? lu_ssc.barcode : NULL);
+	stats_media_bytes(lu_ssc.bytesRead_I, lu_ssc.bytesRead_M,
+					  lu_ssc.bytesWritten_I, lu_ssc.bytesWritten_M);
+}
+
 static void init_lu_ssc(struct priv_lu_ssc *lu_priv) {
 	lu_priv->bufsize				 = 2 * 1024 * 1024;
 	lu_priv->load_status			 = TAPE_UNLOADED;
@@ -2221,6 +2330,7 @@ int main(int argc, char *argv[]) {
 	int				 ret;
 	int				 last_state = MHVTL_STATE_UNKNOWN;
 	useconds_t		 sleep_time = 50000L; /* Used as backoff counter */
+	uint64_t		 poll_start;
 	uint8_t			*buf;
 	pid_t			 child_cleanup, pid, ppid, sid;
 	struct sigaction new_action, old_action;
@@ -2352,11 +2462,12 @@ int main(int argc, char *argv[]) {
 		exit(1);
 	}
 
-	buf = (uint8_t *)zalloc(lu_ssc.bufsize);
-	if (NULL == buf) {
+	/* Aligned, so READ/WRITE data can go straight to/from O_DIRECT media */
+	if (posix_memalign((void **)&buf, DIRECT_IO_ALIGN, lu_ssc.bufsize)) {
 		perror("Problems allocating memory");
 		exit(1);
 	}
+	memset(buf, 0, lu_ssc.bufsize);
 
 	if ((chdir(MHVTL_HOME_PATH)) < 0) {
 		perror("Unable to change directory to " MHVTL_HOME_PATH);
@@ -2414,9 +2525,12 @@ int main(int argc, char *argv[]) {
 	sigaction(SIGINT, &new_action, &old_action);
 	sigaction(SIGPIPE, &new_action, &old_action);
 	sigaction(SIGTERM, &new_action, &old_action);
-	sigaction(SIGUSR1, &new_action, &old_action);
 	sigaction(SIGUSR2, &new_action, &old_action);
 
+	/* SIGUSR1 dumps the trace ring - see mhvtl-trace(1) */
+	new_action.sa_handler = trace_signal;
+	sigaction(SIGUSR1, &new_action, &old_action);
+
 	/* If fifoname passed as switch */
 	if (fifoname)
 		process_fifoname(&lunit, fifoname, 1);
@@ -2432,9 +2546,14 @@ int main(int argc, char *argv[]) {
 		MHVTL_ERR("Failed to set fifo count()...");
 	}
 
+	stats_init(my_id, STATS_LU_TAPE);
+	trace_init(my_id);
+
 	child_cleanup = not_started;
 
 	for (;;) {
+		update_stats();
+
 		/* Check for anything in the messages Q */
 		mlen = msgrcv(r_qid, &lu_ssc.r_entry, MAXOBN, my_id, IPC_NOWAIT);
 		if (mlen > 0) {
@@ -2448,6 +2567,7 @@ int main(int argc, char *argv[]) {
 						  strerror(errno));
 			}
 		}
+		poll_start = stats_clock();
 		ret = ioctl(cdev, VTL_POLL_AND_GET_HEADER, &mhvtl_cmd);
 		if (ret < 0) {
 			MHVTL_DBG(2,
@@ -2480,6 +2600,7 @@ int main(int argc, char *argv[]) {
 				fflush(NULL);
 			switch (ret) {
 			case VTL_QUEUE_CMD: /* A cdb to process */
+				stats_phase(STATS_KERNEL_WAIT, poll_start);
 				cmd = malloc(sizeof(struct mhvtl_header));
 				if (!cmd) {
 					MHVTL_ERR("Out of memory");
@@ -2536,6 +2657,8 @@ exit:
 	close(cdev);
 	free(buf);
 	dec_fifo_count();
+	stats_exit();
+	trace_exit();
 	if (lunit.fifo_fd) {
 		fclose(lunit.fifo_fd);
 		unlink(lunit.fifoname);
@@ -0,0 +1,264 @@
+/*
+ * Cartridge catalog
+ *
+ * Copyright (C) 2005 - 2025 Mark Harvey markh794 at gmail dot com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * Finding a PCL otherwise means walking device.conf and stat()ing every
+ * library home directory, and describing it means opening its MAM. The
+ * catalog keeps the answer for every PCL of every library in one file of
+ * fixed size records: vtltape updates an entry when media is unloaded,
+ * mktape/edit_tape/preload_tape when they change one. Readers take a shared
+ * flock(), writers an exclusive one.
+ *
+ * The catalog is only ever a cache - 'mhvtl-catalog -r' rebuilds it from the
+ * home directories - so failing to update it is logged and otherwise ignored.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include "be_byteshift.h"
+#include "logging.h"
+#include "mhvtl_scsi.h"
+#include "vtllib.h"
+#include "mhvtl_catalog.h"
+
+#define CATALOG_CHUNK 64 /* Records read per pread() */
+
+const char *catalog_path(void) {
+	return MHVTL_HOME_PATH "/" CATALOG_FILE;
+}
+
+static int valid_header(const struct catalog_entry *hdr) {
+	return hdr->pcl[0] == '\0' && hdr->library == CATALOG_MAGIC && hdr->filemarks == CATALOG_VERSION;
+}
+
+/*
+ * Open and lock the catalog. Opening for update creates it, or starts it
+ * afresh if the header is not one we understand.
+ *
+ * Returns the file descriptor, -1 on failure
+ */
+static int catalog_open(int update) {
+	struct catalog_entry hdr;
+	int					 fd;
+
+	BUILD_BUG_ON(sizeof(struct catalog_entry) != 512);
+
+	fd = open(catalog_path(), update ? O_RDWR | O_CREAT | O_CLOEXEC : O_RDONLY | O_CLOEXEC, 0664);
+	if (fd < 0) {
+		if (update || errno != ENOENT)
+			MHVTL_DBG(1, "Can not open %s: %s", catalog_path(), strerror(errno));
+		return -1;
+	}
+	if (flock(fd, update ? LOCK_EX : LOCK_SH) < 0) {
+		MHVTL_DBG(1, "Can not lock %s: %s", catalog_path(), strerror(errno));
+		close(fd);
+		return -1;
+	}
+	if (pread(fd, &hdr, sizeof(hdr), 0) == sizeof(hdr) && valid_header(&hdr))
+		return fd;
+	if (!update) {
+		close(fd);
+		return -1;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.library	  = CATALOG_MAGIC;
+	hdr.filemarks = CATALOG_VERSION;
+	if (ftruncate(fd, 0) < 0 || pwrite(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr)) {
+		MHVTL_DBG(1, "Can not initialise %s: %s", catalog_path(), strerror(errno));
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/*
+ * Find 'pcl' in the catalog open on 'fd'
+ *
+ * Returns its offset and copies it to 'e' (if not NULL).
+ * Not found: returns -1 and sets '*free_slot' to the offset of the first
+ * free record, or the end of the file
+ */
+static off_t catalog_find(int fd, const char *pcl, struct catalog_entry *e, off_t *free_slot) {
+	struct catalog_entry rec[CATALOG_CHUNK];
+	off_t				 offset = sizeof(struct catalog_entry);
+	ssize_t				 n;
+	int					 i;
+
+	if (free_slot)
+		*free_slot = -1;
+
+	while ((n = pread(fd, rec, sizeof(rec), offset)) >= (ssize_t)sizeof(rec[0])) {
+		for (i = 0; i < n / (ssize_t)sizeof(rec[0]); i++, offset += sizeof(rec[0])) {
+			if (rec[i].pcl[0] == '\0') {
+				if (free_slot && *free_slot < 0)
+					*free_slot = offset;
+				continue;
+			}
+			if (!strncmp(rec[i].pcl, pcl, sizeof(rec[i].pcl))) {
+				if (e)
+					*e = rec[i];
+				return offset;
+			}
+		}
+	}
+	if (free_slot && *free_slot < 0)
+		*free_slot = offset;
+	return -1;
+}
+
+/* Returns 0 and fills in 'e' if 'pcl' is in the catalog */
+int catalog_lookup(const char *pcl, struct catalog_entry *e) {
+	off_t offset;
+	int	  fd;
+
+	fd = catalog_open(0);
+	if (fd < 0)
+		return -1;
+	offset = catalog_find(fd, pcl, e, NULL);
+	close(fd);
+	return offset < 0 ? -1 : 0;
+}
+
+/* Add or replace the entry for e->pcl. Returns 0 on success */
+int catalog_update(const struct catalog_entry *e) {
+	off_t offset, free_slot;
+	int	  fd, rc = 0;
+
+	if (!e->pcl[0])
+		return -1;
+
+	fd = catalog_open(1);
+	if (fd < 0)
+		return -1;
+	offset = catalog_find(fd, e->pcl, NULL, &free_slot);
+	if (offset < 0)
+		offset = free_slot;
+	if (pwrite(fd, e, sizeof(*e), offset) != sizeof(*e)) {
+		MHVTL_DBG(1, "Can not update %s in %s: %s", e->pcl, catalog_path(), strerror(errno));
+		rc = -1;
+	}
+	close(fd);
+	return rc;
+}
+
+/* Returns 0 if 'pcl' was in the catalog */
+int catalog_remove(const char *pcl) {
+	struct catalog_entry empty;
+	off_t				 offset;
+	int					 fd, rc = -1;
+
+	fd = catalog_open(1);
+	if (fd < 0)
+		return -1;
+	offset = catalog_find(fd, pcl, NULL, NULL);
+	if (offset >= 0) {
+		memset(&empty, 0, sizeof(empty));
+		if (pwrite(fd, &empty, sizeof(empty), offset) == sizeof(empty))
+			rc = 0;
+	}
+	close(fd);
+	return rc;
+}
+
+/*
+ * Call 'fn' for each entry, stopping early if it returns non-zero
+ *
+ * Returns the number of entries visited, -1 if there is no catalog
+ */
+int catalog_walk(int (*fn)(const struct catalog_entry *e, void *arg), void *arg) {
+	struct catalog_entry rec[CATALOG_CHUNK];
+	off_t				 offset = sizeof(struct catalog_entry);
+	ssize_t				 n;
+	int					 i, fd, count = 0;
+
+	fd = catalog_open(0);
+	if (fd < 0)
+		return -1;
+	while ((n = pread(fd, rec, sizeof(rec), offset)) >= (ssize_t)sizeof(rec[0])) {
+		offset += n - n % sizeof(rec[0]);
+		for (i = 0; i < n / (ssize_t)sizeof(rec[0]); i++) {
+			if (rec[i].pcl[0] == '\0')
+				continue;
+			count++;
+			if (fn(&rec[i], arg))
+				goto done;
+		}
+	}
+done:
+	close(fd);
+	return count;
+}
+
+/*
+ * Describe media 'pcl' of 'library', kept in 'home', from its MAM and what is
+ * on the tape
+ */
+void catalog_fill(struct catalog_entry *e, const char *pcl, long library,
+				  const char *home, struct MAM *mamp, uint64_t filemarks, uint64_t used) {
+	int i;
+
+	memset(e, 0, sizeof(*e));
+	/* Barcodes may be space padded */
+	for (i = 0; i < MAX_BARCODE_LEN && pcl[i] && pcl[i] != ' '; i++)
+		e->pcl[i] = pcl[i];
+
+	e->library		 = library;
+	e->medium_type	 = mamp->MediumType;
+	e->media_type	 = mamp->MediaType;
+	e->partitions	 = mamp->num_partitions;
+	e->write_protect = !!(mamp->Flags & MAM_FLAGS_MEDIA_WRITE_PROTECT);
+	e->filemarks	 = filemarks;
+	e->load_count	 = get_unaligned_be64(&mamp->LoadCount);
+	e->capacity		 = get_unaligned_be64(&mamp->max_capacity);
+	e->used			 = used;
+	e->updated		 = time(NULL);
+	memcpy(e->density, mamp->media_info.density_name, sizeof(e->density));
+	snprintf(e->home, sizeof(e->home), "%s", home);
+}
+
+/*
+ * Record the media currently loaded, from the global MAM and home directory.
+ * 'written' is non-zero if it has been written to since it was loaded,
+ * otherwise the last written time recorded before is kept.
+ */
+void catalog_note(const char *pcl, long library, int written) {
+	struct catalog_entry e, old;
+	uint64_t			 used = 0;
+
+	for (int i = 0; i < mam.num_partitions && i < MAX_PARTITIONS; i++)
+		used += partition_data_offset(i);
+	catalog_fill(&e, pcl, library,
+				 strlen(home_directory) ? home_directory : MHVTL_HOME_PATH,
+				 &mam, total_filemarks(), used);
+	if (written)
+		e.last_written = e.updated;
+	else if (!catalog_lookup(e.pcl, &old))
+		e.last_written = old.last_written;
+
+	if (catalog_update(&e))
+		MHVTL_DBG(1, "Catalog entry for %s not updated", e.pcl);
+}
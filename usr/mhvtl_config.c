@@ -0,0 +1,338 @@
+/*
+ * device.conf configuration model
+ *
+ * Copyright (C) 2005 - 2025 Mark Harvey markh794 at gmail dot com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * Each daemon used to read all of device.conf to find its own few lines,
+ * and again for every media home directory it looked up, so starting N
+ * drives cost N passes over a file that grows with N. device.conf is now
+ * parsed once into a table of its libraries and drives: id, address, the
+ * library and slot a drive is in, a library's media home directory and
+ * how its media is provisioned, and where in device.conf each device's
+ * lines are, so the daemons only read their own.
+ *
+ * The table is kept for the life of the process and checked against the
+ * mtime of device.conf on each use. It is also written out to CONFIG_CACHE,
+ * where the next process to start finds it rather than parsing again.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "logging.h"
+#include "mhvtl_scsi.h"
+#include "vtllib.h"
+#include "mhvtl_config.h"
+
+struct config_cache_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t record_size;
+	uint32_t count;
+	uint64_t dev;
+	uint64_t ino;
+	uint64_t size;
+	int64_t	 mtime_sec;
+	int64_t	 mtime_nsec;
+	char	 device_conf[CONF_FILE_SZ];
+};
+
+static struct mhvtl_config config;
+static int				   config_loaded;
+
+static void cache_header_init(struct config_cache_header *h, const struct mhvtl_config *cfg) {
+	memset(h, 0, sizeof(*h));
+	h->magic	  = CONFIG_CACHE_MAGIC;
+	h->version	  = CONFIG_CACHE_VERSION;
+	h->record_size = sizeof(struct conf_device);
+	h->count	  = cfg->count;
+	h->dev		  = cfg->dev;
+	h->ino		  = cfg->ino;
+	h->size		  = cfg->size;
+	h->mtime_sec  = cfg->mtime.tv_sec;
+	h->mtime_nsec = cfg->mtime.tv_nsec;
+	snprintf(h->device_conf, sizeof(h->device_conf), "%s", cfg->device_conf);
+}
+
+/* Returns 0 if the cache holds 'cfg->device_conf' as it is now */
+static int cache_read(struct mhvtl_config *cfg) {
+	struct config_cache_header want, h;
+	struct stat				   st;
+	size_t					   len;
+	int						   fd;
+
+	fd = open(CONFIG_CACHE, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	/* Only trust what we, or root, wrote */
+	if (fstat(fd, &st) || (st.st_uid != 0 && st.st_uid != geteuid()) ||
+		read(fd, &h, sizeof(h)) != sizeof(h))
+		goto fail;
+
+	cache_header_init(&want, cfg);
+	want.count = h.count;
+	if (memcmp(&want, &h, sizeof(h)))
+		goto fail;
+
+	len			= h.count * sizeof(struct conf_device);
+	cfg->device = malloc(len ? len : 1);
+	if (!cfg->device || read(fd, cfg->device, len) != (ssize_t)len) {
+		free(cfg->device);
+		cfg->device = NULL;
+		goto fail;
+	}
+	cfg->count = h.count;
+	close(fd);
+	MHVTL_DBG(2, "%d devices of %s from %s", cfg->count, cfg->device_conf, CONFIG_CACHE);
+	return 0;
+
+fail:
+	close(fd);
+	return -1;
+}
+
+static void cache_write(const struct mhvtl_config *cfg) {
+	struct config_cache_header h;
+	char					   tmp[64];
+	size_t					   len = cfg->count * sizeof(struct conf_device);
+	int						   fd;
+
+	snprintf(tmp, sizeof(tmp), "%s.%d", CONFIG_CACHE, (int)getpid());
+	/* Never through a file, or symlink, someone else left there */
+	fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0644);
+	if (fd < 0 && errno == EEXIST && !unlink(tmp)) /* An earlier us died */
+		fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		MHVTL_DBG(2, "Can not create %s: %s", tmp, strerror(errno));
+		return;
+	}
+	cache_header_init(&h, cfg);
+	if (write(fd, &h, sizeof(h)) != sizeof(h) ||
+		write(fd, cfg->device, len) != (ssize_t)len) {
+		MHVTL_DBG(2, "Can not write %s: %s", tmp, strerror(errno));
+		close(fd);
+		unlink(tmp);
+		return;
+	}
+	fchmod(fd, 0644); /* Readable by the tools, whatever the umask */
+	close(fd);
+	if (rename(tmp, CONFIG_CACHE))
+		unlink(tmp);
+}
+
+static struct conf_device *add_device(struct mhvtl_config *cfg, int type, long id,
+									  int line, off_t offset) {
+	struct conf_device *d;
+
+	for_each_conf_device(cfg, d) {
+		if (d->type == type && d->id == id) {
+			MHVTL_ERR("%s: %s %ld defined more than once - using the first",
+					  cfg->device_conf, type == CONF_LIBRARY ? "Library" : "Drive", id);
+			return NULL;
+		}
+	}
+
+	if (!(cfg->count % 64)) {
+		d = realloc(cfg->device, (cfg->count + 64) * sizeof(*d));
+		if (!d) {
+			MHVTL_ERR("Could not allocate memory");
+			return NULL;
+		}
+		cfg->device = d;
+	}
+	d = &cfg->device[cfg->count++];
+	memset(d, 0, sizeof(*d));
+	d->type	  = type;
+	d->id	  = id;
+	d->line	  = line;
+	d->offset = offset;
+	d->end	  = offset;
+	return d;
+}
+
+/*
+ * A device's lines run from its 'Library:' or 'Drive:' line to the next
+ * blank line, or the next device
+ */
+static int parse(struct mhvtl_config *cfg) {
+	struct conf_device *cur = NULL;
+	struct conf_device *d, *lib;
+	FILE			   *conf;
+	char			   *b, *s;
+	off_t				offset;
+	long				id;
+	int					channel, target, lun;
+	int					line = 0;
+
+	conf = fopen(cfg->device_conf, "r");
+	if (!conf) {
+		MHVTL_ERR("Can not open config file %s : %s", cfg->device_conf, strerror(errno));
+		return -1;
+	}
+	b = zalloc(MALLOC_SZ);
+	s = zalloc(MALLOC_SZ);
+	if (!b || !s) {
+		MHVTL_ERR("Could not allocate memory");
+		free(b);
+		free(s);
+		fclose(conf);
+		return -1;
+	}
+
+	offset = 0;
+	while (readline(b, MALLOC_SZ, conf) != NULL) {
+		line++;
+		if (b[0] == '#') /* Ignore comments */
+			goto next;
+		if (b[strspn(b, " \t\r\n")] == '\0') { /* Blank line ends a device */
+			if (cur)
+				cur->end = offset;
+			cur = NULL;
+			goto next;
+		}
+		channel = target = lun = 0;
+		if (sscanf(b, "Library: %ld CHANNEL: %d TARGET: %d LUN: %d",
+				   &id, &channel, &target, &lun) >= 1) {
+			if (cur)
+				cur->end = offset;
+			cur = add_device(cfg, CONF_LIBRARY, id, line, offset);
+		} else if (sscanf(b, "Drive: %ld CHANNEL: %d TARGET: %d LUN: %d",
+						  &id, &channel, &target, &lun) >= 1) {
+			if (cur)
+				cur->end = offset;
+			cur = add_device(cfg, CONF_DRIVE, id, line, offset);
+		} else if (cur && cur->type == CONF_LIBRARY) {
+			if (sscanf(b, " Home directory: %s", s) == 1)
+				snprintf(cur->home, sizeof(cur->home), "%s", s);
+			else if (sscanf(b, " Provision: %s", s) == 1)
+				cur->on_demand = !strcasecmp(s, "on-demand");
+			else
+				sscanf(b, " Capacity: %ld", &cur->capacity);
+		} else if (cur && cur->type == CONF_DRIVE) {
+			sscanf(b, " Library ID: %ld Slot: %d", &cur->library_id, &cur->slot);
+		}
+		if (cur && cur->offset == offset) {
+			cur->channel = channel;
+			cur->target	 = target;
+			cur->lun	 = lun;
+		}
+next:
+		offset = ftello(conf);
+	}
+	if (cur)
+		cur->end = offset;
+	fclose(conf);
+	free(b);
+	free(s);
+
+	for_each_conf_device(cfg, d) {
+		if (d->type != CONF_DRIVE || !d->library_id)
+			continue;
+		for (lib = cfg->device; lib < cfg->device + cfg->count; lib++)
+			if (lib->type == CONF_LIBRARY && lib->id == d->library_id)
+				break;
+		if (lib == cfg->device + cfg->count)
+			MHVTL_LOG("%s: Drive %ld is in Library %ld, which is not defined",
+					  cfg->device_conf, d->id, d->library_id);
+	}
+
+	MHVTL_DBG(2, "Parsed %d devices from %s", cfg->count, cfg->device_conf);
+	return 0;
+}
+
+/*
+ * The configuration, parsed or from the cache. It, and the devices in it,
+ * stay valid until the next config_load() or config_find() finds that
+ * device.conf has changed.
+ *
+ * Returns NULL if device.conf can not be read
+ */
+const struct mhvtl_config *config_load(void) {
+	char		device_conf[CONF_FILE_SZ];
+	struct stat st;
+
+	if (get_config(device_conf, DEVICE_CONF, my_id) < 0)
+		return NULL;
+	if (stat(device_conf, &st) < 0) {
+		MHVTL_ERR("Can not stat config file %s : %s", device_conf, strerror(errno));
+		return NULL;
+	}
+
+	if (config_loaded && !strcmp(config.device_conf, device_conf) &&
+		config.dev == st.st_dev && config.ino == st.st_ino &&
+		config.size == st.st_size &&
+		config.mtime.tv_sec == st.st_mtim.tv_sec &&
+		config.mtime.tv_nsec == st.st_mtim.tv_nsec)
+		return &config;
+
+	free(config.device);
+	memset(&config, 0, sizeof(config));
+	config_loaded = 0;
+	snprintf(config.device_conf, sizeof(config.device_conf), "%s", device_conf);
+	config.dev	 = st.st_dev;
+	config.ino	 = st.st_ino;
+	config.size	 = st.st_size;
+	config.mtime = st.st_mtim;
+
+	if (cache_read(&config)) {
+		if (parse(&config)) {
+			free(config.device);
+			memset(&config, 0, sizeof(config));
+			return NULL;
+		}
+		cache_write(&config);
+	}
+	config_loaded = 1;
+	return &config;
+}
+
+/* Library or drive 'id', NULL if it is not in device.conf */
+const struct conf_device *config_find(long id, int type) {
+	const struct mhvtl_config *cfg = config_load();
+	const struct conf_device  *d;
+
+	if (!cfg)
+		return NULL;
+	for_each_conf_device(cfg, d)
+		if (d->type == type && d->id == id)
+			return d;
+	return NULL;
+}
+
+/*
+ * Position 'conf' (device.conf) at the first line of device 'd'
+ *
+ * Returns the offset just past its last line
+ */
+off_t config_stanza(FILE *conf, const struct conf_device *d) {
+	if (fseeko(conf, d->offset, SEEK_SET) < 0)
+		return 0;
+	return d->end;
+}
+
+/* Media home directory of library 'd' - MHVTL_HOME_PATH/<id> if not set */
+void config_home(const struct conf_device *d, char *buf, size_t len) {
+	if (d->home[0])
+		snprintf(buf, len, "%s", d->home);
+	else
+		snprintf(buf, len, "%s/%ld", MHVTL_HOME_PATH, d->id);
+}
@@ -20,6 +20,8 @@
 #include "vtlcart.h"
 #include "ssc.h"
 #include "mhvtl_log.h"
+#include "mhvtl_stats.h"
+#include "mhvtl_trace.h"
 #include "ccan/crc32c/crc32c.h"
 #include <zlib.h>
 #include "minilzo.h"
@@ -43,80 +45,128 @@ mk_sense_short_block(uint32_t requested, uint32_t processed, uint8_t *sense_vali
 	put_unaligned_be32(difference, &sense[3]);
 }
 
-static int uncompress_lzo_block(uint8_t *buf, uint32_t tgtsize, uint8_t *sam_stat) {
-	uint8_t *cbuf, *c2buf;
-	uint32_t disk_blk_size, blk_size;
-	int		 rc, z;
-	loff_t	 nread = 0;
-	lzo_uint uncompress_sz;
+/* CRC32C */
+static uint32_t mhvtl_crc32c(unsigned char const *buf, size_t size) {
+	return crc32c(0, buf, size);
+}
 
-	/* The tape block is compressed.
-	   Save field values we will need after the read which
-	   causes the tape block to advance.
-	*/
-	blk_size	  = c_pos->blk_size;
-	disk_blk_size = c_pos->disk_blk_size;
+/* Smallest scratch allocation, also the zlib 'spill' chunk size */
+#define SCRATCH_MIN (64 * 1024)
 
-	/* Malloc a buffer to hold the compressed data, and read the
-	   data into it.
-	*/
-	cbuf = (uint8_t *)malloc(disk_blk_size);
+/*
+ * Return a scratch buffer of at least 'want' bytes.
+ *
+ * Scratch buffers live as long as the process and only ever grow, so a
+ * stream of READs doesn't malloc()/free() for every block. Contents are not
+ * preserved when one grows. They are aligned for O_DIRECT media.
+ */
+static uint8_t *get_scratch(uint8_t **buf, uint32_t *sz, uint32_t want) {
+	uint8_t *p;
+
+	if (want < SCRATCH_MIN)
+		want = SCRATCH_MIN;
+
+	if (*buf && want <= *sz)
+		return *buf;
+
+	free(*buf);
+	*buf = NULL;
+	*sz	 = 0;
+	if (posix_memalign((void **)&p, DIRECT_IO_ALIGN, want)) {
+		MHVTL_ERR("Unable to allocate %u bytes of scratch space", want);
+		return NULL;
+	}
+	*buf = p;
+	*sz	 = want;
+
+	return p;
+}
+
+/*
+ * Read the compressed data of the current block into the per-LU compressed
+ * buffer.
+ *
+ * Can't reference c_pos after this point
+ * read_tape_block increments c_pos to next block header
+ */
+static uint8_t *read_compressed_block(uint32_t disk_blk_size, uint8_t *sam_stat) {
+	uint8_t *cbuf;
+	uint32_t nread;
+	uint64_t start;
+
+	cbuf = get_scratch(&lu_ssc.comp_buf, &lu_ssc.comp_buf_sz, disk_blk_size);
 	if (!cbuf) {
-		MHVTL_ERR("Out of memory: %d", __LINE__);
 		sam_medium_error(E_DECOMPRESSION_CRC, sam_stat);
-		return 0;
+		return NULL;
 	}
 
-	/* Can't reference c_pos after this point
-	 * read_tape_block increments c_pos to next block header
-	 */
+	start = stats_clock();
 	nread = read_tape_block(cbuf, disk_blk_size, sam_stat);
+	stats_phase(STATS_STORAGE, start);
 	if (nread != disk_blk_size) {
 		MHVTL_ERR("read failed, %s", strerror(errno));
 		sam_medium_error(E_UNRECOVERED_READ, sam_stat);
-		free(cbuf);
-		return 0;
+		return NULL;
 	}
 
-	rc			  = tgtsize;
-	uncompress_sz = blk_size;
+	return cbuf;
+}
+
+/*
+ * Uncompress the current block, placing the first 'tgtsize' bytes in 'buf'.
+ * If 'crc' is non-NULL it is set to the CRC32C of the whole uncompressed block.
+ *
+ * Returns uncompressed size of the block, -1 on error with sense already set
+ */
+static int uncompress_lzo_block(uint8_t *buf, uint32_t tgtsize, uint32_t *crc, uint8_t *sam_stat) {
+	uint8_t *cbuf, *dst;
+	uint32_t disk_blk_size, blk_size;
+	int		 z;
+	lzo_uint uncompress_sz;
+	uint64_t start;
 
-	/* If the scsi read buffer is at least as big as the size of
-	   the uncompressed data then we can uncompress directly into
-	   the read buffer.  If not, then we need an extra buffer to
-	   uncompress into, then memcpy the subrange we need to the
-	   read buffer.
+	/* The tape block is compressed.
+	   Save field values we will need after the read which
+	   causes the tape block to advance.
 	*/
+	blk_size	  = c_pos->blk_size;
+	disk_blk_size = c_pos->disk_blk_size;
 
+	cbuf = read_compressed_block(disk_blk_size, sam_stat);
+	if (!cbuf)
+		return -1;
+
+	/* If the scsi read buffer is at least as big as the uncompressed
+	   data then we can uncompress directly into the read buffer.
+	   minilzo has no streaming interface, so a short read has to
+	   uncompress the whole block into the spill buffer and copy out the
+	   front of it.
+	*/
 	if (tgtsize >= blk_size) {
-		/* block sizes match, uncompress directly into buf */
-		z = lzo1x_decompress_safe(cbuf, disk_blk_size, buf, &uncompress_sz, NULL);
+		dst = buf;
 	} else {
-		/* Initiator hasn't requested same size as data block */
-		c2buf = (uint8_t *)malloc(uncompress_sz);
-		if (c2buf == NULL) {
-			MHVTL_ERR("Out of memory: %d", __LINE__);
+		dst = get_scratch(&lu_ssc.spill_buf, &lu_ssc.spill_buf_sz, blk_size);
+		if (!dst) {
 			sam_medium_error(E_DECOMPRESSION_CRC, sam_stat);
-			free(cbuf);
-			return 0;
+			return -1;
 		}
-		z = lzo1x_decompress_safe(cbuf, disk_blk_size, c2buf, &uncompress_sz, NULL);
-		/* Only copy out decompressed data on success; otherwise c2buf
-		 * contains uninitialized / partial data and would silently
-		 * corrupt the caller's read buffer. The switch (z) below will
-		 * set the appropriate sense for failure cases.
-		 */
-		if (z == LZO_E_OK)
-			memcpy(buf, c2buf, tgtsize);
-		free(c2buf);
 	}
 
+	uncompress_sz = blk_size;
+	start		  = stats_clock();
+	z			  = lzo1x_decompress_safe(cbuf, disk_blk_size, dst, &uncompress_sz, NULL);
+	stats_phase(STATS_COMPRESS, start);
+
 	switch (z) {
 	case LZO_E_OK:
 		MHVTL_DBG(2, "Read %u bytes of lzo compressed"
 					 " data, have %u bytes for result",
-				  (uint32_t)nread, blk_size);
-		goto complete;
+				  disk_blk_size, blk_size);
+		if (crc)
+			*crc = mhvtl_crc32c(dst, uncompress_sz);
+		if (dst != buf)
+			memcpy(buf, dst, tgtsize);
+		return blk_size;
 		break;
 	case LZO_E_INPUT_NOT_CONSUMED:
 		MHVTL_DBG(1, "The end of compressed block has been detected before all %d bytes", blk_size);
@@ -139,20 +189,27 @@ static int uncompress_lzo_block(uint8_t *buf, uint32_t tgtsize, uint8_t *sam_sta
 	}
 
 	sam_medium_error(E_DECOMPRESSION_CRC, sam_stat);
-	rc = 0;
 
-complete:
-	free(cbuf);
-
-	return rc;
+	return -1;
 }
 
-static int uncompress_zlib_block(uint8_t *buf, uint32_t tgtsize, uint8_t *sam_stat) {
-	uint8_t *cbuf, *c2buf;
-	loff_t	 nread = 0;
-	uLongf	 uncompress_sz;
+/*
+ * Uncompress the current block, placing the first 'tgtsize' bytes in 'buf'.
+ * If 'crc' is non-NULL it is set to the CRC32C of the whole uncompressed block.
+ *
+ * zlib is driven as a stream: output goes straight into 'buf' and stops
+ * there, unless a CRC is wanted, in which case the rest of the block is
+ * inflated a chunk at a time through the spill buffer.
+ *
+ * Returns uncompressed size of the block, -1 on error with sense already set
+ */
+static int uncompress_zlib_block(uint8_t *buf, uint32_t tgtsize, uint32_t *crc, uint8_t *sam_stat) {
+	uint8_t *cbuf, *spill;
 	uint32_t disk_blk_size, blk_size;
-	int		 rc, z;
+	uint32_t want;
+	z_stream strm;
+	int		 z;
+	uint64_t start;
 
 	/* The tape block is compressed.
 	   Save field values we will need after the read which
@@ -161,88 +218,155 @@ static int uncompress_zlib_block(uint8_t *buf, uint32_t tgtsize, uint8_t *sam_st
 	blk_size	  = c_pos->blk_size;
 	disk_blk_size = c_pos->disk_blk_size;
 
-	/* Malloc a buffer to hold the compressed data, and read the
-	   data into it.
-	*/
-	cbuf = (uint8_t *)malloc(disk_blk_size);
-	if (!cbuf) {
-		MHVTL_ERR("Out of memory: %d", __LINE__);
-		sam_medium_error(E_DECOMPRESSION_CRC, sam_stat);
-		return 0;
-	}
+	cbuf = read_compressed_block(disk_blk_size, sam_stat);
+	if (!cbuf)
+		return -1;
 
-	nread = read_tape_block(cbuf, disk_blk_size, sam_stat);
-	if (nread != disk_blk_size) {
-		MHVTL_ERR("read failed, %s", strerror(errno));
-		sam_medium_error(E_UNRECOVERED_READ, sam_stat);
-		free(cbuf);
-		return 0;
+	start = stats_clock();
+	memset(&strm, 0, sizeof(strm));
+	strm.next_in  = cbuf;
+	strm.avail_in = disk_blk_size;
+	z			  = inflateInit(&strm);
+	if (z != Z_OK) {
+		MHVTL_ERR("Unable to initialise zlib: %d", z);
+		sam_medium_error(E_DECOMPRESSION_CRC, sam_stat);
+		return -1;
 	}
 
-	rc			  = tgtsize;
-	uncompress_sz = blk_size;
+	want		   = (tgtsize < blk_size) ? tgtsize : blk_size;
+	strm.next_out  = buf;
+	strm.avail_out = want;
+	z			   = inflate(&strm, Z_FINISH);
+	if (z == Z_BUF_ERROR && strm.avail_out == 0)
+		z = Z_OK; /* Output full - more of the block still to come */
 
-	/* If the scsi read buffer is at least as big as the size of
-	   the uncompressed data then we can uncompress directly into
-	   the read buffer.  If not, then we need an extra buffer to
-	   uncompress into, then memcpy the subrange we need to the
-	   read buffer.
-	*/
+	if (crc && (z == Z_OK || z == Z_STREAM_END)) {
+		*crc = mhvtl_crc32c(buf, strm.total_out);
 
-	if (tgtsize >= blk_size) {
-		/* block sizes match, uncompress directly into buf */
-		z = uncompress(buf, &uncompress_sz, cbuf, disk_blk_size);
-	} else {
-		/* Initiator hasn't requested same size as data block */
-		c2buf = (uint8_t *)malloc(uncompress_sz);
-		if (c2buf == NULL) {
-			MHVTL_ERR("Out of memory: %d", __LINE__);
-			sam_medium_error(E_DECOMPRESSION_CRC, sam_stat);
-			free(cbuf);
-			return 0;
+		while (z == Z_OK && strm.total_out < blk_size) {
+			spill = get_scratch(&lu_ssc.spill_buf, &lu_ssc.spill_buf_sz, SCRATCH_MIN);
+			if (!spill) {
+				z = Z_MEM_ERROR;
+				break;
+			}
+			strm.next_out  = spill;
+			strm.avail_out = SCRATCH_MIN;
+			z			   = inflate(&strm, Z_FINISH);
+			if (z == Z_BUF_ERROR && strm.avail_out == 0)
+				z = Z_OK;
+			if (z == Z_OK || z == Z_STREAM_END)
+				*crc = crc32c(*crc, spill, SCRATCH_MIN - strm.avail_out);
 		}
-		z = uncompress(c2buf, &uncompress_sz, cbuf, disk_blk_size);
-		/* Only copy out decompressed data on success; otherwise c2buf
-		 * contains uninitialized / partial data and would silently
-		 * corrupt the caller's read buffer. The switch (z) below will
-		 * set the appropriate sense for failure cases.
-		 */
-		if (z == Z_OK)
-			memcpy(buf, c2buf, tgtsize);
-		free(c2buf);
 	}
 
+	/* Either the whole block, or as much as was wanted, was produced */
+	if ((z == Z_OK || z == Z_STREAM_END) && strm.total_out < want)
+		z = Z_DATA_ERROR;
+
+	inflateEnd(&strm);
+	stats_phase(STATS_COMPRESS, start);
+
 	switch (z) {
 	case Z_OK:
+	case Z_STREAM_END:
 		MHVTL_DBG(2, "Read %u bytes of zlib compressed"
 					 " data, have %u bytes for result",
-				  (uint32_t)nread, blk_size);
+				  disk_blk_size, blk_size);
+		return blk_size;
 		break;
 	case Z_MEM_ERROR:
 		MHVTL_ERR("Not enough memory to decompress");
-		sam_medium_error(E_DECOMPRESSION_CRC, sam_stat);
-		rc = 0;
 		break;
 	case Z_DATA_ERROR:
 		MHVTL_ERR("Block corrupt or incomplete");
-		sam_medium_error(E_DECOMPRESSION_CRC, sam_stat);
-		rc = 0;
 		break;
 	case Z_BUF_ERROR:
 		MHVTL_ERR("Not enough memory in destination buf");
-		sam_medium_error(E_DECOMPRESSION_CRC, sam_stat);
-		rc = 0;
+		break;
+	default:
+		MHVTL_ERR("Unexpected zlib return code: %d", z);
 		break;
 	}
 
-	free(cbuf);
+	sam_medium_error(E_DECOMPRESSION_CRC, sam_stat);
 
-	return rc;
+	return -1;
 }
 
-/* CRC32C */
-static uint32_t mhvtl_crc32c(unsigned char const *buf, size_t size) {
-	return crc32c(0, buf, size);
+/*
+ * Uncompressed block - read straight into 'buf'.
+ * If 'crc' is non-NULL it is set to the CRC32C of the whole block, which for
+ * a short read means reading the block into the spill buffer first.
+ *
+ * Returns size of the block, -1 on error with sense already set
+ */
+static int read_uncompressed_block(uint8_t *buf, uint32_t tgtsize, uint32_t *crc, uint8_t *sam_stat) {
+	uint8_t *dst = buf;
+	uint32_t blk_size;
+	uint32_t iosize;
+	uint32_t nread;
+	uint64_t start;
+
+	blk_size = c_pos->blk_size;
+	iosize	 = (tgtsize < blk_size) ? tgtsize : blk_size;
+
+	if (crc && tgtsize < blk_size) {
+		dst = get_scratch(&lu_ssc.spill_buf, &lu_ssc.spill_buf_sz, blk_size);
+		if (!dst) {
+			sam_medium_error(E_UNRECOVERED_READ, sam_stat);
+			return -1;
+		}
+		iosize = blk_size;
+	}
+
+	start = stats_clock();
+	nread = read_tape_block(dst, iosize, sam_stat);
+	stats_phase(STATS_STORAGE, start);
+	if (nread != iosize) {
+		MHVTL_ERR("read failed, %s", strerror(errno));
+		sam_medium_error(E_UNRECOVERED_READ, sam_stat);
+		return -1;
+	}
+
+	if (crc)
+		*crc = mhvtl_crc32c(dst, blk_size);
+	if (dst != buf)
+		memcpy(buf, dst, tgtsize);
+
+	return blk_size;
+}
+
+/* 16 byte vector - SSE2 on x86_64, NEON on aarch64, emulated elsewhere */
+typedef uint64_t zero_scan_vec __attribute__((vector_size(16)));
+
+/*
+ * Return TRUE if every byte of 'buf' is zero.
+ *
+ * Works through 64 bytes per pass, OR-ing four vectors together, and bails
+ * out on the first pass which finds anything set - so real data usually
+ * costs no more than one pass.
+ */
+static int is_zero_block(const uint8_t *buf, uint32_t len) {
+	const uint8_t *p   = buf;
+	const uint8_t *end = buf + len;
+	zero_scan_vec  a, b, c, d;
+
+	while (end - p >= 64) {
+		memcpy(&a, p, sizeof(a));
+		memcpy(&b, p + 16, sizeof(b));
+		memcpy(&c, p + 32, sizeof(c));
+		memcpy(&d, p + 48, sizeof(d));
+		a |= b | c | d;
+		if (a[0] | a[1])
+			return FALSE;
+		p += 64;
+	}
+
+	while (p < end)
+		if (*p++)
+			return FALSE;
+
+	return TRUE;
 }
 
 /*
@@ -257,13 +381,13 @@ int readBlock(uint8_t *buf, uint32_t request_sz, int sili, int lbp_method, uint8
 	uint32_t blk_flags;
 	uint32_t post_crc;
 	uint32_t lbp_crc;
-	uint8_t *bounce_buffer;
+	uint32_t xfer_sz;
+	int		 want_crc;
 	int		 lbp_sz;
+	int		 sz;
 
-	MHVTL_DBG(3, "Request to read: %u bytes at partition/header %u/%u, SILI: %d, LBP_method: %s",
-			  request_sz, c_pos->partition_id, c_pos->blk_number, sili,
-			  (lbp_method == 0) ? "None" : (lbp_method == 1) ? "RS-CRC"
-															 : "CRC32c");
+	trace_event(TRACE_READ_REQ, c_pos->partition_id, c_pos->blk_number, 0,
+				request_sz, (!!sili) | lbp_method << 1);
 
 	/* check for a zero length read
 	 * This is not an error, and shouldn't change the tape position */
@@ -313,88 +437,83 @@ int readBlock(uint8_t *buf, uint32_t request_sz, int sili, int lbp_method, uint8
 	pre_crc		  = c_pos->uncomp_crc;
 	blk_flags	  = c_pos->blk_flags;
 
-	if (blk_size > request_sz) {
-		/* Add a fudge of 4 bytes in case LBP is calculated */
-		bounce_buffer = malloc(blk_size + 4);
-		if (!bounce_buffer) {
-			MHVTL_ERR("Unable to allocate %d bytes for bounce buffer",
-					  blk_size);
+	/* If the initiator asked for less than the block holds, only the
+	 * first 'request_sz' bytes are produced in 'buf'. The remainder is
+	 * only looked at if the CRC needs to be verified.
+	 */
+	xfer_sz	 = (blk_size > request_sz) ? request_sz : blk_size;
+	want_crc = (blk_flags & BLKHDR_FLG_CRC) && !(blk_flags & BLKHDR_FLG_ZERO);
+
+	if (blk_flags & BLKHDR_FLG_ZERO) {
+		/* Nothing was stored on media for an all-zero block - step over
+		 * the header and make up the data.
+		 */
+		if (read_tape_block(NULL, 0, sam_stat) != 0) {
+			MHVTL_ERR("Failed to step over zero-filled block %u", blk_number);
 			sam_medium_error(E_UNRECOVERED_READ, sam_stat);
 			return 0;
 		}
-	} else {
-		bounce_buffer = buf;
-	}
-
-	if (blk_flags & BLKHDR_FLG_LZO_COMPRESSED)
-		rc = uncompress_lzo_block(bounce_buffer, blk_size, sam_stat);
+		memset(buf, 0, xfer_sz);
+		sz = blk_size;
+	} else if (blk_flags & BLKHDR_FLG_LZO_COMPRESSED)
+		sz = uncompress_lzo_block(buf, xfer_sz, want_crc ? &post_crc : NULL, sam_stat);
 	else if (blk_flags & BLKHDR_FLG_ZLIB_COMPRESSED)
-		rc = uncompress_zlib_block(bounce_buffer, blk_size, sam_stat);
-	else {
-		/* If the tape block is uncompressed, we can read the number of bytes
-		   we need directly into the scsi read buffer and we are done.
-		*/
-		if (read_tape_block(bounce_buffer, blk_size, sam_stat) != blk_size) {
-			MHVTL_ERR("read failed, %s", strerror(errno));
-			sam_medium_error(E_UNRECOVERED_READ, sam_stat);
-			goto free_bounce_buf;
-		}
-		rc = blk_size;
-	}
+		sz = uncompress_zlib_block(buf, xfer_sz, want_crc ? &post_crc : NULL, sam_stat);
+	else
+		sz = read_uncompressed_block(buf, xfer_sz, want_crc ? &post_crc : NULL, sam_stat);
 
-	/* At this point, rc should now contain the actual uncompressed size of the block just read */
+	if (sz < 0)
+		return 0;
 
-	if (blk_flags & BLKHDR_FLG_CRC) {
-		post_crc = mhvtl_crc32c(bounce_buffer, rc);
+	/* At this point, sz should now contain the actual uncompressed size of the block just read */
 
+	if (want_crc) {
 		if (pre_crc != post_crc) {
 			MHVTL_ERR("Recorded CRC: 0x%08x, Calculated CRC: 0x%08x", pre_crc, post_crc);
 			sam_medium_error(E_DECOMPRESSION_CRC, sam_stat);
-			goto free_bounce_buf;
+			return 0;
 		}
 		MHVTL_DBG(3, "Recorded CRC: 0x%08x, calculated CRC: 0x%08x", pre_crc, post_crc);
 	}
 
+	rc = sz;
+
+	/* Short read - any LBP CRC would fall beyond what the initiator asked for */
+	if (xfer_sz < blk_size) {
+		MHVTL_DBG(1, "Short read of large block: request_sz: %d, block size: %d", request_sz, blk_size);
+		rc = request_sz;
+		lbp_method = 0;
+	}
+
 	/* Update Logical Block Protection CRC */
 	switch (lbp_method) {
 	case 1:
-		rc = BlockProtectRSCRC(bounce_buffer, rc, lbp_rscrc_be);
+		rc = BlockProtectRSCRC(buf, rc, lbp_rscrc_be);
 		if (rc == 0) {
 			MHVTL_ERR("Failed to generate/append RSCRC: lbp_be: %d", lbp_rscrc_be);
 		}
-		MHVTL_DBG(2, "READ block %d LBP RSCRC : 0x%02x 0x%02x 0x%02x 0x%02x", blk_number, bounce_buffer[rc - 4], bounce_buffer[rc - 3], bounce_buffer[rc - 2], bounce_buffer[rc - 1]);
+		MHVTL_DBG(2, "READ block %d LBP RSCRC : 0x%02x 0x%02x 0x%02x 0x%02x", blk_number, buf[rc - 4], buf[rc - 3], buf[rc - 2], buf[rc - 1]);
 		break;
 	case 2:
-		MHVTL_DBG(2, "rc: %d, request_sz: %d bounce buffer before LBP: 0x%08x %08x", rc, request_sz, get_unaligned_be32(&bounce_buffer[rc - 4]), get_unaligned_be32(&bounce_buffer[rc]));
+		MHVTL_DBG(2, "rc: %d, request_sz: %d buffer before LBP: 0x%08x %08x", rc, request_sz, get_unaligned_be32(&buf[rc - 4]), get_unaligned_be32(&buf[rc]));
 		/* If we don't have a LBP CRC32C format, re-calculate now */
-		lbp_crc = (blk_flags & BLKHDR_FLG_CRC) ? pre_crc : mhvtl_crc32c(bounce_buffer, rc);
-		memcpy(&bounce_buffer[rc], &lbp_crc, 4);
+		lbp_crc = (blk_flags & BLKHDR_FLG_CRC) ? pre_crc : mhvtl_crc32c(buf, rc);
+		memcpy(&buf[rc], &lbp_crc, 4);
 		MHVTL_DBG(2, "Logical Block Protection - CRC32C, rc: %d, request_sz: %d, lbp_size: %d, CRC32C: 0x%8x", rc, request_sz, lbp_sz, lbp_crc);
-		MHVTL_DBG(2, "rc: %d, request_sz: %d bounce buffer after LBP: 0x%08x %08x", rc, request_sz, get_unaligned_be32(&bounce_buffer[rc - 4]), get_unaligned_be32(&bounce_buffer[rc]));
-		MHVTL_DBG(2, "READ block %d LBP RSCRC : 0x%02x 0x%02x 0x%02x 0x%02x", blk_number, bounce_buffer[rc], bounce_buffer[rc + 1], bounce_buffer[rc + 2], bounce_buffer[rc + 3]);
+		MHVTL_DBG(2, "rc: %d, request_sz: %d buffer after LBP: 0x%08x %08x", rc, request_sz, get_unaligned_be32(&buf[rc - 4]), get_unaligned_be32(&buf[rc]));
+		MHVTL_DBG(2, "READ block %d LBP RSCRC : 0x%02x 0x%02x 0x%02x 0x%02x", blk_number, buf[rc], buf[rc + 1], buf[rc + 2], buf[rc + 3]);
 		rc += 4; /* Account for LBP checksum */
 		break;
 	case 3:
 		/* This should never occur - MODE 0a/f0 should not accept this value */
 		MHVTL_ERR("LBP method 3 not supported : Returning E_LOGICAL_BLOCK_GUARD_FAILED");
 		sam_hardware_error(E_LOGICAL_BLOCK_GUARD_FAILED, sam_stat);
-		rc = 0;
-		goto free_bounce_buf;
+		return 0;
 		break;
 	default:
 		break;
 	}
 
-	/* If bounce_buffer != buf then we're reading a large block and need to copy
-	 * data back into buf
-	 */
-	if (bounce_buffer != buf) {
-		MHVTL_DBG(1, "Bounce buffer in use: request_sz: %d", request_sz);
-		memcpy(buf, bounce_buffer, request_sz);
-		free(bounce_buffer);
-		rc = request_sz;
-	}
-
 	lu_ssc.bytesRead_I += blk_size;
 	lu_ssc.bytesRead_M += disk_blk_size;
 
@@ -433,12 +552,6 @@ int readBlock(uint8_t *buf, uint32_t request_sz, int sili, int lbp_method, uint8
 	}
 
 	return rc;
-
-free_bounce_buf:
-	if (bounce_buffer != buf)
-		free(bounce_buffer);
-
-	return 0;
 }
 
 static lzo_uint mhvtl_compressBound(lzo_uint src_sz) {
@@ -542,16 +655,20 @@ static int writeBlock_nocomp(struct scsi_cmd *cmd, uint32_t src_sz, uint8_t null
 	struct priv_lu_ssc *lu_priv;
 	uint32_t			crc;
 	int					rc;
+	uint64_t			start;
 
 	lu_priv = (struct priv_lu_ssc *)cmd->lu->lu_private;
 
 	crc = mhvtl_crc32c((unsigned char const *)src_buf, (size_t)src_sz);
 	setup_crypto(cmd, lu_priv);
 
+	start = stats_clock();
 	rc = write_tape_block(src_buf, src_sz, 0, lu_priv->app_encr_info, 0, null_wr, crc, sam_stat);
+	stats_phase(STATS_STORAGE, start);
 
 	if (lu_priv->pm->drive_supports_LBP && lbp_method) {
-		log_lbp_method(lbp_method);
+		if (MHVTL_DBG_ON(2))
+			log_lbp_method(lbp_method);
 		if (verify_lbp_crc(lbp_method, src_buf, src_sz, crc) < 0) {
 			MHVTL_ERR("LBP mis-compare on write : Returning E_LOGICAL_BLOCK_GUARD_FAILED");
 			sam_hardware_error(E_LOGICAL_BLOCK_GUARD_FAILED, sam_stat);
@@ -569,6 +686,51 @@ static int writeBlock_nocomp(struct scsi_cmd *cmd, uint32_t src_sz, uint8_t null
 	return src_sz;
 }
 
+/*
+ * All-zero block - only the header is written, the .data file is untouched.
+ *
+ * Return number of bytes written to 'file'
+ *
+ * Zero on error with sense buffer already filled in
+ */
+static int writeBlock_zero(struct scsi_cmd *cmd, uint32_t src_sz, int lbp_method) {
+	uint8_t			   *sam_stat = &cmd->dbuf_p->sam_stat;
+	uint8_t			   *src_buf	 = (uint8_t *)cmd->dbuf_p->data;
+	struct priv_lu_ssc *lu_priv;
+	uint32_t			crc;
+	int					rc;
+	uint64_t			start;
+
+	lu_priv = (struct priv_lu_ssc *)cmd->lu->lu_private;
+
+	crc = mhvtl_crc32c((unsigned char const *)src_buf, (size_t)src_sz);
+	setup_crypto(cmd, lu_priv);
+
+	MHVTL_DBG(2, "Zero-filled block: %d bytes, nothing stored", src_sz);
+
+	start = stats_clock();
+	rc = write_tape_block(NULL, src_sz, 0, lu_priv->app_encr_info, ZERO_BLK, FALSE, crc, sam_stat);
+	stats_phase(STATS_STORAGE, start);
+
+	if (lu_priv->pm->drive_supports_LBP && lbp_method) {
+		if (MHVTL_DBG_ON(2))
+			log_lbp_method(lbp_method);
+		if (verify_lbp_crc(lbp_method, src_buf, src_sz, crc) < 0) {
+			MHVTL_ERR("LBP mis-compare on write : Returning E_LOGICAL_BLOCK_GUARD_FAILED");
+			sam_hardware_error(E_LOGICAL_BLOCK_GUARD_FAILED, sam_stat);
+			log_crc_options(lbp_method, src_buf, src_sz, crc);
+			return 0;
+		}
+	}
+
+	lu_priv->bytesWritten_I += src_sz;
+
+	if (rc < 0)
+		return 0;
+
+	return src_sz;
+}
+
 /*
  * Return number of bytes written to 'file'
  *
@@ -579,6 +741,7 @@ static int writeBlock_lzo(struct scsi_cmd *cmd, uint32_t src_sz, uint8_t null_wr
 	lzo_uint  src_len = src_sz;
 	lzo_bytep dest_buf;
 	lzo_bytep wrkmem = NULL;
+	uint64_t  start;
 	uint32_t  crc;
 
 	lzo_bytep src_buf = (lzo_bytep)cmd->dbuf_p->data;
@@ -612,7 +775,9 @@ static int writeBlock_lzo(struct scsi_cmd *cmd, uint32_t src_sz, uint8_t null_wr
 		return 0;
 	}
 
-	z = lzo1x_1_compress(src_buf, src_sz, dest_buf, &dest_len, wrkmem);
+	start = stats_clock();
+	z	  = lzo1x_1_compress(src_buf, src_sz, dest_buf, &dest_len, wrkmem);
+	stats_phase(STATS_COMPRESS, start);
 	if (unlikely(z != LZO_E_OK)) {
 		MHVTL_ERR("LZO compression error");
 		sam_hardware_error(E_COMPRESSION_CHECK, sam_stat);
@@ -621,7 +786,9 @@ static int writeBlock_lzo(struct scsi_cmd *cmd, uint32_t src_sz, uint8_t null_wr
 
 	MHVTL_DBG(2, "Compression: Orig %d, after comp: %ld", src_sz, (unsigned long)dest_len);
 
+	start = stats_clock();
 	rc = write_tape_block(dest_buf, src_len, dest_len, lu_priv->app_encr_info, LZO, null_wr, crc, sam_stat);
+	stats_phase(STATS_STORAGE, start);
 
 	free(dest_buf);
 	free(wrkmem);
@@ -629,7 +796,8 @@ static int writeBlock_lzo(struct scsi_cmd *cmd, uint32_t src_sz, uint8_t null_wr
 	lu_priv->bytesWritten_I += src_len;
 
 	if (lu_priv->pm->drive_supports_LBP && lbp_method) {
-		log_lbp_method(lbp_method);
+		if (MHVTL_DBG_ON(2))
+			log_lbp_method(lbp_method);
 		if (verify_lbp_crc(lbp_method, src_buf, src_sz, crc) < 0) {
 			MHVTL_ERR("LBP mis-compare on write : Returning E_LOGICAL_BLOCK_GUARD_FAILED - but wrote block anyway...");
 			sam_hardware_error(E_LOGICAL_BLOCK_GUARD_FAILED, sam_stat);
@@ -659,6 +827,7 @@ static int writeBlock_zlib(struct scsi_cmd *cmd, uint32_t src_sz, uint8_t null_w
 	uint32_t			crc;
 	int					rc;
 	int					z;
+	uint64_t			start;
 
 	lu_priv = (struct priv_lu_ssc *)cmd->lu->lu_private;
 
@@ -673,8 +842,10 @@ static int writeBlock_zlib(struct scsi_cmd *cmd, uint32_t src_sz, uint8_t null_w
 		return 0;
 	}
 
-	z = compress2(dest_buf, &dest_len, src_buf, src_sz,
-				  *lu_priv->compressionFactor);
+	start = stats_clock();
+	z	  = compress2(dest_buf, &dest_len, src_buf, src_sz,
+					  *lu_priv->compressionFactor);
+	stats_phase(STATS_COMPRESS, start);
 	if (z != Z_OK) {
 		switch (z) {
 		case Z_MEM_ERROR:
@@ -696,14 +867,17 @@ static int writeBlock_zlib(struct scsi_cmd *cmd, uint32_t src_sz, uint8_t null_w
 			  src_sz, (unsigned long)dest_len,
 			  *lu_priv->compressionFactor);
 
+	start = stats_clock();
 	rc = write_tape_block(dest_buf, src_len, dest_len, lu_priv->app_encr_info, ZLIB, null_wr, crc, sam_stat);
+	stats_phase(STATS_STORAGE, start);
 
 	free(dest_buf);
 	lu_priv->bytesWritten_M += dest_len;
 	lu_priv->bytesWritten_I += src_len;
 
 	if (lu_priv->pm->drive_supports_LBP && lbp_method) {
-		log_lbp_method(lbp_method);
+		if (MHVTL_DBG_ON(2))
+			log_lbp_method(lbp_method);
 		if (verify_lbp_crc(lbp_method, src_buf, src_sz, crc) < 0) {
 			MHVTL_ERR("LBP mis-compare on write : Returning E_LOGICAL_BLOCK_GUARD_FAILED");
 			sam_hardware_error(E_LOGICAL_BLOCK_GUARD_FAILED, sam_stat);
@@ -773,6 +947,12 @@ int writeBlock(struct scsi_cmd *cmd, uint32_t src_sz) {
 	if (lu_priv->mamp->MediumType == MEDIA_TYPE_NULL) {
 		/* Don't compress if null tape media */
 		src_len = writeBlock_nocomp(cmd, lbp_sz, TRUE, 0);
+	} else if (lu_priv->zero_blocks && is_zero_block(cmd->dbuf_p->data, lbp_sz)) {
+		/* Padding / pre-allocated space - keep it off the disk.
+		 * Builds before BLKHDR_FLG_ZERO fail to read such blocks,
+		 * hence only if asked for
+		 */
+		src_len = writeBlock_zero(cmd, lbp_sz, lbp_method);
 	} else if (*lu_priv->compressionFactor == MHVTL_NO_COMPRESSION) {
 		/* No compression - use the no-compression function */
 		src_len = writeBlock_nocomp(cmd, lbp_sz, FALSE, lbp_method);
@@ -32,6 +32,7 @@
 #include "ssc.h"
 #include "be_byteshift.h"
 #include "mhvtl_log.h"
+#include "mhvtl_stats.h"
 
 #define LOG_PG_HEADER(pageCode) \
 	{(uint8_t)(pageCode), 0x00, 0x00}
@@ -642,6 +643,7 @@ int set_TapeAlert(uint64_t flags) {
 
 	for (i = 0; i < 64; i++)
 		ta->TapeAlert[i].value = (flags & (1ull << i)) ? 1 : 0;
+	stats_tapealert(flags);
 
 	/* Don't treat not having a SEQUENTIAL ACCESS DEVICE log page
 	 * as fatal (e.g. SMC devices)
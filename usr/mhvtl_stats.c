@@ -0,0 +1,354 @@
+/*
+ * Per-LU command statistics
+ *
+ * Copyright (C) 2005 - 2025 Mark Harvey markh794 at gmail dot com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * vtltape/vtllibrary keep per-opcode counts and latency histograms, plus
+ * histograms of where the time inside a command goes, in a block of shared
+ * memory. The daemon is the only writer; 'vtlcmd <id> stats' (or anything
+ * else) maps it read-only. Until stats_init() is called every update is a
+ * no-op, so the tools sharing libvtlscsi pay nothing.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "logging.h"
+#include "mhvtl_scsi.h"
+#include "mhvtl_stats.h"
+
+static struct mhvtl_stats *stats;
+static char				   stats_name[64];
+
+#define STATS_ADD(x, v) __atomic_store_n(&(x), (x) + (v), __ATOMIC_RELAXED)
+#define STATS_SET(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELAXED)
+
+/*
+ * Create and map the stats block of LU 'id'
+ *
+ * Returns 0 on success
+ */
+int stats_init(long id, int lu_type) {
+	int fd;
+
+	snprintf(stats_name, sizeof(stats_name), STATS_SHM_NAME, id);
+	shm_unlink(stats_name); /* Left behind by a previous instance */
+
+	fd = shm_open(stats_name, O_RDWR | O_CREAT | O_EXCL, 0644);
+	if (fd < 0) {
+		MHVTL_ERR("Unable to create %s: %s", stats_name, strerror(errno));
+		return -1;
+	}
+	if (ftruncate(fd, sizeof(struct mhvtl_stats)) < 0) {
+		MHVTL_ERR("Unable to size %s: %s", stats_name, strerror(errno));
+		goto fail;
+	}
+	stats = mmap(NULL, sizeof(struct mhvtl_stats), PROT_READ | PROT_WRITE,
+				 MAP_SHARED, fd, 0);
+	if (stats == MAP_FAILED) {
+		MHVTL_ERR("Unable to map %s: %s", stats_name, strerror(errno));
+		stats = NULL;
+		goto fail;
+	}
+	close(fd);
+
+	stats->version	  = STATS_VERSION;
+	stats->lu_type	  = lu_type;
+	stats->pid		  = getpid();
+	stats->lu_id	  = id;
+	stats->start_time = time(NULL);
+	__atomic_store_n(&stats->magic, STATS_MAGIC, __ATOMIC_RELEASE);
+
+	return 0;
+
+fail:
+	close(fd);
+	shm_unlink(stats_name);
+	return -1;
+}
+
+void stats_exit(void) {
+	if (!stats)
+		return;
+
+	munmap(stats, sizeof(struct mhvtl_stats));
+	stats = NULL;
+	shm_unlink(stats_name);
+}
+
+/* Monotonic time in ns, 0 if stats are not being kept */
+uint64_t stats_clock(void) {
+	struct timespec ts;
+
+	if (!stats)
+		return 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void hist_add(struct stats_hist *h, uint64_t start) {
+	uint64_t us = (stats_clock() - start) / 1000;
+	int		 b	= us ? 64 - __builtin_clzll(us) : 0;
+
+	if (b >= STATS_HIST_BUCKETS)
+		b = STATS_HIST_BUCKETS - 1;
+
+	STATS_ADD(h->bucket[b], 1);
+	STATS_ADD(h->sum_us, us);
+	if (us > h->max_us)
+		STATS_SET(h->max_us, us);
+	STATS_ADD(h->count, 1);
+}
+
+/* Account the time since 'start' (from stats_clock()) to 'phase' */
+void stats_phase(int phase, uint64_t start) {
+	if (!stats || !start)
+		return;
+
+	hist_add(&stats->phase[phase], start);
+}
+
+/* A command completed - 'start' is when it was received */
+void stats_cmd(uint8_t opcode, uint64_t start, uint8_t sam_stat) {
+	if (!stats || !start)
+		return;
+
+	if (sam_stat == SAM_STAT_CHECK_CONDITION)
+		STATS_ADD(stats->op[opcode].errors, 1);
+	hist_add(&stats->op[opcode].latency, start);
+}
+
+void stats_bytes(uint64_t in, uint64_t out) {
+	if (!stats)
+		return;
+
+	STATS_ADD(stats->bytes_in, in);
+	STATS_ADD(stats->bytes_out, out);
+}
+
+void stats_state(int state) {
+	if (!stats || stats->state == (uint32_t)state)
+		return;
+
+	STATS_SET(stats->state, state);
+}
+
+void stats_tapealert(uint64_t flags) {
+	if (!stats)
+		return;
+
+	STATS_SET(stats->tapealert, flags);
+}
+
+/* Barcode of the media in the drive, NULL if empty */
+void stats_media(const char *pcl) {
+	struct stats_pcl *m;
+
+	if (!stats)
+		return;
+
+	m = &stats->media;
+	if (!strncmp(m->pcl, pcl ? pcl : "", sizeof(m->pcl) - 1))
+		return;
+
+	__atomic_store_n(&m->seq, m->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memset(m->pcl, 0, sizeof(m->pcl));
+	if (pcl)
+		strncpy(m->pcl, pcl, sizeof(m->pcl) - 1);
+	__atomic_store_n(&m->seq, m->seq + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * The drive's bytes read/written counters start again from zero at each
+ * load. Keep running totals from them.
+ */
+void stats_media_bytes(uint64_t read_i, uint64_t read_m, uint64_t written_i, uint64_t written_m) {
+	static uint64_t last[4];
+	uint64_t		now[4] = {read_i, read_m, written_i, written_m};
+	uint64_t	   *total[4];
+	int				i;
+
+	if (!stats)
+		return;
+
+	total[0] = &stats->read_i;
+	total[1] = &stats->read_m;
+	total[2] = &stats->written_i;
+	total[3] = &stats->written_m;
+
+	for (i = 0; i < 4; i++) {
+		if (now[i] == last[i])
+			continue;
+		STATS_ADD(*total[i], (now[i] > last[i]) ? now[i] - last[i] : now[i]);
+		last[i] = now[i];
+	}
+}
+
+/*
+ * Map the stats block of LU 'id' read-only
+ *
+ * Returns NULL if the LU is not running (or is running an older format)
+ */
+const struct mhvtl_stats *stats_open(long id) {
+	struct mhvtl_stats *s;
+	char				name[64];
+	int					fd;
+
+	snprintf(name, sizeof(name), STATS_SHM_NAME, id);
+	fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0)
+		return NULL;
+
+	s = mmap(NULL, sizeof(struct mhvtl_stats), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (s == MAP_FAILED)
+		return NULL;
+
+	if (__atomic_load_n(&s->magic, __ATOMIC_ACQUIRE) != STATS_MAGIC ||
+		s->version != STATS_VERSION) {
+		munmap(s, sizeof(struct mhvtl_stats));
+		errno = EPROTO;
+		return NULL;
+	}
+
+	return s;
+}
+
+void stats_close(const struct mhvtl_stats *s) {
+	munmap((void *)s, sizeof(struct mhvtl_stats));
+}
+
+#define STATS_READ_TRIES 1000 /* Before giving up on a writer mid-update */
+
+/*
+ * Consistent copy of the media barcode, "" if the drive is empty
+ *
+ * Returns -1, with 'pcl' "", if the writer stays mid-update - as it does
+ * if it died in stats_media()
+ */
+int stats_read_media(const struct mhvtl_stats *s, char *pcl, int len) {
+	uint32_t seq;
+	int		 tries;
+
+	for (tries = 0; tries < STATS_READ_TRIES; tries++) {
+		seq = __atomic_load_n(&s->media.seq, __ATOMIC_ACQUIRE);
+		if (!(seq & 1)) {
+			snprintf(pcl, len, "%.*s", (int)sizeof(s->media.pcl) - 1, s->media.pcl);
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			if (__atomic_load_n(&s->media.seq, __ATOMIC_RELAXED) == seq)
+				return 0;
+		}
+		sched_yield();
+	}
+	pcl[0] = '\0';
+	return -1;
+}
+
+const char *stats_phase_name(int phase) {
+	static const char *names[STATS_PHASES] = {
+		[STATS_KERNEL_WAIT] = "kernel_wait",
+		[STATS_XFER]		= "data_transfer",
+		[STATS_COMPRESS]	= "compression",
+		[STATS_STORAGE]		= "storage_io",
+		[STATS_FSYNC]		= "fsync",
+	};
+
+	return (phase >= 0 && phase < STATS_PHASES) ? names[phase] : "unknown";
+}
+
+const char *stats_opcode_name(uint8_t opcode) {
+	static const char *names[256] = {
+		[TEST_UNIT_READY]			 = "TEST_UNIT_READY",
+		[REZERO_UNIT]				 = "REWIND",
+		[REQUEST_SENSE]				 = "REQUEST_SENSE",
+		[FORMAT_UNIT]				 = "FORMAT_MEDIUM",
+		[READ_BLOCK_LIMITS]			 = "READ_BLOCK_LIMITS",
+		[INITIALIZE_ELEMENT_STATUS] = "INITIALIZE_ELEMENT_STATUS",
+		[READ_6]					 = "READ_6",
+		[WRITE_6]					 = "WRITE_6",
+		[SET_CAPACITY]				 = "SET_CAPACITY",
+		[READ_REVERSE_6]			 = "READ_REVERSE_6",
+		[WRITE_FILEMARKS]			 = "WRITE_FILEMARKS",
+		[SPACE]						 = "SPACE",
+		[INQUIRY]					 = "INQUIRY",
+		[VERIFY_6]					 = "VERIFY_6",
+		[RECOVER_BUFFERED_DATA]		 = "RECOVER_BUFFERED_DATA",
+		[MODE_SELECT]				 = "MODE_SELECT",
+		[RESERVE]					 = "RESERVE",
+		[RELEASE]					 = "RELEASE",
+		[ERASE_6]					 = "ERASE_6",
+		[MODE_SENSE]				 = "MODE_SENSE",
+		[START_STOP]				 = "LOAD_UNLOAD",
+		[RECEIVE_DIAGNOSTIC]		 = "RECEIVE_DIAGNOSTIC",
+		[SEND_DIAGNOSTIC]			 = "SEND_DIAGNOSTIC",
+		[ALLOW_MEDIUM_REMOVAL]		 = "ALLOW_MEDIUM_REMOVAL",
+		[READ_10]					 = "READ_10",
+		[WRITE_10]					 = "WRITE_10",
+		[LOCATE_10]					 = "LOCATE_10",
+		[READ_POSITION]				 = "READ_POSITION",
+		[WRITE_BUFFER]				 = "WRITE_BUFFER",
+		[READ_BUFFER]				 = "READ_BUFFER",
+		[REPORT_DENSITY]			 = "REPORT_DENSITY",
+		[LOG_SELECT]				 = "LOG_SELECT",
+		[LOG_SENSE]					 = "LOG_SENSE",
+		[MODE_SELECT_10]			 = "MODE_SELECT_10",
+		[RESERVE_10]				 = "RESERVE_10",
+		[RELEASE_10]				 = "RELEASE_10",
+		[MODE_SENSE_10]				 = "MODE_SENSE_10",
+		[PERSISTENT_RESERVE_IN]		 = "PERSISTENT_RESERVE_IN",
+		[PERSISTENT_RESERVE_OUT]	 = "PERSISTENT_RESERVE_OUT",
+		[WRITE_FILEMARKS_16]		 = "WRITE_FILEMARKS_16",
+		[READ_REVERSE_16]			 = "READ_REVERSE_16",
+		[ALLOW_OVERWRITE]			 = "ALLOW_OVERWRITE",
+		[EXTENDED_COPY]				 = "EXTENDED_COPY",
+		[ACCESS_CONTROL_IN]			 = "ACCESS_CONTROL_IN",
+		[ACCESS_CONTROL_OUT]		 = "ACCESS_CONTROL_OUT",
+		[READ_16]					 = "READ_16",
+		[WRITE_16]					 = "WRITE_16",
+		[READ_ATTRIBUTE]			 = "READ_ATTRIBUTE",
+		[WRITE_ATTRIBUTE]			 = "WRITE_ATTRIBUTE",
+		[VERIFY_16]					 = "VERIFY_16",
+		[SPACE_16]					 = "SPACE_16",
+		[LOCATE_16]					 = "LOCATE_16",
+		[ERASE_16]					 = "ERASE_16",
+		[REPORT_ELEMENT_INFORMATION] = "REPORT_ELEMENT_INFORMATION",
+		[REPORT_LUNS]				 = "REPORT_LUNS",
+		[SECURITY_PROTOCOL_IN]		 = "SECURITY_PROTOCOL_IN",
+		[A3_SA]						 = "MAINTENANCE_IN",
+		[A4_SA]						 = "MAINTENANCE_OUT",
+		[MOVE_MEDIUM]				 = "MOVE_MEDIUM",
+		[EXCHANGE_MEDIUM]			 = "EXCHANGE_MEDIUM",
+		[READ_12]					 = "READ_12",
+		[WRITE_12]					 = "WRITE_12",
+		[READ_MEDIA_SERIAL_NUMBER]	 = "READ_MEDIA_SERIAL_NUMBER",
+		[SECURITY_PROTOCOL_OUT]		 = "SECURITY_PROTOCOL_OUT",
+		[READ_ELEMENT_STATUS]		 = "READ_ELEMENT_STATUS",
+		[INITIALIZE_ELEMENT_STATUS_WITH_RANGE] = "INITIALIZE_ELEMENT_STATUS_WITH_RANGE",
+	};
+
+	return names[opcode] ? names[opcode] : "UNKNOWN";
+}
@@ -0,0 +1,341 @@
+/*
+ * Per-LU binary trace ring
+ *
+ * Copyright (C) 2005 - 2025 Mark Harvey markh794 at gmail dot com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * Hot-path events (commands, block headers, block reads/writes, sense) are
+ * recorded as fixed size binary records in a ring in shared memory rather
+ * than formatted through syslog(). A record costs a clock read and a few
+ * stores, so tracing is always on. 'mhvtl-trace <id>' decodes the ring of a
+ * running daemon; trace_dump() - called on SIGUSR1, on a crash, or on a
+ * medium/hardware error - writes it to TRACE_DUMP_NAME for later decoding.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "logging.h"
+#include "mhvtl_trace.h"
+
+static struct mhvtl_trace *trace;
+static char				   trace_name[64];
+static char				   dump_name[64];
+
+/* Command being processed - stamped on every record. Per thread, as
+ * vtllibrary's picker threads each have a MOVE MEDIUM of their own */
+static __thread uint8_t	 cur_opcode;
+static __thread uint64_t cur_serial;
+static __thread uint64_t cur_start;
+
+/* Don't let a failing cartridge rewrite the dump on every command */
+#define TRACE_DUMP_INTERVAL 60
+static time_t last_dump;
+
+static uint64_t trace_clock(clockid_t clk) {
+	struct timespec ts;
+
+	clock_gettime(clk, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void crash_handler(int signo) {
+	switch (signo) {
+	case SIGSEGV:
+		trace_dump("SIGSEGV");
+		break;
+	case SIGBUS:
+		trace_dump("SIGBUS");
+		break;
+	case SIGFPE:
+		trace_dump("SIGFPE");
+		break;
+	default:
+		trace_dump("SIGABRT");
+		break;
+	}
+	raise(signo); /* SA_RESETHAND - now the default action */
+}
+
+/*
+ * Create and map the trace ring of LU 'id'
+ *
+ * Returns 0 on success
+ */
+int trace_init(long id) {
+	struct sigaction sa;
+	int				 fd;
+
+	snprintf(trace_name, sizeof(trace_name), TRACE_SHM_NAME, id);
+	snprintf(dump_name, sizeof(dump_name), TRACE_DUMP_NAME, id);
+	shm_unlink(trace_name); /* Left behind by a previous instance */
+
+	fd = shm_open(trace_name, O_RDWR | O_CREAT | O_EXCL, 0644);
+	if (fd < 0) {
+		MHVTL_ERR("Unable to create %s: %s", trace_name, strerror(errno));
+		return -1;
+	}
+	if (ftruncate(fd, sizeof(struct mhvtl_trace)) < 0) {
+		MHVTL_ERR("Unable to size %s: %s", trace_name, strerror(errno));
+		goto fail;
+	}
+	trace = mmap(NULL, sizeof(struct mhvtl_trace), PROT_READ | PROT_WRITE,
+				 MAP_SHARED, fd, 0);
+	if (trace == MAP_FAILED) {
+		MHVTL_ERR("Unable to map %s: %s", trace_name, strerror(errno));
+		trace = NULL;
+		goto fail;
+	}
+	close(fd);
+
+	trace->version	 = TRACE_VERSION;
+	trace->pid		 = getpid();
+	trace->records	 = TRACE_RECORDS;
+	trace->lu_id	 = id;
+	trace->mono_base = trace_clock(CLOCK_MONOTONIC);
+	trace->wall_base = trace_clock(CLOCK_REALTIME);
+	__atomic_store_n(&trace->magic, TRACE_MAGIC, __ATOMIC_RELEASE);
+
+	/* Flight recorder - keep the last moments of a crashed daemon */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = crash_handler;
+	sa.sa_flags	  = SA_RESETHAND;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGSEGV, &sa, NULL);
+	sigaction(SIGBUS, &sa, NULL);
+	sigaction(SIGFPE, &sa, NULL);
+	sigaction(SIGABRT, &sa, NULL);
+
+	return 0;
+
+fail:
+	close(fd);
+	shm_unlink(trace_name);
+	return -1;
+}
+
+void trace_exit(void) {
+	if (!trace)
+		return;
+
+	munmap(trace, sizeof(struct mhvtl_trace));
+	trace = NULL;
+	shm_unlink(trace_name);
+}
+
+void trace_event(int event, uint8_t arg, uint64_t block, uint64_t offset,
+				 uint32_t size, uint32_t extra) {
+	struct trace_rec *r;
+	uint64_t		  n;
+
+	if (!trace)
+		return;
+
+	n = trace->head;
+	r = &trace->rec[n & (TRACE_RECORDS - 1)];
+
+	__atomic_store_n(&r->seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	r->ts	  = trace_clock(CLOCK_MONOTONIC);
+	r->serial = cur_serial;
+	r->block  = block;
+	r->offset = offset;
+	r->size	  = size;
+	r->extra  = extra;
+	r->event  = event;
+	r->opcode = cur_opcode;
+	r->arg	  = arg;
+	__atomic_store_n(&r->seq, n + 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&trace->head, n + 1, __ATOMIC_RELEASE);
+}
+
+void trace_begin(uint8_t opcode, uint64_t serial) {
+	if (!trace)
+		return;
+
+	cur_opcode = opcode;
+	cur_serial = serial;
+	cur_start  = trace_clock(CLOCK_MONOTONIC);
+	trace_event(TRACE_CMD_START, 0, 0, 0, 0, 0);
+}
+
+void trace_end(uint8_t sam_stat, uint32_t size) {
+	if (!trace)
+		return;
+
+	trace_event(TRACE_CMD_END, sam_stat, 0, 0, size,
+				(trace_clock(CLOCK_MONOTONIC) - cur_start) / 1000);
+}
+
+/*
+ * Flight recorder - copy the ring to TRACE_DUMP_NAME
+ *
+ * Only uses async-signal-safe calls so it can run from a signal handler.
+ */
+void trace_dump(const char *reason) {
+	char   why[sizeof(trace->reason)] = {0};
+	size_t hsz						  = offsetof(struct mhvtl_trace, reason);
+	int	   fd;
+
+	if (!trace)
+		return;
+
+	strncpy(why, reason, sizeof(why) - 1);
+
+	fd = open(dump_name, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW, 0644);
+	if (fd < 0)
+		return;
+	if (write(fd, trace, hsz) != (ssize_t)hsz ||
+		write(fd, why, sizeof(why)) != sizeof(why) ||
+		write(fd, trace->rec, sizeof(trace->rec)) != sizeof(trace->rec))
+		unlink(dump_name);
+	close(fd);
+}
+
+/* Dump on a medium/hardware error, at most once a minute */
+void trace_error(const char *reason) {
+	time_t now;
+
+	if (!trace)
+		return;
+
+	now = time(NULL);
+	if (now - last_dump < TRACE_DUMP_INTERVAL)
+		return;
+	last_dump = now;
+
+	trace_dump(reason);
+}
+
+/* SIGUSR1 handler for the daemons */
+void trace_signal(int signo) {
+	(void)signo;
+	trace_dump("SIGUSR1");
+}
+
+static const struct mhvtl_trace *trace_check(struct mhvtl_trace *t) {
+	if (__atomic_load_n(&t->magic, __ATOMIC_ACQUIRE) != TRACE_MAGIC ||
+		t->version != TRACE_VERSION || t->records != TRACE_RECORDS) {
+		munmap(t, sizeof(struct mhvtl_trace));
+		errno = EPROTO;
+		return NULL;
+	}
+	return t;
+}
+
+/* Map the trace ring of a running daemon */
+const struct mhvtl_trace *trace_open(long id) {
+	struct mhvtl_trace *t;
+	char				name[64];
+	int					fd;
+
+	snprintf(name, sizeof(name), TRACE_SHM_NAME, id);
+	fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0)
+		return NULL;
+
+	t = mmap(NULL, sizeof(struct mhvtl_trace), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (t == MAP_FAILED)
+		return NULL;
+
+	return trace_check(t);
+}
+
+/* Map a flight recorder dump */
+const struct mhvtl_trace *trace_load(const char *file) {
+	struct mhvtl_trace *t;
+	struct stat			st;
+	int					fd;
+
+	fd = open(file, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &st) < 0 || st.st_size != sizeof(struct mhvtl_trace)) {
+		close(fd);
+		errno = EPROTO;
+		return NULL;
+	}
+	t = mmap(NULL, sizeof(struct mhvtl_trace), PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (t == MAP_FAILED)
+		return NULL;
+
+	return trace_check(t);
+}
+
+void trace_close(const struct mhvtl_trace *t) {
+	munmap((void *)t, sizeof(struct mhvtl_trace));
+}
+
+static int cmp_seq(const void *a, const void *b) {
+	const struct trace_rec *ra = a;
+	const struct trace_rec *rb = b;
+
+	return (ra->seq > rb->seq) - (ra->seq < rb->seq);
+}
+
+/*
+ * Copy the valid records of the ring into 'out' (TRACE_RECORDS entries),
+ * oldest first.
+ *
+ * Returns the number of records copied
+ */
+int trace_read(const struct mhvtl_trace *t, struct trace_rec *out) {
+	uint64_t seq;
+	int		 i, n = 0;
+
+	for (i = 0; i < TRACE_RECORDS; i++) {
+		seq = __atomic_load_n(&t->rec[i].seq, __ATOMIC_ACQUIRE);
+		if (!seq)
+			continue;
+		out[n] = t->rec[i];
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&t->rec[i].seq, __ATOMIC_RELAXED) != seq)
+			continue;
+		out[n].seq = seq;
+		n++;
+	}
+	qsort(out, n, sizeof(struct trace_rec), cmp_seq);
+
+	return n;
+}
+
+const char *trace_event_name(int event) {
+	static const char *names[TRACE_EVENTS] = {
+		[TRACE_NONE]	  = "none",
+		[TRACE_CMD_START] = "cmd_start",
+		[TRACE_CMD_END]	  = "cmd_end",
+		[TRACE_SENSE]	  = "sense",
+		[TRACE_READ_REQ]  = "read_request",
+		[TRACE_READ_HDR]  = "read_header",
+		[TRACE_READ_DATA] = "read_data",
+		[TRACE_WRITE_BLK] = "write_block",
+		[TRACE_FILEMARK]  = "filemark",
+	};
+
+	return (event >= 0 && event < TRACE_EVENTS) ? names[event] : "unknown";
+}
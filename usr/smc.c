@@ -26,6 +26,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <inttypes.h>
 #include "be_byteshift.h"
 #include "mhvtl_scsi.h"
@@ -45,37 +46,6 @@ uint8_t smc_allow_removal(struct scsi_cmd *cmd) {
 	return SAM_STAT_GOOD;
 }
 
-uint8_t smc_initialize_element_status(struct scsi_cmd *cmd) {
-	uint8_t *sam_stat = &cmd->dbuf_p->sam_stat;
-
-	current_state = MHVTL_STATE_INITIALISE_ELEMENTS;
-
-	MHVTL_DBG(1, "%s (%ld) **", "INITIALIZE ELEMENT",
-			  (long)cmd->dbuf_p->serialNo);
-	if (!cmd->lu->online) {
-		sam_not_ready(NO_ADDITIONAL_SENSE, sam_stat);
-		return SAM_STAT_CHECK_CONDITION;
-	}
-	sleep(1);
-	return SAM_STAT_GOOD;
-}
-
-uint8_t smc_initialize_element_status_with_range(struct scsi_cmd *cmd) {
-	uint8_t *sam_stat = &cmd->dbuf_p->sam_stat;
-
-	current_state = MHVTL_STATE_INITIALISE_ELEMENTS;
-
-	MHVTL_DBG(1, "%s (%ld) **", "INITIALIZE ELEMENT RANGE",
-			  (long)cmd->dbuf_p->serialNo);
-
-	if (!cmd->lu->online) {
-		sam_not_ready(NO_ADDITIONAL_SENSE, sam_stat);
-		return SAM_STAT_CHECK_CONDITION;
-	}
-	sleep(1);
-	return SAM_STAT_GOOD;
-}
-
 /* Return the element type of a particular element address */
 static int slot_type(struct smc_priv *smc_p, int addr) {
 	if ((addr >= smc_p->pm->start_drive) &&
@@ -112,17 +82,145 @@ static int slot_number(struct smc_personality_template *pm, struct s_info *sp) {
 }
 
 /*
- * Takes a slot number and returns a struct pointer to the slot
+ * READ ELEMENT STATUS is polled by backup software far more often than
+ * anything in the library moves, and used to walk slot_list several times
+ * and format every descriptor on each call.
+ *
+ * Instead each element type keeps an array of its elements in address order
+ * and, for each VOLTAG/DVCID combination asked for, the encoded descriptor
+ * of every element and a bitmap of those which have changed since - the
+ * status setters set the element's bit. A report skips 64 unchanged
+ * elements per word of the bitmap without touching them, re-encodes the
+ * few which moved and is otherwise one memcpy() of a range of descriptors,
+ * so polling for full/empty costs little more than the copy even with
+ * many thousands of slots.
+ *
+ * Anything which changes elements without the setters (adding slots, MAP
+ * open/close, re-reading the configuration) calls smc_elements_changed().
  */
-static struct s_info *slot2struct(struct smc_priv *smc_p, int addr) {
-	struct list_head *slot_head;
-	struct s_info	 *sp;
+#define RES_VARIANT(voltag, dvcid) ((voltag) << 1 | (dvcid))
+#define RES_WORDS(count)		   (((count) + 63) / 64)
 
-	slot_head = &smc_p->slot_list;
+void smc_elements_changed(struct smc_priv *smc_p) {
+	smc_p->res_stale = 1;
+}
+
+/* Descriptors of 's' need re-encoding */
+void smc_element_changed(struct s_info *s) {
+	struct smc_res_cache *rc = s->res_cache;
+	uint64_t			  bit;
+	int					  v;
 
-	list_for_each_entry(sp, slot_head, siblings) {
-		if (sp->slot_location == (unsigned int)addr)
-			return sp;
+	if (!rc)
+		return;
+	bit = 1ULL << (s->res_index % 64);
+	for (v = 0; v < 4; v++)
+		if (rc->stale[v])
+			rc->stale[v][s->res_index / 64] |= bit;
+}
+
+static int cmp_slot_location(const void *a, const void *b) {
+	const struct s_info *sa = *(struct s_info *const *)a;
+	const struct s_info *sb = *(struct s_info *const *)b;
+
+	return (sa->slot_location > sb->slot_location) - (sa->slot_location < sb->slot_location);
+}
+
+/* (Re)build the per element type arrays from slot_list */
+static void res_index(struct smc_priv *smc_p) {
+	struct smc_res_cache *rc;
+	struct s_info		 *sp;
+	uint32_t			  i;
+	int					  t, v;
+
+	for (t = 0; t < 5; t++) {
+		rc = &smc_p->res[t];
+		free(rc->slot);
+		for (v = 0; v < 4; v++) {
+			free(rc->desc[v]);
+			free(rc->stale[v]);
+			rc->desc[v]	 = NULL;
+			rc->stale[v] = NULL;
+		}
+		rc->slot  = NULL;
+		rc->count = 0;
+	}
+
+	list_for_each_entry(sp, &smc_p->slot_list, siblings)
+		if (sp->element_type < 5)
+			smc_p->res[sp->element_type].count++;
+
+	for (t = 1; t < 5; t++) {
+		rc = &smc_p->res[t];
+		if (!rc->count)
+			continue;
+		rc->slot = malloc(rc->count * sizeof(*rc->slot));
+		if (!rc->slot) {
+			MHVTL_ERR("Could not allocate memory");
+			exit(-ENOMEM);
+		}
+		rc->count = 0;
+	}
+
+	list_for_each_entry(sp, &smc_p->slot_list, siblings) {
+		sp->res_cache = NULL;
+		if (sp->element_type && sp->element_type < 5) {
+			rc						= &smc_p->res[sp->element_type];
+			rc->slot[rc->count++] = sp;
+		}
+	}
+
+	for (t = 1; t < 5; t++) {
+		rc = &smc_p->res[t];
+		if (rc->count > 1)
+			qsort(rc->slot, rc->count, sizeof(struct s_info *),
+				  cmp_slot_location);
+		for (i = 0; i < rc->count; i++) {
+			rc->slot[i]->res_cache = rc;
+			rc->slot[i]->res_index = i;
+		}
+	}
+
+	smc_p->res_stale = 0;
+	MHVTL_DBG(2, "Indexed %d drives, %d pickers, %d MAP slots, %d storage slots",
+			  smc_p->res[DATA_TRANSFER].count, smc_p->res[MEDIUM_TRANSPORT].count,
+			  smc_p->res[MAP_ELEMENT].count, smc_p->res[STORAGE_ELEMENT].count);
+}
+
+static struct smc_res_cache *res_cache(struct smc_priv *smc_p, int type) {
+	if (smc_p->res_stale)
+		res_index(smc_p);
+	return &smc_p->res[type];
+}
+
+/* Index of first element at or above address 'start' */
+static uint32_t res_first(struct smc_res_cache *rc, uint32_t start) {
+	uint32_t lo = 0, hi = rc->count, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (rc->slot[mid]->slot_location < start)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/*
+ * Takes a slot number and returns a struct pointer to the slot
+ */
+static struct s_info *slot2struct(struct smc_priv *smc_p, int addr) {
+	struct smc_res_cache *rc;
+	uint32_t			  i;
+	int					  type;
+
+	type = slot_type(smc_p, addr);
+	if (type) {
+		rc = res_cache(smc_p, type);
+		i  = res_first(rc, addr);
+		if (i < rc->count && rc->slot[i]->slot_location == (unsigned int)addr)
+			return rc->slot[i];
 	}
 
 	MHVTL_DBG(1, "Arrr... Could not find slot %d", addr);
@@ -144,7 +242,7 @@ static struct d_info *drive2struct(struct smc_priv *smc_p, int addr) {
 }
 
 /* Query the drive to check if it thinks it is empty */
-static int is_drive_empty(struct d_info *drv) {
+static int is_drive_empty(struct d_info *drv, long reply_id) {
 	int			   mlen, r_qid;
 	struct q_entry q;
 
@@ -156,13 +254,13 @@ static int is_drive_empty(struct d_info *drv) {
 	}
 
 	MHVTL_DBG(1, "%ld: Sending \"%s\" to snd_id %ld",
-			  my_id, msg_mount_state, drv->drv_id);
-	send_msg(msg_mount_state, drv->drv_id);
+			  reply_id, msg_mount_state, drv->drv_id);
+	send_msg_as(msg_mount_state, drv->drv_id, reply_id);
 
-	mlen = msgrcv(r_qid, &q, MAXOBN, my_id, MSG_NOERROR);
+	mlen = msgrcv(r_qid, &q, MAXOBN, reply_id, MSG_NOERROR);
 	if (mlen > 0)
 		MHVTL_DBG(1, "%ld: Received \"%s\" from snd_id %ld",
-				  my_id,
+				  reply_id,
 				  q.msg.text,
 				  q.msg.snd_id);
 
@@ -180,17 +278,35 @@ int slotOccupied(struct s_info *s) {
 	return s->status & STATUS_Full;
 }
 
-/* Returns true if drive has media in it */
-static int driveOccupied(struct d_info *d) {
-	int ret;
+static int check_tape_unload(long reply_id) {
+	int			   mlen, r_qid;
+	struct q_entry q;
 
-	ret = slotOccupied(d->slot);
-	ret |= is_drive_empty(d);
+	/* Initialise message queue as necessary */
+	r_qid = init_queue();
+	if (r_qid == -1) {
+		printf("Could not initialise message queue\n");
+		exit(1);
+	}
 
-	return ret;
+	mlen = msgrcv(r_qid, &q, MAXOBN, reply_id, MSG_NOERROR);
+	if (mlen > 0)
+		MHVTL_DBG(1, "%ld: Received \"%s\" from snd_id %ld",
+				  reply_id,
+				  q.msg.text,
+				  q.msg.snd_id);
+
+	/* msg defined in q.h */
+	return strncmp(msg_unload_ok, q.msg.text, 11);
 }
 
-static int check_tape_unload(void) {
+/* Expect a response from tape drive on load success/failure
+ * Returns 0 on success
+ * non-zero on load failure
+
+ * FIXME: I really need a timeout here..
+ */
+static int check_tape_load(long reply_id) {
 	int			   mlen, r_qid;
 	struct q_entry q;
 
@@ -201,15 +317,51 @@ static int check_tape_unload(void) {
 		exit(1);
 	}
 
-	mlen = msgrcv(r_qid, &q, MAXOBN, my_id, MSG_NOERROR);
+	mlen = msgrcv(r_qid, &q, MAXOBN, reply_id, MSG_NOERROR);
 	if (mlen > 0)
 		MHVTL_DBG(1, "%ld: Received \"%s\" from snd_id %ld",
-				  my_id,
+				  reply_id,
 				  q.msg.text,
 				  q.msg.snd_id);
 
 	/* msg defined in q.h */
-	return strncmp(msg_unload_ok, q.msg.text, 11);
+	return strncmp(msg_load_ok, q.msg.text, strlen(msg_load_ok));
+}
+
+/* Message id drives answer picker 'pk' on */
+static long picker_reply_id(struct smc_picker *pk) {
+	return pk ? pk->reply_id : my_id;
+}
+
+/*
+ * Wait for a drive to answer picker 'pk' - 0 if it loaded (or unloaded)
+ * the media. Other pickers, and the host, have the library meanwhile.
+ */
+static int picker_wait_drive(struct smc_priv *smc_p, struct smc_picker *pk, int load) {
+	int rc;
+
+	pthread_mutex_unlock(&smc_p->lock);
+	if (load)
+		rc = check_tape_load(picker_reply_id(pk));
+	else
+		rc = check_tape_unload(picker_reply_id(pk));
+	pthread_mutex_lock(&smc_p->lock);
+	return rc;
+}
+
+/* Returns true if drive has media in it */
+static int driveOccupied(struct smc_priv *smc_p, struct smc_picker *pk,
+						 struct d_info *d) {
+	int ret;
+
+	ret = slotOccupied(d->slot);
+	if (!d->drv_id) /* Pooled drive, bound to no tape daemon */
+		return ret;
+	pthread_mutex_unlock(&smc_p->lock);
+	ret |= is_drive_empty(d, picker_reply_id(pk));
+	pthread_mutex_lock(&smc_p->lock);
+
+	return ret;
 }
 
 /*
@@ -250,6 +402,7 @@ void setAccessStatus(struct s_info *s, int flg) {
 		s->status |= STATUS_Access;
 	else
 		s->status &= ~STATUS_Access;
+	smc_element_changed(s);
 }
 
 /*
@@ -257,15 +410,13 @@ void setAccessStatus(struct s_info *s, int flg) {
  * condition exists. An exception indicates the libary is uncertain of an
  * elements status.
  */
-/*
-static void setExceptStatus(struct s_info *s, int flg)
-{
+static void setExceptStatus(struct s_info *s, int flg) {
 	if (flg)
 		s->status |= STATUS_Except;
 	else
 		s->status &= ~STATUS_Except;
+	smc_element_changed(s);
 }
-*/
 
 /*
  * If set(1) then cartridge placed by operator
@@ -276,6 +427,7 @@ void setImpExpStatus(struct s_info *s, int flg) {
 		s->status |= STATUS_ImpExp;
 	else
 		s->status &= ~STATUS_ImpExp;
+	smc_element_changed(s);
 }
 
 /*
@@ -286,17 +438,41 @@ void setFullStatus(struct s_info *s, int flg) {
 		s->status |= STATUS_Full;
 	else
 		s->status &= ~STATUS_Full;
+	smc_element_changed(s);
 }
 
 void setSlotEmpty(struct s_info *s) {
 	setFullStatus(s, 0);
+	if (s->asc_ascq) { /* Reported for the media just taken out */
+		s->asc_ascq = 0;
+		setExceptStatus(s, 0);
+	}
 }
 
-static void setDriveEmpty(struct d_info *d) {
+static void setDriveEmpty(struct smc_priv *smc_p, struct smc_picker *pk,
+						  struct d_info *d) {
 	setFullStatus(d->slot, 0);
-	send_msg(msg_set_empty, d->drv_id);
+	if (!d->drv_id)
+		return;
+	send_msg_as(msg_set_empty, d->drv_id, picker_reply_id(pk));
 	/* Wait for ack from drive */
-	check_tape_unload();
+	picker_wait_drive(smc_p, pk, 0);
+	if (d->pooled)
+		smc_p->release_drive(smc_p, d);
+}
+
+/* Bind pooled drive 'd' to a tape daemon, if it is not already */
+static int bind_pooled_drive(struct smc_priv *smc_p, struct d_info *d,
+							 uint8_t *sam_stat) {
+	if (!d->pooled || d->drv_id)
+		return SAM_STAT_GOOD;
+	if (smc_p->bind_drive(smc_p, d)) {
+		MHVTL_LOG("No drive in the pool free for drive %d",
+				  slot_number(smc_p->pm, d->slot));
+		sam_not_ready(E_CAUSE_NOT_REPORTABLE, sam_stat);
+		return SAM_STAT_CHECK_CONDITION;
+	}
+	return SAM_STAT_GOOD;
 }
 
 void setSlotFull(struct s_info *s) {
@@ -417,10 +593,8 @@ static void decode_element_status(struct smc_priv *smc_p, uint8_t *p) {
 		fflush(NULL);
 }
 
-/*
- * Calculate length of one element
- */
-static int sizeof_element(struct scsi_cmd *cmd, int type) {
+/* VOLTAG and DVCID bits of the CDB */
+static int res_variant(struct scsi_cmd *cmd) {
 	struct smc_priv *smc_p = (struct smc_priv *)cmd->lu->lu_private;
 	int				 dvcid;
 	int				 voltag;
@@ -431,27 +605,35 @@ static int sizeof_element(struct scsi_cmd *cmd, int type) {
 	else
 		dvcid = cmd->scb[6] & 0x01; /* Device ID */
 
+	return RES_VARIANT(voltag, dvcid);
+}
+
+static int __sizeof_element(struct smc_priv *smc_p, int type, int variant) {
+	int voltag = variant >> 1;
+	int dvcid  = variant & 1;
+
 	return 16 + (voltag ? VOLTAG_LEN : 0) +
 		   (dvcid && (type == DATA_TRANSFER) ? smc_p->pm->dvcid_len : 0);
 }
 
+/*
+ * Calculate length of one element
+ */
+static int sizeof_element(struct scsi_cmd *cmd, int type) {
+	return __sizeof_element(cmd->lu->lu_private, type, res_variant(cmd));
+}
+
 /*
  * Fill in a single element descriptor
  *
  * Returns number of bytes in element data.
  */
-static int fill_ed(struct scsi_cmd *cmd, uint8_t *p, struct s_info *s) {
-	struct smc_priv *smc_p = (struct smc_priv *)cmd->lu->lu_private;
-	struct d_info	*d	   = NULL;
-	int				 j	   = 0;
-	uint8_t			 voltag;
-	uint8_t			 dvcid;
-
-	voltag = (cmd->scb[1] & 0x10) >> 4;
-	if (smc_p->pm->no_dvcid_flag)
-		dvcid = 1;
-	else
-		dvcid = cmd->scb[6] & 0x01; /* Device ID */
+static int fill_ed(struct smc_priv *smc_p, uint8_t *p, struct s_info *s,
+				   int variant) {
+	struct d_info *d	  = NULL;
+	int			   j	  = 0;
+	uint8_t		   voltag = variant >> 1;
+	uint8_t		   dvcid  = variant & 1;
 
 	/* Should never occur, but better to trap then core */
 	if (!s) {
@@ -646,43 +828,31 @@ static int fill_element_status_data_hdr(uint8_t *p, int start, int count,
 static uint32_t find_first_matching_element(struct smc_priv *priv,
 											uint32_t		 start,
 											uint8_t			 type) {
-	struct list_head *slot_head;
-	struct s_info	 *sp;
-
-	slot_head = &priv->slot_list;
-
-	list_for_each_entry(sp, slot_head, siblings) {
-		if (!type) { /* Element type not defined */
-			if (sp->slot_location >= start)
-				return sp->slot_location;
-		} else if (sp->element_type == type) {
-			if (sp->slot_location >= start)
-				return sp->slot_location;
-		}
+	struct smc_res_cache *rc;
+	uint32_t			  i, addr = 0;
+	int					  t;
+
+	for (t = type ? type : 1; t <= (type ? type : 4); t++) {
+		rc = res_cache(priv, t);
+		i  = res_first(rc, start);
+		if (i < rc->count && (!addr || rc->slot[i]->slot_location < addr))
+			addr = rc->slot[i]->slot_location;
 	}
-	return 0;
+	return addr;
 }
 
 /* Returns number of available elements left from starting number */
 static uint32_t num_available_elements(struct smc_priv *priv, uint8_t type,
 									   uint32_t start, uint32_t max) {
-	struct list_head *slot_head;
-	struct s_info	 *sp;
-	unsigned int	  counted = 0;
-
-	slot_head = &priv->slot_list;
-
-	list_for_each_entry(sp, slot_head, siblings) {
-		if (!type) { /* Element type not defined */
-			if (sp->slot_location >= start)
-				if (counted < max)
-					counted++;
-		} else if (sp->element_type == type) {
-			if (sp->slot_location >= start)
-				if (counted < max)
-					counted++;
-		}
+	struct smc_res_cache *rc;
+	unsigned int		  counted = 0;
+	int					  t;
+
+	for (t = type ? type : 1; t <= (type ? type : 4); t++) {
+		rc = res_cache(priv, t);
+		counted += rc->count - res_first(rc, start);
 	}
+	counted = min(counted, max);
 
 	MHVTL_DBG(2, "Determining %d element%s of type %s starting at %d"
 				 ", returning %d",
@@ -693,6 +863,49 @@ static uint32_t num_available_elements(struct smc_priv *priv, uint8_t type,
 	return counted;
 }
 
+/*
+ * Encoded descriptors of elements 'first' to 'first + count - 1' of 'rc',
+ * re-encoding those which have changed
+ */
+static uint8_t *res_descriptors(struct smc_priv *smc_p, struct smc_res_cache *rc,
+								int type, int variant, uint32_t first,
+								uint32_t count) {
+	uint32_t element_sz = __sizeof_element(smc_p, type, variant);
+	uint32_t last		= first + count - 1;
+	uint32_t w, i;
+	uint64_t mask, bits;
+	uint8_t *desc;
+
+	if (!rc->desc[variant]) {
+		rc->desc[variant]  = malloc(rc->count * element_sz);
+		rc->stale[variant] = malloc(RES_WORDS(rc->count) * sizeof(uint64_t));
+		if (!rc->desc[variant] || !rc->stale[variant]) {
+			MHVTL_ERR("Could not allocate memory");
+			exit(-ENOMEM);
+		}
+		memset(rc->stale[variant], 0xff, RES_WORDS(rc->count) * sizeof(uint64_t));
+	}
+	desc = rc->desc[variant];
+
+	for (w = first / 64; count && w <= last / 64; w++) {
+		mask = ~0ULL;
+		if (w == first / 64)
+			mask &= ~0ULL << (first % 64);
+		if (w == last / 64)
+			mask &= ~0ULL >> (63 - last % 64);
+		bits = rc->stale[variant][w] & mask;
+		if (!bits)
+			continue;
+		rc->stale[variant][w] &= ~bits;
+		do {
+			i = w * 64 + __builtin_ctzll(bits);
+			fill_ed(smc_p, desc + i * element_sz, rc->slot[i], variant);
+			bits &= bits - 1;
+		} while (bits);
+	}
+	return desc + first * element_sz;
+}
+
 /*
  * Fill in Element status page header + each Element descriptor
  *
@@ -706,10 +919,10 @@ static uint32_t num_available_elements(struct smc_priv *priv, uint8_t type,
 static uint32_t fill_element_page(struct scsi_cmd *cmd, uint8_t *p,
 								  uint16_t start, uint8_t type,
 								  uint16_t residual) {
-	struct smc_priv *smc_p;
-	int				 j;
-	uint8_t			*cdb = cmd->scb;
-	struct s_info	*sp;
+	struct smc_priv		 *smc_p;
+	struct smc_res_cache *rc;
+	uint8_t				 *cdb = cmd->scb;
+	int					  variant;
 
 	uint16_t max_count; /* Max element count */
 	uint32_t avail_count;
@@ -743,6 +956,9 @@ static uint32_t fill_element_page(struct scsi_cmd *cmd, uint8_t *p,
 		MHVTL_DBG(1, "Start element is still 0, line %d", __LINE__);
 		return 0;
 	}
+	/* Any type.. Need to fill in one type at a time */
+	if (!type)
+		type = slot_type(smc_p, begin_element);
 
 	avail_count = num_available_elements(smc_p, type, start, max_count);
 
@@ -754,36 +970,21 @@ static uint32_t fill_element_page(struct scsi_cmd *cmd, uint8_t *p,
 
 	/* Account for the 8 bytes in element status page header */
 	p += 8;
-	avail_count = 8; /* Reuse avail_count as available byte count */
 
-	/* Now loop over each slot and fill in details. */
-	j = 1;
-	list_for_each_entry(sp, &smc_p->slot_list, siblings) {
-		if (sp->slot_location < start)
-			continue;
-		if (type) {
-			if (sp->element_type != type)
-				continue; /* Don't report on this one */
-		} else {
-			/* Any type.. Need to fill in one type at a time */
-			if (sp->slot_location == start)
-				type = sp->element_type;
-		}
-		element_sz = fill_ed(cmd, p, sp);
-		avail_count += element_sz; /* inc byte count */
-		MHVTL_DBG(3, "Count: %d, max_count: %d, slot: %d, "
-					 "byte_count: 0x%04x (%d)",
-				  j, max_count, sp->slot_location,
-				  avail_count, avail_count);
-		if (debug)
-			hex_dump(p, element_sz);
-		p += element_sz; /* inc pointer into dest buf */
-		j++;
-		if (j > max_count)
-			break;
-	}
+	variant	   = res_variant(cmd);
+	element_sz = __sizeof_element(smc_p, type, variant);
+	rc		   = res_cache(smc_p, type);
+	memcpy(p, res_descriptors(smc_p, rc, type, variant, res_first(rc, start), avail_count),
+		   avail_count * element_sz);
 
-	return avail_count;
+	MHVTL_DBG(3, "Count: %d, max_count: %d, first slot: %d, "
+				 "byte_count: 0x%04x (%d)",
+			  avail_count, max_count, begin_element,
+			  8 + avail_count * element_sz, 8 + avail_count * element_sz);
+	if (debug)
+		hex_dump(p, avail_count * element_sz);
+
+	return 8 + avail_count * element_sz;
 }
 
 /*
@@ -960,38 +1161,196 @@ uint8_t smc_read_element_status(struct scsi_cmd *cmd) {
 	return SAM_STAT_GOOD;
 }
 
-/* Expect a response from tape drive on load success/failure
- * Returns 0 on success
- * non-zero on load failure
-
- * FIXME: I really need a timeout here..
+/*
+ * INITIALIZE ELEMENT STATUS audits the media: the files of each cartridge
+ * in a storage or MAP element are checked to exist and be loadable, and
+ * any which are not reported with an ASC/ASCQ (and the Except bit) in the
+ * element's READ ELEMENT STATUS descriptor until they are.
+ *
+ * That is a few stat()/read() per cartridge, mostly waiting on the
+ * filesystem, so IES_WORKERS threads check cartridges at once. Pickers
+ * have the library meanwhile - media moved during the audit keeps its
+ * previous state.
  */
-static int check_tape_load(void) {
-	int			   mlen, r_qid;
-	struct q_entry q;
+#define IES_WORKERS 16
+
+struct ies_audit {
+	uint16_t (*verify_media)(const char *barcode);
+	struct s_info **slot;
+	struct m_info **media;	  /* In slot[] as the audit started */
+	uint16_t	   *asc_ascq; /* Result for each */
+	uint32_t		count;
+	uint32_t		next; /* Next to check */
+};
+
+static void *ies_worker(void *arg) {
+	struct ies_audit *a = arg;
+	uint32_t		  i;
+
+	while ((i = __atomic_fetch_add(&a->next, 1, __ATOMIC_RELAXED)) < a->count)
+		a->asc_ascq[i] = a->verify_media((char *)a->media[i]->barcode);
+	return NULL;
+}
 
-	/* Initialise message queue as necessary */
-	r_qid = init_queue();
-	if (r_qid == -1) {
-		printf("Could not initialise message queue\n");
-		exit(1);
+static void setElementAsc(struct s_info *s, uint16_t asc_ascq) {
+	if (s->asc_ascq == asc_ascq)
+		return;
+	s->asc_ascq = asc_ascq;
+	setExceptStatus(s, asc_ascq != 0);
+}
+
+/* Audit the media in storage and MAP elements 'first' to 'last' */
+static void ies_audit(struct smc_priv *smc_p, uint32_t first, uint32_t last) {
+	static const int	  types[] = {STORAGE_ELEMENT, MAP_ELEMENT};
+	struct smc_res_cache *rc;
+	struct ies_audit	  a;
+	struct s_info		 *sp;
+	pthread_t			  worker[IES_WORKERS];
+	uint32_t			  i, bad = 0;
+	int					  t, n, workers;
+
+	if (!smc_p->verify_media)
+		return;
+
+	memset(&a, 0, sizeof(a));
+	a.verify_media = smc_p->verify_media;
+	for (t = 0; t < 2; t++)
+		a.count += res_cache(smc_p, types[t])->count;
+	a.slot	   = malloc(a.count * sizeof(*a.slot));
+	a.media	   = malloc(a.count * sizeof(*a.media));
+	a.asc_ascq = malloc(a.count * sizeof(*a.asc_ascq));
+	if (!a.slot || !a.media || !a.asc_ascq) {
+		MHVTL_ERR("Could not allocate memory");
+		goto out;
 	}
 
-	mlen = msgrcv(r_qid, &q, MAXOBN, my_id, MSG_NOERROR);
-	if (mlen > 0)
-		MHVTL_DBG(1, "%ld: Received \"%s\" from snd_id %ld",
-				  my_id,
-				  q.msg.text,
-				  q.msg.snd_id);
+	a.count = 0;
+	for (t = 0; t < 2; t++) {
+		rc = res_cache(smc_p, types[t]);
+		for (i = res_first(rc, first); i < rc->count; i++) {
+			sp = rc->slot[i];
+			if (sp->slot_location > last)
+				break;
+			if (!slotOccupied(sp) || !sp->media) {
+				setElementAsc(sp, 0);
+				continue;
+			}
+			if (sp->busy) /* Being moved */
+				continue;
+			a.slot[a.count]	 = sp;
+			a.media[a.count] = sp->media;
+			a.count++;
+		}
+	}
 
-	/* msg defined in q.h */
-	return strncmp(msg_load_ok, q.msg.text, strlen(msg_load_ok));
+	workers = min(a.count, (uint32_t)IES_WORKERS);
+	pthread_mutex_unlock(&smc_p->lock);
+	for (n = 0; n < workers; n++)
+		if (pthread_create(&worker[n], NULL, ies_worker, &a))
+			break;
+	ies_worker(&a); /* Even if no thread could be started */
+	while (n--)
+		pthread_join(worker[n], NULL);
+	pthread_mutex_lock(&smc_p->lock);
+
+	for (i = 0; i < a.count; i++) {
+		if (a.slot[i]->media != a.media[i])
+			continue; /* Moved since */
+		setElementAsc(a.slot[i], a.asc_ascq[i]);
+		if (a.asc_ascq[i])
+			bad++;
+	}
+	MHVTL_DBG(1, "Checked %u cartridge%s, %u will not load",
+			  a.count, a.count == 1 ? "" : "s", bad);
+
+out:
+	free(a.slot);
+	free(a.media);
+	free(a.asc_ascq);
+}
+
+uint8_t smc_initialize_element_status(struct scsi_cmd *cmd) {
+	uint8_t *sam_stat = &cmd->dbuf_p->sam_stat;
+
+	current_state = MHVTL_STATE_INITIALISE_ELEMENTS;
+
+	MHVTL_DBG(1, "%s (%ld) **", "INITIALIZE ELEMENT",
+			  (long)cmd->dbuf_p->serialNo);
+	if (!cmd->lu->online) {
+		sam_not_ready(NO_ADDITIONAL_SENSE, sam_stat);
+		return SAM_STAT_CHECK_CONDITION;
+	}
+	ies_audit(cmd->lu->lu_private, 0, UINT32_MAX);
+	return SAM_STAT_GOOD;
+}
+
+uint8_t smc_initialize_element_status_with_range(struct scsi_cmd *cmd) {
+	uint8_t *sam_stat = &cmd->dbuf_p->sam_stat;
+	uint8_t *cdb	  = cmd->scb;
+	uint32_t first	  = 0;
+	uint32_t last	  = UINT32_MAX;
+
+	current_state = MHVTL_STATE_INITIALISE_ELEMENTS;
+
+	MHVTL_DBG(1, "%s (%ld) **", "INITIALIZE ELEMENT RANGE",
+			  (long)cmd->dbuf_p->serialNo);
+
+	if (!cmd->lu->online) {
+		sam_not_ready(NO_ADDITIONAL_SENSE, sam_stat);
+		return SAM_STAT_CHECK_CONDITION;
+	}
+	if (cdb[1] & 0x01) { /* RANGE - else all elements */
+		first = get_unaligned_be16(&cdb[2]);
+		last  = first + get_unaligned_be16(&cdb[6]) - 1;
+		if (!get_unaligned_be16(&cdb[6]))
+			return SAM_STAT_GOOD;
+	}
+	ies_audit(cmd->lu->lu_private, first, last);
+	return SAM_STAT_GOOD;
+}
+
+/*
+ * Append a record to the library state journal, if there is one, and
+ * flush it to disk before returning. Replayed over the .persist file
+ * on start-up - see journal_start() in vtllibrary.c
+ *
+ * op: 'M' media moved from 'src' to 'dest'
+ *     'I' media imported into MAP slot 'dest'
+ *     'E' media removed from MAP slot 'src'
+ *     'S' storage slot 'dest' added
+ *     'D' media loaded in drive 'dest' from 'src' - written as the journal
+ *         is emptied, the .persist file having it back in storage
+ */
+void smc_journal(struct smc_priv *smc_p, char op, uint32_t src, uint32_t dest,
+				 const char *barcode) {
+	char bc[MAX_BARCODE_LEN + 1];
+	char rec[MAX_BARCODE_LEN + 64];
+	int	 len;
+
+	if (smc_p->journal_fd < 0)
+		return;
+
+	snprintf(bc, sizeof(bc), "%s", barcode ? barcode : "");
+	truncate_spaces(bc, sizeof(bc));
+	len = snprintf(rec, sizeof(rec), "%" PRIu64 " %c %u %u %s\n",
+				   smc_p->journal_seq + 1, op, src, dest, bc[0] ? bc : "-");
+	if (write(smc_p->journal_fd, rec, len) != len ||
+		fdatasync(smc_p->journal_fd)) {
+		MHVTL_ERR("Can not write library state journal: %s", strerror(errno));
+		return;
+	}
+	smc_p->journal_seq++;
+	smc_p->journal_count++;
 }
 
 /*
  * Logically move information from 'src' address to 'dest' address
  */
-static void move_cart(struct s_info *src, struct s_info *dest) {
+void move_cart(struct smc_priv *smc_p, struct s_info *src, struct s_info *dest) {
+	uint16_t asc_ascq;
+
+	smc_journal(smc_p, 'M', src->slot_location, dest->slot_location,
+				src->media ? src->media->barcode : NULL);
 
 	dest->media = src->media;
 
@@ -1002,6 +1361,21 @@ static void move_cart(struct s_info *src, struct s_info *dest) {
 	if (is_map_slot(dest))
 		setImpExpStatus(dest, ROBOT_ARM); /* Placed by robot arm */
 
+	/* What INITIALIZE ELEMENT STATUS found goes with the media. A drive
+	 * does not report it, so the media holds it until unloaded
+	 */
+	if (src->element_type == DATA_TRANSFER)
+		asc_ascq = dest->media->asc_ascq;
+	else
+		asc_ascq = src->asc_ascq;
+	if (dest->element_type == DATA_TRANSFER) {
+		dest->media->asc_ascq = asc_ascq;
+	} else {
+		dest->media->asc_ascq = 0;
+		dest->asc_ascq		  = asc_ascq;
+		setExceptStatus(dest, asc_ascq != 0);
+	}
+
 	src->media		   = NULL;
 	src->last_location = 0; /* Forget where the old media was */
 	setSlotEmpty(src);		/* Clear Full bit */
@@ -1009,18 +1383,64 @@ static void move_cart(struct s_info *src, struct s_info *dest) {
 	setAccessStatus(src, 1); /* Set the access bit now it's empty */
 }
 
-static int run_move_command(struct smc_priv *smc_p, struct s_info *src,
-							struct s_info *dest, uint8_t *sam_stat) {
+/* Picker 'pk' taking its 'latency' over a move, with the library unlocked */
+static void picker_travel(struct smc_priv *smc_p, struct smc_picker *pk) {
+	struct timespec ts;
+
+	if (!pk || pk->latency <= 0)
+		return;
+
+	ts.tv_sec  = pk->latency / 1000;
+	ts.tv_nsec = (pk->latency % 1000) * 1000000L;
+	pthread_mutex_unlock(&smc_p->lock);
+	while (nanosleep(&ts, &ts) && errno == EINTR)
+		;
+	pthread_mutex_lock(&smc_p->lock);
+}
+
+static int run_move_command(struct smc_priv *smc_p, struct smc_picker *pk,
+							struct s_info *src, struct s_info *dest,
+							uint8_t *sam_stat) {
 	char *movecommand;
 	char  barcode[MAX_BARCODE_LEN + 1];
 	int	  res = 0;
 	int	  cmdlen;
 
-	if (!smc_p->movecommand) {
+	picker_travel(smc_p, pk);
+
+	if (!smc_p->movecommand && !smc_p->movehelper) {
 		/* no command: do nothing */
 		return SAM_STAT_GOOD;
 	}
 
+	sprintf(barcode, "%s", src->media->barcode);
+	truncate_spaces(&barcode[0], MAX_BARCODE_LEN + 1);
+
+	if (smc_p->movehelper) {
+		char request[MAX_BARCODE_LEN + 64];
+
+		snprintf(request, sizeof(request), "MOVE %s %d %s %d %s",
+				 slot_type_str(src->element_type),
+				 slot_number(smc_p->pm, src),
+				 slot_type_str(dest->element_type),
+				 slot_number(smc_p->pm, dest),
+				 barcode);
+		/* Other pickers' requests go to the helper meanwhile - 'src' and
+		 * 'dest' are busy until this move is done
+		 */
+		pthread_mutex_unlock(&smc_p->lock);
+		res = coproc_send(smc_p->movehelper, request, smc_p->commandtimeout);
+		if (res > 0)
+			res = coproc_wait(smc_p->movehelper, res);
+		pthread_mutex_lock(&smc_p->lock);
+		if (res) {
+			MHVTL_ERR("move helper returned %d", res);
+			sam_hardware_error(E_MANUAL_INTERVENTION_REQ, sam_stat);
+			return SAM_STAT_CHECK_CONDITION;
+		}
+		return SAM_STAT_GOOD;
+	}
+
 	cmdlen		= strlen(smc_p->movecommand) + MAX_BARCODE_LEN + 4 * 10;
 	movecommand = zalloc(cmdlen + 1);
 
@@ -1030,8 +1450,6 @@ static int run_move_command(struct smc_priv *smc_p, struct s_info *src,
 		return SAM_STAT_CHECK_CONDITION;
 	}
 
-	sprintf(barcode, "%s", src->media->barcode);
-	truncate_spaces(&barcode[0], MAX_BARCODE_LEN + 1);
 	snprintf(movecommand, cmdlen, "%s %s %d %s %d %s",
 			 smc_p->movecommand,
 			 slot_type_str(src->element_type),
@@ -1040,7 +1458,11 @@ static int run_move_command(struct smc_priv *smc_p, struct s_info *src,
 			 slot_number(smc_p->pm, dest),
 			 barcode);
 	MHVTL_DBG(3, "Calling external script: %s", movecommand);
+	/* run_command() runs one at a time, but not with the library locked */
+	pthread_mutex_unlock(&smc_p->lock);
 	res = run_command(movecommand, smc_p->commandtimeout);
+	pthread_mutex_lock(&smc_p->lock);
+	free(movecommand);
 	if (res) {
 		MHVTL_ERR("move command returned %d", res);
 		sam_hardware_error(E_MANUAL_INTERVENTION_REQ, sam_stat);
@@ -1049,12 +1471,12 @@ static int run_move_command(struct smc_priv *smc_p, struct s_info *src,
 	return SAM_STAT_GOOD;
 }
 
-static int move_slot2drive(struct smc_priv *smc_p,
+static int move_slot2drive(struct smc_priv *smc_p, struct smc_picker *pk,
 						   int src_addr, int dest_addr, uint8_t *sam_stat) {
 	struct s_info *src;
 	struct d_info *dest;
 	char		   cmd[MAX_BARCODE_LEN + 12];
-	int			   retval;
+	int			   retval, bound;
 
 	current_state = MHVTL_STATE_MOVING_SLOT_2_DRIVE;
 
@@ -1065,7 +1487,7 @@ static int move_slot2drive(struct smc_priv *smc_p,
 		sam_illegal_request(E_MEDIUM_SRC_EMPTY, NULL, sam_stat);
 		return SAM_STAT_CHECK_CONDITION;
 	}
-	if (driveOccupied(dest)) {
+	if (driveOccupied(smc_p, pk, dest)) {
 		sam_illegal_request(E_MEDIUM_DEST_FULL, NULL, sam_stat);
 		return SAM_STAT_CHECK_CONDITION;
 	}
@@ -1077,24 +1499,32 @@ static int move_slot2drive(struct smc_priv *smc_p,
 		}
 	}
 
-	/* Call any external cmd first before changing state */
-	retval = run_move_command(smc_p, src, dest->slot, sam_stat);
+	/* A drive from the pool before the robot moves anything */
+	bound  = dest->pooled && !dest->drv_id;
+	retval = bind_pooled_drive(smc_p, dest, sam_stat);
 	if (retval)
 		return retval;
 
+	/* Call any external cmd first before changing state */
+	retval = run_move_command(smc_p, pk, src, dest->slot, sam_stat);
+	if (retval) {
+		if (bound)
+			smc_p->release_drive(smc_p, dest);
+		return retval;
+	}
+
 	sprintf(cmd, "lload %s", src->media->barcode);
 	/* Remove traling spaces */
 	truncate_spaces(&cmd[6], MAX_BARCODE_LEN + 1);
 
-	/* FIXME: About here would be a good spot to create any 'missing'
-	 *	  media. That way, the user would not have to pre-create
-	 *	  media.
+	/* Media not yet created is created by vtltape as it loads it, in
+	 * libraries provisioned on-demand - see provision_media()
 	 */
 
 	MHVTL_DBG(1, "About to send cmd: \'%s\' to drive %d",
 			  cmd, slot_number(smc_p->pm, dest->slot));
 
-	send_msg(cmd, dest->drv_id);
+	send_msg_as(cmd, dest->drv_id, picker_reply_id(pk));
 
 	if (!smc_p->state_msg)
 		smc_p->state_msg = (char *)zalloc(DEF_SMC_PRIV_STATE_MSG_LENGTH);
@@ -1111,14 +1541,16 @@ static int move_slot2drive(struct smc_priv *smc_p,
 				 slot_number(smc_p->pm, dest->slot));
 	}
 
-	if (check_tape_load()) {
+	if (picker_wait_drive(smc_p, pk, 1)) {
 		MHVTL_ERR("Load of %s into drive %d failed",
 				  cmd, slot_number(smc_p->pm, dest->slot));
+		if (dest->pooled)
+			smc_p->release_drive(smc_p, dest);
 		sam_hardware_error(E_MANUAL_INTERVENTION_REQ, sam_stat);
 		return SAM_STAT_CHECK_CONDITION;
 	}
 
-	move_cart(src, dest->slot);
+	move_cart(smc_p, src, dest->slot);
 	setDriveFull(dest);
 	/* Set the 'Access bit' to zero - i.e. the picker arm can't access it */
 	setAccessStatus(dest->slot, 0);
@@ -1126,8 +1558,8 @@ static int move_slot2drive(struct smc_priv *smc_p,
 	return retval;
 }
 
-static int move_slot2slot(struct smc_priv *smc_p, int src_addr,
-						  int dest_addr, uint8_t *sam_stat) {
+static int move_slot2slot(struct smc_priv *smc_p, struct smc_picker *pk,
+						  int src_addr, int dest_addr, uint8_t *sam_stat) {
 	struct s_info *src;
 	struct s_info *dest;
 	char		   cmd[MAX_BARCODE_LEN + 1];
@@ -1183,10 +1615,10 @@ static int move_slot2slot(struct smc_priv *smc_p, int src_addr,
 				 slot_number(smc_p->pm, dest));
 	}
 
-	retval = run_move_command(smc_p, src, dest, sam_stat);
+	retval = run_move_command(smc_p, pk, src, dest, sam_stat);
 	if (retval)
 		return retval;
-	move_cart(src, dest);
+	move_cart(smc_p, src, dest);
 	return retval;
 }
 
@@ -1209,7 +1641,7 @@ static int valid_slot(struct smc_priv *smc_p, int addr) {
 			MHVTL_DBG(1, "No target drive %d in device.conf", addr);
 			return FALSE; /* No drive, return false */
 		}
-		if (drv->drv_id) {
+		if (drv->drv_id || drv->pooled) {
 			MHVTL_DBG(3, "Found drive id: %d", (int)drv->drv_id);
 			return TRUE; /* Found a drive ID */
 		} else {
@@ -1220,7 +1652,7 @@ static int valid_slot(struct smc_priv *smc_p, int addr) {
 	return FALSE;
 }
 
-static int move_drive2slot(struct smc_priv *smc_p,
+static int move_drive2slot(struct smc_priv *smc_p, struct smc_picker *pk,
 						   int src_addr, int dest_addr, uint8_t *sam_stat) {
 	char		   cmd[MAX_BARCODE_LEN + 1 + 12]; /* 12 being the longest msg string */
 	struct d_info *src;
@@ -1232,7 +1664,7 @@ static int move_drive2slot(struct smc_priv *smc_p,
 	src	 = drive2struct(smc_p, src_addr);
 	dest = slot2struct(smc_p, dest_addr);
 
-	if (!driveOccupied(src)) {
+	if (!driveOccupied(smc_p, pk, src)) {
 		sam_illegal_request(E_MEDIUM_SRC_EMPTY, NULL, sam_stat);
 		return SAM_STAT_CHECK_CONDITION;
 	}
@@ -1249,16 +1681,16 @@ static int move_drive2slot(struct smc_priv *smc_p,
 	}
 
 	/* Send any external command before any changes here */
-	retval = run_move_command(smc_p, src->slot, dest, sam_stat);
+	retval = run_move_command(smc_p, pk, src->slot, dest, sam_stat);
 	if (retval)
 		return retval;
 
 	/* Send 'unload' message to drive b4 the move.. If not already unloaded */
-	if (!slotAccess(src->slot)) {
+	if (!slotAccess(src->slot) && src->drv_id) {
 		sprintf(cmd, "unload %s", src->slot->media->barcode);
-		send_msg(cmd, src->drv_id);
+		send_msg_as(cmd, src->drv_id, picker_reply_id(pk));
 		/* Now we wait for the tape device to respond with status of unload */
-		if (check_tape_unload()) {
+		if (picker_wait_drive(smc_p, pk, 0)) {
 			MHVTL_ERR("Unload of %s from drive %d failed",
 					  cmd, slot_number(smc_p->pm, src->slot));
 			sam_hardware_error(E_MANUAL_INTERVENTION_REQ, sam_stat);
@@ -1279,19 +1711,19 @@ static int move_drive2slot(struct smc_priv *smc_p,
 				 slot_number(smc_p->pm, dest));
 	}
 
-	move_cart(src->slot, dest);
-	setDriveEmpty(src);
+	move_cart(smc_p, src->slot, dest);
+	setDriveEmpty(smc_p, pk, src);
 
 	return retval;
 }
 
 /* Move media in drive 'src_addr' to drive 'dest_addr' */
-static int move_drive2drive(struct smc_priv *smc_p,
+static int move_drive2drive(struct smc_priv *smc_p, struct smc_picker *pk,
 							int src_addr, int dest_addr, uint8_t *sam_stat) {
 	struct d_info *src;
 	struct d_info *dest;
 	char		   cmd[MAX_BARCODE_LEN + 12];
-	int			   retval;
+	int			   retval, bound;
 
 	current_state = MHVTL_STATE_MOVING_DRIVE_2_DRIVE;
 
@@ -1304,37 +1736,50 @@ static int move_drive2drive(struct smc_priv *smc_p,
 		return SAM_STAT_GOOD;
 	}
 
-	if (!driveOccupied(src)) {
+	if (!driveOccupied(smc_p, pk, src)) {
 		sam_illegal_request(E_MEDIUM_SRC_EMPTY, NULL, sam_stat);
 		return SAM_STAT_CHECK_CONDITION;
 	}
-	if (driveOccupied(dest)) {
+	if (driveOccupied(smc_p, pk, dest)) {
 		sam_illegal_request(E_MEDIUM_DEST_FULL, NULL, sam_stat);
 		return SAM_STAT_CHECK_CONDITION;
 	}
 
-	/* Execute any external commands before changing state */
-	retval = run_move_command(smc_p, src->slot, dest->slot, sam_stat);
+	/* A drive from the pool before the robot moves anything */
+	bound  = dest->pooled && !dest->drv_id;
+	retval = bind_pooled_drive(smc_p, dest, sam_stat);
 	if (retval)
 		return retval;
 
+	/* Execute any external commands before changing state */
+	retval = run_move_command(smc_p, pk, src->slot, dest->slot, sam_stat);
+	if (retval) {
+		if (bound)
+			smc_p->release_drive(smc_p, dest);
+		return retval;
+	}
+
 	/* Send 'unload' message to drive b4 the move.. */
 	MHVTL_DBG(2, "Unloading %s from drive %d",
 			  src->slot->media->barcode,
 			  slot_number(smc_p->pm, src->slot));
 
-	sprintf(cmd, "unload %s", src->slot->media->barcode);
-	send_msg(cmd, src->drv_id);
-	/* Now we wait for the tape device to respond with status of unload */
-	if (check_tape_unload()) {
-		MHVTL_ERR("Failed to unload tape from drive %d",
-				  slot_number(smc_p->pm, src->slot));
-		sam_hardware_error(E_MANUAL_INTERVENTION_REQ, sam_stat);
-		return SAM_STAT_CHECK_CONDITION;
+	if (src->drv_id) {
+		sprintf(cmd, "unload %s", src->slot->media->barcode);
+		send_msg_as(cmd, src->drv_id, picker_reply_id(pk));
+		/* Now we wait for the tape device to respond with status of unload */
+		if (picker_wait_drive(smc_p, pk, 0)) {
+			MHVTL_ERR("Failed to unload tape from drive %d",
+					  slot_number(smc_p->pm, src->slot));
+			if (dest->pooled)
+				smc_p->release_drive(smc_p, dest);
+			sam_hardware_error(E_MANUAL_INTERVENTION_REQ, sam_stat);
+			return SAM_STAT_CHECK_CONDITION;
+		}
 	}
 
-	move_cart(src->slot, dest->slot);
-	setDriveEmpty(src);
+	move_cart(smc_p, src->slot, dest->slot);
+	setDriveEmpty(smc_p, pk, src);
 
 	sprintf(cmd, "lload %s", dest->slot->media->barcode);
 
@@ -1342,19 +1787,23 @@ static int move_drive2drive(struct smc_priv *smc_p,
 	MHVTL_DBG(2, "Sending cmd: \'%s\' to drive %d",
 			  cmd, slot_number(smc_p->pm, dest->slot));
 
-	send_msg(cmd, dest->drv_id);
+	send_msg_as(cmd, dest->drv_id, picker_reply_id(pk));
 
-	if (check_tape_load()) {
+	if (picker_wait_drive(smc_p, pk, 1)) {
 		/* Failed, so put the tape back where it came from */
 		MHVTL_ERR("Failed to move to drive %d, "
 				  "placing back into drive %d",
 				  slot_number(smc_p->pm, dest->slot),
 				  slot_number(smc_p->pm, src->slot));
-		move_cart(dest->slot, src->slot);
-		sprintf(cmd, "lload %s", src->slot->media->barcode);
-		truncate_spaces(&cmd[6], MAX_BARCODE_LEN + 1);
-		send_msg(cmd, src->drv_id);
-		check_tape_load();
+		move_cart(smc_p, dest->slot, src->slot);
+		if (dest->pooled)
+			smc_p->release_drive(smc_p, dest);
+		if (!bind_pooled_drive(smc_p, src, sam_stat)) {
+			sprintf(cmd, "lload %s", src->slot->media->barcode);
+			truncate_spaces(&cmd[6], MAX_BARCODE_LEN + 1);
+			send_msg_as(cmd, src->drv_id, picker_reply_id(pk));
+			picker_wait_drive(smc_p, pk, 1);
+		}
 		sam_hardware_error(E_MANUAL_INTERVENTION_REQ, sam_stat);
 		return SAM_STAT_CHECK_CONDITION;
 	}
@@ -1378,16 +1827,36 @@ static int move_drive2drive(struct smc_priv *smc_p,
 	return retval;
 }
 
+/* Storage, MAP or drive element at 'addr' */
+static struct s_info *element2struct(struct smc_priv *smc_p, int addr) {
+	struct d_info *drv;
+
+	if (slot_type(smc_p, addr) == DATA_TRANSFER) {
+		drv = drive2struct(smc_p, addr);
+		return drv ? drv->slot : NULL;
+	}
+	return slot2struct(smc_p, addr);
+}
+
+/* Picker at 'addr', NULL if there is none */
+static struct smc_picker *picker2struct(struct smc_priv *smc_p, int addr) {
+	if (!smc_p->picker || slot_type(smc_p, addr) != MEDIUM_TRANSPORT)
+		return NULL;
+	return &smc_p->picker[addr - smc_p->pm->start_picker];
+}
+
 /* Move a piece of medium from one slot to another */
 uint8_t smc_move_medium(struct scsi_cmd *cmd) {
-	uint8_t			*cdb	  = cmd->scb;
-	uint8_t			*sam_stat = &cmd->dbuf_p->sam_stat;
-	int				 transport_addr;
-	int				 src_addr, src_type;
-	int				 dest_addr, dest_type;
-	int				 retval = SAM_STAT_GOOD;
-	struct smc_priv *smc_p	= cmd->lu->lu_private;
-	struct s_sd		 sd;
+	uint8_t			  *cdb		= cmd->scb;
+	uint8_t			  *sam_stat = &cmd->dbuf_p->sam_stat;
+	int				   transport_addr;
+	int				   src_addr, src_type;
+	int				   dest_addr, dest_type;
+	int				   retval = SAM_STAT_GOOD;
+	struct smc_priv	  *smc_p  = cmd->lu->lu_private;
+	struct smc_picker *pk;
+	struct s_info	  *src, *dest;
+	struct s_sd		   sd;
 
 	MHVTL_DBG(1, "MOVE MEDIUM (%ld) **", (long)cmd->dbuf_p->serialNo);
 
@@ -1449,23 +1918,39 @@ uint8_t smc_move_medium(struct scsi_cmd *cmd) {
 		retval = SAM_STAT_CHECK_CONDITION;
 	}
 
-	if (retval == SAM_STAT_GOOD) {
-		if (src_type == DATA_TRANSFER && dest_type == DATA_TRANSFER) {
-			/* Move between drives */
-			retval = move_drive2drive(smc_p, src_addr, dest_addr,
-									  sam_stat);
-		} else if (src_type == DATA_TRANSFER) {
-			retval = move_drive2slot(smc_p, src_addr, dest_addr,
-									 sam_stat);
-		} else if (dest_type == DATA_TRANSFER) {
-			retval = move_slot2drive(smc_p, src_addr, dest_addr,
-									 sam_stat);
-		} else { /* Move between (non-drive) slots */
-			retval = move_slot2slot(smc_p, src_addr, dest_addr,
-									sam_stat);
-		}
+	if (retval != SAM_STAT_GOOD)
+		return retval;
+
+	/* The picker thread doing the move, else the one asked for */
+	pk = cmd->picker ? cmd->picker : picker2struct(smc_p, transport_addr);
+
+	/* Wait for any other picker moving media to or from either element */
+	src	 = element2struct(smc_p, src_addr);
+	dest = element2struct(smc_p, dest_addr);
+	while (src->busy || dest->busy)
+		pthread_cond_wait(&smc_p->moved, &smc_p->lock);
+	src->busy  = 1;
+	dest->busy = 1;
+
+	if (src_type == DATA_TRANSFER && dest_type == DATA_TRANSFER) {
+		/* Move between drives */
+		retval = move_drive2drive(smc_p, pk, src_addr, dest_addr,
+								  sam_stat);
+	} else if (src_type == DATA_TRANSFER) {
+		retval = move_drive2slot(smc_p, pk, src_addr, dest_addr,
+								 sam_stat);
+	} else if (dest_type == DATA_TRANSFER) {
+		retval = move_slot2drive(smc_p, pk, src_addr, dest_addr,
+								 sam_stat);
+	} else { /* Move between (non-drive) slots */
+		retval = move_slot2slot(smc_p, pk, src_addr, dest_addr,
+								sam_stat);
 	}
 
+	src->busy  = 0;
+	dest->busy = 0;
+	pthread_cond_broadcast(&smc_p->moved);
+
 	return retval;
 }
 
@@ -1504,12 +1989,14 @@ uint8_t smc_open_close_import_export_element(struct scsi_cmd *cmd) {
 		if (smc_p->cap_closed == CAP_CLOSED) {
 			MHVTL_DBG(2, "opening CAP");
 			smc_p->cap_closed = CAP_OPEN;
+			smc_elements_changed(smc_p);
 		}
 		break;
 	case 1: /* close */
 		if (smc_p->cap_closed == CAP_OPEN) {
 			MHVTL_DBG(2, "closing CAP");
 			smc_p->cap_closed = CAP_CLOSED;
+			smc_elements_changed(smc_p);
 		}
 		break;
 	default:
@@ -1606,11 +2093,12 @@ log_page_not_found:
 	return SAM_STAT_CHECK_CONDITION;
 }
 
-void unload_drive_on_shutdown(struct s_info *src, struct s_info *dest) {
+void unload_drive_on_shutdown(struct smc_priv *smc_p, struct s_info *src,
+							  struct s_info *dest) {
 	if (!dest)
 		return;
 
 	MHVTL_DBG(1, "Force unload of media %s to slot %d",
 			  src->media->barcode, dest->slot_location);
-	move_cart(src, dest);
+	move_cart(smc_p, src, dest);
 }
@@ -33,8 +33,6 @@
 #include "logging.h"
 #include "ssc.h"
 
-extern unsigned char sense[];
-
 uint32_t SPR_Reservation_Generation;
 uint8_t	 SPR_Reservation_Type;
 uint64_t SPR_Reservation_Key;
@@ -0,0 +1,185 @@
+/*
+ * log_bench - Cost per block of writeBlock()/readBlock() with debug logging
+ *	       switched off at run time (verbose 0) or compiled out
+ *	       (MHVTL_DBG_MAX=0)
+ *
+ * 'make log_bench' builds this twice, once per logging mode, and runs both.
+ * A scratch cartridge is created under /tmp, written and read back in-process
+ * the same way preload_tape/dump_tape drive the I/O path.
+ *
+ * Copyright (C) 2005 - 2025 Mark Harvey markh794 at gmail dot com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <time.h>
+#include <zlib.h>
+#include "be_byteshift.h"
+#include "mhvtl_scsi.h"
+#include "mhvtl_list.h"
+#include "vtl_common.h"
+#include "vtllib.h"
+#include "vtlcart.h"
+#include "ssc.h"
+#include "logging.h"
+#include "minilzo.h"
+
+char mhvtl_driver_name[] = "log_bench";
+
+#define PCL "BENCH0L8"
+
+/* Hooks the personality module and mhvtl_io.c expect from vtltape */
+uint8_t check_restrictions(struct scsi_cmd *cmd) {
+	*lu_ssc.OK_2_write = 1;
+	return 1;
+}
+
+uint8_t valid_encryption_blk(struct scsi_cmd *cmd) {
+	return TRUE;
+}
+
+void register_ops(struct lu_phy_attr *lu, int op, void *f, void *g, void *h) {
+}
+
+void ssc_personality_module_register(struct ssc_personality_template *pm) {
+	lu_ssc.pm = pm;
+}
+
+int add_drive_media_list(struct lu_phy_attr *lu, int status, char *s) {
+	return 0;
+}
+
+static uint64_t cycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+	return __builtin_ia32_rdtsc();
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+static void setup(void) {
+	uint8_t sam_stat;
+
+	memset(&lunit, 0, sizeof(lunit));
+	memset(&lu_ssc, 0, sizeof(lu_ssc));
+	lunit.lu_private = &lu_ssc;
+	lunit.sense_p	 = sense;
+	INIT_LIST_HEAD(&lunit.den_list);
+	INIT_LIST_HEAD(&lunit.mode_pg);
+	INIT_LIST_HEAD(&lunit.log_pg);
+
+	lu_ssc.load_status		 = TAPE_UNLOADED;
+	lu_ssc.capacity_unit	 = 1;
+	lu_ssc.c_pos			 = c_pos;
+	lu_ssc.app_encr_info	 = &app_encryption_state;
+	lu_ssc.OK_2_write		 = &OK_to_write;
+	lu_ssc.mamp				 = &mam;
+	lu_ssc.compressionType	 = LZO;
+	INIT_LIST_HEAD(&lu_ssc.supported_media_list);
+
+	init_default_ssc(&lunit);
+
+	init_mam(&mam);
+	mam.tape_fmt_version = TAPE_FMT_VERSION;
+	mam.mam_fmt_version	 = MAM_VERSION;
+	mam.MediumType		 = MEDIA_TYPE_DATA;
+	put_unaligned_be64(64ULL << 30, &mam.max_capacity);
+	put_unaligned_be64(64ULL << 30, &mam.remaining_capacity);
+	sprintf((char *)mam.Barcode, "%-31s", PCL);
+	if (create_tape(PCL, &sam_stat) || load_tape(PCL, &sam_stat)) {
+		fprintf(stderr, "Unable to create a cartridge in %s\n", home_directory);
+		exit(1);
+	}
+	lu_ssc.max_capacity = get_unaligned_be64(&mam.max_capacity);
+}
+
+int main(int argc, char *argv[]) {
+	struct scsi_cmd cmd;
+	struct mhvtl_ds ds;
+	uint64_t		start, wr, rd;
+	uint32_t		blk_sz = 65536;
+	uint8_t			sam_stat;
+	uint8_t		   *buf;
+	char			dir[] = "/tmp/mhvtl_log_bench.XXXXXX";
+	char			rm[64];
+	int				blocks = 4096;
+	int				i, j;
+
+	if (argc > 1)
+		blocks = atoi(argv[1]);
+	if (argc > 2)
+		blk_sz = atoi(argv[2]);
+
+	if (!mkdtemp(dir)) {
+		perror("mkdtemp");
+		exit(1);
+	}
+	snprintf(home_directory, HOME_DIR_PATH_SZ, "%s", dir);
+	lzo_init();
+	setup();
+
+	buf = malloc(blk_sz);
+	memset(&cmd, 0, sizeof(cmd));
+	memset(&ds, 0, sizeof(ds));
+	cmd.lu		 = &lunit;
+	cmd.dbuf_p	 = &ds;
+	ds.sense_buf = sense;
+	ds.data		 = buf;
+	ds.sz		 = blk_sz;
+
+	/* Compressible but not all-zero, so the data really goes through LZO */
+	for (j = 0; j < (int)blk_sz; j++)
+		buf[j] = (j / 64) & 0xff;
+
+	start = cycles();
+	for (i = 0; i < blocks; i++) {
+		buf[0] = i;
+		if (writeBlock(&cmd, blk_sz) != (int)blk_sz) {
+			fprintf(stderr, "writeBlock failed at block %d\n", i);
+			exit(1);
+		}
+	}
+	wr = cycles() - start;
+
+	rewind_tape(&sam_stat);
+	start = cycles();
+	for (i = 0; i < blocks; i++)
+		if (readBlock(buf, blk_sz, 1, 0, &sam_stat) != (int)blk_sz) {
+			fprintf(stderr, "readBlock failed at block %d\n", i);
+			exit(1);
+		}
+	rd = cycles() - start;
+
+	unload_tape(&sam_stat);
+	snprintf(rm, sizeof(rm), "rm -rf %s", dir);
+	if (system(rm))
+		fprintf(stderr, "Unable to remove %s\n", dir);
+
+	printf("%-22s %d x %u byte blocks: writeBlock %" PRIu64 ", readBlock %" PRIu64
+		   " %s/block\n",
+#if MHVTL_DBG_MAX == 0
+		   "compiled out:",
+#else
+		   "disabled at run time:",
+#endif
+		   blocks, blk_sz, wr / blocks, rd / blocks,
+#if defined(__x86_64__) || defined(__i386__)
+		   "cycles"
+#else
+		   "ns"
+#endif
+	);
+	free(buf);
+	return 0;
+}
@@ -61,7 +61,8 @@ int init_queue(void) {
 	return queue_id;
 }
 
-int send_msg(char *cmd, long rcv_id) {
+/* Send 'cmd' to 'rcv_id', for the reply to go to 'snd_id' */
+int send_msg_as(char *cmd, long rcv_id, long snd_id) {
 	int			   len, s_qid;
 	struct q_entry s_entry;
 
@@ -82,7 +83,7 @@ int send_msg(char *cmd, long rcv_id) {
 		return -1;
 
 	s_entry.rcv_id	   = rcv_id;
-	s_entry.msg.snd_id = my_id;
+	s_entry.msg.snd_id = snd_id;
 	strncpy(s_entry.msg.text, cmd, MAXTEXTLEN);
 	s_entry.msg.text[MAXTEXTLEN] = '\0';
 	len = strlen(s_entry.msg.text) + 1 + offsetof(struct q_entry, msg.text);
@@ -95,6 +96,10 @@ int send_msg(char *cmd, long rcv_id) {
 	return 0;
 }
 
+int send_msg(char *cmd, long rcv_id) {
+	return send_msg_as(cmd, rcv_id, my_id);
+}
+
 static void proc_obj(struct q_entry *q_entry) {
 	printf("rcv_id: %ld, snd_id: %ld, text: %s\n",
 		   q_entry->rcv_id, q_entry->msg.snd_id, q_entry->msg.text);
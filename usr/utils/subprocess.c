@@ -22,13 +22,20 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/socket.h>
 #include <signal.h>
 #include "logging.h"
+#include "subprocess.h"
 
 static pid_t pid;
 static int	 timedout;
+/* One command at a time: 'pid', 'timedout' and SIGALRM are shared */
+static pthread_mutex_t run_lock = PTHREAD_MUTEX_INITIALIZER;
 
 void alarm_timeout(int sig) {
 	alarm(0);
@@ -38,13 +45,15 @@ void alarm_timeout(int sig) {
 }
 
 int run_command(char *command, int timeout) {
+	int res = -1;
+
+	pthread_mutex_lock(&run_lock);
 	pid = fork();
 	if (!pid) {
 		/* child */
 		execlp("/bin/sh", "/bin/sh", "-c", command, (char *)NULL);
 	} else if (pid < 0) {
 		/* TODO error handling */
-		return -1;
 	} else {
 		signal(SIGALRM, alarm_timeout);
 		timedout = 0;
@@ -57,16 +66,302 @@ int run_command(char *command, int timeout) {
 		alarm(0);
 
 		if (WIFEXITED(status)) {
-			int res = WEXITSTATUS(status);
-			return res;
+			res = WEXITSTATUS(status);
 		} else if (WIFSIGNALED(status)) {
 			int sig = WTERMSIG(status);
 			MHVTL_DBG(1, "command died with signal: %d "
 						 "(timedout: %d)\n",
 					  sig, timedout);
-			return -sig;
+			res = -sig;
 		}
 	}
+	pid = 0;
+	pthread_mutex_unlock(&run_lock);
+
+	return res;
+}
+
+/*
+ * Co-process: one helper serving every request, rather than a fork and
+ * exec of /bin/sh per command.
+ */
+
+struct coproc *coproc_new(const char *command) {
+	struct coproc	  *cp;
+	pthread_condattr_t attr;
+
+	cp = calloc(1, sizeof(*cp));
+	if (!cp)
+		return NULL;
+	cp->command = strdup(command);
+	if (!cp->command) {
+		free(cp);
+		return NULL;
+	}
+	cp->fd		   = -1;
+	cp->reading_fd = -1;
+	cp->next_id	   = 1;
+	pthread_mutex_init(&cp->lock, NULL);
+	/* Deadlines are CLOCK_MONOTONIC */
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&cp->replied, &attr);
+	pthread_condattr_destroy(&attr);
+	return cp;
+}
+
+/*
+ * Fail any requests outstanding. Called with cp->lock held - a socket a
+ * waiter is polling is shut down, for that waiter to close.
+ */
+static void coproc_stop(struct coproc *cp, int status) {
+	int i;
 
-	return -1;
+	for (i = 0; i < COPROC_PENDING; i++) {
+		if (cp->req[i].id && !cp->req[i].done) {
+			cp->req[i].done	  = 1;
+			cp->req[i].status = status;
+		}
+	}
+	if (cp->fd >= 0 && cp->fd == cp->reading_fd)
+		shutdown(cp->fd, SHUT_RDWR);
+	else if (cp->fd >= 0)
+		close(cp->fd);
+	cp->fd	= -1;
+	cp->len = 0;
+	if (cp->pid) {
+		kill(cp->pid, SIGKILL);
+		waitpid(cp->pid, NULL, 0);
+		cp->pid = 0;
+	}
+	pthread_cond_broadcast(&cp->replied);
+}
+
+static int coproc_start(struct coproc *cp) {
+	char *command;
+	int	  sv[2];
+
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0) {
+		MHVTL_ERR("socketpair failed: %s", strerror(errno));
+		return -1;
+	}
+	if (asprintf(&command, "exec %s", cp->command) < 0) {
+		close(sv[0]);
+		close(sv[1]);
+		return -1;
+	}
+
+	cp->pid = fork();
+	if (!cp->pid) {
+		/* child */
+		dup2(sv[1], STDIN_FILENO);
+		dup2(sv[1], STDOUT_FILENO);
+		signal(SIGPIPE, SIG_DFL);
+		execlp("/bin/sh", "/bin/sh", "-c", command, (char *)NULL);
+		_exit(127);
+	}
+	free(command);
+	close(sv[1]);
+	if (cp->pid < 0) {
+		MHVTL_ERR("Unable to start %s: %s", cp->command, strerror(errno));
+		cp->pid = 0;
+		close(sv[0]);
+		return -1;
+	}
+	cp->fd = sv[0];
+	MHVTL_DBG(1, "Started helper '%s', pid %ld", cp->command, (long)cp->pid);
+	return 0;
+}
+
+/*
+ * Send 'request', to be answered within 'timeout' seconds. The helper is
+ * (re)started if it is not running.
+ *
+ * Returns the request id to wait for, -1 on failure
+ */
+int coproc_send(struct coproc *cp, const char *request, int timeout) {
+	struct coproc_request *r = NULL;
+	char				   line[COPROC_LINE_MAX];
+	ssize_t				   n;
+	int					   len, off, i, tries, id = -1;
+
+	pthread_mutex_lock(&cp->lock);
+	for (i = 0; i < COPROC_PENDING; i++)
+		if (!cp->req[i].id)
+			r = &cp->req[i];
+	if (!r) {
+		MHVTL_ERR("%d requests to '%s' already in flight",
+				  COPROC_PENDING, cp->command);
+		goto out;
+	}
+	if (!cp->next_id)
+		cp->next_id = 1;
+
+	len = snprintf(line, sizeof(line), "%u %s\n", cp->next_id, request);
+	if (len >= (int)sizeof(line)) {
+		MHVTL_ERR("Request '%s' too long", request);
+		goto out;
+	}
+
+	/* One retry, should the helper have gone away since the last request */
+	for (tries = 0; tries < 2; tries++) {
+		if (cp->fd < 0 && coproc_start(cp))
+			goto out;
+		for (off = 0; off < len; off += n) {
+			n = send(cp->fd, line + off, len - off, MSG_NOSIGNAL);
+			if (n < 0 && errno == EINTR)
+				n = 0;
+			else if (n <= 0)
+				break;
+		}
+		if (off == len)
+			break;
+		MHVTL_LOG("Helper '%s' has gone away: %s - restarting",
+				  cp->command, strerror(errno));
+		coproc_stop(cp, -EPIPE);
+	}
+	if (tries == 2)
+		goto out;
+
+	r->id	  = cp->next_id++;
+	r->done	  = 0;
+	r->status = 0;
+	clock_gettime(CLOCK_MONOTONIC, &r->deadline);
+	r->deadline.tv_sec += timeout;
+	MHVTL_DBG(3, "Sent helper: %.*s", len - 1, line);
+	id = r->id;
+out:
+	pthread_mutex_unlock(&cp->lock);
+	return id;
+}
+
+/* Match each complete line read from the helper to its request, waking
+ * whoever waits for it
+ */
+static void coproc_replies(struct coproc *cp) {
+	char	 *nl, *start = cp->buf;
+	uint32_t  id;
+	int		  status, i;
+
+	while ((nl = memchr(start, '\n', cp->buf + cp->len - start))) {
+		*nl = '\0';
+		if (sscanf(start, "%u %d", &id, &status) == 2) {
+			for (i = 0; i < COPROC_PENDING; i++)
+				if (cp->req[i].id == id && !cp->req[i].done)
+					break;
+			if (i < COPROC_PENDING) {
+				cp->req[i].done	  = 1;
+				cp->req[i].status = status;
+				MHVTL_DBG(3, "Helper replied: %s", start);
+			} else
+				MHVTL_DBG(1, "Unexpected reply from helper: %s", start);
+		} else
+			MHVTL_DBG(1, "Unexpected reply from helper: %s", start);
+		start = nl + 1;
+	}
+	cp->len -= start - cp->buf;
+	memmove(cp->buf, start, cp->len);
+	if (cp->len == sizeof(cp->buf)) {
+		MHVTL_ERR("Reply line from helper too long - discarded");
+		cp->len = 0;
+	}
+	pthread_cond_broadcast(&cp->replied);
+}
+
+/*
+ * Wait for the reply to request 'id', until its deadline. A helper that
+ * misses it is killed, failing any other requests it has, and restarted
+ * by the next coproc_send(). Only one waiter at a time reads the helper,
+ * with cp->lock dropped; the others sleep until it has read their reply.
+ *
+ * Returns the status the helper replied with, negative on failure
+ */
+int coproc_wait(struct coproc *cp, int id) {
+	struct coproc_request *r = NULL;
+	struct timespec		   now;
+	struct pollfd		   pfd;
+	char				   buf[COPROC_LINE_MAX];
+	ssize_t				   n;
+	size_t				   room;
+	long				   ms;
+	int					   i, fd, rc, status;
+
+	pthread_mutex_lock(&cp->lock);
+	for (i = 0; i < COPROC_PENDING; i++)
+		if (cp->req[i].id == (uint32_t)id)
+			r = &cp->req[i];
+	if (!r) {
+		pthread_mutex_unlock(&cp->lock);
+		return -EINVAL;
+	}
+
+	while (!r->done) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		ms = (r->deadline.tv_sec - now.tv_sec) * 1000 +
+			 (r->deadline.tv_nsec - now.tv_nsec) / 1000000;
+		if (ms <= 0) {
+			MHVTL_ERR("Helper '%s' did not answer request %d in time - restarting",
+					  cp->command, id);
+			coproc_stop(cp, -ETIMEDOUT);
+			break;
+		}
+		if (cp->reading_fd >= 0) { /* Another waiter is reading */
+			pthread_cond_timedwait(&cp->replied, &cp->lock, &r->deadline);
+			continue;
+		}
+
+		fd			   = cp->fd;
+		room		   = sizeof(cp->buf) - cp->len;
+		cp->reading_fd = fd;
+		pthread_mutex_unlock(&cp->lock);
+		pfd.fd	   = fd;
+		pfd.events = POLLIN;
+		rc		   = poll(&pfd, 1, ms);
+		n		   = rc > 0 ? read(fd, buf, room) : 0;
+		pthread_mutex_lock(&cp->lock);
+		cp->reading_fd = -1;
+		pthread_cond_broadcast(&cp->replied); /* Someone else's turn */
+
+		if (fd != cp->fd) { /* Stopped meanwhile */
+			close(fd);
+			continue;
+		}
+		if (rc <= 0 || (n < 0 && errno == EINTR))
+			continue;
+		if (n <= 0) {
+			MHVTL_ERR("Helper '%s' has exited", cp->command);
+			coproc_stop(cp, -EPIPE);
+			break;
+		}
+		memcpy(cp->buf + cp->len, buf, n);
+		cp->len += n;
+		coproc_replies(cp);
+	}
+	status = r->status;
+	r->id  = 0;
+	pthread_mutex_unlock(&cp->lock);
+	return status;
+}
+
+void coproc_free(struct coproc *cp) {
+	int i;
+
+	if (!cp)
+		return;
+	/* Give the helper a second to exit on seeing end of file */
+	if (cp->fd >= 0) {
+		close(cp->fd);
+		cp->fd = -1;
+	}
+	for (i = 0; i < 10 && cp->pid; i++) {
+		if (waitpid(cp->pid, NULL, WNOHANG) == cp->pid)
+			cp->pid = 0;
+		else
+			usleep(100000);
+	}
+	coproc_stop(cp, -ESHUTDOWN);
+	pthread_cond_destroy(&cp->replied);
+	pthread_mutex_destroy(&cp->lock);
+	free(cp->command);
+	free(cp);
 }
@@ -0,0 +1,164 @@
+/*
+ * syscall_count.c -- Count the file I/O system calls of a benchmark
+ *
+ * Linked into a program, these definitions take precedence over the libc
+ * ones for every caller - libvtlscsi.so included - count the call and pass
+ * it on. Only the calls the cartridge code makes per block or per
+ * positioning operation are wrapped: open() and stat() are not.
+ *
+ * No libc I/O headers here: their prototypes (and _FORTIFY_SOURCE inline
+ * wrappers) would clash with these definitions.
+ *
+ * Copyright (C) 2005 - 2025 Mark Harvey markh794 at gmail dot com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <dlfcn.h>
+#include <sys/types.h>
+#include <sys/syscall.h>
+#include "syscall_count.h"
+
+uint64_t syscall_count[SC_CLASSES];
+
+#define REAL(fn, name)                      \
+	do {                                    \
+		if (!fn)                            \
+			fn = dlsym(RTLD_NEXT, name);    \
+	} while (0)
+
+const char *syscall_class_name(int sc) {
+	static const char *names[SC_CLASSES] = {
+		[SC_READ]	= "read",
+		[SC_WRITE]	= "write",
+		[SC_PREAD]	= "pread",
+		[SC_PWRITE] = "pwrite",
+		[SC_LSEEK]	= "lseek",
+		[SC_SYNC]	= "sync",
+		[SC_URING]	= "io_uring",
+		[SC_OTHER]	= "other",
+	};
+
+	return (sc >= 0 && sc < SC_CLASSES) ? names[sc] : "unknown";
+}
+
+ssize_t read(int fd, void *buf, size_t count) {
+	static ssize_t (*fn)(int, void *, size_t);
+
+	REAL(fn, "read");
+	syscall_count[SC_READ]++;
+	return fn(fd, buf, count);
+}
+
+ssize_t write(int fd, const void *buf, size_t count) {
+	static ssize_t (*fn)(int, const void *, size_t);
+
+	REAL(fn, "write");
+	syscall_count[SC_WRITE]++;
+	return fn(fd, buf, count);
+}
+
+ssize_t pread64(int fd, void *buf, size_t count, off64_t offset) {
+	static ssize_t (*fn)(int, void *, size_t, off64_t);
+
+	REAL(fn, "pread64");
+	syscall_count[SC_PREAD]++;
+	return fn(fd, buf, count, offset);
+}
+
+ssize_t pwrite64(int fd, const void *buf, size_t count, off64_t offset) {
+	static ssize_t (*fn)(int, const void *, size_t, off64_t);
+
+	REAL(fn, "pwrite64");
+	syscall_count[SC_PWRITE]++;
+	return fn(fd, buf, count, offset);
+}
+
+off64_t lseek64(int fd, off64_t offset, int whence) {
+	static off64_t (*fn)(int, off64_t, int);
+
+	REAL(fn, "lseek64");
+	syscall_count[SC_LSEEK]++;
+	return fn(fd, offset, whence);
+}
+
+int fsync(int fd) {
+	static int (*fn)(int);
+
+	REAL(fn, "fsync");
+	syscall_count[SC_SYNC]++;
+	return fn(fd);
+}
+
+int fdatasync(int fd) {
+	static int (*fn)(int);
+
+	REAL(fn, "fdatasync");
+	syscall_count[SC_SYNC]++;
+	return fn(fd);
+}
+
+int sync_file_range(int fd, off64_t offset, off64_t nbytes, unsigned int flags) {
+	static int (*fn)(int, off64_t, off64_t, unsigned int);
+
+	REAL(fn, "sync_file_range");
+	syscall_count[SC_SYNC]++;
+	return fn(fd, offset, nbytes, flags);
+}
+
+int ftruncate64(int fd, off64_t length) {
+	static int (*fn)(int, off64_t);
+
+	REAL(fn, "ftruncate64");
+	syscall_count[SC_OTHER]++;
+	return fn(fd, length);
+}
+
+struct stat64;
+int fstat64(int fd, struct stat64 *st) {
+	static int (*fn)(int, struct stat64 *);
+
+	REAL(fn, "fstat64");
+	syscall_count[SC_OTHER]++;
+	return fn(fd, st);
+}
+
+int close(int fd) {
+	static int (*fn)(int);
+
+	REAL(fn, "close");
+	syscall_count[SC_OTHER]++;
+	return fn(fd);
+}
+
+/* The io_uring engine enters the kernel through syscall() */
+long syscall(long number, ...) {
+	static long (*fn)(long, ...);
+	va_list		ap;
+	long		a[6];
+	int			i;
+
+	REAL(fn, "syscall");
+	va_start(ap, number);
+	for (i = 0; i < 6; i++)
+		a[i] = va_arg(ap, long);
+	va_end(ap);
+
+#ifdef __NR_io_uring_enter
+	if (number == __NR_io_uring_enter)
+		syscall_count[SC_URING]++;
+	else
+#endif
+		syscall_count[SC_OTHER]++;
+	return fn(number, a[0], a[1], a[2], a[3], a[4], a[5]);
+}
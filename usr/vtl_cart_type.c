@@ -46,8 +46,10 @@
 #include <string.h>
 #include <unistd.h>
 #include "logging.h"
+#include "mhvtl_scsi.h"
 #include "vtllib.h"
 #include "vtlcart.h"
+#include "mhvtl_config.h"
 
 static char currentPCL[HOME_DIR_PATH_SZ + MAX_BARCODE_LEN + 3]; /* make room for home_dir plus some */
 
@@ -64,11 +66,33 @@ static char currentPCL[HOME_DIR_PATH_SZ + MAX_BARCODE_LEN + 3]; /* make room for
  * == 5 -> NULL media type (SMC specifies values > 4 as 'reserved')
  */
 
+static int on_demand; /* Media may not be created until first loaded */
+
 void update_home_dir(long lib_id) {
+	const struct conf_device *d;
+
 	if (strlen(home_directory) < 2) {
 		find_media_home_directory(NULL, lib_id);
 		MHVTL_DBG(3, "Setting home dir to %s", home_directory);
 	}
+	d = config_find(lib_id, CONF_LIBRARY);
+	on_demand = d && d->on_demand;
+}
+
+static int smc_cart_type(uint8_t medium_type) {
+	switch (medium_type) {
+	case MEDIA_TYPE_NULL:
+		return 5; /* Reserved */
+	case MEDIA_TYPE_DATA:
+		return 1;
+	case MEDIA_TYPE_CLEAN:
+		return 2;
+	case MEDIA_TYPE_DIAGNOSTIC:
+		return 3;
+	case MEDIA_TYPE_WORM:
+		return 4;
+	}
+	return 0;
 }
 
 int get_cart_type(const char *barcode) {
@@ -77,6 +101,7 @@ int get_cart_type(const char *barcode) {
 	int		   rc	   = 0;
 	int		   mamfile = -1;
 	struct MAM tmp_mam;
+	char	   density[16];
 
 	/* init tmp_mam */
 	init_mam(&tmp_mam);
@@ -97,6 +122,12 @@ int get_cart_type(const char *barcode) {
 	/* Open mam file */
 	snprintf(path, ARRAY_SIZE(path), "%s/mam", currentPCL);
 	mamfile = open(path, O_RDWR | O_LARGEFILE);
+	if (mamfile == -1 && errno == ENOENT && on_demand && access(currentPCL, F_OK)) {
+		/* Not created yet - it will be as vtltape first loads it */
+		rc = barcode_media_rules(pcl, density, sizeof(density));
+		rc = density[0] ? smc_cart_type(rc) : 0;
+		goto failed;
+	}
 	if (mamfile == -1) {
 		MHVTL_ERR("open of file %s failed: %s", path, strerror(errno));
 		rc = 0;
@@ -106,26 +137,7 @@ int get_cart_type(const char *barcode) {
 	/* Read in the MAM */
 	read_mam(mamfile, -1, &tmp_mam);
 
-	switch (tmp_mam.MediumType) {
-	case MEDIA_TYPE_NULL:
-		rc = 5; /* Reserved */
-		break;
-	case MEDIA_TYPE_DATA:
-		rc = 1;
-		break;
-	case MEDIA_TYPE_CLEAN:
-		rc = 2;
-		break;
-	case MEDIA_TYPE_DIAGNOSTIC:
-		rc = 3;
-		break;
-	case MEDIA_TYPE_WORM:
-		rc = 4;
-		break;
-	default:
-		rc = 0;
-		break;
-	}
+	rc = smc_cart_type(tmp_mam.MediumType);
 
 failed:
 	if (mamfile >= 0)
@@ -135,3 +147,30 @@ failed:
 			  currentPCL, barcode, rc);
 	return rc;
 }
+
+/*
+ * ASC/ASCQ for the element holding cartridge 'barcode' - 0 if its files
+ * would load. Safe to call from several threads at once.
+ */
+uint16_t verify_media(const char *barcode) {
+	char pcl[MAX_BARCODE_LEN + 1];
+	char dir[HOME_DIR_PATH_SZ + MAX_BARCODE_LEN + 2];
+
+	snprintf(pcl, sizeof(pcl), "%s", barcode);
+	pcl[strcspn(pcl, " ")] = '\0';
+	snprintf(dir, sizeof(dir), "%s/%s",
+			 strlen(home_directory) ? home_directory : MHVTL_HOME_PATH, pcl);
+
+	switch (check_cart_files(dir)) {
+	case 0:
+		return 0;
+	case 1:
+		if (on_demand)
+			return 0; /* Created as vtltape first loads it */
+		MHVTL_LOG("Media %s: %s does not exist", pcl, dir);
+		return E_UNKNOWN_FORMAT;
+	default:
+		MHVTL_LOG("Media %s: %s is damaged and will not load", pcl, dir);
+		return E_MEDIUM_FMT_CORRUPT;
+	}
+}
@@ -32,10 +32,16 @@
 /* for unistd.h pread/pwrite and fcntl.h posix_fadvise */
 #define _XOPEN_SOURCE 600
 
+/* for fcntl.h O_DIRECT and sync_file_range */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -43,6 +49,9 @@
 #include "logging.h"
 #include "mhvtl_scsi.h"
 #include "vtlcart.h"
+#include "vtlcart_uring.h"
+#include "mhvtl_stats.h"
+#include "mhvtl_trace.h"
 #include "vtllib.h"
 #include "mhvtl_update.h"
 #include "be_byteshift.h"
@@ -57,7 +66,8 @@
 struct raw_header {
 	loff_t			  data_offset;
 	struct blk_header hdr;
-	char			  pad[512 - sizeof(loff_t) - sizeof(struct blk_header)];
+	uint32_t		  data_pad; /* Alignment padding after the data (O_DIRECT) */
+	char			  pad[512 - sizeof(loff_t) - sizeof(struct blk_header) - sizeof(uint32_t)];
 };
 
 /* The .meta file consists of a meta_header
@@ -68,7 +78,8 @@ struct raw_header {
 
 struct meta_header {
 	uint32_t filemark_count;
-	char	 pad[512 - sizeof(uint32_t)];
+	uint32_t segment_mb; /* Data split into segments of this many MiB, 0 = single data file */
+	char	 pad[512 - 2 * sizeof(uint32_t)];
 };
 
 static char *currentPCL = NULL;
@@ -91,25 +102,467 @@ static uint32_t *filemarks[MAX_PARTITIONS]		= {[0 ... MAX_PARTITIONS - 1] = NULL
 /* Initialisation of current position (global blk_header) */
 struct blk_header *c_pos = &raw_pos.hdr;
 
-#ifdef MHVTL_DEBUG
-static char *mhvtl_block_type_desc(int blk_type) {
+/* O_DIRECT access to the .data files - 'Direct IO:' in device.conf */
+static int		direct_io;
+static int		data_odirect[MAX_PARTITIONS];
+static uint8_t *direct_buf; /* Aligned bounce buffer */
+static uint32_t direct_buf_sz;
+
+#define IS_DIO_ALIGNED(x) ((((uintptr_t)(x)) & (DIRECT_IO_ALIGN - 1)) == 0)
+#define DIO_ALIGN_UP(x)	  (((uint64_t)(x) + DIRECT_IO_ALIGN - 1) & ~((uint64_t)DIRECT_IO_ALIGN - 1))
+
+/* Index records of WRITE FILEMARKS while queued on the io_uring engine */
+static struct raw_header fm_batch[URING_BATCH];
+
+/* Buffered access - page cache hints are given every DATA_HINT_CHUNK bytes */
+#define DATA_HINT_CHUNK (8 * 1024 * 1024)
+static uint64_t hint_prev[MAX_PARTITIONS];
+static uint64_t hint_mark[MAX_PARTITIONS];
+
+/*
+ * Segmented layout - the block data of a partition lives in fixed size
+ * segment files data.N.000000, data.N.000001, ... and data.N stays empty.
+ * The index keeps the logical offset, the segment is offset / segment size.
+ */
+#define SEG_FD_CACHE 4
+static uint32_t new_segment_mb; /* For media created from now on */
+static unsigned int seg_next;
+static struct {
+	int		 fd;
+	int		 part;
+	uint32_t seg;
+} seg_cache[SEG_FD_CACHE] = {[0 ... SEG_FD_CACHE - 1] = {.fd = -1}};
+
+#define SEGMENT_SIZE(part) ((uint64_t)meta[part].segment_mb << 20)
+
+void cart_set_direct_io(int enable) {
+	direct_io = enable;
+}
+
+/*
+ * Select the storage engine - STORAGE_SYNC or STORAGE_IO_URING.
+ * Falls back to synchronous I/O if io_uring can't be set up.
+ *
+ * Returns the engine in use
+ */
+int cart_set_storage_engine(int engine) {
+	if (engine == STORAGE_IO_URING) {
+		if (uring_init() == 0)
+			return STORAGE_IO_URING;
+		MHVTL_LOG("Falling back to synchronous I/O");
+	} else {
+		uring_exit();
+	}
+
+	return STORAGE_SYNC;
+}
+
+/*
+ * Media created from now on keep their data in segment files of
+ * 'segment_mb' MiB each. 0 for a single data file.
+ */
+void cart_set_segment_size(uint32_t segment_mb) {
+	new_segment_mb = segment_mb;
+}
+
+static uint8_t *get_direct_buf(uint64_t sz) {
+	sz = DIO_ALIGN_UP(sz);
+	if (direct_buf && sz <= direct_buf_sz)
+		return direct_buf;
+
+	free(direct_buf);
+	direct_buf_sz = 0;
+	if (posix_memalign((void **)&direct_buf, DIRECT_IO_ALIGN, sz)) {
+		MHVTL_ERR("Unable to allocate %" PRId64 " bytes for direct I/O", sz);
+		direct_buf = NULL;
+		errno	   = ENOMEM;
+		return NULL;
+	}
+	direct_buf_sz = sz;
+
+	return direct_buf;
+}
+
+/* Segmented layout - fd of segment 'seg' of the current partition if open */
+static int seg_cached(uint32_t seg) {
+	int part = c_pos->partition_id;
+
+	for (unsigned int i = 0; i < SEG_FD_CACHE; i++)
+		if (seg_cache[i].fd >= 0 && seg_cache[i].part == part && seg_cache[i].seg == seg)
+			return seg_cache[i].fd;
+
+	return -1;
+}
+
+/*
+ * Segmented layout - fd of segment 'seg' of the current partition.
+ * Opened on demand, and created if 'create' is set. The segment it
+ * replaces in the cache is flushed and, unless O_DIRECT, dropped from
+ * the page cache.
+ *
+ * Returns -1 if the segment does not exist (or can't be opened)
+ */
+static int seg_fd(uint32_t seg, int create) {
+	int			 part = c_pos->partition_id;
+	char		 path[1024];
 	unsigned int i;
+	int			 fd, flags;
+
+	fd = seg_cached(seg);
+	if (fd >= 0)
+		return fd;
+
+	snprintf(path, sizeof(path), "%s/data.%d.%06u", currentPCL, part, seg);
+	flags = O_RDWR | O_LARGEFILE;
+	if (create)
+		flags |= O_CREAT;
+	if (data_odirect[part])
+		flags |= O_DIRECT;
+	fd = open(path, flags, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+	if (fd < 0) {
+		if (errno != ENOENT || create)
+			MHVTL_ERR("open of segment %s failed: %s", path, strerror(errno));
+		return -1;
+	}
+	if (!data_odirect[part])
+		posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
 
-	static const struct {
-		int	  blk_type;
-		char *desc;
-	} block_type_desc[] = {
-		{B_FILEMARK, "FILEMARK"},
-		{B_EOD, "END OF DATA"},
-		{B_NOOP, "NO OP"},
-		{B_DATA, "DATA"},
-	};
-	for (i = 0; i < ARRAY_SIZE(block_type_desc); i++)
-		if (block_type_desc[i].blk_type == blk_type)
-			return block_type_desc[i].desc;
-	return NULL;
+	i = seg_next++ % SEG_FD_CACHE;
+	if (seg_cache[i].fd >= 0) {
+		uring_readahead_drop();
+		fsync(seg_cache[i].fd);
+		if (!data_odirect[part])
+			posix_fadvise(seg_cache[i].fd, 0, 0, POSIX_FADV_DONTNEED);
+		close(seg_cache[i].fd);
+	}
+	seg_cache[i].fd	  = fd;
+	seg_cache[i].part = part;
+	seg_cache[i].seg  = seg;
+
+	return fd;
+}
+
+/* Close the cached segment fds of 'part' (all partitions if -1) */
+static void seg_close(int part, int64_t seg) {
+	for (unsigned int i = 0; i < SEG_FD_CACHE; i++) {
+		if (seg_cache[i].fd < 0)
+			continue;
+		if (part >= 0 && seg_cache[i].part != part)
+			continue;
+		if (seg >= 0 && seg_cache[i].seg != seg)
+			continue;
+		uring_readahead_drop();
+		close(seg_cache[i].fd);
+		seg_cache[i].fd = -1;
+	}
+}
+
+/* Total size of the segment files of 'part' */
+static uint64_t seg_total_size(int part) {
+	char		path[1024];
+	struct stat st;
+	uint64_t	sz = 0;
+
+	for (uint32_t seg = 0;; seg++) {
+		snprintf(path, sizeof(path), "%s/data.%d.%06u", currentPCL, part, seg);
+		if (stat(path, &st) < 0)
+			break;
+		sz += st.st_size;
+	}
+
+	return sz;
+}
+
+/* Remove the segment files of 'part' from segment 'seg' onwards */
+static void seg_unlink(int part, uint32_t seg) {
+	char path[1024];
+
+	for (;; seg++) {
+		seg_close(part, seg);
+		snprintf(path, sizeof(path), "%s/data.%d.%06u", currentPCL, part, seg);
+		if (unlink(path) < 0)
+			break;
+	}
+}
+
+enum data_op {
+	DATA_READ,
+	DATA_WRITE,
+	DATA_WRITE_QUEUED,	 /* Queued on the io_uring engine, if in use */
+	DATA_WRITE_BUFFERED, /* O_DIRECT file - this write through the page cache */
+	DATA_WRITEBACK,		 /* Start writeback */
+	DATA_WRITEBACK_WAIT, /* Start and wait for writeback */
+	DATA_DONTNEED,		 /* Drop from the page cache */
+};
+
+static ssize_t data_fd_io(int fd, enum data_op op, uint8_t *buf, uint64_t len, uint64_t offset) {
+	ssize_t nwrite;
+
+	switch (op) {
+	case DATA_READ:
+		return pread(fd, buf, len, offset);
+	case DATA_WRITE_QUEUED:
+		if (uring_ready() && !uring_queue_write(fd, buf, len, offset))
+			return len;
+		/* Fall through */
+	case DATA_WRITE:
+		return pwrite(fd, buf, len, offset);
+	case DATA_WRITE_BUFFERED:
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+		nwrite = pwrite(fd, buf, len, offset);
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_DIRECT);
+		return nwrite;
+	case DATA_WRITEBACK:
+		sync_file_range(fd, offset, len, SYNC_FILE_RANGE_WRITE);
+		return len;
+	case DATA_WRITEBACK_WAIT:
+		sync_file_range(fd, offset, len,
+						SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+		return len;
+	case DATA_DONTNEED:
+		posix_fadvise(fd, offset, len, POSIX_FADV_DONTNEED);
+		return len;
+	}
+
+	return -1;
+}
+
+/*
+ * Perform 'op' on 'len' bytes at 'offset' of the data of the current
+ * partition. On a segmented partition it is split at segment boundaries.
+ * Only a transfer within a single segment is queued on the io_uring engine,
+ * and page cache hints only go to segments already open, so no fd can be
+ * closed under a queued write.
+ *
+ * Returns the number of bytes transferred
+ */
+static ssize_t data_io(enum data_op op, uint8_t *buf, uint64_t len, uint64_t offset) {
+	int		 part = c_pos->partition_id;
+	uint64_t seg_sz, done, chunk, seg_off;
+	ssize_t	 n;
+	int		 fd;
+
+	if (!meta[part].segment_mb)
+		return data_fd_io(datafile[part], op, buf, len, offset);
+
+	seg_sz = SEGMENT_SIZE(part);
+	if (op == DATA_WRITE_QUEUED && offset / seg_sz != (offset + len - 1) / seg_sz)
+		op = DATA_WRITE;
+
+	for (done = 0; done < len; done += n) {
+		seg_off = (offset + done) % seg_sz;
+		chunk	= min(len - done, seg_sz - seg_off);
+		if (op >= DATA_WRITEBACK) {
+			fd = seg_cached((offset + done) / seg_sz);
+			n  = chunk;
+			if (fd >= 0)
+				data_fd_io(fd, op, NULL, chunk, seg_off);
+			continue;
+		}
+		fd = seg_fd((offset + done) / seg_sz, op != DATA_READ);
+		if (fd < 0)
+			break;
+		n = data_fd_io(fd, op, buf + done, chunk, seg_off);
+		if (n < 0)
+			return done ? (ssize_t)done : -1;
+		if ((uint64_t)n < chunk)
+			return done + n;
+	}
+
+	return done;
+}
+
+/*
+ * Map 'len' bytes at 'offset' of the current partition onto the single
+ * file holding them.
+ *
+ * Returns -1 if they straddle segments
+ */
+static int data_locate(uint64_t offset, uint64_t len, int *fd, uint64_t *file_offset) {
+	int		 part = c_pos->partition_id;
+	uint64_t seg_sz;
+
+	if (!meta[part].segment_mb) {
+		*fd			 = datafile[part];
+		*file_offset = offset;
+		return 0;
+	}
+
+	seg_sz = SEGMENT_SIZE(part);
+	if (len == 0 || offset / seg_sz != (offset + len - 1) / seg_sz)
+		return -1;
+	*fd			 = seg_fd(offset / seg_sz, 0);
+	*file_offset = offset % seg_sz;
+
+	return (*fd < 0) ? -1 : 0;
+}
+
+/*
+ * Cut the data of the current partition back to 'offset'.
+ * On a segmented partition any segments beyond are simply removed.
+ */
+static int data_truncate(uint64_t offset) {
+	int		 part = c_pos->partition_id;
+	uint64_t seg_sz;
+	uint32_t seg;
+	int		 fd;
+
+	if (!meta[part].segment_mb)
+		return ftruncate(datafile[part], offset);
+
+	seg_sz = SEGMENT_SIZE(part);
+	seg	   = offset / seg_sz;
+	if (offset % seg_sz == 0) {
+		seg_unlink(part, seg);
+		return 0;
+	}
+	seg_unlink(part, seg + 1);
+
+	fd = seg_fd(seg, 0);
+	if (fd < 0)
+		return 0;
+
+	return ftruncate(fd, offset % seg_sz);
+}
+
+/*
+ * Page cache hints for buffered access.
+ *
+ * Once another DATA_HINT_CHUNK has gone by, start writeback of it, then wait
+ * for and drop the chunk before. A streaming drive then neither fills the
+ * page cache nor leaves the kernel a writeback storm to deal with.
+ */
+static void data_cache_hint(int part, uint64_t offset, int writing) {
+	if (offset < hint_mark[part]) { /* Repositioned backwards */
+		hint_prev[part] = hint_mark[part] = offset;
+		return;
+	}
+	if (offset - hint_mark[part] < DATA_HINT_CHUNK)
+		return;
+
+	if (writing) {
+		data_io(DATA_WRITEBACK, NULL, offset - hint_mark[part], hint_mark[part]);
+		data_io(DATA_WRITEBACK_WAIT, NULL, hint_mark[part] - hint_prev[part], hint_prev[part]);
+	}
+	data_io(DATA_DONTNEED, NULL, hint_mark[part] - hint_prev[part], hint_prev[part]);
+
+	hint_prev[part] = hint_mark[part];
+	hint_mark[part] = offset;
+}
+
+/*
+ * Write 'len' bytes of block data at 'offset' of the current partition.
+ *
+ * With O_DIRECT the data is padded with zeros up to the next alignment
+ * boundary, and the amount of padding returned in '*pad' for the index.
+ *
+ * On the io_uring engine the write is only queued - see write_tape_block()
+ *
+ * Returns 'len' on success
+ */
+static ssize_t data_pwrite(const uint8_t *buf, uint32_t len, uint64_t offset, uint32_t *pad) {
+	int		 part = c_pos->partition_id;
+	uint8_t *b;
+	ssize_t	 nwrite;
+
+	*pad = 0;
+
+	if (!data_odirect[part]) {
+		nwrite = data_io(DATA_WRITE_QUEUED, (uint8_t *)buf, len, offset);
+		if (!uring_queued()) /* Else once written - see write_tape_block() */
+			data_cache_hint(part, offset + len, 1);
+		return nwrite;
+	}
+
+	*pad = DIO_ALIGN_UP(offset + len) - (offset + len);
+
+	if (IS_DIO_ALIGNED(offset) && IS_DIO_ALIGNED(buf) && *pad == 0)
+		return data_io(DATA_WRITE_QUEUED, (uint8_t *)buf, len, offset);
+
+	b = get_direct_buf(len + *pad);
+	if (!b)
+		return -1;
+	memcpy(b, buf, len);
+	memset(b + len, 0, *pad);
+
+	if (IS_DIO_ALIGNED(offset)) {
+		nwrite = data_io(DATA_WRITE_QUEUED, b, len + *pad, offset);
+	} else {
+		/* Appending to media written through the page cache. Write this
+		 * one block buffered, padded so the next one is aligned.
+		 */
+		nwrite = data_io(DATA_WRITE_BUFFERED, b, len + *pad, offset);
+	}
+
+	return (nwrite == (ssize_t)(len + *pad)) ? (ssize_t)len : -1;
+}
+
+/*
+ * Read 'len' bytes of block data at 'offset' of the current partition.
+ *
+ * With O_DIRECT, anything not aligned in memory, offset and length goes
+ * through the bounce buffer.
+ *
+ * Returns 'len' on success
+ */
+static ssize_t data_pread(uint8_t *buf, uint32_t len, uint64_t offset) {
+	int		 part = c_pos->partition_id;
+	uint64_t start, end, file_offset;
+	uint8_t *b;
+	ssize_t	 nread;
+	int		 fd;
+
+	if (uring_ready() && !data_locate(offset, len, &fd, &file_offset) &&
+		uring_readahead_get(fd, buf, len, file_offset) == len)
+		return len;
+
+	if (!data_odirect[part]) {
+		nread = data_io(DATA_READ, buf, len, offset);
+		data_cache_hint(part, offset + len, 0);
+		return nread;
+	}
+
+	start = offset & ~((uint64_t)DIRECT_IO_ALIGN - 1);
+	end	  = DIO_ALIGN_UP(offset + len);
+
+	if (start == offset && end == offset + len && IS_DIO_ALIGNED(buf))
+		return data_io(DATA_READ, buf, len, offset);
+
+	b = get_direct_buf(end - start);
+	if (!b)
+		return -1;
+
+	/* May come up short at the end of a file written without O_DIRECT */
+	nread = data_io(DATA_READ, b, end - start, start);
+	if (nread < (ssize_t)(offset + len - start))
+		return -1;
+	memcpy(buf, b + (offset - start), len);
+
+	return len;
+}
+
+/* io_uring engine - start reading the data of the block at c_pos */
+static void data_readahead(void) {
+	int		 part = c_pos->partition_id;
+	uint64_t start, end, file_offset;
+	int		 fd;
+
+	if (c_pos->blk_type != B_DATA || c_pos->disk_blk_size == 0)
+		return;
+
+	start = raw_pos.data_offset;
+	end	  = start + c_pos->disk_blk_size;
+	if (data_odirect[part]) {
+		start &= ~((uint64_t)DIRECT_IO_ALIGN - 1);
+		end = DIO_ALIGN_UP(end);
+	}
+
+	/* Not worth it for the odd block straddling two segments */
+	if (data_locate(start, end - start, &fd, &file_offset))
+		return;
+
+	uring_readahead(fd, file_offset, end - start);
 }
-#endif
 
 /*
  * Returns:
@@ -144,8 +597,6 @@ static int mkEODHeader(uint32_t blk_number, uint64_t data_offset) {
 static int read_header(uint32_t blk_number, uint8_t *sam_stat) {
 	loff_t nread;
 
-	MHVTL_DBG(3, "Reading header partition/block %d/%d", c_pos->partition_id, blk_number);
-
 	if (blk_number > eod_blk_number[c_pos->partition_id]) {
 		MHVTL_ERR("Attempt to seek [%d] beyond EOD [%d]",
 				  blk_number, eod_blk_number[c_pos->partition_id]);
@@ -165,12 +616,8 @@ static int read_header(uint32_t blk_number, uint8_t *sam_stat) {
 		}
 	}
 
-	MHVTL_DBG(3, "Reading header partition/block %u/%u at disk offset %ld, type: %s, size: %d",
-			  c_pos->partition_id,
-			  raw_pos.hdr.blk_number,
-			  (unsigned long)raw_pos.data_offset,
-			  mhvtl_block_type_desc(raw_pos.hdr.blk_type),
-			  raw_pos.hdr.blk_size);
+	trace_event(TRACE_READ_HDR, c_pos->partition_id, raw_pos.hdr.blk_number,
+				raw_pos.data_offset, raw_pos.hdr.blk_size, raw_pos.hdr.blk_type);
 	return 0;
 }
 
@@ -238,6 +685,9 @@ static int check_for_overwrite(uint8_t *sam_stat) {
 	if (c_pos->blk_type == B_EOD)
 		return 0;
 
+	/* About to rewrite what may be being read ahead */
+	uring_readahead_drop();
+
 	MHVTL_DBG(2, "At block %ld", (unsigned long)c_pos->blk_number);
 
 	/* We aren't at EOD so we are performing a rewrite.  Truncate
@@ -255,7 +705,7 @@ static int check_for_overwrite(uint8_t *sam_stat) {
 				  strerror(errno));
 		return -1;
 	}
-	if (ftruncate(datafile[c_pos->partition_id], data_offset)) {
+	if (data_truncate(data_offset)) {
 		sam_medium_error(E_WRITE_ERROR, sam_stat);
 		MHVTL_ERR("Data file ftruncate failure, pos: "
 				  "%" PRId64 ": %s",
@@ -805,6 +1255,7 @@ static void unlink_partition(int partition_number) {
 		snprintf(path, sizeof(path), "%s/meta.%d", currentPCL, partition_number);
 		unlink(path);
 	}
+	seg_unlink(partition_number, 0);
 }
 
 static int open_partition(uint8_t partition_number) {
@@ -821,8 +1272,21 @@ static int open_partition(uint8_t partition_number) {
 	snprintf(pcl_indx, ARRAY_SIZE(pcl_indx), "%s/indx.%d", currentPCL, partition_number);
 	snprintf(pcl_meta, ARRAY_SIZE(pcl_meta), "%s/meta.%d", currentPCL, partition_number);
 
+	data_odirect[partition_number] = 0;
+	hint_prev[partition_number]	   = 0;
+	hint_mark[partition_number]	   = 0;
+
 	for (int i = 0; i < 3; i++) {
-		*fd_open[i] = open(pcl_files[i], O_RDWR | O_LARGEFILE);
+		*fd_open[i] = -1;
+		if (i == 0 && direct_io) {
+			*fd_open[i] = open(pcl_files[i], O_RDWR | O_LARGEFILE | O_DIRECT);
+			if (*fd_open[i] >= 0)
+				data_odirect[partition_number] = 1;
+			else if (errno == EINVAL)
+				MHVTL_LOG("%s does not support O_DIRECT - using buffered I/O", pcl_files[i]);
+		}
+		if (*fd_open[i] == -1)
+			*fd_open[i] = open(pcl_files[i], O_RDWR | O_LARGEFILE);
 		if (*fd_open[i] == -1) {
 			MHVTL_ERR("open of file %s failed: %s", pcl_files[i], strerror(errno));
 			rc = 3;
@@ -833,6 +1297,10 @@ static int open_partition(uint8_t partition_number) {
 		}
 	}
 
+	/* Tape access is sequential - read-ahead harder */
+	if (!data_odirect[partition_number] && datafile[partition_number] >= 0)
+		posix_fadvise(datafile[partition_number], 0, 0, POSIX_FADV_SEQUENTIAL);
+
 	return rc;
 }
 
@@ -840,6 +1308,9 @@ static void close_partition(uint8_t partition_number) {
 	int *fd_close[3] = {&datafile[partition_number],
 						&indxfile[partition_number],
 						&metafile[partition_number]};
+
+	uring_readahead_drop();
+	seg_close(partition_number, -1);
 	for (int i = 0; i < 3; i++) {
 		if (*fd_close[i] >= 0) {
 			close(*fd_close[i]);
@@ -882,7 +1353,7 @@ static void erase_partition(uint8_t *sam_stat) {
  * == 2, could not create some file(s)
  * == 1, an error occurred.
  */
-static int create_partition(int partition_number) {
+static int create_partition(int partition_number, uint32_t segment_mb) {
 	char		path[1024];
 	int		   *fd[3]		= {&datafile[partition_number],
 							   &indxfile[partition_number],
@@ -904,12 +1375,14 @@ static int create_partition(int partition_number) {
 	}
 
 	MHVTL_LOG("%s files created", currentPCL);
+	seg_unlink(partition_number, 0); /* Leftovers of a previous layout */
 
 	/* Write the meta file consisting of the meta_header
 	   structure with the filemark count initialized to zero.
 	*/
 	memset(&meta[partition_number], 0, sizeof(struct meta_header));
 	meta[partition_number].filemark_count = 0;
+	meta[partition_number].segment_mb	  = segment_mb;
 	if (write(metafile[partition_number], &meta[partition_number],
 			  sizeof(struct meta_header)) != sizeof(struct meta_header)) {
 		snprintf(path, ARRAY_SIZE(path), "%s/meta.%d", currentPCL, partition_number);
@@ -983,6 +1456,8 @@ int create_tape(const char *pcl, uint8_t *sam_stat) {
 		return 2;
 	}
 
+	if (new_segment_mb)
+		mam.tape_fmt_version = TAPE_FMT_SEGMENTED;
 	if (write_mam(mamfile, mhvtlfile) < 0) {
 		MHVTL_ERR("Failed to initialize mam/mhvtl_data files");
 	};
@@ -992,7 +1467,7 @@ int create_tape(const char *pcl, uint8_t *sam_stat) {
 	close(mhvtlfile);
 	mhvtlfile = -1;
 
-	return create_partition(0);
+	return create_partition(0, new_segment_mb);
 }
 
 int load_partition(const char *pcl, uint8_t *sam_stat, uint8_t error_check, uint8_t partition_number) {
@@ -1142,9 +1617,13 @@ int load_partition(const char *pcl, uint8_t *sam_stat, uint8_t error_check, uint
 			goto cleanup;
 		}
 		eod_data_offset[partition_number] = raw_pos.data_offset +
-											raw_pos.hdr.disk_blk_size;
+											raw_pos.hdr.disk_blk_size +
+											raw_pos.data_pad;
 	}
 
+	if (meta[partition_number].segment_mb)
+		data_stat.st_size += seg_total_size(partition_number);
+
 	if (mam.MediumType == MEDIA_TYPE_NULL) {
 		MHVTL_LOG("Loaded NULL media type"); /* Skip check */
 	} else if ((uint64_t)data_stat.st_size != eod_data_offset[partition_number]) {
@@ -1258,7 +1737,8 @@ int load_tape(const char *pcl, uint8_t *sam_stat) {
 	mhvtlfile = open(path, O_RDWR | O_LARGEFILE);
 	read_mam(mamfile, mhvtlfile, &mam);
 
-	if (mam.tape_fmt_version != TAPE_FMT_VERSION) { /* Check for Tape Format Update */
+	if (mam.tape_fmt_version != TAPE_FMT_VERSION &&
+		mam.tape_fmt_version != TAPE_FMT_SEGMENTED) { /* Check for Tape Format Update */
 		MHVTL_ERR("pcl %s contains incorrect media format", pcl);
 		MHVTL_LOG("Trying to update tape format...");
 		if (try_update_tape(currentPCL)) {
@@ -1313,8 +1793,9 @@ int format_partition(uint8_t *sam_stat) {
 }
 
 int format_tape(uint8_t *sam_stat) {
-	char path[1024];
-	int	 partition_number = 0;
+	char	 path[1024];
+	int		 partition_number = 0;
+	uint32_t segment_mb		  = meta[0].segment_mb; /* Keep the layout */
 
 	/* Erase all partitions */
 	snprintf(path, ARRAY_SIZE(path), "%s/data.%d", currentPCL, partition_number);
@@ -1327,7 +1808,7 @@ int format_tape(uint8_t *sam_stat) {
 
 	/* Create <mam.num_partitions> partitions */
 	for (int j = 0; j < mam.num_partitions; ++j) {
-		create_partition(j);
+		create_partition(j, segment_mb);
 	}
 
 	change_partition(0);
@@ -1341,11 +1822,77 @@ int format_tape(uint8_t *sam_stat) {
  * != 0, failure
  */
 
+/*
+ * fsync() data, index and meta files of the current partition.
+ *
+ * With 'queue' set (io_uring engine only) the fsync()s are queued, to be
+ * started once everything queued ahead of them has completed.
+ *
+ * Returns 0 if queued
+ */
+static int flush_partition(int queue) {
+	int			 part = c_pos->partition_id;
+	unsigned int i;
+	uint64_t	 start;
+
+	if (queue && uring_ready()) {
+		int rc = uring_queue_fsync(datafile[part], 1);
+
+		for (i = 0; i < SEG_FD_CACHE; i++)
+			if (!rc && seg_cache[i].fd >= 0 && seg_cache[i].part == part)
+				rc = uring_queue_fsync(seg_cache[i].fd, 0);
+		if (rc == 0 &&
+			uring_queue_fsync(indxfile[part], 0) == 0 &&
+			uring_queue_fsync(metafile[part], 0) == 0)
+			return 0;
+	}
+
+	start = stats_clock();
+	fsync(datafile[part]);
+	for (i = 0; i < SEG_FD_CACHE; i++)
+		if (seg_cache[i].fd >= 0 && seg_cache[i].part == part)
+			fsync(seg_cache[i].fd);
+	fsync(indxfile[part]);
+	fsync(metafile[part]);
+	stats_phase(STATS_FSYNC, start);
+
+	return -1;
+}
+
+/*
+ * io_uring engine - submit 'nr' queued filemark headers, starting at
+ * 'blk_number', plus any fsync()s queued behind them
+ */
+static int submit_filemarks(int nr, uint32_t blk_number, uint8_t *sam_stat) {
+	ssize_t res[URING_BATCH];
+	int		i, queued;
+
+	queued = uring_submit_wait(res);
+	for (i = 0; i < queued; i++) {
+		if (i < nr && res[i] != (ssize_t)sizeof(struct raw_header)) {
+			errno = (res[i] < 0) ? -res[i] : EIO;
+			sam_medium_error(E_WRITE_ERROR, sam_stat);
+			MHVTL_ERR("Index file write failure,"
+					  " pos: %" PRId64 ": %s",
+					  (uint64_t)(blk_number + i) * sizeof(struct raw_header),
+					  strerror(errno));
+			return -1;
+		}
+		if (i >= nr && res[i] < 0)
+			MHVTL_ERR("fsync failure: %s", strerror(-res[i]));
+	}
+
+	return 0;
+}
+
 int write_filemarks(uint32_t count, uint8_t *sam_stat) {
 	uint32_t blk_number;
 	uint32_t partition_id;
 	uint64_t data_offset;
 	ssize_t	 nwrite;
+	uint64_t start;
+	int		 fm_nr		  = 0;
+	int		 flush_queued = 0;
 
 	if (!tape_loaded(sam_stat))
 		return -1;
@@ -1359,9 +1906,7 @@ int write_filemarks(uint32_t count, uint8_t *sam_stat) {
 
 	if (count == 0) {
 		MHVTL_DBG(2, "Flushing data - 0 filemarks written");
-		fsync(datafile[c_pos->partition_id]);
-		fsync(indxfile[c_pos->partition_id]);
-		fsync(metafile[c_pos->partition_id]);
+		flush_partition(0);
 
 		return 0;
 	}
@@ -1388,12 +1933,33 @@ int write_filemarks(uint32_t count, uint8_t *sam_stat) {
 	c_pos->disk_blk_size = 0;
 	c_pos->partition_id	 = partition_id;
 
+	trace_event(TRACE_FILEMARK, partition_id, blk_number, data_offset, count, 0);
+
 	/* Now write out one header per filemark. */
 
 	for (; count > 0; count--, blk_number++) {
 		c_pos->blk_number = blk_number;
 
-		MHVTL_DBG(3, "Writing filemark: partition/block %u/%u", partition_id, blk_number);
+		if (uring_ready()) {
+			/* Queue up to a batch of headers, each needs its own copy */
+			fm_batch[fm_nr] = raw_pos;
+			if (uring_queue_write(indxfile[c_pos->partition_id], &fm_batch[fm_nr],
+								  sizeof(raw_pos), blk_number * sizeof(raw_pos)) == 0) {
+				add_filemark(blk_number);
+				/* Leave room for the flush of the last batch */
+				if (++fm_nr < URING_BATCH - 3 - SEG_FD_CACHE && count > 1)
+					continue;
+				if (count == 1)
+					flush_queued = flush_partition(1) == 0;
+				start = stats_clock();
+				if (submit_filemarks(fm_nr, blk_number + 1 - fm_nr, sam_stat))
+					return -1;
+				if (flush_queued) /* Dominated by the fsync()s */
+					stats_phase(STATS_FSYNC, start);
+				fm_nr = 0;
+				continue;
+			}
+		}
 
 		nwrite = pwrite(indxfile[c_pos->partition_id], &raw_pos, sizeof(raw_pos),
 						blk_number * sizeof(raw_pos));
@@ -1408,11 +1974,13 @@ int write_filemarks(uint32_t count, uint8_t *sam_stat) {
 		add_filemark(blk_number);
 	}
 
+	if (fm_nr && submit_filemarks(fm_nr, blk_number - fm_nr, sam_stat))
+		return -1;
+
 	/* Provide the force-flush guarantee. */
 
-	fsync(datafile[c_pos->partition_id]);
-	fsync(indxfile[c_pos->partition_id]);
-	fsync(metafile[c_pos->partition_id]);
+	if (!flush_queued)
+		flush_partition(0);
 
 	return mkEODHeader(blk_number, data_offset);
 }
@@ -1423,6 +1991,7 @@ int write_tape_block(const uint8_t *buffer, uint32_t blk_size,
 	uint32_t blk_number, disk_blk_size, partition_id;
 	uint32_t max_blk_number;
 	uint64_t data_offset;
+	uint32_t data_pad = 0;
 	ssize_t	 nwrite;
 
 	/* Medium format limits to unsigned 32bit blks */
@@ -1462,7 +2031,11 @@ int write_tape_block(const uint8_t *buffer, uint32_t blk_size,
 
 	MHVTL_DBG(2, "CRC is 0x%08x", crc);
 
-	if (comp_size) {
+	if (comp_type == ZERO_BLK) {
+		/* Nothing to store - readBlock() regenerates the zeros */
+		c_pos->blk_flags |= BLKHDR_FLG_ZERO;
+		c_pos->disk_blk_size = disk_blk_size = 0;
+	} else if (comp_size) {
 		if (comp_type == LZO)
 			c_pos->blk_flags |= BLKHDR_FLG_LZO_COMPRESSED;
 		else
@@ -1489,35 +2062,42 @@ int write_tape_block(const uint8_t *buffer, uint32_t blk_size,
 	}
 
 	/* Now write out both the data and the header. */
-	if (null_media_type) {
+	if (null_media_type || disk_blk_size == 0) {
 		nwrite = disk_blk_size;
 	} else
-		nwrite = pwrite(datafile[c_pos->partition_id], buffer, disk_blk_size, data_offset);
-	if (nwrite != disk_blk_size) {
-		sam_medium_error(E_WRITE_ERROR, sam_stat);
-
-		MHVTL_ERR("Data file write failure, pos: %" PRId64 ": %s",
-				  data_offset, strerror(errno));
-
-		/* Truncate last partital write */
-		MHVTL_DBG(1, "Truncating data file size: %" PRId64, data_offset);
-		if (ftruncate(datafile[c_pos->partition_id], data_offset) < 0) {
-			MHVTL_ERR("Error truncating data: %s", strerror(errno));
+		nwrite = data_pwrite(buffer, disk_blk_size, data_offset, &data_pad);
+	if (nwrite != disk_blk_size)
+		goto data_fail;
+
+	raw_pos.data_pad = data_pad;
+
+	if (uring_queued()) {
+		/* io_uring engine - data and header go to the kernel together */
+		ssize_t res[2];
+		int		nr;
+
+		uring_queue_write(indxfile[c_pos->partition_id], &raw_pos, sizeof(raw_pos),
+						  blk_number * sizeof(raw_pos));
+		nr = uring_submit_wait(res);
+		if (res[0] != (ssize_t)(disk_blk_size + data_pad)) {
+			errno = (res[0] < 0) ? -res[0] : EIO;
+			/* Don't leave a header behind for data which isn't there */
+			if (ftruncate(indxfile[c_pos->partition_id], blk_number * sizeof(raw_pos)) < 0)
+				MHVTL_ERR("Error truncating indx: %s", strerror(errno));
+			goto data_fail;
 		}
-
-		mkEODHeader(blk_number, data_offset);
-		return -1;
-	}
-
-	MHVTL_DBG(3, "writing partition/header %d/%u at offset %lu, type: %s, size: %u",
-			  c_pos->partition_id,
-			  c_pos->blk_number,
-			  (unsigned long)raw_pos.data_offset,
-			  mhvtl_block_type_desc(c_pos->blk_type),
-			  c_pos->blk_size);
-
-	nwrite = pwrite(indxfile[c_pos->partition_id], &raw_pos, sizeof(raw_pos),
-					blk_number * sizeof(raw_pos));
+		if (!data_odirect[partition_id] && disk_blk_size)
+			data_cache_hint(partition_id, data_offset + disk_blk_size, 1);
+		if (nr == 2)
+			nwrite = res[1];
+		else
+			nwrite = pwrite(indxfile[c_pos->partition_id], &raw_pos, sizeof(raw_pos),
+							blk_number * sizeof(raw_pos));
+		if (nwrite < 0)
+			errno = -nwrite;
+	} else
+		nwrite = pwrite(indxfile[c_pos->partition_id], &raw_pos, sizeof(raw_pos),
+						blk_number * sizeof(raw_pos));
 	if (nwrite != sizeof(raw_pos)) {
 		long indxsz = (blk_number - 1) * sizeof(raw_pos);
 
@@ -1535,7 +2115,7 @@ int write_tape_block(const uint8_t *buffer, uint32_t blk_size,
 		if (!null_media_type) {
 			MHVTL_DBG(1, "Truncating data file size: %" PRId64,
 					  data_offset);
-			if (ftruncate(datafile[c_pos->partition_id], data_offset) < 0) {
+			if (data_truncate(data_offset) < 0) {
 				MHVTL_ERR("Error truncating data: %s",
 						  strerror(errno));
 			}
@@ -1545,9 +2125,25 @@ int write_tape_block(const uint8_t *buffer, uint32_t blk_size,
 		return -1;
 	}
 
-	MHVTL_DBG(3, "Successfully wrote block: %u", blk_number);
+	trace_event(TRACE_WRITE_BLK, c_pos->partition_id, blk_number, data_offset,
+				c_pos->blk_size, disk_blk_size);
+
+	return mkEODHeader(blk_number + 1, data_offset + disk_blk_size + data_pad);
+
+data_fail:
+	sam_medium_error(E_WRITE_ERROR, sam_stat);
+
+	MHVTL_ERR("Data file write failure, pos: %" PRId64 ": %s",
+			  data_offset, strerror(errno));
 
-	return mkEODHeader(blk_number + 1, data_offset + disk_blk_size);
+	/* Truncate last partital write */
+	MHVTL_DBG(1, "Truncating data file size: %" PRId64, data_offset);
+	if (data_truncate(data_offset) < 0) {
+		MHVTL_ERR("Error truncating data: %s", strerror(errno));
+	}
+
+	mkEODHeader(blk_number, data_offset);
+	return -1;
 }
 
 void unload_tape(uint8_t *sam_stat) {
@@ -1586,9 +2182,6 @@ uint32_t read_tape_block(uint8_t *buf, uint32_t buf_size, uint8_t *sam_stat) {
 	if (!tape_loaded(sam_stat))
 		return -1;
 
-	MHVTL_DBG(3, "Reading data partition/block %u/%u, size: %d",
-			  c_pos->partition_id, c_pos->blk_number, buf_size);
-
 	/* The caller should have already verified that this is a
 	   B_DATA block before issuing this read, so we shouldn't have to
 	   worry about B_EOD or B_FILEMARK here.
@@ -1604,20 +2197,30 @@ uint32_t read_tape_block(uint8_t *buf, uint32_t buf_size, uint8_t *sam_stat) {
 	if (iosize > buf_size)
 		iosize = buf_size;
 
-	nread = pread(datafile[c_pos->partition_id], buf, iosize, raw_pos.data_offset);
+	/* An all-zero block has no data on disk, only the header to step over */
+	if (iosize)
+		nread = data_pread(buf, iosize, raw_pos.data_offset);
+	else
+		nread = 0;
 	if (nread != iosize) {
 		MHVTL_ERR("Failed to read %d bytes", iosize);
 		return -1;
 	}
 
+	trace_event(TRACE_READ_DATA, c_pos->partition_id, c_pos->blk_number,
+				raw_pos.data_offset, iosize, 0);
+
 	/* Now position to the following block. */
-	MHVTL_DBG(3, "Reading data succeeded, now positioning to next header");
 	if (read_header(c_pos->blk_number + 1, sam_stat)) {
 		MHVTL_ERR("Failed to read next partition/block header %u/%u",
 				  c_pos->partition_id, c_pos->blk_number + 1);
 		return -1;
 	}
 
+	/* Have the next block on its way while this one goes to the initiator */
+	if (uring_ready())
+		data_readahead();
+
 	return nread;
 }
 
@@ -1711,7 +2314,9 @@ void print_raw_header(void) {
 		if (c_pos->blk_flags & BLKHDR_FLG_ENCRYPTED) {
 			strncat(f, "Encrypt/", 9);
 		}
-		if (c_pos->blk_flags & BLKHDR_FLG_ZLIB_COMPRESSED) {
+		if (c_pos->blk_flags & BLKHDR_FLG_ZERO) {
+			strncat(f, "zero-filled", 12);
+		} else if (c_pos->blk_flags & BLKHDR_FLG_ZLIB_COMPRESSED) {
 			strncat(f, "zlibCompressed", 15);
 		} else if (c_pos->blk_flags & BLKHDR_FLG_LZO_COMPRESSED) {
 			strncat(f, "lzoCompressed", 14);
@@ -1784,6 +2389,275 @@ void print_metadata(void) {
 		printf("Filemark: %d\n", filemarks[c_pos->partition_id][a]);
 }
 
+/* Note the first problem found by a scrub */
+static void scrub_problem(struct scrub_result *r, uint32_t partition, uint32_t blk_number) {
+	if (!r->crc_errors && !r->index_errors) {
+		r->bad_partition = partition;
+		r->bad_block	 = blk_number;
+	}
+	r->index_errors++;
+}
+
+/*
+ * Check the index of the current partition against itself, the filemark
+ * map and the size of the data file - without reading any block data.
+ *
+ * Returns the number of problems found, which are added to 'r'
+ */
+#define SCRUB_HDRS 128 /* Index records read at a time */
+
+int verify_partition_index(struct scrub_result *r) {
+	int				   part	   = c_pos->partition_id;
+	uint32_t		   eod	   = eod_blk_number[part];
+	uint32_t		   fm	   = 0;
+	uint32_t		   before  = r->index_errors;
+	uint64_t		   offset  = 0;
+	uint64_t		   data_sz = 0;
+	struct raw_header *hdrs;
+	struct raw_header *h;
+	struct stat		   st;
+	const char		  *problem;
+	uint32_t		   n, i, count;
+	ssize_t			   nread;
+
+	hdrs = malloc(SCRUB_HDRS * sizeof(*hdrs));
+	if (!hdrs) {
+		MHVTL_ERR("Unable to allocate index buffer");
+		return -1;
+	}
+
+	for (n = 0; n < eod; n += count) {
+		count = (eod - n < SCRUB_HDRS) ? eod - n : SCRUB_HDRS;
+		nread = pread(indxfile[part], hdrs, count * sizeof(*hdrs), (loff_t)n * sizeof(*hdrs));
+		if (nread != (ssize_t)(count * sizeof(*hdrs))) {
+			MHVTL_ERR("Partition %d: index read at block %u failed", part, n);
+			scrub_problem(r, part, n);
+			break;
+		}
+		for (i = 0; i < count; i++) {
+			h		= &hdrs[i];
+			problem = NULL;
+			if (h->hdr.blk_number != n + i)
+				problem = "block number";
+			else if (h->hdr.blk_type != B_DATA && h->hdr.blk_type != B_FILEMARK)
+				problem = "block type";
+			else if ((uint64_t)h->data_offset != offset)
+				problem = "data offset";
+			else if (h->hdr.blk_type == B_FILEMARK) {
+				if (fm >= meta[part].filemark_count || filemarks[part][fm] != n + i)
+					problem = "filemark map";
+				fm++;
+			}
+			if (problem) {
+				MHVTL_ERR("Partition %d block %u: %s does not match the index",
+						  part, n + i, problem);
+				scrub_problem(r, part, n + i);
+			}
+			/* Carry on from what was recorded, to report each problem once */
+			offset = h->data_offset + h->hdr.disk_blk_size + h->data_pad;
+		}
+	}
+	free(hdrs);
+
+	if (fm != meta[part].filemark_count) {
+		MHVTL_ERR("Partition %d: filemark map holds %u filemarks, index %u",
+				  part, meta[part].filemark_count, fm);
+		scrub_problem(r, part, eod);
+	}
+
+	if (fstat(datafile[part], &st) == 0)
+		data_sz = st.st_size;
+	if (meta[part].segment_mb)
+		data_sz += seg_total_size(part);
+	if (mam.MediumType != MEDIA_TYPE_NULL && data_sz != offset) {
+		MHVTL_ERR("Partition %d: data holds %" PRIu64 " bytes, index %" PRIu64,
+				  part, data_sz, offset);
+		scrub_problem(r, part, eod);
+	}
+
+	return r->index_errors - before;
+}
+
+/*
+ * Outcome of the last scrub, kept in a 'scrub' file beside the 'mam' of
+ * the cartridge in 'dir' - or of the loaded cartridge if 'dir' is NULL
+ */
+int write_scrub_result(const char *dir, const struct scrub_result *r) {
+	char  path[1024], tmp[1100];
+	FILE *fp;
+
+	snprintf(path, sizeof(path), "%s/scrub", dir ? dir : currentPCL);
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	fp = fopen(tmp, "w");
+	if (!fp) {
+		MHVTL_ERR("Unable to create %s: %s", tmp, strerror(errno));
+		return -1;
+	}
+	fprintf(fp, "Scrubbed: %" PRIu64 "\n", r->time);
+	fprintf(fp, "Blocks: %" PRIu64 "\n", r->blocks);
+	fprintf(fp, "Filemarks: %" PRIu64 "\n", r->filemarks);
+	fprintf(fp, "Bytes: %" PRIu64 "\n", r->bytes);
+	fprintf(fp, "CRC errors: %u\n", r->crc_errors);
+	fprintf(fp, "Index errors: %u\n", r->index_errors);
+	if (r->crc_errors || r->index_errors)
+		fprintf(fp, "First error: partition %u block %u\n",
+				r->bad_partition, r->bad_block);
+	if (fclose(fp) || rename(tmp, path)) {
+		MHVTL_ERR("Unable to write %s: %s", path, strerror(errno));
+		unlink(tmp);
+		return -1;
+	}
+	return 0;
+}
+
+/* Returns 0 if a result was found */
+int read_scrub_result(const char *dir, struct scrub_result *r) {
+	char  path[1024], line[128];
+	FILE *fp;
+
+	memset(r, 0, sizeof(*r));
+	snprintf(path, sizeof(path), "%s/scrub", dir ? dir : currentPCL);
+	fp = fopen(path, "r");
+	if (!fp)
+		return -1;
+	while (fgets(line, sizeof(line), fp)) {
+		sscanf(line, "Scrubbed: %" SCNu64, &r->time);
+		sscanf(line, "Blocks: %" SCNu64, &r->blocks);
+		sscanf(line, "Filemarks: %" SCNu64, &r->filemarks);
+		sscanf(line, "Bytes: %" SCNu64, &r->bytes);
+		sscanf(line, "CRC errors: %u", &r->crc_errors);
+		sscanf(line, "Index errors: %u", &r->index_errors);
+		sscanf(line, "First error: partition %u block %u",
+			   &r->bad_partition, &r->bad_block);
+	}
+	fclose(fp);
+	return r->time ? 0 : -1;
+}
+
+/* Filemarks on all partitions of the loaded media */
+uint64_t total_filemarks(void) {
+	uint64_t count = 0;
+
+	for (int j = 0; j < mam.num_partitions && j < MAX_PARTITIONS; j++)
+		count += meta[j].filemark_count;
+	return count;
+}
+
+/*
+ * Read the MAM, filemark count and bytes written of the media in 'dir'
+ * without loading it - nothing is opened for write and no global state is
+ * touched
+ *
+ * Returns 0 on success
+ */
+int read_cart_summary(const char *dir, struct MAM *mamp, uint64_t *fm_count, uint64_t *used) {
+	char			   path[1024];
+	struct meta_header hdr;
+	struct raw_header  last;
+	struct stat		   st;
+	int				   mam_fd, mhvtl_fd, fd, rc;
+
+	init_mam(mamp);
+	*fm_count = 0;
+	*used	  = 0;
+
+	snprintf(path, sizeof(path), "%s/mam", dir);
+	mam_fd = open(path, O_RDONLY);
+	if (mam_fd < 0)
+		return -1;
+	snprintf(path, sizeof(path), "%s/mhvtl_data", dir);
+	mhvtl_fd = open(path, O_RDONLY); /* Not there for old format media */
+	rc		 = read_mam(mam_fd, mhvtl_fd, mamp);
+	close(mam_fd);
+	if (mhvtl_fd >= 0)
+		close(mhvtl_fd);
+	if (rc < 0)
+		return -1;
+
+	/* As load_tape(): the partitions are the meta files there are */
+	mamp->num_partitions = 0;
+	for (int j = 0; j < MAX_PARTITIONS; j++) {
+		snprintf(path, sizeof(path), "%s/meta.%d", dir, j);
+		fd = open(path, O_RDONLY);
+		if (fd < 0)
+			break;
+		mamp->num_partitions++;
+		if (read(fd, &hdr, sizeof(hdr)) == sizeof(hdr))
+			*fm_count += hdr.filemark_count;
+		close(fd);
+
+		/* As load_partition(): end of the block before EOD */
+		snprintf(path, sizeof(path), "%s/indx.%d", dir, j);
+		fd = open(path, O_RDONLY);
+		if (fd < 0)
+			continue;
+		if (!fstat(fd, &st) && st.st_size >= (off_t)sizeof(last) &&
+			pread(fd, &last, sizeof(last), st.st_size - st.st_size % sizeof(last) - sizeof(last)) == sizeof(last))
+			*used += last.data_offset + last.hdr.disk_blk_size + last.data_pad;
+		close(fd);
+	}
+	return 0;
+}
+
+/*
+ * Would the cartridge in 'dir' load ? Checks what load_tape() would trip
+ * over without loading it: the MAM can be read, and each partition has a
+ * data file, an indx file of whole raw_headers and a meta file as long as
+ * its header says. Uses no global state, so several cartridges can be
+ * checked at once.
+ *
+ * Returns 0 - loads, 1 - not there, 2 - damaged
+ */
+int check_cart_files(const char *dir) {
+	char			   path[1024];
+	struct meta_header hdr;
+	struct stat		   st;
+	uint32_t		   version[2];
+	ssize_t			   nread;
+	int				   fd, j, bad;
+
+	if (stat(dir, &st) < 0 || !S_ISDIR(st.st_mode))
+		return 1;
+
+	snprintf(path, sizeof(path), "%s/mam", dir);
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		/* Old format - the MAM is extracted from meta.0 on load */
+		snprintf(path, sizeof(path), "%s/meta.0", dir);
+		return access(path, R_OK) ? 2 : 0;
+	}
+	nread = read(fd, version, sizeof(version));
+	close(fd);
+	if (nread != sizeof(version))
+		return 2;
+
+	/* As load_tape(): the partitions are the data files there are */
+	for (j = 0; j < MAX_PARTITIONS; j++) {
+		snprintf(path, sizeof(path), "%s/data.%d", dir, j);
+		if (stat(path, &st) < 0) {
+			if (j)
+				break;
+			return 2;
+		}
+
+		snprintf(path, sizeof(path), "%s/indx.%d", dir, j);
+		if (stat(path, &st) < 0 || st.st_size % sizeof(struct raw_header))
+			return 2;
+
+		snprintf(path, sizeof(path), "%s/meta.%d", dir, j);
+		fd = open(path, O_RDONLY);
+		if (fd < 0)
+			return 2;
+		bad = fstat(fd, &st) < 0 ||
+			  read(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+			  (uint64_t)st.st_size != sizeof(hdr) + (uint64_t)hdr.filemark_count * sizeof(*filemarks[j]);
+		close(fd);
+		if (bad)
+			return 2;
+	}
+	return 0;
+}
+
 /*
  * Cleanup entry point
  */
@@ -0,0 +1,469 @@
+/*
+ * io_uring storage engine for vtlcart
+ *
+ * Copyright (C) 2005 - 2025 Mark Harvey markh794 at gmail dot com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * vtlcart.c queues the data and index writes of a block (or the index
+ * writes and fsync()s of WRITE FILEMARKS) here and then waits for the lot,
+ * rather than issuing them one blocking syscall at a time.
+ * While reading, the data of the next block is read ahead in the
+ * background, overlapping with transfer of the current one to the initiator.
+ *
+ * The ring is driven with the raw syscalls from <linux/io_uring.h>, so there
+ * is no dependency on liburing. Build with 'make IO_URING=no' to leave the
+ * engine out altogether, in which case uring_init() always fails and
+ * vtlcart.c stays with synchronous I/O.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include "logging.h"
+#include "vtlcart.h"
+#include "vtlcart_uring.h"
+
+#ifdef MHVTL_IO_URING
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+#ifndef __NR_io_uring_setup
+#define __NR_io_uring_setup 425
+#endif
+#ifndef __NR_io_uring_enter
+#define __NR_io_uring_enter 426
+#endif
+
+#define URING_ENTRIES 128
+
+/* user_data of the read-ahead request, batch requests use their index */
+#define RA_TAG (~(uint64_t)0)
+
+static int ring_fd = -1;
+
+static struct {
+	unsigned *head, *tail, *mask, *entries, *array;
+
+	struct io_uring_sqe *sqes;
+	unsigned			 pending; /* Queued but not yet handed to the kernel */
+} sq;
+
+static struct {
+	unsigned *head, *tail, *mask;
+
+	struct io_uring_cqe *cqes;
+} cq;
+
+static void	  *sq_ring, *cq_ring;
+static size_t  sq_ring_sz, cq_ring_sz, sqes_sz;
+static struct iovec iov[URING_ENTRIES]; /* One per SQE slot */
+
+/* Requests queued by vtlcart.c, completed by uring_submit_wait() */
+static int	   batch_nr;
+static int	   batch_done;
+static ssize_t batch_res[URING_BATCH];
+
+/* Read-ahead of the next data block */
+static uint8_t *ra_buf;
+static uint32_t ra_buf_sz;
+static int		ra_fd = -1;
+static uint64_t ra_off;
+static uint32_t ra_len;
+static int		ra_valid;
+static int		ra_pending;
+static ssize_t	ra_res;
+
+static int ring_enter(unsigned to_submit, unsigned min_complete) {
+	int rc;
+
+	do {
+		rc = syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete,
+					 min_complete ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+	} while (rc < 0 && errno == EINTR);
+
+	if (rc > 0)
+		sq.pending -= ((unsigned)rc > sq.pending) ? sq.pending : (unsigned)rc;
+
+	return rc;
+}
+
+static struct io_uring_sqe *get_sqe(unsigned *idx) {
+	unsigned			 tail = *sq.tail;
+	struct io_uring_sqe *sqe;
+
+	if (tail - __atomic_load_n(sq.head, __ATOMIC_ACQUIRE) >= *sq.entries)
+		return NULL;
+
+	*idx = tail & *sq.mask;
+	sqe	 = &sq.sqes[*idx];
+	memset(sqe, 0, sizeof(*sqe));
+
+	return sqe;
+}
+
+static void commit_sqe(unsigned idx) {
+	sq.array[idx] = idx;
+	__atomic_store_n(sq.tail, *sq.tail + 1, __ATOMIC_RELEASE);
+	sq.pending++;
+}
+
+static void reap_cqes(void) {
+	unsigned			 head = *cq.head;
+	struct io_uring_cqe *cqe;
+
+	while (head != __atomic_load_n(cq.tail, __ATOMIC_ACQUIRE)) {
+		cqe = &cq.cqes[head & *cq.mask];
+		if (cqe->user_data == RA_TAG) {
+			ra_res	   = cqe->res;
+			ra_pending = 0;
+		} else if (cqe->user_data < URING_BATCH) {
+			batch_res[cqe->user_data] = cqe->res;
+			batch_done++;
+		}
+		head++;
+	}
+	__atomic_store_n(cq.head, head, __ATOMIC_RELEASE);
+}
+
+static void wait_readahead(void) {
+	reap_cqes();
+	while (ra_pending) {
+		if (ring_enter(sq.pending, 1) < 0) {
+			MHVTL_ERR("io_uring_enter: %s", strerror(errno));
+			ra_pending = 0;
+			ra_res	   = -errno;
+			break;
+		}
+		reap_cqes();
+	}
+}
+
+int uring_init(void) {
+	struct io_uring_params p;
+
+	if (ring_fd >= 0)
+		return 0;
+
+	memset(&p, 0, sizeof(p));
+	ring_fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+	if (ring_fd < 0) {
+		MHVTL_LOG("io_uring not available: %s", strerror(errno));
+		return -1;
+	}
+
+	sq_ring_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	cq_ring_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (cq_ring_sz > sq_ring_sz)
+			sq_ring_sz = cq_ring_sz;
+		cq_ring_sz = sq_ring_sz;
+	}
+
+	sq_ring = mmap(NULL, sq_ring_sz, PROT_READ | PROT_WRITE,
+				   MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+	if (sq_ring == MAP_FAILED)
+		goto fail;
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		cq_ring = sq_ring;
+	} else {
+		cq_ring = mmap(NULL, cq_ring_sz, PROT_READ | PROT_WRITE,
+					   MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+		if (cq_ring == MAP_FAILED) {
+			munmap(sq_ring, sq_ring_sz);
+			goto fail;
+		}
+	}
+
+	sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+	sq.sqes = mmap(NULL, sqes_sz, PROT_READ | PROT_WRITE,
+				   MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+	if (sq.sqes == MAP_FAILED) {
+		if (cq_ring != sq_ring)
+			munmap(cq_ring, cq_ring_sz);
+		munmap(sq_ring, sq_ring_sz);
+		goto fail;
+	}
+
+	sq.head	   = (unsigned *)((char *)sq_ring + p.sq_off.head);
+	sq.tail	   = (unsigned *)((char *)sq_ring + p.sq_off.tail);
+	sq.mask	   = (unsigned *)((char *)sq_ring + p.sq_off.ring_mask);
+	sq.entries = (unsigned *)((char *)sq_ring + p.sq_off.ring_entries);
+	sq.array   = (unsigned *)((char *)sq_ring + p.sq_off.array);
+	sq.pending = 0;
+
+	cq.head = (unsigned *)((char *)cq_ring + p.cq_off.head);
+	cq.tail = (unsigned *)((char *)cq_ring + p.cq_off.tail);
+	cq.mask = (unsigned *)((char *)cq_ring + p.cq_off.ring_mask);
+	cq.cqes = (struct io_uring_cqe *)((char *)cq_ring + p.cq_off.cqes);
+
+	MHVTL_DBG(1, "io_uring storage engine ready: %u entries", p.sq_entries);
+
+	return 0;
+
+fail:
+	MHVTL_ERR("Unable to map io_uring: %s", strerror(errno));
+	close(ring_fd);
+	ring_fd = -1;
+	return -1;
+}
+
+void uring_exit(void) {
+	if (ring_fd < 0)
+		return;
+
+	uring_readahead_drop();
+	if (batch_nr)
+		uring_submit_wait(NULL);
+
+	munmap(sq.sqes, sqes_sz);
+	if (cq_ring != sq_ring)
+		munmap(cq_ring, cq_ring_sz);
+	munmap(sq_ring, sq_ring_sz);
+	close(ring_fd);
+	ring_fd = -1;
+
+	free(ra_buf);
+	ra_buf	  = NULL;
+	ra_buf_sz = 0;
+}
+
+int uring_ready(void) {
+	return ring_fd >= 0;
+}
+
+int uring_queued(void) {
+	return batch_nr;
+}
+
+/*
+ * Queue a write of 'len' bytes from 'buf' at 'offset'.
+ * 'buf' has to stay put until uring_submit_wait() returns.
+ *
+ * Returns 0 on success, -1 if the batch is full
+ */
+int uring_queue_write(int fd, const void *buf, uint32_t len, uint64_t offset) {
+	struct io_uring_sqe *sqe;
+	unsigned			 idx;
+
+	if (batch_nr >= URING_BATCH)
+		return -1;
+	sqe = get_sqe(&idx);
+	if (!sqe)
+		return -1;
+
+	iov[idx].iov_base = (void *)buf;
+	iov[idx].iov_len  = len;
+
+	sqe->opcode	   = IORING_OP_WRITEV;
+	sqe->fd		   = fd;
+	sqe->addr	   = (uintptr_t)&iov[idx];
+	sqe->len	   = 1;
+	sqe->off	   = offset;
+	sqe->user_data = batch_nr++;
+	commit_sqe(idx);
+
+	return 0;
+}
+
+/*
+ * Queue an fsync(). With 'drain' set, it is not started until everything
+ * queued ahead of it has completed.
+ *
+ * Returns 0 on success, -1 if the batch is full
+ */
+int uring_queue_fsync(int fd, int drain) {
+	struct io_uring_sqe *sqe;
+	unsigned			 idx;
+
+	if (batch_nr >= URING_BATCH)
+		return -1;
+	sqe = get_sqe(&idx);
+	if (!sqe)
+		return -1;
+
+	sqe->opcode	   = IORING_OP_FSYNC;
+	sqe->fd		   = fd;
+	sqe->flags	   = drain ? IOSQE_IO_DRAIN : 0;
+	sqe->user_data = batch_nr++;
+	commit_sqe(idx);
+
+	return 0;
+}
+
+/*
+ * Hand everything queued to the kernel and wait for it all to complete.
+ * Result of each request (bytes or -errno, as per pwrite()/fsync()) is
+ * returned in 'res', in the order they were queued.
+ *
+ * Returns number of requests
+ */
+int uring_submit_wait(ssize_t *res) {
+	int nr = batch_nr;
+	int i;
+
+	reap_cqes();
+	while (batch_done < batch_nr) {
+		if (ring_enter(sq.pending, 1) < 0) {
+			MHVTL_ERR("io_uring_enter: %s", strerror(errno));
+			for (i = batch_done; i < batch_nr; i++)
+				batch_res[i] = -EIO;
+			break;
+		}
+		reap_cqes();
+	}
+
+	if (res)
+		memcpy(res, batch_res, nr * sizeof(*res));
+	batch_nr   = 0;
+	batch_done = 0;
+
+	return nr;
+}
+
+/*
+ * Start reading 'len' bytes at 'offset' into the read-ahead buffer
+ * without waiting for it. Any earlier read-ahead is discarded.
+ */
+void uring_readahead(int fd, uint64_t offset, uint32_t len) {
+	struct io_uring_sqe *sqe;
+	unsigned			 idx;
+
+	uring_readahead_drop();
+
+	if (batch_nr)
+		return;
+
+	if (len > ra_buf_sz) {
+		free(ra_buf);
+		ra_buf_sz = 0;
+		if (posix_memalign((void **)&ra_buf, DIRECT_IO_ALIGN, len)) {
+			ra_buf = NULL;
+			return;
+		}
+		ra_buf_sz = len;
+	}
+
+	sqe = get_sqe(&idx);
+	if (!sqe)
+		return;
+
+	iov[idx].iov_base = ra_buf;
+	iov[idx].iov_len  = len;
+
+	sqe->opcode	   = IORING_OP_READV;
+	sqe->fd		   = fd;
+	sqe->addr	   = (uintptr_t)&iov[idx];
+	sqe->len	   = 1;
+	sqe->off	   = offset;
+	sqe->user_data = RA_TAG;
+	commit_sqe(idx);
+
+	/* Even if it can't be submitted now, it will be with the next
+	 * request - so has to be waited for before the buffer is reused.
+	 */
+	ra_pending = 1;
+	if (ring_enter(sq.pending, 0) < 0) {
+		MHVTL_ERR("io_uring_enter: %s", strerror(errno));
+		return;
+	}
+
+	ra_fd	 = fd;
+	ra_off	 = offset;
+	ra_len	 = len;
+	ra_valid = 1;
+}
+
+/*
+ * Copy 'len' bytes at 'offset' out of the read-ahead buffer, waiting for
+ * the read to finish if need be.
+ *
+ * Returns 'len', or -1 if the data was not read ahead
+ */
+ssize_t uring_readahead_get(int fd, void *buf, uint32_t len, uint64_t offset) {
+	if (!ra_valid || fd != ra_fd || offset < ra_off ||
+		offset + len > ra_off + ra_len) {
+		uring_readahead_drop();
+		return -1;
+	}
+
+	wait_readahead();
+	ra_valid = 0;
+
+	if (ra_res < 0 || (uint64_t)ra_res < offset + len - ra_off)
+		return -1;
+
+	memcpy(buf, ra_buf + (offset - ra_off), len);
+
+	return len;
+}
+
+/* Must be called before anything rewrites or closes the file being read ahead */
+void uring_readahead_drop(void) {
+	if (ra_pending)
+		wait_readahead();
+	ra_valid = 0;
+}
+
+#else /* !MHVTL_IO_URING */
+
+int uring_init(void) {
+	MHVTL_LOG("io_uring storage engine not built in");
+	errno = ENOSYS;
+	return -1;
+}
+
+void uring_exit(void) {
+}
+
+int uring_ready(void) {
+	return 0;
+}
+
+int uring_queued(void) {
+	return 0;
+}
+
+int uring_queue_write(int fd, const void *buf, uint32_t len, uint64_t offset) {
+	return -1;
+}
+
+int uring_queue_fsync(int fd, int drain) {
+	return -1;
+}
+
+int uring_submit_wait(ssize_t *res) {
+	return 0;
+}
+
+void uring_readahead(int fd, uint64_t offset, uint32_t len) {
+}
+
+ssize_t uring_readahead_get(int fd, void *buf, uint32_t len, uint64_t offset) {
+	return -1;
+}
+
+void uring_readahead_drop(void) {
+}
+
+#endif /* MHVTL_IO_URING */
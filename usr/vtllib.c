@@ -55,6 +55,9 @@
 #include "q.h"
 #include "ssc.h"
 #include "mhvtl_log.h"
+#include "mhvtl_stats.h"
+#include "mhvtl_trace.h"
+#include "mhvtl_config.h"
 
 static int reset				= 0;
 static int inquiry_data_changed = 0;
@@ -67,13 +70,15 @@ struct encryption  app_encryption_state;
 int				   current_state;
 int				   lbp_rscrc_be = 1;
 int				   OK_to_write	= 0;
-uint8_t			   sense[SENSE_BUF_SIZE];
 uint8_t			   modeBlockDescriptor[8] = {0, 0, 0, 0, 0, 0, 0, 0};
 char			   home_directory[HOME_DIR_PATH_SZ + 1];
 uint8_t			   debug   = 0;
 uint8_t			   verbose = 0;
 long			   my_id   = 0;
 
+/* Per thread: each of vtllibrary's pickers has a command of its own */
+__thread uint8_t sense[SENSE_BUF_SIZE];
+
 #define INIT_MAM_ATTR(attr_id, len, ro, fmt, field, enum_id)           \
 	do {                                                               \
 		_Static_assert(sizeof(field) == (len),                         \
@@ -179,12 +184,30 @@ void init_mam(struct MAM *mamp) {
 	INIT_VTL_ATTR(0x09, 32, mamp->media_info.description, MAM_MHVTL_MEDIAINFO_DESCRIPTION);
 }
 
-int get_config(char *buf, conf_file conf, long id) {
-	char  format[128];
-	char  config_path[CONF_DIR_PATH_SZ] = {0};
-	FILE *fp							= fopen(MHVTL_CONFIG_PATH "/mhvtl.conf", "r");
+/*
+ * MHVTL_CONFIG_PATH from mhvtl.conf, parsed again only when the file changes.
+ * Every daemon and tool asks for a config file path many times over.
+ */
+static const char *config_dir(void) {
+	static char			   config_path[CONF_DIR_PATH_SZ];
+	static struct timespec parsed_mtime;
+	static int			   parsed;
+	struct timespec		   mtime = {0, 0};
+	struct stat			   st;
+	char				   format[128];
+	FILE				  *fp;
+
+	if (!stat(MHVTL_CONFIG_PATH "/mhvtl.conf", &st))
+		mtime = st.st_mtim;
+	if (parsed && mtime.tv_sec == parsed_mtime.tv_sec && mtime.tv_nsec == parsed_mtime.tv_nsec)
+		return config_path;
+
+	parsed		   = 1;
+	parsed_mtime   = mtime;
+	config_path[0] = '\0';
 
 	snprintf(format, sizeof(format), "%%255[^= \t\r] = %%%u[^\n]", CONF_DIR_PATH_SZ - 1);
+	fp = fopen(MHVTL_CONFIG_PATH "/mhvtl.conf", "r");
 	if (fp) {
 		char  *line = NULL;
 		size_t len	= 0;
@@ -208,6 +231,11 @@ int get_config(char *buf, conf_file conf, long id) {
 		free(line);
 		fclose(fp);
 	}
+	return config_path;
+}
+
+int get_config(char *buf, conf_file conf, long id) {
+	const char *config_path = config_dir();
 
 	switch (conf) {
 	case DEVICE_CONF:
@@ -222,6 +250,10 @@ int get_config(char *buf, conf_file conf, long id) {
 		snprintf(buf, CONF_FILE_SZ, "%s/library_contents.%ld.persist",
 				 (config_path[0] != '\0') ? config_path : MHVTL_CONFIG_PATH, id);
 		break;
+	case LIBCONTENTS_JOURNAL:
+		snprintf(buf, CONF_FILE_SZ, "%s/library_contents.%ld.journal",
+				 (config_path[0] != '\0') ? config_path : MHVTL_CONFIG_PATH, id);
+		break;
 
 	default:
 		MHVTL_ERR("Wrong config file requested");
@@ -426,7 +458,7 @@ void *zalloc(int sz) {
 }
 
 /*
- * Fills in a global array with current sense data
+ * Fills in this thread's array with current sense data
  * Sets 'sam status' to SAM_STAT_CHECK_CONDITION.
  */
 
@@ -471,6 +503,7 @@ static void return_sense(uint8_t key, uint32_t asc_ascq, struct s_sd *sd,
 	MHVTL_DBG(1, "[Key/ASC/ASCQ] [%02x %02x %02x]%s",
 			  sense[2], sense[12], sense[13],
 			  (sd) ? extended : "");
+	trace_event(TRACE_SENSE, 0, 0, 0, 0, key << 16 | (asc_ascq & 0xffff));
 }
 
 void sam_unit_attention(uint16_t ascq, uint8_t *sam_stat) {
@@ -491,6 +524,7 @@ void sam_illegal_request(uint16_t ascq, struct s_sd *sd, uint8_t *sam_stat) {
 void sam_medium_error(uint16_t ascq, uint8_t *sam_stat) {
 	return_sense(MEDIUM_ERROR, ascq, NULL, sam_stat);
 	MHVTL_DBG(1, "");
+	trace_error("medium error");
 }
 
 void sam_blank_check(uint16_t ascq, uint8_t *sam_stat) {
@@ -506,6 +540,7 @@ void sam_data_protect(uint16_t ascq, uint8_t *sam_stat) {
 void sam_hardware_error(uint16_t ascq, uint8_t *sam_stat) {
 	return_sense(HARDWARE_ERROR, ascq, NULL, sam_stat);
 	MHVTL_DBG(1, "");
+	trace_error("hardware error");
 }
 
 void sam_no_sense(uint8_t key, uint16_t ascq, uint8_t *sam_stat) {
@@ -578,19 +613,27 @@ void setTapeAlert(struct TapeAlert_pg *ta, uint64_t flg) {
 		ta->TapeAlert[a].value = (flg & (1ull << a)) ? 1 : 0;
 }
 
+/* Set once the current command has fetched data from the initiator */
+static int data_out_cmd;
+
 /*
  * Simple function to read 'count' bytes from the chardev into 'buf'.
  */
 int retrieve_CDB_data(int cdev, struct mhvtl_ds *ds) {
-	int ioctl_err;
+	uint64_t start;
+	int		 ioctl_err;
 
 	MHVTL_DBG(3, "retrieving %d bytes from kernel", ds->sz);
+	start	  = stats_clock();
 	ioctl_err = ioctl(cdev, VTL_GET_DATA, ds);
+	stats_phase(STATS_XFER, start);
+	data_out_cmd = 1;
 	if (ioctl_err < 0) {
 		MHVTL_ERR("Failed retrieving data via ioctl(): %s",
 				  strerror(errno));
 		return 0;
 	}
+	stats_bytes(ds->sz, 0);
 	return ds->sz;
 }
 
@@ -601,9 +644,17 @@ int retrieve_CDB_data(int cdev, struct mhvtl_ds *ds) {
  * Returns nothing.
  */
 void completeSCSICommand(int cdev, struct mhvtl_ds *ds) {
+	uint64_t start;
 	uint8_t *s;
 
+	start = stats_clock();
 	ioctl(cdev, VTL_PUT_DATA, ds);
+	stats_phase(STATS_XFER, start);
+
+	/* Whatever 'sz' is left at after a data-out command is not sent */
+	if (!data_out_cmd)
+		stats_bytes(0, ds->sz);
+	data_out_cmd = 0;
 
 	s = (uint8_t *)ds->sense_buf;
 
@@ -1657,6 +1708,16 @@ void find_media_home_directory(char *config_directory, long lib_id) {
 	found			  = 0;
 	home_directory[0] = '\0';
 
+	if (!config_directory) {
+		const struct conf_device *d = config_find(lib_id, CONF_LIBRARY);
+
+		if (d) {
+			config_home(d, home_directory, sizeof(home_directory));
+			MHVTL_DBG(2, "Library %ld home directory: %s", lib_id, home_directory);
+			return;
+		}
+	}
+
 	if (config_directory) {
 		snprintf(device_conf, CONF_FILE_SZ, "%s/device.conf", config_directory);
 	} else if (get_config(device_conf, DEVICE_CONF, my_id) < 0) {
@@ -2200,6 +2261,172 @@ unsigned int set_media_params(struct MAM *mamp, char *density) {
 	return 0;
 }
 
+/*
+ * Media type and density of cartridge 'pcl', going by the barcode naming
+ * rules make_vtl_media follows: six to eight characters then a two
+ * character media identifier - e.g. 'L8' is LTO8, 'LW' LTO6 WORM.
+ * Barcodes starting 'CLN' are cleaning media, those starting 'W' WORM.
+ *
+ * Returns the MEDIA_TYPE_* and copies the density into 'density',
+ * which is left empty if the barcode does not name one
+ */
+int barcode_media_rules(const char *pcl, char *density, size_t len) {
+	char		b[MAX_BARCODE_LEN + 1];
+	const char *d = NULL;
+	int			type = MEDIA_TYPE_DATA;
+	int			i, n;
+	char		m, v;
+
+	for (n = 0; n < MAX_BARCODE_LEN && pcl[n] && pcl[n] != ' '; n++)
+		b[n] = pcl[n];
+	b[n] = '\0';
+	density[0] = '\0';
+
+	/* Six characters of [A-Z0-9] before the media identifier */
+	for (i = n - 8; i >= 0 && i < n - 2; i++)
+		if (!isupper(b[i]) && !isdigit(b[i]))
+			break;
+	m = n >= 2 ? b[n - 2] : '\0';
+	v = n >= 2 ? b[n - 1] : '\0';
+	if (n >= 8 && i == n - 2 && v && strchr("12345678ABKUVWXYZ", v)) {
+		switch (m) {
+		case 'L':
+			if (v == 'T')
+				d = "LTO3";
+			else if (v == 'U')
+				d = "LTO4";
+			else if (v == 'V')
+				d = "LTO5";
+			else if (v == 'W')
+				d = "LTO6";
+			else if (v >= '1' && v <= '8') {
+				snprintf(density, len, "LTO%c", v);
+				d = density;
+			}
+			if (v == 'T' || v == 'U' || v == 'V' || v == 'W')
+				type = MEDIA_TYPE_WORM;
+			break;
+		case 'D':
+			if (v == '7')
+				d = "DLT4";
+			break;
+		case 'S':
+			if (v == '3')
+				d = "SDLT600";
+			else if (v == '2')
+				d = "SDLT320";
+			else if (v == '1')
+				d = "SDLT220";
+			else
+				d = "SDLT";
+			break;
+		case 'J':
+			if (v == 'A')
+				d = "J1A";
+			else if (v == 'B' || v == 'W' || v == 'X')
+				d = "E05";
+			else if (v == 'Y' || v == 'K')
+				d = "E07";
+			if (v == 'W' || v == 'X' || v == 'Y')
+				type = MEDIA_TYPE_WORM;
+			break;
+		case 'X':
+			if (v >= '1' && v <= '8') {
+				snprintf(density, len, "AIT%c", v);
+				d = density;
+			}
+			break;
+		case 'T':
+			if (v == 'Z')
+				d = "9840A";
+			else if (v == 'Y')
+				d = "9840B";
+			else if (v == 'X')
+				d = "9840C";
+			else if (v == 'W')
+				d = "9840D";
+			else if (v == 'V')
+				d = "9940A";
+			else if (v == 'U')
+				d = "9940B";
+			else if (strchr("ABK", v)) {
+				snprintf(density, len, "T10K%c", v);
+				d = density;
+			}
+			break;
+		}
+	}
+	if (d && d != density)
+		snprintf(density, len, "%s", d);
+
+	if (b[0] == 'W')
+		type = MEDIA_TYPE_WORM;
+	else if (!strncmp(b, "CLN", 3))
+		type = MEDIA_TYPE_CLEAN;
+	return type;
+}
+
+static time_t media_creation_time(void) {
+	const char *source_date_epoch = getenv("SOURCE_DATE_EPOCH");
+	time_t		t;
+
+	if (!source_date_epoch || (t = (time_t)strtoll(source_date_epoch, NULL, 10)) <= 0)
+		t = time(NULL);
+	return t;
+}
+
+/*
+ * Initialise 'mamp' for new media 'pcl' of 'medium_type' (MEDIA_TYPE_*),
+ * 'density' and 'size' Megabytes - zero for the native capacity of the
+ * media type
+ *
+ * Returns 0, or 1 if 'density' is not one we know
+ */
+int init_new_mam(struct MAM *mamp, const char *pcl, int medium_type,
+				 char *density, uint64_t size) {
+	char ver[64];
+	int	 major = 0, minor = 0;
+	int	 t;
+
+	init_mam(mamp);
+
+	if (sscanf(MHVTL_VERSION, "%d.%d", &major, &minor) != 2)
+		MHVTL_LOG("Attempting to retrieve version string from %s failed",
+				  MHVTL_VERSION);
+	snprintf(ver, sizeof(ver), "vtl-%d.%d      ", major, minor);
+
+	mamp->tape_fmt_version = TAPE_FMT_VERSION;
+	mamp->mam_fmt_version  = MAM_VERSION;
+
+	put_unaligned_be64(size * 1048576, &mamp->max_capacity);
+	put_unaligned_be64(size * 1048576, &mamp->remaining_capacity);
+
+	memcpy(&mamp->MediumManufacturer, "linuxVTL", 8);
+	memcpy(&mamp->ApplicationVendor, ver, 8);
+	sprintf((char *)mamp->ApplicationVersion, "%d", TAPE_FMT_VERSION);
+
+	mamp->MediumType = medium_type;
+	if (medium_type == MEDIA_TYPE_CLEAN)
+		mamp->MediumTypeInformation = 20; /* Max cleaning loads */
+
+	/* Without a recognised density there is no media type, and so no
+	 * capacity to give the cartridge
+	 */
+	if (set_media_params(mamp, density))
+		return 1;
+
+	/* Space left in the cartridge memory, being what the attributes stored
+	 * in it do not already take up.
+	 */
+	mam_space_remaining(mamp);
+
+	t = (int)media_creation_time();
+	sprintf((char *)mamp->MediumSerialNumber, "%s_%d", pcl, t);
+	sprintf((char *)mamp->MediumManufactureDate, "%d", t);
+	sprintf((char *)mamp->Barcode, "%-31s", pcl);
+	return 0;
+}
+
 void ymd(int *year, int *month, int *day, int *hh, int *min, int *sec) {
 	sscanf(__TIME__, "%d:%d:%d", hh, min, sec);
 